@@ -0,0 +1,376 @@
+/******************************************************************************
+* Copyright (c) 2000-2021 Ericsson Telecom AB
+* All rights reserved. This program and the accompanying materials
+* are made available under the terms of the Eclipse Public License v2.0
+* which accompanies this distribution, and is available at
+* https://www.eclipse.org/org/documents/epl-2.0/EPL-2.0.html
+*
+* Contributors:
+*  Peter Dimitrov- initial implementation and initial documentation
+*  Adam Delic
+*  Eduard Czimbalmos
+*  Endre Kulcsar
+*  Gabor Bettesch
+*  Gabor Szalai
+*  Tamas Buti
+*  Zoltan Medve
+******************************************************************************/
+//
+//  File:               SCTPasp_Capture.cc
+//  Description:        pcap capture of the SCTPasp test port traffic
+//  Prodnr:             CNL 113 469
+//
+
+
+#include "SCTPasp_Capture.hh"
+
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#define PCAP_MAGIC_NSEC 0xa1b23c4d
+#define PCAP_SNAPLEN 262144
+#define LINKTYPE_RAW 101
+// the largest DATA chunk payload which fits into an IP packet with the headers
+#define CAPTURE_MAX_FRAGMENT 65000
+
+namespace SCTPasp__PortType {
+
+struct CaptureWriter::item_t
+{
+  uint64_t timestamp; // CLOCK_REALTIME in nanoseconds
+  int32_t client_id;
+  uint32_t ppid;
+  uint16_t stream;
+  bool outgoing;
+  bool notification;
+  struct sockaddr_storage local; // ss_family is AF_UNSPEC if unknown
+  struct sockaddr_storage peer;
+  size_t len;
+  unsigned char data[1];
+};
+
+
+static uint32_t crc32c_table[256];
+static pthread_once_t crc32c_once = PTHREAD_ONCE_INIT;
+
+// called once through crc32c_once, the captures of several ports share the table
+static void crc32c_init()
+{
+  for (uint32_t i = 0; i < 256; i++)
+  {
+    uint32_t c = i;
+    for (int k = 0; k < 8; k++) c = (c & 1) ? (c >> 1) ^ 0x82F63B78 : c >> 1;
+    crc32c_table[i] = c;
+  }
+}
+
+static uint32_t crc32c_update(uint32_t crc, const unsigned char *buf, size_t len)
+{
+  while (len--) crc = crc32c_table[(crc ^ *buf++) & 0xff] ^ (crc >> 8);
+  return crc;
+}
+
+static uint16_t ip_checksum(const unsigned char *hdr, size_t len)
+{
+  uint32_t sum = 0;
+  for (size_t i = 0; i < len; i += 2) sum += (hdr[i] << 8) | hdr[i + 1];
+  while (sum >> 16) sum = (sum & 0xffff) + (sum >> 16);
+  return ~sum & 0xffff;
+}
+
+static inline void put16(unsigned char *p, uint16_t v) { p[0] = v >> 8; p[1] = v; }
+static inline void put32(unsigned char *p, uint32_t v) { p[0] = v >> 24; p[1] = v >> 16; p[2] = v >> 8; p[3] = v; }
+
+static uint16_t addr_port(const struct sockaddr_storage *sa)
+{
+  if (sa->ss_family == AF_INET) return ntohs(((const struct sockaddr_in *)sa)->sin_port);
+  if (sa->ss_family == AF_INET6) return ntohs(((const struct sockaddr_in6 *)sa)->sin6_port);
+  return 0;
+}
+
+static void addr_v4(const struct sockaddr_storage *sa, unsigned char *p)
+{
+  if (sa->ss_family == AF_INET) memcpy(p, &((const struct sockaddr_in *)sa)->sin_addr, 4);
+  else memset(p, 0, 4);
+}
+
+static void addr_v6(const struct sockaddr_storage *sa, unsigned char *p)
+{
+  memset(p, 0, 16);
+  if (sa->ss_family == AF_INET6) memcpy(p, &((const struct sockaddr_in6 *)sa)->sin6_addr, 16);
+  else if (sa->ss_family == AF_INET)
+  { // IPv4-mapped address
+    p[10] = p[11] = 0xff;
+    memcpy(p + 12, &((const struct sockaddr_in *)sa)->sin_addr, 4);
+  }
+}
+
+
+CaptureWriter::CaptureWriter()
+  : file(NULL), thread_started(false), stopping(false), sleeping(false), wakeup(-1), queue(NULL),
+    mask(0), head(0), tail(0), written(0), dropped(0)
+{
+  tsn[0] = tsn[1] = 1;
+}
+
+
+CaptureWriter::~CaptureWriter()
+{
+  close();
+}
+
+
+int CaptureWriter::open(const char *filename, unsigned int queue_size)
+{
+  if (thread_started) return EBUSY;
+  pthread_once(&crc32c_once, crc32c_init);
+  file = fopen(filename, "wb");
+  if (file == NULL) return errno;
+  setvbuf(file, NULL, _IOFBF, 1 << 20);
+
+  unsigned char hdr[24];
+  put32(hdr, PCAP_MAGIC_NSEC);
+  put16(hdr + 4, 2);
+  put16(hdr + 6, 4);
+  put32(hdr + 8, 0);
+  put32(hdr + 12, 0);
+  put32(hdr + 16, PCAP_SNAPLEN);
+  put32(hdr + 20, LINKTYPE_RAW);
+  // the pcap header is written in big endian, readers detect it from the magic
+  if (fwrite(hdr, sizeof(hdr), 1, file) != 1)
+  {
+    int err = errno;
+    fclose(file);
+    file = NULL;
+    return err;
+  }
+
+  wakeup = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (wakeup == -1)
+  {
+    int err = errno;
+    fclose(file);
+    file = NULL;
+    return err;
+  }
+
+  size_t len = 1;
+  while (len < queue_size) len <<= 1;
+  queue = new item_t*[len];
+  mask = len - 1;
+  head.store(0);
+  tail.store(0);
+  stopping.store(false);
+  sleeping.store(false);
+  written.store(0);
+  dropped.store(0);
+  tsn[0] = tsn[1] = 1;
+
+  int err = pthread_create(&thread, NULL, thread_main, this);
+  if (err != 0)
+  {
+    fclose(file);
+    file = NULL;
+    ::close(wakeup);
+    wakeup = -1;
+    delete [] queue;
+    queue = NULL;
+    return err;
+  }
+  thread_started = true;
+  return 0;
+}
+
+
+void CaptureWriter::close()
+{
+  if (!thread_started) return;
+  stopping.store(true, std::memory_order_seq_cst);
+  wake();
+  pthread_join(thread, NULL);
+  thread_started = false;
+  fclose(file);
+  file = NULL;
+  ::close(wakeup);
+  wakeup = -1;
+  delete [] queue;
+  queue = NULL;
+}
+
+
+void CaptureWriter::submit(bool outgoing, bool notification, int client_id, unsigned int stream,
+  uint32_t ppid, const void *data, size_t len,
+  const struct sockaddr_storage *local, const struct sockaddr_storage *peer,
+  uint64_t timestamp)
+{
+  if (!thread_started) return;
+  size_t h = head.load(std::memory_order_relaxed);
+  if (h - tail.load(std::memory_order_acquire) > mask)
+  {
+    dropped.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+  item_t *item = (item_t *)malloc(offsetof(item_t, data) + len);
+  if (item == NULL)
+  {
+    dropped.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+  if (timestamp == 0)
+  {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    timestamp = (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+  }
+  item->timestamp = timestamp;
+  item->client_id = client_id;
+  item->ppid = ppid;
+  item->stream = stream;
+  item->outgoing = outgoing;
+  item->notification = notification;
+  if (local) item->local = *local;
+  else item->local.ss_family = AF_UNSPEC;
+  if (peer) item->peer = *peer;
+  else item->peer.ss_family = AF_UNSPEC;
+  item->len = len;
+  if (len) memcpy(item->data, data, len); // data may be NULL for an empty message
+  queue[h & mask] = item;
+  head.store(h + 1, std::memory_order_release);
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (sleeping.load(std::memory_order_relaxed)) wake();
+}
+
+
+void CaptureWriter::wake()
+{
+  uint64_t one = 1;
+  if (write(wakeup, &one, sizeof(one)) < 0) errno = 0; // the counter is already set
+}
+
+
+void *CaptureWriter::thread_main(void *arg)
+{
+  CaptureWriter *self = (CaptureWriter *)arg;
+  for (;;)
+  {
+    size_t t = self->tail.load(std::memory_order_relaxed);
+    if (t == self->head.load(std::memory_order_acquire))
+    {
+      if (self->stopping.load(std::memory_order_acquire))
+      { // the producer is stopped, the queue can be checked for the last time
+        if (t == self->head.load(std::memory_order_acquire)) break;
+        continue;
+      }
+      fflush(self->file);
+      // the producer wakes the thread up if it sees the flag after queueing a message
+      self->sleeping.store(true, std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      if (t == self->head.load(std::memory_order_relaxed) && !self->stopping.load(std::memory_order_relaxed))
+      {
+        struct pollfd pfd;
+        pfd.fd = self->wakeup;
+        pfd.events = POLLIN;
+        if (poll(&pfd, 1, -1) > 0)
+        {
+          uint64_t value;
+          if (read(self->wakeup, &value, sizeof(value)) < 0) errno = 0;
+        }
+      }
+      self->sleeping.store(false, std::memory_order_relaxed);
+      continue;
+    }
+    item_t *item = self->queue[t & self->mask];
+    self->write_item(item);
+    free(item);
+    self->tail.store(t + 1, std::memory_order_release);
+  }
+  fflush(self->file);
+  return NULL;
+}
+
+
+void CaptureWriter::write_item(const item_t *item)
+{
+  const struct sockaddr_storage *src = item->outgoing ? &item->local : &item->peer;
+  const struct sockaddr_storage *dst = item->outgoing ? &item->peer : &item->local;
+  bool v6 = src->ss_family == AF_INET6 || dst->ss_family == AF_INET6;
+  size_t ip_len = v6 ? 40 : 20;
+  unsigned char hdr[40 + 12 + 16];
+  uint32_t &dir_tsn = tsn[item->outgoing ? 0 : 1];
+
+  size_t offset = 0;
+  do
+  {
+    size_t frag = item->len - offset;
+    if (frag > CAPTURE_MAX_FRAGMENT) frag = CAPTURE_MAX_FRAGMENT;
+    size_t pad = (4 - (frag & 3)) & 3;
+    size_t sctp_len = 12 + 16 + frag + pad;
+    size_t pkt_len = ip_len + sctp_len;
+
+    memset(hdr, 0, sizeof(hdr));
+    if (v6)
+    {
+      hdr[0] = 0x60;
+      put16(hdr + 4, sctp_len);
+      hdr[6] = IPPROTO_SCTP;
+      hdr[7] = 64;
+      addr_v6(src, hdr + 8);
+      addr_v6(dst, hdr + 24);
+    }
+    else
+    {
+      hdr[0] = 0x45;
+      put16(hdr + 2, pkt_len);
+      put16(hdr + 6, 0x4000); // DF
+      hdr[8] = 64;
+      hdr[9] = IPPROTO_SCTP;
+      addr_v4(src, hdr + 12);
+      addr_v4(dst, hdr + 16);
+      put16(hdr + 10, ip_checksum(hdr, 20));
+    }
+    unsigned char *sctp = hdr + ip_len;
+    put16(sctp, addr_port(src));
+    put16(sctp + 2, addr_port(dst));
+    put32(sctp + 4, (uint32_t)item->client_id); // the verification tag identifies the association
+    unsigned char *chunk = sctp + 12;
+    chunk[0] = 0; // DATA
+    chunk[1] = (offset == 0 ? 0x02 : 0) | (offset + frag == item->len ? 0x01 : 0);
+    put16(chunk + 2, 16 + frag);
+    put32(chunk + 4, dir_tsn++);
+    put16(chunk + 8, item->stream);
+    put16(chunk + 10, 0);
+    put32(chunk + 12, item->ppid);
+
+    static const unsigned char zero[4] = { 0, 0, 0, 0 };
+    uint32_t crc = crc32c_update(0xffffffff, sctp, 12 + 16);
+    crc = crc32c_update(crc, item->data + offset, frag);
+    crc = ~crc32c_update(crc, zero, pad);
+    // the checksum is transmitted in little endian byte order
+    sctp[8] = crc;
+    sctp[9] = crc >> 8;
+    sctp[10] = crc >> 16;
+    sctp[11] = crc >> 24;
+
+    unsigned char rec[16];
+    put32(rec, item->timestamp / 1000000000ULL);
+    put32(rec + 4, item->timestamp % 1000000000ULL);
+    put32(rec + 8, pkt_len);
+    put32(rec + 12, pkt_len);
+    fwrite(rec, sizeof(rec), 1, file);
+    fwrite(hdr, ip_len + 12 + 16, 1, file);
+    if (frag) fwrite(item->data + offset, frag, 1, file);
+    if (pad) fwrite(zero, pad, 1, file);
+    offset += frag;
+  } while (offset < item->len);
+  written.fetch_add(1, std::memory_order_relaxed);
+}
+
+}
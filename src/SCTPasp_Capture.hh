@@ -0,0 +1,93 @@
+/******************************************************************************
+* Copyright (c) 2000-2021 Ericsson Telecom AB
+* All rights reserved. This program and the accompanying materials
+* are made available under the terms of the Eclipse Public License v2.0
+* which accompanies this distribution, and is available at
+* https://www.eclipse.org/org/documents/epl-2.0/EPL-2.0.html
+*
+* Contributors:
+*  Peter Dimitrov- initial implementation and initial documentation
+*  Adam Delic
+*  Eduard Czimbalmos
+*  Endre Kulcsar
+*  Gabor Bettesch
+*  Gabor Szalai
+*  Tamas Buti
+*  Zoltan Medve
+******************************************************************************/
+//
+//  File:               SCTPasp_Capture.hh
+//  Description:        pcap capture of the SCTPasp test port traffic
+//  Prodnr:             CNL 113 469
+//
+// The messages are written as reconstructed IPv4/IPv6 + SCTP DATA chunk
+// packets (LINKTYPE_RAW) by a background thread. The hot path only copies
+// the message into a lock-free single producer single consumer queue.
+
+
+#ifndef SCTPasp__Capture_HH
+#define SCTPasp__Capture_HH
+
+#include <stdint.h>
+#include <stdio.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <atomic>
+
+namespace SCTPasp__PortType {
+
+// stream and PPID of the chunks carrying notifications
+#define CAPTURE_NOTIFICATION_STREAM 0xFFFF
+#define CAPTURE_NOTIFICATION_PPID 0
+
+class CaptureWriter
+{
+public:
+  CaptureWriter();
+  ~CaptureWriter();
+
+  // creates the file and starts the writer thread, returns 0 or errno
+  int open(const char *filename, unsigned int queue_size);
+  // writes the queued messages and stops the writer thread
+  void close();
+  bool is_open() const { return thread_started; }
+
+  // queues a message, never blocks: the message is dropped if the queue is full
+  // local and peer may be NULL if the addresses are unknown, timestamp is
+  // CLOCK_REALTIME in nanoseconds or 0 for the current time
+  void submit(bool outgoing, bool notification, int client_id, unsigned int stream,
+    uint32_t ppid, const void *data, size_t len,
+    const struct sockaddr_storage *local, const struct sockaddr_storage *peer,
+    uint64_t timestamp = 0);
+
+  uint64_t get_written() const { return written.load(std::memory_order_relaxed); }
+  uint64_t get_dropped() const { return dropped.load(std::memory_order_relaxed); }
+
+private:
+  CaptureWriter(const CaptureWriter&);
+  CaptureWriter& operator=(const CaptureWriter&);
+
+  struct item_t;
+  static void *thread_main(void *arg);
+  void write_item(const item_t *item);
+  void wake();
+
+  FILE *file;
+  pthread_t thread;
+  bool thread_started;
+  std::atomic<bool> stopping;
+  std::atomic<bool> sleeping; // the writer thread waits for the eventfd
+  int wakeup; // eventfd: producer -> writer thread
+
+  item_t **queue;
+  size_t mask;
+  std::atomic<size_t> head; // written by the producer
+  std::atomic<size_t> tail; // written by the writer thread
+
+  uint32_t tsn[2]; // per direction, used by the writer thread only
+  std::atomic<uint64_t> written;
+  std::atomic<uint64_t> dropped;
+};
+
+}
+#endif
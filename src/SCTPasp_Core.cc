@@ -0,0 +1,381 @@
+/******************************************************************************
+* Copyright (c) 2000-2021 Ericsson Telecom AB
+* All rights reserved. This program and the accompanying materials
+* are made available under the terms of the Eclipse Public License v2.0
+* which accompanies this distribution, and is available at
+* https://www.eclipse.org/org/documents/epl-2.0/EPL-2.0.html
+*
+* Contributors:
+*  Peter Dimitrov- initial implementation and initial documentation
+*  Adam Delic
+*  Eduard Czimbalmos
+*  Endre Kulcsar
+*  Gabor Bettesch
+*  Gabor Szalai
+*  Tamas Buti
+*  Zoltan Medve
+******************************************************************************/
+//
+//  File:               SCTPasp_Core.cc
+//  Description:        socket core of the SCTPasp test port
+//  Prodnr:             CNL 113 469
+//
+
+
+#include "SCTPasp_Core.hh"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <new>
+#include <netinet/in.h>
+#include <netinet/sctp.h>
+#include <arpa/inet.h>
+
+// the initial size of the receiving buffer, doubled for longer messages
+#define BUFLEN 1024
+// the initial size of the association table, doubled when it is full
+#define MAP_LENGTH 10
+
+namespace SCTPasp__PortType {
+
+AssociationTable::AssociationTable()
+: items(NULL), len(0), used(0), first_free(-1)
+{
+}
+
+
+AssociationTable::~AssociationTable()
+{
+  for (int i = 0; i < len; i++) erase(i);
+  free(items);
+}
+
+
+void AssociationTable::reset(Association& item)
+{
+  item.fd = -1;
+  item.erased = true;
+  item.processing_message = false;
+  item.einprogress = false;
+  item.buf = NULL;
+  item.buflen = 0;
+  item.nr = 0;
+  memset(&item.sin, 0, sizeof(item.sin));
+  item.saLen = 0;
+  item.rx_ts_valid = false;
+  item.addr_valid = false;
+  item.generator_target = false;
+  item.reflector_target = false;
+  item.listener_port = 0;
+  item.context_sent = false;
+  item.failure_start = 0;
+  item.connect_deadline = 0;
+  item.io_seq = 0;
+}
+
+
+int AssociationTable::put(int fd)
+{
+  if (fd < 0)
+  {
+    errno = EBADF;
+    return -1;
+  }
+  if (first_free == -1)
+  { // the table is full, doubling it
+    int grown_len = len ? len * 2 : MAP_LENGTH;
+    Association *grown = (Association *)realloc(items, grown_len * sizeof(Association));
+    if (grown == NULL) return -1; // errno is ENOMEM
+    items = grown;
+    for (int k = grown_len - 1; k >= len; k--)
+    { // the lower indexes are reused first
+      reset(items[k]);
+      items[k].next_free = first_free;
+      first_free = k;
+    }
+    len = grown_len;
+  }
+  if (fd >= (int)index_of_fd.size())
+  {
+    try { index_of_fd.resize(fd + 1, -1); }
+    catch (std::bad_alloc&)
+    {
+      errno = ENOMEM;
+      return -1;
+    }
+  }
+  int i = first_free;
+  first_free = items[i].next_free;
+  items[i].next_free = -1;
+  items[i].fd = fd;
+  items[i].erased = false;
+  used++;
+  index_of_fd[fd] = i;
+  return i;
+}
+
+
+int AssociationTable::get(int fd) const
+{
+  if (fd < 0 || fd >= (int)index_of_fd.size()) return -1;
+  return index_of_fd[fd];
+}
+
+
+void AssociationTable::erase(int index)
+{
+  Association& item = items[index];
+  if (item.erased) return; // already on the free list
+  used--;
+  if (item.fd >= 0 && item.fd < (int)index_of_fd.size() && index_of_fd[item.fd] == index)
+    index_of_fd[item.fd] = -1;
+  // the buffer of a socket engine socket is owned by the engine
+  if (item.buf && item.io_seq == 0) free(item.buf);
+  reset(item);
+  item.next_free = first_free;
+  first_free = index;
+}
+
+
+receive_result_t receive_message(Association& item, int flags, received_t& received)
+{
+  struct sctp_sndrcvinfo sri;
+  // room for the SNDRCV and the SO_TIMESTAMPNS ancillary data
+  char cbuf[CMSG_SPACE(sizeof (struct sctp_sndrcvinfo)) + CMSG_SPACE(sizeof (struct timespec))];
+  struct msghdr msg;
+  struct iovec iov;
+
+  if (!item.processing_message)
+  {
+    item.buf = malloc(BUFLEN);
+    if (item.buf == NULL) return EOF_OR_ERROR;
+    item.buflen = BUFLEN;
+    item.nr = 0;
+    item.rx_ts_valid = false;
+  }
+  // the next part is read after the received ones
+  iov.iov_base = (char *)item.buf + item.nr;
+  iov.iov_len = item.buflen - item.nr;
+
+  memset(&msg, 0, sizeof (msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = cbuf;
+  msg.msg_controllen = sizeof (cbuf);
+  memset(cbuf, 0, sizeof (cbuf));
+  memset(&sri, 0, sizeof (sri));
+
+  ssize_t value = recvmsg(item.fd, &msg, flags);
+  if (value <= 0)
+  {
+    bool would_block = value < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+    errno = 0;
+    if (!would_block) return EOF_OR_ERROR;
+    if (!item.processing_message) discard_message(item);
+    return WOULD_BLOCK;
+  }
+  item.nr += value;
+  for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg))
+  {
+    if (cmsg->cmsg_level == IPPROTO_SCTP && cmsg->cmsg_type == SCTP_SNDRCV)
+      memcpy(&sri, CMSG_DATA(cmsg), sizeof (sri));
+    else if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_TIMESTAMPNS && !item.rx_ts_valid)
+    { // the timestamp of the first part is kept for partially received messages
+      memcpy(&item.rx_ts, CMSG_DATA(cmsg), sizeof (struct timespec));
+      item.rx_ts_valid = true;
+    }
+  }
+  if (msg.msg_flags & MSG_EOR)
+  {
+    item.processing_message = false;
+    received.notification = (msg.msg_flags & MSG_NOTIFICATION) != 0;
+    received.stream = sri.sinfo_stream;
+    received.ppid = ntohl(sri.sinfo_ppid);
+    return WHOLE_MESSAGE_RECEIVED;
+  }
+  item.processing_message = true;
+  if (item.buflen == item.nr)
+  { // the rest needs a bigger buffer
+    void *grown = realloc(item.buf, item.buflen * 2);
+    if (grown == NULL) return EOF_OR_ERROR;
+    item.buf = grown;
+    item.buflen *= 2;
+  }
+  return PARTIAL_RECEIVE;
+}
+
+
+void discard_message(Association& item)
+{
+  free(item.buf);
+  item.buf = NULL;
+  item.rx_ts_valid = false;
+}
+
+
+int send_message(int fd, unsigned int stream, uint32_t ppid, const void *buf, size_t len, uint32_t context)
+{
+  char cbuf[CMSG_SPACE(sizeof (struct sctp_sndrcvinfo))];
+  struct msghdr msg;
+  struct iovec iov;
+
+  iov.iov_base = (void *)buf;
+  iov.iov_len = len;
+
+  memset(&msg, 0, sizeof (msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = cbuf;
+  msg.msg_controllen = sizeof (cbuf);
+  memset(cbuf, 0, sizeof (cbuf));
+
+  struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+  cmsg->cmsg_len = CMSG_LEN(sizeof (struct sctp_sndrcvinfo));
+  cmsg->cmsg_level = IPPROTO_SCTP;
+  cmsg->cmsg_type = SCTP_SNDRCV;
+  struct sctp_sndrcvinfo *sri = (struct sctp_sndrcvinfo *)CMSG_DATA(cmsg);
+  sri->sinfo_stream = stream;
+  sri->sinfo_ppid = htonl(ppid);
+  sri->sinfo_context = context;
+
+  if (sendmsg(fd, &msg, 0) < 0)
+  {
+    int err = errno;
+    errno = 0;
+    return err;
+  }
+  return 0;
+}
+
+
+bool decode_notification(const void *buf, size_t len, notification_t& notification)
+{
+  const union sctp_notification *snp = (const union sctp_notification *)buf;
+  if (len < sizeof (snp->sn_header)) return false;
+  notification.sn_type = snp->sn_header.sn_type;
+  notification.length = snp->sn_header.sn_length;
+  notification.state = 0;
+  notification.assoc_state = ASSOC_UNKNOWN;
+  notification.addr_state = ADDR_UNKNOWN;
+  notification.send_info = false;
+  switch (snp->sn_header.sn_type)
+  {
+    case SCTP_ASSOC_CHANGE:
+      notification.type = NOTIFICATION_ASSOC_CHANGE;
+      if (len < sizeof (snp->sn_assoc_change.sac_state) + offsetof(struct sctp_assoc_change, sac_state)) break;
+      notification.state = snp->sn_assoc_change.sac_state;
+      switch (snp->sn_assoc_change.sac_state)
+      {
+        case SCTP_COMM_UP: notification.assoc_state = ASSOC_COMM_UP; break;
+        case SCTP_COMM_LOST: notification.assoc_state = ASSOC_COMM_LOST; break;
+        case SCTP_RESTART: notification.assoc_state = ASSOC_RESTART; break;
+        case SCTP_SHUTDOWN_COMP: notification.assoc_state = ASSOC_SHUTDOWN_COMP; break;
+        case SCTP_CANT_STR_ASSOC: notification.assoc_state = ASSOC_CANT_STR_ASSOC; break;
+        default: break;
+      }
+      break;
+    case SCTP_PEER_ADDR_CHANGE:
+      notification.type = NOTIFICATION_PEER_ADDR_CHANGE;
+      if (len < sizeof (snp->sn_paddr_change.spc_state) + offsetof(struct sctp_paddr_change, spc_state)) break;
+      notification.state = snp->sn_paddr_change.spc_state;
+      switch (snp->sn_paddr_change.spc_state)
+      {
+        case SCTP_ADDR_AVAILABLE: notification.addr_state = ADDR_AVAILABLE; break;
+        case SCTP_ADDR_UNREACHABLE: notification.addr_state = ADDR_UNREACHABLE; break;
+        case SCTP_ADDR_REMOVED: notification.addr_state = ADDR_REMOVED; break;
+        case SCTP_ADDR_ADDED: notification.addr_state = ADDR_ADDED; break;
+        case SCTP_ADDR_MADE_PRIM: notification.addr_state = ADDR_MADE_PRIM; break;
+#ifndef SCTP_ADAPTION_LAYER // lksctp 1.0.7 or newer
+        case SCTP_ADDR_CONFIRMED: notification.addr_state = ADDR_CONFIRMED; break;
+#endif
+#ifdef SCTP_ADDR_PF
+        case SCTP_ADDR_PF: notification.addr_state = ADDR_POTENTIALLY_FAILED; break;
+#endif
+        default: break;
+      }
+      break;
+    case SCTP_REMOTE_ERROR:
+      notification.type = NOTIFICATION_REMOTE_ERROR;
+      break;
+    case SCTP_SEND_FAILED:
+      notification.type = NOTIFICATION_SEND_FAILED;
+      if (len < offsetof(struct sctp_send_failed, ssf_data)) break;
+      notification.send_info = true;
+      notification.error = snp->sn_send_failed.ssf_error;
+      notification.stream = snp->sn_send_failed.ssf_info.sinfo_stream;
+      notification.ppid = ntohl(snp->sn_send_failed.ssf_info.sinfo_ppid);
+      notification.context = snp->sn_send_failed.ssf_info.sinfo_context;
+      notification.data = (const unsigned char *)buf + offsetof(struct sctp_send_failed, ssf_data);
+      notification.data_len = len - offsetof(struct sctp_send_failed, ssf_data);
+      break;
+#ifdef SCTP_SEND_FAILED_EVENT // RFC 6458, subscribed instead of SCTP_SEND_FAILED by SCTP_EVENT
+    case SCTP_SEND_FAILED_EVENT:
+      notification.type = NOTIFICATION_SEND_FAILED;
+      if (len < offsetof(struct sctp_send_failed_event, ssf_data)) break;
+      notification.send_info = true;
+      notification.error = snp->sn_send_failed_event.ssf_error;
+      notification.stream = snp->sn_send_failed_event.ssfe_info.snd_sid;
+      notification.ppid = ntohl(snp->sn_send_failed_event.ssfe_info.snd_ppid);
+      notification.context = snp->sn_send_failed_event.ssfe_info.snd_context;
+      notification.data = (const unsigned char *)buf + offsetof(struct sctp_send_failed_event, ssf_data);
+      notification.data_len = len - offsetof(struct sctp_send_failed_event, ssf_data);
+      break;
+#endif
+    case SCTP_SHUTDOWN_EVENT:
+      notification.type = NOTIFICATION_SHUTDOWN_EVENT;
+      break;
+#ifndef SCTP_ADAPTION_LAYER
+    case SCTP_ADAPTATION_INDICATION:
+#else
+    case SCTP_ADAPTION_INDICATION:
+#endif
+      notification.type = NOTIFICATION_ADAPTATION_INDICATION;
+      break;
+    case SCTP_PARTIAL_DELIVERY_EVENT:
+      notification.type = NOTIFICATION_PARTIAL_DELIVERY_EVENT;
+      break;
+#ifdef SCTP_EVENT // the newer notifications are known by the headers of per-event subscription
+    case SCTP_SENDER_DRY_EVENT:
+      notification.type = NOTIFICATION_SENDER_DRY;
+      break;
+    case SCTP_STREAM_RESET_EVENT:
+      notification.type = NOTIFICATION_STREAM_RESET;
+      break;
+    case SCTP_ASSOC_RESET_EVENT:
+      notification.type = NOTIFICATION_ASSOC_RESET;
+      break;
+#endif
+    default:
+      notification.type = NOTIFICATION_UNKNOWN;
+      break;
+  }
+  return true;
+}
+
+
+void TokenBucket::refill(double rate, double burst, unsigned long long now)
+{
+  if (now > refilled) tokens += (now - refilled) * rate / 1e9;
+  if (tokens > burst) tokens = burst;
+  refilled = now;
+}
+
+
+bool TokenBucket::take()
+{
+  if (tokens < 1) return false;
+  tokens -= 1;
+  return true;
+}
+
+
+unsigned long long TokenBucket::next_token(double rate) const
+{
+  if (tokens >= 1) return refilled;
+  // rounded up, the token is there when the deadline is reached
+  return refilled + (unsigned long long)ceil((1 - tokens) * 1e9 / rate);
+}
+
+}
@@ -0,0 +1,180 @@
+/******************************************************************************
+* Copyright (c) 2000-2021 Ericsson Telecom AB
+* All rights reserved. This program and the accompanying materials
+* are made available under the terms of the Eclipse Public License v2.0
+* which accompanies this distribution, and is available at
+* https://www.eclipse.org/org/documents/epl-2.0/EPL-2.0.html
+*
+* Contributors:
+*  Peter Dimitrov- initial implementation and initial documentation
+*  Adam Delic
+*  Eduard Czimbalmos
+*  Endre Kulcsar
+*  Gabor Bettesch
+*  Gabor Szalai
+*  Tamas Buti
+*  Zoltan Medve
+******************************************************************************/
+//
+//  File:               SCTPasp_Core.hh
+//  Description:        socket core of the SCTPasp test port
+//  Prodnr:             CNL 113 469
+//
+// The parts of the test port that do not depend on TITAN: the association
+// table, the reassembly of the received messages, the decoding of the
+// notifications and the sending of a message on a kernel SCTP socket. The
+// test port converts the results to ASPs, SCTPasp_core_bench drives the same
+// code without TITAN.
+
+
+#ifndef SCTPasp__Core_HH
+#define SCTPasp__Core_HH
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <vector>
+
+namespace SCTPasp__PortType {
+
+// a connected or connecting socket of the port
+struct Association
+{
+  int fd; // socket descriptor
+  bool erased;
+  bool processing_message; // if true only part of the message is received
+  bool einprogress; // connection establishment is in progress
+  void *buf; // the message being received, malloc()-ed unless the socket belongs to a socket engine
+  ssize_t buflen; // length of the buffer
+  ssize_t nr; // number of received bytes
+  struct sockaddr_storage sin; // storing remote address
+  socklen_t saLen;
+  bool rx_ts_valid; // rx_ts holds the kernel timestamp of the message being received
+  struct timespec rx_ts; // kernel receive timestamp (SO_TIMESTAMPNS)
+  bool addr_valid; // local_addr and peer_addr are filled, used by the capture
+  struct sockaddr_storage local_addr;
+  struct sockaddr_storage peer_addr;
+  bool generator_target; // the generator sends on this association, used in closed-loop mode
+  bool reflector_target; // the reflector answers the messages of this association
+  unsigned short listener_port; // the local port of the listener of the accepted associations, 0 otherwise
+  bool context_sent; // a message was sent with sinfo_context, it is echoed in the send failed notifications
+  unsigned long long failure_start; // monotonic time of the first failed path notification since the peer was reachable, in ns, 0 if none
+  unsigned long long connect_deadline; // monotonic deadline of the connection establishment in ns, 0 if none
+  uint32_t io_seq; // registration number of the socket in the socket engine
+  int next_free; // the next erased item of the free list, -1 at its end
+};
+
+// The associations are kept in an array, the indexes stay valid until the
+// item is erased; the erased items are reused from a free list and the array
+// is doubled when it is full. The items are found by the file descriptor in
+// constant time.
+class AssociationTable
+{
+public:
+  AssociationTable();
+  ~AssociationTable();
+
+  // adds fd to the table, returns its index, -1 with errno set if the
+  // table cannot grow
+  int put(int fd);
+  // the index of fd, -1 if it is not in the table
+  int get(int fd) const;
+  // resets the item, the socket is not closed
+  void erase(int index);
+
+  // number of the items including the erased ones
+  int size() const { return len; }
+  // number of the items in use
+  int count() const { return used; }
+  Association& operator[](int index) { return items[index]; }
+  const Association& operator[](int index) const { return items[index]; }
+
+private:
+  AssociationTable(const AssociationTable&);
+  AssociationTable& operator=(const AssociationTable&);
+
+  static void reset(Association& item);
+
+  Association *items;
+  int len;
+  int used;
+  int first_free; // the head of the free list of the erased items, -1 if none
+  std::vector<int> index_of_fd; // -1 if the descriptor is not in the table
+};
+
+enum receive_result_t { WHOLE_MESSAGE_RECEIVED, PARTIAL_RECEIVE, EOF_OR_ERROR, WOULD_BLOCK };
+
+// the parameters of a whole message returned by receive_message()
+struct received_t
+{
+  bool notification;
+  unsigned int stream;
+  uint32_t ppid;
+};
+
+// Reads the next part of the message of item.fd into item.buf. The buffer is
+// allocated for a new message and grown as the parts arrive; it holds
+// item.nr bytes of the whole message when WHOLE_MESSAGE_RECEIVED is
+// returned, release it by discard_message(). The timestamp of the first part
+// is kept in item.rx_ts. errno is cleared.
+receive_result_t receive_message(Association& item, int flags, received_t& received);
+void discard_message(Association& item);
+
+// sends the message with the given stream and ppid, returns 0 or errno
+// the context is returned in the send failed notification of the message
+int send_message(int fd, unsigned int stream, uint32_t ppid, const void *buf, size_t len, uint32_t context = 0);
+
+// the notification types and states, the states are in the order of
+// SCTPasp_Types.SAC_STATE and SPC_STATE
+enum notification_type_t { NOTIFICATION_ASSOC_CHANGE, NOTIFICATION_PEER_ADDR_CHANGE, NOTIFICATION_REMOTE_ERROR,
+  NOTIFICATION_SEND_FAILED, NOTIFICATION_SHUTDOWN_EVENT, NOTIFICATION_ADAPTATION_INDICATION,
+  NOTIFICATION_PARTIAL_DELIVERY_EVENT, NOTIFICATION_SENDER_DRY, NOTIFICATION_STREAM_RESET,
+  NOTIFICATION_ASSOC_RESET, NOTIFICATION_UNKNOWN };
+enum assoc_state_t { ASSOC_COMM_UP, ASSOC_COMM_LOST, ASSOC_RESTART, ASSOC_SHUTDOWN_COMP, ASSOC_CANT_STR_ASSOC,
+  ASSOC_UNKNOWN };
+enum addr_state_t { ADDR_AVAILABLE, ADDR_UNREACHABLE, ADDR_REMOVED, ADDR_ADDED, ADDR_MADE_PRIM, ADDR_CONFIRMED,
+  ADDR_POTENTIALLY_FAILED, ADDR_UNKNOWN };
+
+struct notification_t
+{
+  notification_type_t type;
+  unsigned int sn_type; // as received
+  uint32_t length;
+  unsigned int state; // sac_state or spc_state as received, 0 for the other types
+  assoc_state_t assoc_state; // NOTIFICATION_ASSOC_CHANGE only
+  addr_state_t addr_state; // NOTIFICATION_PEER_ADDR_CHANGE only
+  // NOTIFICATION_SEND_FAILED only, the rest is valid if send_info is set
+  bool send_info;
+  uint32_t error;
+  unsigned int stream;
+  uint32_t ppid; // host byte order
+  uint32_t context;
+  const unsigned char *data; // the undelivered message, points into the notification
+  size_t data_len;
+};
+
+// decodes the header and the state of a notification of the kernel stack,
+// and the failed message of the send failed ones; returns false if it is
+// shorter than its header
+bool decode_notification(const void *buf, size_t len, notification_t& notification);
+
+// A token bucket refilled by rate tokens per second up to burst tokens, used
+// by the rate limits and the accept rate. The times are monotonic, in ns.
+struct TokenBucket
+{
+  double tokens;
+  unsigned long long refilled; // the time of the last refill
+
+  // the bucket starts full
+  void reset(double burst, unsigned long long now) { tokens = burst; refilled = now; }
+  void refill(double rate, double burst, unsigned long long now);
+  // takes a token if there is a whole one
+  bool take();
+  // the time a whole token is available, refilled if there is one already
+  unsigned long long next_token(double rate) const;
+};
+
+}
+#endif
@@ -0,0 +1,100 @@
+/******************************************************************************
+* Copyright (c) 2000-2021 Ericsson Telecom AB
+* All rights reserved. This program and the accompanying materials
+* are made available under the terms of the Eclipse Public License v2.0
+* which accompanies this distribution, and is available at
+* https://www.eclipse.org/org/documents/epl-2.0/EPL-2.0.html
+*
+* Contributors:
+*  Peter Dimitrov- initial implementation and initial documentation
+*  Adam Delic
+*  Eduard Czimbalmos
+*  Endre Kulcsar
+*  Gabor Bettesch
+*  Gabor Szalai
+*  Tamas Buti
+*  Zoltan Medve
+******************************************************************************/
+//
+//  File:               SCTPasp_Engine.hh
+//  Description:        socket engine interface of the SCTPasp test port
+//  Prodnr:             CNL 113 469
+//
+// A socket engine takes over the receiving and sending on the connected
+// sockets of the port. The received messages are fetched by the TITAN thread
+// when the event file descriptor of the engine becomes readable.
+
+
+#ifndef SCTPasp__Engine_HH
+#define SCTPasp__Engine_HH
+
+#include <stdint.h>
+#include <stddef.h>
+#include <time.h>
+
+namespace SCTPasp__PortType {
+
+// messages up to this size are stored in the message itself, longer ones are allocated
+#define IO_INLINE_SIZE 2048
+
+class SocketEngine
+{
+public:
+  enum message_type_t {
+    // engine -> port
+    IO_DATA, IO_NOTIFICATION, IO_EOF, IO_SEND_ERROR,
+    // port -> engine
+    IO_ADD, IO_CLOSE, IO_SEND
+  };
+
+  struct message_t
+  {
+    message_type_t type;
+    int fd;
+    uint32_t seq; // identifies the registration of fd, see add_socket()
+    uint16_t stream;
+    uint32_t ppid; // host byte order
+    uint32_t context; // IO_SEND and IO_SEND_ERROR: the sinfo_context of the message
+    bool has_context; // the sinfo_context of the message was given, it is echoed in IO_SEND_ERROR
+    int err; // errno of IO_EOF and IO_SEND_ERROR
+    bool report; // IO_SEND: a failure is reported in IO_SEND_ERROR
+    bool ts_valid;
+    struct timespec ts; // kernel receive timestamp of the first fragment
+    size_t len;
+    unsigned char *data; // points to inline_data or to a buffer of the engine
+    unsigned char inline_data[IO_INLINE_SIZE];
+  };
+
+  virtual ~SocketEngine() {}
+
+  // closes the remaining sockets and releases the resources
+  virtual void stop() = 0;
+
+  // readable if there are received messages
+  virtual int get_event_fd() const = 0;
+
+  // called from the TITAN thread only
+  // the socket must be non-blocking, seq is returned in the messages of the socket
+  virtual void add_socket(int fd, uint32_t seq) = 0;
+  virtual void close_socket(int fd) = 0;
+  // returns false if the send queue is full or the message cannot be stored
+  virtual bool send(int fd, unsigned int stream, uint32_t ppid, uint32_t context, bool has_context, const void *data,
+    size_t len, bool report) = 0;
+  // passes the queued sends to the kernel
+  virtual void flush() {}
+
+  // resets the event file descriptor, must be called before draining the messages
+  virtual void clear_event() = 0;
+  // makes the event file descriptor readable again, if the messages are not drained completely
+  virtual void notify() = 0;
+  // returns the next received message or NULL, the message is valid until release()
+  virtual const message_t *receive() = 0;
+  virtual void release() = 0;
+
+  virtual uint64_t get_send_errors() const = 0;
+  // received messages the engine had to drop
+  virtual uint64_t get_receive_errors() const { return 0; }
+};
+
+}
+#endif
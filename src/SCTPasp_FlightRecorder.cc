@@ -0,0 +1,125 @@
+/******************************************************************************
+* Copyright (c) 2000-2021 Ericsson Telecom AB
+* All rights reserved. This program and the accompanying materials
+* are made available under the terms of the Eclipse Public License v2.0
+* which accompanies this distribution, and is available at
+* https://www.eclipse.org/org/documents/epl-2.0/EPL-2.0.html
+*
+* Contributors:
+*  Peter Dimitrov- initial implementation and initial documentation
+*  Adam Delic
+*  Eduard Czimbalmos
+*  Endre Kulcsar
+*  Gabor Bettesch
+*  Gabor Szalai
+*  Tamas Buti
+*  Zoltan Medve
+******************************************************************************/
+//
+//  File:               SCTPasp_FlightRecorder.cc
+//  Description:        In-memory trace ring of the SCTPasp test port
+//  Prodnr:             CNL 113 469
+//
+
+
+#include "SCTPasp_FlightRecorder.hh"
+
+#include <string.h>
+#include <errno.h>
+
+namespace SCTPasp__PortType {
+
+FlightRecorder::FlightRecorder(unsigned int size)
+  : head(0)
+{
+  uint64_t len = 1;
+  while (len < size) len <<= 1;
+  mask = len - 1;
+  ring = new trace_record_t[len]();
+}
+
+
+FlightRecorder::~FlightRecorder()
+{
+  delete [] ring;
+}
+
+
+int FlightRecorder::dump(const char *filename) const
+{
+  FILE *f = fopen(filename, "wb");
+  if (f == NULL) return errno;
+
+  uint64_t end = head.load(std::memory_order_acquire);
+  uint64_t size = mask + 1;
+  uint64_t start = end > size ? end - size : 0;
+
+  trace_file_header_t hdr;
+  memset(&hdr, 0, sizeof(hdr));
+  memcpy(hdr.magic, TRACE_FILE_MAGIC, sizeof(hdr.magic));
+  hdr.version = TRACE_FILE_VERSION;
+  hdr.record_size = sizeof(trace_record_t);
+  hdr.count = end - start;
+  hdr.lost = start;
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  hdr.realtime_ns = (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+  hdr.monotonic_ns = now();
+
+  int ret = 0;
+  if (fwrite(&hdr, sizeof(hdr), 1, f) != 1) ret = errno;
+  // the ring is written in at most two chunks: from start to the end of the array and from its beginning
+  for (uint64_t i = start; ret == 0 && i < end; )
+  {
+    uint64_t idx = i & mask;
+    uint64_t chunk = size - idx;
+    if (chunk > end - i) chunk = end - i;
+    if (fwrite(ring + idx, sizeof(trace_record_t), chunk, f) != chunk) ret = errno;
+    i += chunk;
+  }
+  if (fclose(f) != 0 && ret == 0) ret = errno;
+  return ret;
+}
+
+
+const char *FlightRecorder::event_name(unsigned int event)
+{
+  static const char *names[TRACE_EVENT_MAX] = { "UNKNOWN",
+    "RX_DATA", "RX_PARTIAL", "RX_NOTIFICATION", "RX_EOF", "TX_DATA", "TX_ERROR",
+    "ACCEPT", "CONNECT", "CONNECT_FAILED", "CLOSE", "ERROR" };
+  return event < TRACE_EVENT_MAX ? names[event] : names[0];
+}
+
+
+int FlightRecorder::render(FILE *in, FILE *out)
+{
+  trace_file_header_t hdr;
+  if (fread(&hdr, sizeof(hdr), 1, in) != 1) return EIO;
+  if (memcmp(hdr.magic, TRACE_FILE_MAGIC, sizeof(hdr.magic)) != 0 ||
+      hdr.version != TRACE_FILE_VERSION || hdr.record_size != sizeof(trace_record_t))
+    return EINVAL;
+
+  fprintf(out, "# %llu records, %llu older records lost\n",
+    (unsigned long long)hdr.count, (unsigned long long)hdr.lost);
+  trace_record_t r;
+  uint64_t prev = 0;
+  for (uint64_t i = 0; i < hdr.count; i++)
+  {
+    if (fread(&r, sizeof(r), 1, in) != 1) return EIO;
+    // converting the monotonic timestamp to wall clock time
+    uint64_t wall = hdr.realtime_ns - (hdr.monotonic_ns - r.timestamp);
+    time_t sec = wall / 1000000000ULL;
+    struct tm tm;
+    char tbuf[32];
+    localtime_r(&sec, &tm);
+    strftime(tbuf, sizeof(tbuf), "%Y/%m/%d %H:%M:%S", &tm);
+    fprintf(out, "%s.%09llu +%llu ns fd=%d %s len=%u stream=%u ppid=%u\n", tbuf,
+      (unsigned long long)(wall % 1000000000ULL),
+      (unsigned long long)(prev ? r.timestamp - prev : 0),
+      r.fd, event_name(r.event), r.length, r.stream, r.ppid);
+    prev = r.timestamp;
+  }
+  return 0;
+}
+
+}
@@ -0,0 +1,122 @@
+/******************************************************************************
+* Copyright (c) 2000-2021 Ericsson Telecom AB
+* All rights reserved. This program and the accompanying materials
+* are made available under the terms of the Eclipse Public License v2.0
+* which accompanies this distribution, and is available at
+* https://www.eclipse.org/org/documents/epl-2.0/EPL-2.0.html
+*
+* Contributors:
+*  Peter Dimitrov- initial implementation and initial documentation
+*  Adam Delic
+*  Eduard Czimbalmos
+*  Endre Kulcsar
+*  Gabor Bettesch
+*  Gabor Szalai
+*  Tamas Buti
+*  Zoltan Medve
+******************************************************************************/
+//
+//  File:               SCTPasp_FlightRecorder.hh
+//  Description:        In-memory trace ring of the SCTPasp test port
+//  Prodnr:             CNL 113 469
+//
+// The flight recorder does not depend on the TITAN runtime, it is shared
+// by the test port and the tools/SCTPasp_trace_decode utility.
+
+
+#ifndef SCTPasp__FlightRecorder_HH
+#define SCTPasp__FlightRecorder_HH
+
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+#include <atomic>
+
+namespace SCTPasp__PortType {
+
+enum trace_event_t {
+  TRACE_RX_DATA = 1,      // whole user message received
+  TRACE_RX_PARTIAL,       // part of a message received
+  TRACE_RX_NOTIFICATION,  // notification received, ppid: sn_type, stream: state
+  TRACE_RX_EOF,           // EOF or error on the socket
+  TRACE_TX_DATA,          // user message sent
+  TRACE_TX_ERROR,         // sendmsg() failed, ppid: errno
+  TRACE_ACCEPT,           // association accepted, stream: listening socket
+  TRACE_CONNECT,          // association established
+  TRACE_CONNECT_FAILED,   // connect() failed, ppid: errno
+  TRACE_CLOSE,            // socket closed by the test port
+  TRACE_ERROR,            // fatal error of the test port
+  TRACE_EVENT_MAX
+};
+
+struct trace_record_t
+{
+  uint64_t timestamp; // CLOCK_MONOTONIC in nanoseconds
+  int32_t fd;
+  uint16_t event;     // trace_event_t
+  uint16_t stream;
+  uint32_t ppid;
+  uint32_t length;
+};
+
+// header of the dump file, followed by the records from the oldest one
+struct trace_file_header_t
+{
+  char magic[8];           // TRACE_FILE_MAGIC
+  uint32_t version;
+  uint32_t record_size;
+  uint64_t count;          // number of records in the file
+  uint64_t lost;           // records overwritten before the dump
+  uint64_t realtime_ns;    // CLOCK_REALTIME at the time of the dump
+  uint64_t monotonic_ns;   // CLOCK_MONOTONIC at the time of the dump
+};
+
+#define TRACE_FILE_MAGIC "SCTPFR01"
+#define TRACE_FILE_VERSION 1
+
+class FlightRecorder
+{
+public:
+  // the size is rounded up to a power of two
+  explicit FlightRecorder(unsigned int size);
+  ~FlightRecorder();
+
+  static inline uint64_t now()
+  {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+  }
+
+  // not thread-safe: the records are written by the thread of the test port
+  // only, the socket engines do not record
+  inline void record(trace_event_t event, int fd, unsigned int length = 0,
+    unsigned int stream = 0, unsigned int ppid = 0)
+  {
+    trace_record_t& r = ring[head.fetch_add(1, std::memory_order_relaxed) & mask];
+    r.timestamp = now();
+    r.fd = fd;
+    r.event = event;
+    r.stream = stream;
+    r.ppid = ppid;
+    r.length = length;
+  }
+
+  // writes the content of the ring into a file, returns 0 or errno
+  int dump(const char *filename) const;
+
+  // renders the records of a dump file in text format, returns 0 or errno
+  static int render(FILE *in, FILE *out);
+  static const char *event_name(unsigned int event);
+
+private:
+  FlightRecorder(const FlightRecorder&);
+  FlightRecorder& operator=(const FlightRecorder&);
+
+  trace_record_t *ring;
+  uint64_t mask;
+  std::atomic<uint64_t> head;
+};
+
+}
+#endif
@@ -0,0 +1,784 @@
+/******************************************************************************
+* Copyright (c) 2000-2021 Ericsson Telecom AB
+* All rights reserved. This program and the accompanying materials
+* are made available under the terms of the Eclipse Public License v2.0
+* which accompanies this distribution, and is available at
+* https://www.eclipse.org/org/documents/epl-2.0/EPL-2.0.html
+*
+* Contributors:
+*  Peter Dimitrov- initial implementation and initial documentation
+*  Adam Delic
+*  Eduard Czimbalmos
+*  Endre Kulcsar
+*  Gabor Bettesch
+*  Gabor Szalai
+*  Tamas Buti
+*  Zoltan Medve
+******************************************************************************/
+//
+//  File:               SCTPasp_IOThread.cc
+//  Description:        socket I/O thread of the SCTPasp test port
+//  Prodnr:             CNL 113 469
+//
+
+
+#include "SCTPasp_IOThread.hh"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sched.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <poll.h>
+#include <netinet/in.h>
+#include <netinet/sctp.h>
+#include <arpa/inet.h>
+#include <vector>
+#include <deque>
+#include <unordered_map>
+#include <new>
+
+// size of the receive buffer of the I/O thread, longer messages are reassembled
+#define IO_BUFFER_SIZE 65536
+// max. number of messages read from one socket in one round
+#define IO_READ_BATCH 64
+#define IO_MAX_EVENTS 64
+
+namespace SCTPasp__PortType {
+
+struct IOThread::pending_t
+{
+  uint16_t stream;
+  uint32_t ppid;
+  uint32_t context;
+  bool has_context;
+  bool report;
+  std::vector<unsigned char> data;
+};
+
+
+struct IOThread::connection_t
+{
+  uint32_t seq;
+  std::vector<unsigned char> partial; // fragments of a partially received message
+  bool ts_valid;
+  struct timespec ts;
+  std::deque<pending_t> pending; // sends refused by the full socket buffer, sent on EPOLLOUT
+  bool paused; // not read while the receive ring is full
+  bool writable; // waits for EPOLLOUT
+  bool registered; // in the epoll set, it is left out while neither read nor written
+};
+
+
+// Returns 0 or the errno of sendmsg().
+static int send_sctp(int fd, uint16_t stream, uint32_t ppid, uint32_t context, const void *data, size_t len)
+{
+  struct cmsghdr *cmsg;
+  struct sctp_sndrcvinfo *sri;
+  char cbuf[CMSG_SPACE(sizeof (*sri))];
+  struct msghdr msg;
+  struct iovec iov;
+  iov.iov_base = (void *)data;
+  iov.iov_len = len;
+  memset(&msg, 0, sizeof (msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = cbuf;
+  msg.msg_controllen = sizeof (cbuf);
+  memset(cbuf, 0, sizeof (cbuf));
+  cmsg = CMSG_FIRSTHDR(&msg);
+  cmsg->cmsg_len = CMSG_LEN(sizeof (*sri));
+  cmsg->cmsg_level = IPPROTO_SCTP;
+  cmsg->cmsg_type = SCTP_SNDRCV;
+  sri = (struct sctp_sndrcvinfo *)CMSG_DATA(cmsg);
+  sri->sinfo_stream = stream;
+  sri->sinfo_ppid = htonl(ppid);
+  sri->sinfo_context = context;
+  if (sendmsg(fd, &msg, MSG_DONTWAIT | MSG_NOSIGNAL) >= 0) return 0;
+  int err = errno;
+  errno = 0;
+  return err == EWOULDBLOCK ? EAGAIN : err;
+}
+
+
+struct IOThread::state_t
+{
+  std::unordered_map<int, connection_t> connections;
+  std::vector<int> paused; // sockets paused since the receive ring was last resumed
+  std::deque<message_t> backlog; // IO_EOF and IO_SEND_ERROR messages waiting for room in the receive ring
+  unsigned char buffer[IO_BUFFER_SIZE];
+};
+
+
+bool IOThread::ring_t::init(size_t size)
+{
+  size_t len = 1;
+  while (len < size) len <<= 1;
+  slots = new (std::nothrow) message_t[len];
+  if (!slots) return false;
+  for (size_t i = 0; i < len; i++) slots[i].data = slots[i].inline_data; // see free_data()
+  mask = len - 1;
+  head.store(0);
+  tail.store(0);
+  return true;
+}
+
+
+void IOThread::ring_t::destroy()
+{
+  if (!slots) return;
+  message_t *m;
+  while ((m = consumer_slot()) != NULL)
+  {
+    free_data(m);
+    consume();
+  }
+  delete [] slots;
+  slots = NULL;
+}
+
+
+IOThread::message_t *IOThread::ring_t::producer_slot()
+{
+  size_t h = head.load(std::memory_order_relaxed);
+  if (h - tail.load(std::memory_order_acquire) > mask) return NULL;
+  return &slots[h & mask];
+}
+
+
+void IOThread::ring_t::produce()
+{
+  // sequentially consistent, it is paired with the sleeping flag of the consumer
+  head.fetch_add(1, std::memory_order_seq_cst);
+}
+
+
+IOThread::message_t *IOThread::ring_t::consumer_slot()
+{
+  size_t t = tail.load(std::memory_order_relaxed);
+  if (t == head.load(std::memory_order_acquire)) return NULL;
+  return &slots[t & mask];
+}
+
+
+void IOThread::ring_t::consume()
+{
+  tail.store(tail.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+}
+
+
+size_t IOThread::ring_t::count() const
+{
+  return head.load(std::memory_order_acquire) - tail.load(std::memory_order_acquire);
+}
+
+
+IOThread::IOThread() :
+    thread_started(false), stopping(false), sleeping(false),
+    cmd_waiting(false), rx_waiting(false), epoll_fd(-1), rx_event(-1), cmd_event(-1), space_event(-1), state(NULL),
+    rx_pending(false), send_errors(0), receive_errors(0)
+{
+  rx.slots = NULL;
+  cmd.slots = NULL;
+}
+
+
+IOThread::~IOThread()
+{
+  stop();
+}
+
+
+int IOThread::start(unsigned int queue_size, int cpu)
+{
+  if (thread_started) return EBUSY;
+  int err = 0;
+  epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+  if (epoll_fd == -1) err = errno;
+  if (err == 0 && (rx_event = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) == -1) err = errno;
+  if (err == 0 && (cmd_event = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) == -1) err = errno;
+  if (err == 0 && (space_event = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) == -1) err = errno;
+  if (err == 0)
+  {
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.fd = cmd_event;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, cmd_event, &ev) == -1) err = errno;
+  }
+  if (err == 0 && (!rx.init(queue_size) || !cmd.init(queue_size))) err = ENOMEM;
+  if (err == 0)
+  {
+    state = new (std::nothrow) state_t;
+    if (!state) err = ENOMEM;
+  }
+  if (err == 0)
+  {
+    stopping.store(false);
+    rx_waiting.store(false);
+    err = pthread_create(&thread, NULL, thread_main, this);
+  }
+  if (err != 0)
+  {
+    thread_started = true; // releasing the resources
+    stopping.store(true);
+    stop();
+    errno = 0;
+    return err;
+  }
+  thread_started = true;
+  if (cpu >= 0)
+  {
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(cpu, &cpus);
+    err = pthread_setaffinity_np(thread, sizeof(cpus), &cpus);
+    if (err != 0)
+    {
+      stop();
+      return err;
+    }
+  }
+  return 0;
+}
+
+
+void IOThread::stop()
+{
+  if (!thread_started) return;
+  if (!stopping.exchange(true))
+  {
+    uint64_t one = 1;
+    if (write(cmd_event, &one, sizeof(one)) < 0) errno = 0;
+    pthread_join(thread, NULL);
+  }
+  thread_started = false;
+  rx.destroy();
+  cmd.destroy();
+  delete state;
+  state = NULL;
+  if (epoll_fd != -1) close(epoll_fd);
+  if (rx_event != -1) close(rx_event);
+  if (cmd_event != -1) close(cmd_event);
+  if (space_event != -1) close(space_event);
+  epoll_fd = rx_event = cmd_event = space_event = -1;
+}
+
+
+// Returns false if the message cannot be stored, it is left empty then.
+bool IOThread::set_data(message_t *m, const void *data, size_t len)
+{
+  m->data = len <= IO_INLINE_SIZE ? m->inline_data : (unsigned char *)malloc(len);
+  if (!m->data)
+  {
+    m->data = m->inline_data;
+    m->len = 0;
+    return false;
+  }
+  if (len > 0) memcpy(m->data, data, len);
+  m->len = len;
+  return true;
+}
+
+
+void IOThread::free_data(message_t *m)
+{
+  if (m->data != m->inline_data) free(m->data);
+  m->data = m->inline_data;
+}
+
+
+void IOThread::wake()
+{
+  if (sleeping.load(std::memory_order_seq_cst))
+  {
+    uint64_t one = 1;
+    if (write(cmd_event, &one, sizeof(one)) < 0) errno = 0;
+  }
+}
+
+
+// Returns a free slot of the command ring, blocks on space_event while the ring is full.
+IOThread::message_t *IOThread::cmd_slot()
+{
+  message_t *m;
+  while ((m = cmd.producer_slot()) == NULL)
+  {
+    cmd_waiting.store(true, std::memory_order_seq_cst);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if ((m = cmd.producer_slot()) != NULL) break; // the I/O thread took a command meanwhile
+    struct pollfd pfd;
+    pfd.fd = space_event;
+    pfd.events = POLLIN;
+    if (poll(&pfd, 1, -1) > 0)
+    {
+      uint64_t value;
+      if (read(space_event, &value, sizeof(value)) < 0) errno = 0;
+    }
+    else errno = 0;
+  }
+  cmd_waiting.store(false, std::memory_order_relaxed);
+  return m;
+}
+
+
+void IOThread::add_socket(int fd, uint32_t seq)
+{
+  message_t *m = cmd_slot();
+  m->type = IO_ADD;
+  m->fd = fd;
+  m->seq = seq;
+  m->len = 0;
+  cmd.produce();
+  wake();
+}
+
+
+void IOThread::close_socket(int fd)
+{
+  message_t *m = cmd_slot();
+  m->type = IO_CLOSE;
+  m->fd = fd;
+  m->len = 0;
+  cmd.produce();
+  wake();
+}
+
+
+bool IOThread::send(int fd, unsigned int stream, uint32_t ppid, uint32_t context, bool has_context, const void *data,
+  size_t len, bool report)
+{
+  message_t *m = cmd.producer_slot();
+  if (!m) return false;
+  m->type = IO_SEND;
+  m->fd = fd;
+  m->stream = stream;
+  m->ppid = ppid;
+  m->context = context;
+  m->has_context = has_context;
+  m->report = report;
+  if (!set_data(m, data, len))
+  {
+    send_errors.fetch_add(1, std::memory_order_relaxed);
+    return false;
+  }
+  cmd.produce();
+  wake();
+  return true;
+}
+
+
+void IOThread::clear_event()
+{
+  uint64_t value;
+  if (read(rx_event, &value, sizeof(value)) < 0) errno = 0;
+}
+
+
+void IOThread::notify()
+{
+  uint64_t one = 1;
+  if (write(rx_event, &one, sizeof(one)) < 0) errno = 0;
+}
+
+
+const IOThread::message_t *IOThread::receive()
+{
+  return rx.consumer_slot();
+}
+
+
+void IOThread::release()
+{
+  free_data(rx.consumer_slot());
+  rx.consume();
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (rx_waiting.load(std::memory_order_seq_cst) && rx.count() <= (rx.mask + 1) / 2 &&
+      rx_waiting.exchange(false))
+  { // the I/O thread waits in epoll_wait() for the ring to empty, see resume_reading()
+    uint64_t one = 1;
+    if (write(cmd_event, &one, sizeof(one)) < 0) errno = 0;
+  }
+}
+
+
+void *IOThread::thread_main(void *arg)
+{
+  static_cast<IOThread *>(arg)->run();
+  return NULL;
+}
+
+
+void IOThread::run()
+{
+  struct epoll_event events[IO_MAX_EVENTS];
+  while (!stopping.load(std::memory_order_acquire))
+  {
+    process_commands();
+    resume_reading();
+    if (rx_pending)
+    {
+      rx_pending = false;
+      notify();
+    }
+    sleeping.store(true, std::memory_order_seq_cst);
+    if (cmd.head.load(std::memory_order_seq_cst) != cmd.tail.load(std::memory_order_relaxed))
+    { // a command arrived meanwhile
+      sleeping.store(false, std::memory_order_relaxed);
+      continue;
+    }
+    int n = epoll_wait(epoll_fd, events, IO_MAX_EVENTS, -1);
+    sleeping.store(false, std::memory_order_relaxed);
+    for (int i = 0; i < n; i++)
+    {
+      if (events[i].data.fd == cmd_event)
+      {
+        uint64_t value;
+        if (read(cmd_event, &value, sizeof(value)) < 0) errno = 0;
+      }
+      else
+      {
+        // a hang-up fails the queued sends, a paused socket waiting for EPOLLOUT is not read
+        if (events[i].events & (EPOLLOUT | EPOLLERR | EPOLLHUP)) write_socket(events[i].data.fd);
+        if (events[i].events & ~EPOLLOUT) read_socket(events[i].data.fd);
+      }
+    }
+  }
+  process_commands(); // closing the sockets of the unmap
+  for (std::unordered_map<int, connection_t>::iterator it = state->connections.begin();
+       it != state->connections.end(); ++it)
+  {
+    send_errors.fetch_add(it->second.pending.size(), std::memory_order_relaxed);
+    close(it->first);
+  }
+  state->connections.clear();
+  resume_reading(); // whatever fits into the ring, the port does not wait for the rest
+  for (size_t i = 0; i < state->backlog.size(); i++) free_data(&state->backlog[i]);
+  state->backlog.clear();
+  if (rx_pending) notify();
+}
+
+
+// Returns the slot of the next message to the port, to be passed by rx_produce().
+// The I/O thread never waits for the port, the TITAN thread may be waiting for
+// it in cmd_slot(): while the ring is full, or the earlier messages wait, the
+// message is put into the backlog and moved into the ring by resume_reading().
+IOThread::message_t *IOThread::rx_slot()
+{
+  message_t *m = state->backlog.empty() ? rx.producer_slot() : NULL;
+  if (m) return m;
+  state->backlog.push_back(message_t());
+  m = &state->backlog.back();
+  m->data = m->inline_data; // see free_data()
+  return m;
+}
+
+
+void IOThread::rx_produce()
+{
+  if (state->backlog.empty()) rx.produce(); // otherwise the message is the last one of the backlog
+  rx_pending = true;
+}
+
+
+// Stops reading fd while the receive ring is full, the messages wait in the
+// socket buffer and the peer is flow controlled meanwhile.
+void IOThread::pause_reading(int fd, connection_t& c)
+{
+  c.paused = true;
+  state->paused.push_back(fd);
+  watch_events(fd, c);
+}
+
+
+// Moves the backlog into the receive ring and reads the paused sockets again
+// when the port has emptied half of the ring. Otherwise release() wakes the
+// I/O thread up when that happens.
+void IOThread::resume_reading()
+{
+  while (!state->backlog.empty() || !state->paused.empty())
+  {
+    if (rx.count() > (rx.mask + 1) / 2)
+    {
+      rx_waiting.store(true, std::memory_order_seq_cst);
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      if (rx.count() > (rx.mask + 1) / 2) return;
+      rx_waiting.store(false, std::memory_order_relaxed);
+    }
+    message_t *m;
+    while (!state->backlog.empty() && (m = rx.producer_slot()) != NULL)
+    {
+      message_t& b = state->backlog.front();
+      memcpy(m, &b, sizeof(message_t));
+      m->data = b.data == b.inline_data ? m->inline_data : b.data;
+      state->backlog.pop_front();
+      rx.produce();
+      rx_pending = true;
+    }
+    if (!state->backlog.empty()) continue;
+    for (size_t i = 0; i < state->paused.size(); i++)
+    {
+      std::unordered_map<int, connection_t>::iterator it = state->connections.find(state->paused[i]);
+      if (it == state->connections.end() || !it->second.paused) continue; // closed meanwhile
+      it->second.paused = false;
+      watch_events(it->first, it->second);
+    }
+    state->paused.clear();
+  }
+}
+
+
+void IOThread::process_commands()
+{
+  message_t *m;
+  while ((m = cmd.consumer_slot()) != NULL)
+  {
+    switch (m->type)
+    {
+      case IO_ADD:
+      {
+        connection_t& c = state->connections[m->fd];
+        c.seq = m->seq;
+        c.partial.clear();
+        c.ts_valid = false;
+        c.paused = false;
+        c.writable = false;
+        c.registered = true;
+        struct epoll_event ev;
+        memset(&ev, 0, sizeof(ev));
+        ev.events = EPOLLIN;
+        ev.data.fd = m->fd;
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, m->fd, &ev) == -1)
+        { // reported as the loss of the association
+          message_t *r = rx_slot();
+          r->type = IO_EOF;
+          r->fd = m->fd;
+          r->seq = m->seq;
+          r->err = errno;
+          r->len = 0;
+          rx_produce();
+          state->connections.erase(m->fd);
+          errno = 0;
+        }
+        break;
+      }
+      case IO_CLOSE:
+      {
+        std::unordered_map<int, connection_t>::iterator it = state->connections.find(m->fd);
+        if (it != state->connections.end())
+        { // the port does not wait for the sends still queued
+          send_errors.fetch_add(it->second.pending.size(), std::memory_order_relaxed);
+          if (it->second.registered) epoll_ctl(epoll_fd, EPOLL_CTL_DEL, m->fd, NULL);
+          state->connections.erase(it);
+        }
+        close(m->fd);
+        break;
+      }
+      case IO_SEND:
+      {
+        std::unordered_map<int, connection_t>::iterator it = state->connections.find(m->fd);
+        connection_t *c = it != state->connections.end() ? &it->second : NULL;
+        // the order of the messages is kept behind the queued ones
+        int err = c && !c->pending.empty() ? EAGAIN :
+          send_sctp(m->fd, m->stream, m->ppid, m->context, m->data, m->len);
+        if (err == EAGAIN && c)
+        {
+          if (c->pending.empty())
+          {
+            c->writable = true;
+            watch_events(m->fd, *c);
+          }
+          c->pending.push_back(pending_t());
+          pending_t& p = c->pending.back();
+          p.stream = m->stream;
+          p.ppid = m->ppid;
+          p.context = m->context;
+          p.has_context = m->has_context;
+          p.report = m->report;
+          p.data.assign(m->data, m->data + m->len);
+        }
+        else if (err != 0)
+        {
+          send_errors.fetch_add(1, std::memory_order_relaxed);
+          if (m->report && c) send_failed(m->fd, c->seq, m->stream, m->ppid, m->context, m->has_context, m->data, m->len, err);
+        }
+        break;
+      }
+      default:
+        break;
+    }
+    free_data(m);
+    cmd.consume();
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (cmd_waiting.load(std::memory_order_seq_cst))
+    { // the TITAN thread waits for a free slot in cmd_slot()
+      cmd_waiting.store(false, std::memory_order_relaxed);
+      uint64_t one = 1;
+      if (write(space_event, &one, sizeof(one)) < 0) errno = 0;
+    }
+  }
+}
+
+
+void IOThread::send_failed(int fd, uint32_t seq, uint16_t stream, uint32_t ppid, uint32_t context, bool has_context,
+  const void *data, size_t len, int err)
+{
+  message_t *r = rx_slot();
+  r->type = IO_SEND_ERROR;
+  r->fd = fd;
+  r->seq = seq;
+  r->stream = stream;
+  r->ppid = ppid;
+  r->context = context;
+  r->has_context = has_context;
+  r->err = err;
+  set_data(r, data, len); // reported without the data if it cannot be stored
+  rx_produce();
+}
+
+
+// Sets the events of fd after c: readable unless it is paused, writable while
+// sends are queued. A socket waiting for neither is left out of the epoll set,
+// so its hang-up is not reported while it is paused.
+void IOThread::watch_events(int fd, connection_t& c)
+{
+  struct epoll_event ev;
+  memset(&ev, 0, sizeof(ev));
+  ev.events = (c.paused ? 0 : EPOLLIN) | (c.writable ? EPOLLOUT : 0);
+  ev.data.fd = fd;
+  if (ev.events == 0 && !c.registered) return;
+  int op = ev.events == 0 ? EPOLL_CTL_DEL : c.registered ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+  if (epoll_ctl(epoll_fd, op, fd, &ev) == -1) errno = 0;
+  else c.registered = ev.events != 0;
+}
+
+
+// Sends the queued messages of fd until the socket buffer is full again.
+void IOThread::write_socket(int fd)
+{
+  std::unordered_map<int, connection_t>::iterator it = state->connections.find(fd);
+  if (it == state->connections.end()) return;
+  connection_t& c = it->second;
+  if (!c.writable) return;
+  while (!c.pending.empty())
+  {
+    pending_t& p = c.pending.front();
+    int err = send_sctp(fd, p.stream, p.ppid, p.context, p.data.empty() ? NULL : &p.data[0], p.data.size());
+    if (err == EAGAIN) return;
+    if (err != 0)
+    {
+      send_errors.fetch_add(1, std::memory_order_relaxed);
+      if (p.report) send_failed(fd, c.seq, p.stream, p.ppid, p.context, p.has_context, p.data.empty() ? NULL : &p.data[0],
+        p.data.size(), err);
+    }
+    c.pending.pop_front();
+  }
+  c.writable = false;
+  watch_events(fd, c);
+}
+
+
+void IOThread::read_socket(int fd)
+{
+  std::unordered_map<int, connection_t>::iterator it = state->connections.find(fd);
+  if (it == state->connections.end()) return;
+  connection_t& c = it->second;
+  if (c.paused) return;
+  for (int n = 0; n < IO_READ_BATCH; n++)
+  {
+    if (!state->backlog.empty() || rx.producer_slot() == NULL)
+    { // the port is behind
+      pause_reading(fd, c);
+      return;
+    }
+    struct sctp_sndrcvinfo sri;
+    char cbuf[CMSG_SPACE(sizeof (struct sctp_sndrcvinfo)) + CMSG_SPACE(sizeof (struct timespec))];
+    struct msghdr msg;
+    struct iovec iov;
+    iov.iov_base = state->buffer;
+    iov.iov_len = IO_BUFFER_SIZE;
+    memset(&msg, 0, sizeof (msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = cbuf;
+    msg.msg_controllen = sizeof (cbuf);
+    memset(&sri, 0, sizeof (sri));
+
+    ssize_t len = recvmsg(fd, &msg, MSG_DONTWAIT);
+    if (len < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+    {
+      errno = 0;
+      return;
+    }
+    if (len <= 0)
+    { // the socket is closed by the port
+      int err = len < 0 ? errno : 0;
+      for (size_t i = 0; i < c.pending.size(); i++)
+      { // the queued sends are failed before the loss of the association
+        pending_t& p = c.pending[i];
+        send_errors.fetch_add(1, std::memory_order_relaxed);
+        if (p.report) send_failed(fd, c.seq, p.stream, p.ppid, p.context, p.has_context, p.data.empty() ? NULL : &p.data[0],
+          p.data.size(), err != 0 ? err : EPIPE);
+      }
+      message_t *m = rx_slot();
+      m->type = IO_EOF;
+      m->fd = fd;
+      m->seq = c.seq;
+      m->err = err;
+      m->len = 0;
+      rx_produce();
+      errno = 0;
+      if (c.registered) epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+      state->connections.erase(it);
+      return;
+    }
+
+    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg))
+    {
+      if (cmsg->cmsg_level == IPPROTO_SCTP && cmsg->cmsg_type == SCTP_SNDRCV)
+        memcpy(&sri, CMSG_DATA(cmsg), sizeof (sri));
+      else if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_TIMESTAMPNS && !c.ts_valid)
+      {
+        memcpy(&c.ts, CMSG_DATA(cmsg), sizeof (struct timespec));
+        c.ts_valid = true;
+      }
+    }
+    if (!(msg.msg_flags & MSG_EOR))
+    {
+      c.partial.insert(c.partial.end(), state->buffer, state->buffer + len);
+      continue;
+    }
+
+    message_t *m = rx_slot(); // a slot of the ring, checked above
+    const unsigned char *data = state->buffer;
+    size_t data_len = len;
+    if (!c.partial.empty())
+    {
+      c.partial.insert(c.partial.end(), state->buffer, state->buffer + len);
+      data = &c.partial[0];
+      data_len = c.partial.size();
+    }
+    bool stored = set_data(m, data, data_len);
+    c.partial.clear();
+    bool ts_valid = c.ts_valid;
+    c.ts_valid = false;
+    if (!stored)
+    { // out of memory, the message is dropped
+      receive_errors.fetch_add(1, std::memory_order_relaxed);
+      continue;
+    }
+    m->type = msg.msg_flags & MSG_NOTIFICATION ? IO_NOTIFICATION : IO_DATA;
+    m->fd = fd;
+    m->seq = c.seq;
+    m->stream = sri.sinfo_stream;
+    m->ppid = ntohl(sri.sinfo_ppid);
+    m->ts_valid = ts_valid;
+    m->ts = c.ts;
+    rx_produce();
+  }
+}
+
+}
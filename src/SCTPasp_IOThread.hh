@@ -0,0 +1,132 @@
+/******************************************************************************
+* Copyright (c) 2000-2021 Ericsson Telecom AB
+* All rights reserved. This program and the accompanying materials
+* are made available under the terms of the Eclipse Public License v2.0
+* which accompanies this distribution, and is available at
+* https://www.eclipse.org/org/documents/epl-2.0/EPL-2.0.html
+*
+* Contributors:
+*  Peter Dimitrov- initial implementation and initial documentation
+*  Adam Delic
+*  Eduard Czimbalmos
+*  Endre Kulcsar
+*  Gabor Bettesch
+*  Gabor Szalai
+*  Tamas Buti
+*  Zoltan Medve
+******************************************************************************/
+//
+//  File:               SCTPasp_IOThread.hh
+//  Description:        socket I/O thread of the SCTPasp test port
+//  Prodnr:             CNL 113 469
+//
+// The I/O thread owns the SCTP sockets of the port: it receives with epoll,
+// reassembles the messages and passes them to the TITAN thread through a
+// lock-free single producer single consumer ring. An eventfd signals the ring
+// to the TITAN event loop. The sockets are added, closed and written through a
+// second ring in the opposite direction. The sends refused by a full socket
+// buffer are queued per socket and retried when the socket becomes writable.
+// The I/O thread never waits for the port: while the receive ring is full the
+// sockets are not read, and the errors and closes wait in a backlog.
+
+
+#ifndef SCTPasp__IOThread_HH
+#define SCTPasp__IOThread_HH
+
+#include "SCTPasp_Engine.hh"
+
+#include <pthread.h>
+#include <atomic>
+
+namespace SCTPasp__PortType {
+
+class IOThread : public SocketEngine
+{
+public:
+  IOThread();
+  ~IOThread();
+
+  // creates the rings and starts the thread, pinned to cpu if it is not -1
+  // returns 0 or errno
+  int start(unsigned int queue_size, int cpu);
+  // closes the remaining sockets and stops the thread
+  void stop();
+  bool is_running() const { return thread_started; }
+
+  int get_event_fd() const { return rx_event; }
+
+  void add_socket(int fd, uint32_t seq);
+  void close_socket(int fd);
+  bool send(int fd, unsigned int stream, uint32_t ppid, uint32_t context, bool has_context, const void *data,
+    size_t len, bool report);
+
+  void clear_event();
+  void notify();
+  const message_t *receive();
+  void release();
+
+  uint64_t get_send_errors() const { return send_errors.load(std::memory_order_relaxed); }
+  uint64_t get_receive_errors() const { return receive_errors.load(std::memory_order_relaxed); }
+
+private:
+  IOThread(const IOThread&);
+  IOThread& operator=(const IOThread&);
+
+  struct ring_t
+  {
+    message_t *slots;
+    size_t mask;
+    std::atomic<size_t> head; // written by the producer
+    std::atomic<size_t> tail; // written by the consumer
+
+    bool init(size_t size);
+    void destroy();
+    message_t *producer_slot();
+    void produce();
+    message_t *consumer_slot();
+    void consume();
+    size_t count() const;
+  };
+  struct pending_t;
+  struct connection_t;
+  struct state_t;
+
+  static void *thread_main(void *arg);
+  void run();
+  void process_commands();
+  void read_socket(int fd);
+  void write_socket(int fd);
+  void watch_events(int fd, connection_t& c);
+  void pause_reading(int fd, connection_t& c);
+  void resume_reading();
+  void send_failed(int fd, uint32_t seq, uint16_t stream, uint32_t ppid, uint32_t context, bool has_context,
+    const void *data, size_t len, int err);
+  message_t *rx_slot();
+  void rx_produce();
+  void wake();
+  message_t *cmd_slot();
+  static bool set_data(message_t *m, const void *data, size_t len);
+  static void free_data(message_t *m);
+
+  pthread_t thread;
+  bool thread_started;
+  std::atomic<bool> stopping;
+  std::atomic<bool> sleeping; // the I/O thread waits in epoll_wait()
+  std::atomic<bool> cmd_waiting; // the TITAN thread waits for room in the command ring
+  std::atomic<bool> rx_waiting; // the I/O thread waits for the port to empty half of the receive ring
+
+  int epoll_fd;
+  int rx_event; // I/O thread -> port
+  int cmd_event; // port -> I/O thread
+  int space_event; // I/O thread -> port: the command ring has room again
+  ring_t rx;
+  ring_t cmd;
+  state_t *state; // used by the I/O thread only
+  bool rx_pending; // a message was queued since the last signal of rx_event
+
+  std::atomic<uint64_t> send_errors;
+  std::atomic<uint64_t> receive_errors; // messages dropped for the lack of memory
+};
+
+}
+#endif
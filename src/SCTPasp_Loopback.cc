@@ -0,0 +1,1061 @@
+/******************************************************************************
+* Copyright (c) 2000-2021 Ericsson Telecom AB
+* All rights reserved. This program and the accompanying materials
+* are made available under the terms of the Eclipse Public License v2.0
+* which accompanies this distribution, and is available at
+* https://www.eclipse.org/org/documents/epl-2.0/EPL-2.0.html
+*
+* Contributors:
+*  Peter Dimitrov- initial implementation and initial documentation
+*  Adam Delic
+*  Eduard Czimbalmos
+*  Endre Kulcsar
+*  Gabor Bettesch
+*  Gabor Szalai
+*  Tamas Buti
+*  Zoltan Medve
+******************************************************************************/
+//
+//  File:               SCTPasp_Loopback.cc
+//  Description:        shared memory loopback transport of the SCTPasp test port
+//  Prodnr:             CNL 113 469
+//
+
+
+#include "SCTPasp_Loopback.hh"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <netinet/in.h>
+#include <netinet/sctp.h>
+#include <arpa/inet.h>
+#include <deque>
+#include <vector>
+#include <unordered_map>
+
+namespace SCTPasp__PortType {
+
+#define LOOPBACK_MAGIC 0x53435450
+#define LOOPBACK_VERSION 1
+#define LOOPBACK_NAME "SCTPasp-loopback"
+#define LOOPBACK_MIN_RING 4096
+#define LOOPBACK_PAD 0xffff // record type: the end of the ring is skipped
+#define LOOPBACK_BURST 16 // messages delivered from an association before the next one is served
+#define LOOPBACK_EVENTS 64 // epoll events fetched at once
+#define LOOPBACK_HELLO_TIMEOUT 1000 // ms, the hello follows connect() immediately
+#define EPHEMERAL_FIRST 32768
+#define EPHEMERAL_LAST 60999
+
+// the epoll keys: the file descriptor of the socket and the kind of the event
+#define KEY_RING 0
+#define KEY_HANGUP 1
+#define KEY_NOTIFY (~(uint64_t)0)
+
+// the synthesised events of an association, in the order of delivery
+#define PENDING_COMM_UP 1
+#define PENDING_SHUTDOWN_EVENT 2
+#define PENDING_SHUTDOWN_COMP 4
+#define PENDING_EOF 8
+
+// the header of a ring in the shared memory, the records follow it
+struct LoopbackTransport::ring_t
+{
+  uint64_t head; // written by the producer
+  unsigned char pad1[56];
+  uint64_t tail; // written by the consumer
+  unsigned char pad2[56];
+  uint32_t waiting; // the consumer waits for the eventfd
+  uint32_t full; // the producer waits for room, it is signalled when the ring is drained
+  uint32_t closed; // the producer closed the association, set after its last record
+  unsigned char pad3[52];
+};
+
+// a message in the ring, the records are aligned to 16 bytes
+struct record_t
+{
+  uint32_t len; // of the data, of the whole record for LOOPBACK_PAD
+  uint16_t stream;
+  uint16_t type;
+  uint32_t ppid;
+  uint32_t reserved;
+};
+
+// sent with the memory file and the eventfds by the connecting side
+struct hello_t
+{
+  uint32_t magic;
+  uint32_t version;
+  uint64_t ring_size;
+  struct sockaddr_storage from; // the local address of the connecting side
+  struct sockaddr_storage to; // the address it connected to
+  uint16_t ostreams;
+  uint16_t instreams;
+};
+
+struct LoopbackTransport::sock_t
+{
+  int fd; // the AF_UNIX socket, it identifies the socket towards the port
+  int family;
+  uint32_t seq; // see add_socket(), 0 if the socket is not served by the engine
+  bool bound; // fd is bound to the name of local
+  bool listening;
+  bool timestamps; // SO_TIMESTAMPNS is set
+  struct sctp_event_subscribe events;
+  uint16_t ostreams;
+  uint16_t instreams;
+  struct sockaddr_storage local;
+  struct sockaddr_storage peer;
+  // the association, mem is NULL if the socket is not connected
+  unsigned char *mem;
+  size_t mem_size;
+  size_t ring_size;
+  ring_t *rx;
+  ring_t *tx;
+  uint64_t rx_tail; // the positions owned by this side
+  uint64_t tx_head;
+  int rx_efd; // signalled by the peer
+  int tx_efd; // signals the peer
+  bool hangup; // the AF_UNIX socket of the peer is closed
+  bool finished; // the end of the association was delivered
+  int pending; // PENDING_*
+  bool ready; // in state_t::ready
+  unsigned int burst;
+};
+
+struct send_error_t
+{
+  int fd;
+  uint32_t seq;
+  uint16_t stream;
+  uint32_t ppid;
+  uint32_t context;
+  bool has_context;
+  int err;
+  std::vector<unsigned char> data;
+};
+
+struct LoopbackTransport::state_t
+{
+  std::unordered_map<int, sock_t *> socks;
+  std::deque<sock_t *> ready; // the associations with something to deliver
+  std::deque<send_error_t> errors;
+  std::vector<unsigned char> error_data; // of the current IO_SEND_ERROR
+};
+
+
+static inline uint64_t record_size(size_t len)
+{
+  return (sizeof(record_t) + len + 15) & ~(uint64_t)15;
+}
+
+
+static void wake(int efd)
+{
+  uint64_t one = 1;
+  if (write(efd, &one, sizeof(one)) < 0) errno = 0;
+}
+
+
+static socklen_t addr_len(const struct sockaddr_storage& addr)
+{
+  return addr.ss_family == AF_INET6 ? sizeof(struct sockaddr_in6) : sizeof(struct sockaddr_in);
+}
+
+
+static int get_port(const struct sockaddr_storage& addr)
+{
+  if (addr.ss_family == AF_INET6) return ntohs(((const struct sockaddr_in6 *)&addr)->sin6_port);
+  return ntohs(((const struct sockaddr_in *)&addr)->sin_port);
+}
+
+
+static void set_port(struct sockaddr_storage& addr, int port)
+{
+  if (addr.ss_family == AF_INET6) ((struct sockaddr_in6 *)&addr)->sin6_port = htons(port);
+  else ((struct sockaddr_in *)&addr)->sin_port = htons(port);
+}
+
+
+static bool is_any(const struct sockaddr_storage& addr)
+{
+  if (addr.ss_family == AF_INET6)
+    return IN6_IS_ADDR_UNSPECIFIED(&((const struct sockaddr_in6 *)&addr)->sin6_addr);
+  return ((const struct sockaddr_in *)&addr)->sin_addr.s_addr == htonl(INADDR_ANY);
+}
+
+
+// the wildcard address of the family with the given port
+static struct sockaddr_storage any_addr(int family, int port)
+{
+  struct sockaddr_storage addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.ss_family = family;
+  set_port(addr, port);
+  return addr;
+}
+
+
+static void copy_addr(const struct sockaddr_storage& from, struct sockaddr *addr, socklen_t *len)
+{
+  if (addr == NULL || len == NULL) return;
+  socklen_t n = addr_len(from);
+  memcpy(addr, &from, *len < n ? *len : n);
+  *len = n;
+}
+
+
+// the abstract AF_UNIX name of an SCTP address
+static socklen_t make_name(const struct sockaddr_storage& addr, struct sockaddr_un& un)
+{
+  char ip[INET6_ADDRSTRLEN];
+  if (addr.ss_family == AF_INET6)
+    inet_ntop(AF_INET6, &((const struct sockaddr_in6 *)&addr)->sin6_addr, ip, sizeof(ip));
+  else inet_ntop(AF_INET, &((const struct sockaddr_in *)&addr)->sin_addr, ip, sizeof(ip));
+  memset(&un, 0, sizeof(un));
+  un.sun_family = AF_UNIX;
+  int n = snprintf(un.sun_path + 1, sizeof(un.sun_path) - 1, LOOPBACK_NAME "/%s/%d", ip, get_port(addr));
+  return offsetof(struct sockaddr_un, sun_path) + 1 + n;
+}
+
+
+LoopbackTransport::LoopbackTransport() :
+    event_fd(-1), notify_fd(-1), ring_size(0), state(NULL), current_sock(NULL), current_len(0),
+    send_errors(0)
+{
+  current.data = NULL;
+}
+
+
+LoopbackTransport::~LoopbackTransport()
+{
+  stop();
+}
+
+
+int LoopbackTransport::start(size_t size)
+{
+  ring_size = LOOPBACK_MIN_RING;
+  while (ring_size < size) ring_size <<= 1;
+  if ((event_fd = epoll_create1(EPOLL_CLOEXEC)) == -1) return errno;
+  if ((notify_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) == -1)
+  {
+    int err = errno;
+    ::close(event_fd);
+    event_fd = -1;
+    return err;
+  }
+  struct epoll_event ev;
+  ev.events = EPOLLIN;
+  ev.data.u64 = KEY_NOTIFY;
+  epoll_ctl(event_fd, EPOLL_CTL_ADD, notify_fd, &ev);
+  state = new state_t;
+  return 0;
+}
+
+
+void LoopbackTransport::stop()
+{
+  if (!state) return;
+  release();
+  while (!state->socks.empty()) close_sock(state->socks.begin()->second);
+  delete state;
+  state = NULL;
+  ::close(notify_fd);
+  ::close(event_fd);
+  notify_fd = -1;
+  event_fd = -1;
+}
+
+
+LoopbackTransport::sock_t *LoopbackTransport::find(int fd) const
+{
+  if (!state) return NULL;
+  std::unordered_map<int, sock_t *>::const_iterator it = state->socks.find(fd);
+  return it == state->socks.end() ? NULL : it->second;
+}
+
+
+int LoopbackTransport::socket(int family, bool nonblocking)
+{
+  if (!state)
+  {
+    errno = ENETDOWN;
+    return -1;
+  }
+  if (family != AF_INET && family != AF_INET6)
+  {
+    errno = EAFNOSUPPORT;
+    return -1;
+  }
+  int fd = ::socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC | (nonblocking ? SOCK_NONBLOCK : 0), 0);
+  if (fd == -1) return -1;
+  sock_t *s = new sock_t();
+  s->fd = fd;
+  s->family = family;
+  s->ostreams = 10; // the defaults of the kernel
+  s->instreams = 10;
+  s->local = any_addr(family, 0);
+  s->rx_efd = -1;
+  s->tx_efd = -1;
+  state->socks[fd] = s;
+  return fd;
+}
+
+
+// reserves the address by binding the AF_UNIX socket to its name
+int LoopbackTransport::bind_name(sock_t *s, const struct sockaddr_storage& addr)
+{
+  struct sockaddr_un un;
+  socklen_t len = make_name(addr, un);
+  if (::bind(s->fd, (struct sockaddr *)&un, len) == -1) return -1;
+  s->local = addr;
+  s->bound = true;
+  return 0;
+}
+
+
+int LoopbackTransport::bind_ephemeral(sock_t *s)
+{
+  static int next_port = EPHEMERAL_FIRST + getpid() % (EPHEMERAL_LAST - EPHEMERAL_FIRST + 1);
+  for (int i = EPHEMERAL_FIRST; i <= EPHEMERAL_LAST; i++)
+  {
+    struct sockaddr_storage addr = s->local;
+    set_port(addr, next_port);
+    if (++next_port > EPHEMERAL_LAST) next_port = EPHEMERAL_FIRST;
+    if (bind_name(s, addr) == 0) return 0;
+    if (errno != EADDRINUSE) return -1;
+  }
+  errno = EADDRNOTAVAIL;
+  return -1;
+}
+
+
+int LoopbackTransport::bind(int fd, const struct sockaddr *addr, socklen_t len)
+{
+  sock_t *s = find(fd);
+  if (!s)
+  {
+    errno = EBADF;
+    return -1;
+  }
+  if (s->bound || s->mem || addr->sa_family != s->family || len > sizeof(struct sockaddr_storage))
+  {
+    errno = EINVAL;
+    return -1;
+  }
+  struct sockaddr_storage a;
+  memset(&a, 0, sizeof(a));
+  memcpy(&a, addr, len);
+  if (get_port(a) != 0) return bind_name(s, a);
+  s->local = a; // the port is chosen by listen() or connect()
+  return 0;
+}
+
+
+int LoopbackTransport::listen(int fd, int backlog)
+{
+  sock_t *s = find(fd);
+  if (!s)
+  {
+    errno = EBADF;
+    return -1;
+  }
+  if (s->mem)
+  {
+    errno = EINVAL;
+    return -1;
+  }
+  if (!s->bound && bind_ephemeral(s) == -1) return -1;
+  if (::listen(fd, backlog) == -1) return -1;
+  s->listening = true;
+  return 0;
+}
+
+
+int LoopbackTransport::attach(sock_t *s, int mem_fd, size_t size, bool client)
+{
+  void *p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, mem_fd, 0);
+  if (p == MAP_FAILED) return -1;
+  s->mem = (unsigned char *)p;
+  s->mem_size = size;
+  s->ring_size = size / 2 - sizeof(ring_t);
+  // the first ring carries the messages of the connecting side
+  ring_t *first = (ring_t *)s->mem;
+  ring_t *second = (ring_t *)(s->mem + size / 2);
+  s->rx = client ? second : first;
+  s->tx = client ? first : second;
+  s->rx_tail = __atomic_load_n(&s->rx->tail, __ATOMIC_ACQUIRE);
+  s->tx_head = __atomic_load_n(&s->tx->head, __ATOMIC_ACQUIRE);
+  return 0;
+}
+
+
+int LoopbackTransport::connect(int fd, const struct sockaddr *addr, socklen_t len)
+{
+  sock_t *s = find(fd);
+  if (!s)
+  {
+    errno = EBADF;
+    return -1;
+  }
+  if (s->mem)
+  {
+    errno = EISCONN;
+    return -1;
+  }
+  if (s->listening || addr->sa_family != s->family || len > sizeof(struct sockaddr_storage))
+  {
+    errno = EINVAL;
+    return -1;
+  }
+  struct sockaddr_storage to;
+  memset(&to, 0, sizeof(to));
+  memcpy(&to, addr, len);
+  if (!s->bound && bind_ephemeral(s) == -1) return -1;
+
+  // the listener is bound to the address, to the wildcard address of the family
+  // or, for IPv4, to the IPv6 wildcard address
+  struct sockaddr_storage names[3];
+  int count = 0;
+  names[count++] = to;
+  names[count++] = any_addr(s->family, get_port(to));
+  if (s->family == AF_INET) names[count++] = any_addr(AF_INET6, get_port(to));
+  // a full backlog is not waited for, it refuses the connection as the kernel would
+  int flags = fcntl(fd, F_GETFL);
+  fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+  int rc = -1;
+  for (int i = 0; i < count && rc == -1; i++)
+  {
+    struct sockaddr_un un;
+    socklen_t un_len = make_name(names[i], un);
+    rc = ::connect(fd, (struct sockaddr *)&un, un_len);
+    if (rc == -1 && errno != ECONNREFUSED && errno != ENOENT) break;
+  }
+  int err = errno;
+  fcntl(fd, F_SETFL, flags);
+  if (rc == -1)
+  {
+    errno = (err == EAGAIN || err == ENOENT) ? ECONNREFUSED : err;
+    return -1;
+  }
+
+  // the connecting side sets up the association
+  size_t size = 2 * (sizeof(ring_t) + ring_size);
+  int fds[3] = { memfd_create(LOOPBACK_NAME, MFD_CLOEXEC),
+                 eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC), eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC) };
+  if (fds[0] == -1 || fds[1] == -1 || fds[2] == -1 || ftruncate(fds[0], size) == -1 ||
+      attach(s, fds[0], size, true) == -1)
+  {
+    err = errno;
+    for (int i = 0; i < 3; i++) if (fds[i] != -1) ::close(fds[i]);
+    if (s->mem) munmap(s->mem, s->mem_size);
+    s->mem = NULL;
+    errno = err;
+    return -1;
+  }
+  // nothing was read yet, the first message of both sides is signalled
+  s->rx->waiting = 1;
+  s->tx->waiting = 1;
+  if (is_any(s->local))
+  { // reported as the address connected to, the peer is on the same host
+    struct sockaddr_storage local = to;
+    set_port(local, get_port(s->local));
+    s->local = local;
+  }
+  s->peer = to;
+
+  hello_t hello;
+  memset(&hello, 0, sizeof(hello));
+  hello.magic = LOOPBACK_MAGIC;
+  hello.version = LOOPBACK_VERSION;
+  hello.ring_size = s->ring_size;
+  hello.from = s->local;
+  hello.to = to;
+  hello.ostreams = s->ostreams;
+  hello.instreams = s->instreams;
+  char cbuf[CMSG_SPACE(sizeof(fds))];
+  memset(cbuf, 0, sizeof(cbuf));
+  struct iovec iov;
+  iov.iov_base = &hello;
+  iov.iov_len = sizeof(hello);
+  struct msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = cbuf;
+  msg.msg_controllen = sizeof(cbuf);
+  struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+  memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+  rc = sendmsg(fd, &msg, MSG_NOSIGNAL);
+  err = errno;
+  ::close(fds[0]); // the mapping keeps the memory
+  s->tx_efd = fds[1];
+  s->rx_efd = fds[2];
+  if (rc == -1)
+  {
+    errno = err;
+    return -1;
+  }
+  return 0;
+}
+
+
+int LoopbackTransport::accept(int fd, struct sockaddr *addr, socklen_t *len, bool nonblocking)
+{
+  sock_t *l = find(fd);
+  if (!l || !l->listening)
+  {
+    errno = EINVAL;
+    return -1;
+  }
+  int c = accept4(fd, NULL, NULL, SOCK_CLOEXEC | (nonblocking ? SOCK_NONBLOCK : 0));
+  if (c == -1) return -1;
+
+  hello_t hello;
+  int fds[3] = { -1, -1, -1 };
+  char cbuf[CMSG_SPACE(sizeof(fds))];
+  struct iovec iov;
+  iov.iov_base = &hello;
+  iov.iov_len = sizeof(hello);
+  struct msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = cbuf;
+  msg.msg_controllen = sizeof(cbuf);
+  struct pollfd p;
+  p.fd = c;
+  p.events = POLLIN;
+  ssize_t n = -1;
+  if (poll(&p, 1, LOOPBACK_HELLO_TIMEOUT) == 1) n = recvmsg(c, &msg, MSG_DONTWAIT | MSG_CMSG_CLOEXEC);
+  struct cmsghdr *cmsg = n > 0 ? CMSG_FIRSTHDR(&msg) : NULL;
+  if (cmsg && cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS &&
+      cmsg->cmsg_len == CMSG_LEN(sizeof(fds)))
+    memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+  struct stat st;
+  sock_t *s = new sock_t();
+  s->fd = c;
+  s->rx_efd = -1;
+  s->tx_efd = -1;
+  if (n != sizeof(hello) || fds[0] == -1 || hello.magic != LOOPBACK_MAGIC || hello.version != LOOPBACK_VERSION ||
+      hello.ring_size < LOOPBACK_MIN_RING || (hello.ring_size & (hello.ring_size - 1)) != 0 ||
+      fstat(fds[0], &st) == -1 || (size_t)st.st_size != 2 * (sizeof(ring_t) + hello.ring_size) ||
+      attach(s, fds[0], st.st_size, false) == -1)
+  { // not a loopback transport or the connecting side is gone
+    for (int i = 0; i < 3; i++) if (fds[i] != -1) ::close(fds[i]);
+    ::close(c);
+    delete s;
+    errno = EAGAIN;
+    return -1;
+  }
+  ::close(fds[0]);
+  s->tx_efd = fds[2];
+  s->rx_efd = fds[1];
+  // the options are inherited from the listening socket
+  s->family = l->family;
+  s->timestamps = l->timestamps;
+  s->events = l->events;
+  s->ostreams = l->ostreams < hello.instreams ? l->ostreams : hello.instreams;
+  s->instreams = l->instreams < hello.ostreams ? l->instreams : hello.ostreams;
+  s->local = l->local;
+  if (is_any(s->local))
+  {
+    s->local = hello.to;
+    set_port(s->local, get_port(l->local));
+  }
+  s->peer = hello.from;
+  state->socks[c] = s;
+  copy_addr(s->peer, addr, len);
+  return c;
+}
+
+
+int LoopbackTransport::set_nonblocking(int fd)
+{
+  if (!find(fd))
+  {
+    errno = EBADF;
+    return -1;
+  }
+  int flags = fcntl(fd, F_GETFL);
+  if (flags == -1) return -1;
+  return fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+
+int LoopbackTransport::setsockopt(int fd, int level, int name, const void *value, socklen_t len)
+{
+  sock_t *s = find(fd);
+  if (!s)
+  {
+    errno = EBADF;
+    return -1;
+  }
+  if (level == IPPROTO_SCTP)
+  {
+    switch (name)
+    {
+      case SCTP_INITMSG:
+      {
+        if (len < sizeof(struct sctp_initmsg))
+        {
+          errno = EINVAL;
+          return -1;
+        }
+        const struct sctp_initmsg *initmsg = (const struct sctp_initmsg *)value;
+        if (initmsg->sinit_num_ostreams != 0) s->ostreams = initmsg->sinit_num_ostreams;
+        if (initmsg->sinit_max_instreams != 0) s->instreams = initmsg->sinit_max_instreams;
+        return 0;
+      }
+      case SCTP_EVENTS:
+        memset(&s->events, 0, sizeof(s->events));
+        memcpy(&s->events, value, len < sizeof(s->events) ? len : sizeof(s->events));
+        return 0;
+#ifdef SCTP_EVENT
+      case SCTP_EVENT:
+      { // the fields of sctp_event_subscribe are in the order of the notification types
+        const struct sctp_event *event = (const struct sctp_event *)value;
+        if (len < sizeof(struct sctp_event) || event->se_type < SCTP_SN_TYPE_BASE ||
+            event->se_type > SCTP_SN_TYPE_MAX)
+        {
+          errno = EINVAL;
+          return -1;
+        }
+        unsigned int i = event->se_type - SCTP_SN_TYPE_BASE;
+        if (i < sizeof(s->events)) ((unsigned char *)&s->events)[i] = event->se_on != 0;
+        return 0;
+      }
+#endif
+      case SCTP_RTOINFO:
+      case SCTP_PEER_ADDR_PARAMS:
+      case SCTP_ASSOCINFO:
+#ifdef SCTP_PEER_ADDR_THLDS
+      case SCTP_PEER_ADDR_THLDS:
+#endif
+#ifdef SCTP_EXPOSE_POTENTIALLY_FAILED_STATE
+      case SCTP_EXPOSE_POTENTIALLY_FAILED_STATE:
+#endif
+      case SCTP_NODELAY:
+        return 0; // nothing is retransmitted or bundled on the rings
+      default:
+        break;
+    }
+  }
+  else if (level == SOL_SOCKET)
+  {
+    switch (name)
+    {
+      case SO_TIMESTAMPNS:
+        if (len < sizeof(int))
+        {
+          errno = EINVAL;
+          return -1;
+        }
+        s->timestamps = *(const int *)value != 0;
+        return 0;
+      case SO_LINGER:
+        return 0; // closing never waits, the peer reads the rest of the ring
+      default:
+        break;
+    }
+  }
+  errno = ENOPROTOOPT;
+  return -1;
+}
+
+
+int LoopbackTransport::getsockname(int fd, struct sockaddr *addr, socklen_t *len)
+{
+  sock_t *s = find(fd);
+  if (!s)
+  {
+    errno = EBADF;
+    return -1;
+  }
+  copy_addr(s->local, addr, len);
+  return 0;
+}
+
+
+int LoopbackTransport::getpeername(int fd, struct sockaddr *addr, socklen_t *len)
+{
+  sock_t *s = find(fd);
+  if (!s)
+  {
+    errno = EBADF;
+    return -1;
+  }
+  if (!s->mem)
+  {
+    errno = ENOTCONN;
+    return -1;
+  }
+  copy_addr(s->peer, addr, len);
+  return 0;
+}
+
+
+int LoopbackTransport::close(int fd)
+{
+  sock_t *s = find(fd);
+  if (!s)
+  {
+    errno = EBADF;
+    return -1;
+  }
+  close_sock(s);
+  return 0;
+}
+
+
+void LoopbackTransport::close_sock(sock_t *s)
+{
+  if (s == current_sock) current_sock = NULL;
+  if (s->ready)
+  {
+    for (std::deque<sock_t *>::iterator it = state->ready.begin(); it != state->ready.end(); ++it)
+      if (*it == s)
+      {
+        state->ready.erase(it);
+        break;
+      }
+  }
+  if (s->seq != 0 && !s->finished)
+  {
+    epoll_ctl(event_fd, EPOLL_CTL_DEL, s->rx_efd, NULL);
+    if (!s->hangup) epoll_ctl(event_fd, EPOLL_CTL_DEL, s->fd, NULL);
+  }
+  if (s->mem)
+  { // the peer delivers the rest of the ring, then the end of the association
+    __atomic_store_n(&s->tx->closed, 1, __ATOMIC_RELEASE);
+    wake(s->tx_efd);
+    munmap(s->mem, s->mem_size);
+  }
+  if (s->rx_efd != -1) ::close(s->rx_efd);
+  if (s->tx_efd != -1) ::close(s->tx_efd);
+  ::close(s->fd);
+  state->socks.erase(s->fd);
+  delete s;
+}
+
+
+void LoopbackTransport::add_socket(int fd, uint32_t seq)
+{
+  sock_t *s = find(fd);
+  if (!s || !s->mem) return;
+  s->seq = seq;
+  struct epoll_event ev;
+  ev.events = EPOLLIN;
+  ev.data.u64 = ((uint64_t)fd << 1) | KEY_RING;
+  epoll_ctl(event_fd, EPOLL_CTL_ADD, s->rx_efd, &ev);
+  ev.events = EPOLLRDHUP;
+  ev.data.u64 = ((uint64_t)fd << 1) | KEY_HANGUP;
+  epoll_ctl(event_fd, EPOLL_CTL_ADD, fd, &ev);
+  if (s->events.sctp_association_event) s->pending |= PENDING_COMM_UP;
+  // the peer may have sent already
+  set_ready(s);
+  notify();
+}
+
+
+void LoopbackTransport::close_socket(int fd)
+{
+  sock_t *s = find(fd);
+  if (s) close_sock(s);
+}
+
+
+void LoopbackTransport::send_error(sock_t *s, unsigned int stream, uint32_t ppid, uint32_t context, bool has_context,
+  const void *data, size_t len, int err, bool report)
+{
+  send_errors++;
+  if (!report) return;
+  send_error_t e;
+  e.fd = s->fd;
+  e.seq = s->seq;
+  e.stream = stream;
+  e.ppid = ppid;
+  e.context = context;
+  e.has_context = has_context;
+  e.err = err;
+  e.data.assign((const unsigned char *)data, (const unsigned char *)data + len);
+  state->errors.push_back(e);
+  notify();
+}
+
+
+bool LoopbackTransport::send(int fd, unsigned int stream, uint32_t ppid, uint32_t context, bool has_context, const void *data,
+  size_t len, bool report)
+{
+  sock_t *s = find(fd);
+  if (!s || !s->mem) return true; // closed meanwhile
+  if (s->hangup || __atomic_load_n(&s->rx->closed, __ATOMIC_ACQUIRE))
+  {
+    send_error(s, stream, ppid, context, has_context, data, len, EPIPE, report);
+    return true;
+  }
+  if (stream >= s->ostreams)
+  {
+    send_error(s, stream, ppid, context, has_context, data, len, EINVAL, report);
+    return true;
+  }
+  uint64_t need = record_size(len);
+  if (need > s->ring_size / 2)
+  {
+    send_error(s, stream, ppid, context, has_context, data, len, EMSGSIZE, report);
+    return true;
+  }
+  unsigned char *ring = (unsigned char *)(s->tx + 1);
+  uint64_t head = s->tx_head;
+  uint64_t off = head & (s->ring_size - 1);
+  uint64_t room = s->ring_size - off; // up to the end of the ring
+  uint64_t total = need > room ? room + need : need;
+  if (head + total - __atomic_load_n(&s->tx->tail, __ATOMIC_ACQUIRE) > s->ring_size)
+  {
+    __atomic_store_n(&s->tx->full, 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (head + total - __atomic_load_n(&s->tx->tail, __ATOMIC_ACQUIRE) > s->ring_size) return false;
+  }
+  if (need > room)
+  { // the records are contiguous, the end of the ring is skipped
+    record_t *pad = (record_t *)(ring + off);
+    pad->len = room;
+    pad->type = LOOPBACK_PAD;
+    head += room;
+    off = 0;
+  }
+  record_t *r = (record_t *)(ring + off);
+  r->len = len;
+  r->stream = stream;
+  r->type = 0;
+  r->ppid = ppid;
+  r->reserved = 0;
+  memcpy(r + 1, data, len);
+  s->tx_head = head + need;
+  __atomic_store_n(&s->tx->head, s->tx_head, __ATOMIC_SEQ_CST);
+  // the peer is woken only if it waits, see next_event()
+  if (__atomic_exchange_n(&s->tx->waiting, 0, __ATOMIC_SEQ_CST)) wake(s->tx_efd);
+  return true;
+}
+
+
+void LoopbackTransport::clear_event()
+{
+  uint64_t value;
+  if (read(notify_fd, &value, sizeof(value)) < 0) errno = 0;
+}
+
+
+void LoopbackTransport::notify()
+{
+  wake(notify_fd);
+}
+
+
+void LoopbackTransport::set_ready(sock_t *s)
+{
+  if (s->ready || s->finished) return;
+  s->ready = true;
+  s->burst = 0;
+  state->ready.push_back(s);
+}
+
+
+// fills current with the next message or event of the association, returns
+// false if there is nothing to deliver
+bool LoopbackTransport::next_event(sock_t *s)
+{
+  if (s->finished) return false;
+  current.fd = s->fd;
+  current.seq = s->seq;
+  current.stream = 0;
+  current.ppid = 0;
+  current.err = 0;
+  current.report = false;
+  current.ts_valid = s->timestamps;
+  if (s->timestamps) clock_gettime(CLOCK_REALTIME, &current.ts);
+  current.len = 0;
+  current.data = current.inline_data;
+  if (s->pending & PENDING_COMM_UP)
+  {
+    s->pending &= ~PENDING_COMM_UP;
+    struct sctp_assoc_change *sac = (struct sctp_assoc_change *)current.inline_data;
+    memset(sac, 0, sizeof(*sac));
+    sac->sac_type = SCTP_ASSOC_CHANGE;
+    sac->sac_length = sizeof(*sac);
+    sac->sac_state = SCTP_COMM_UP;
+    sac->sac_outbound_streams = s->ostreams;
+    sac->sac_inbound_streams = s->instreams;
+    current.type = IO_NOTIFICATION;
+    current.len = sizeof(*sac);
+    return true;
+  }
+
+  unsigned char *ring = (unsigned char *)(s->rx + 1);
+  for (;;)
+  {
+    if (s->rx_tail != __atomic_load_n(&s->rx->head, __ATOMIC_ACQUIRE))
+    {
+      record_t *r = (record_t *)(ring + (s->rx_tail & (s->ring_size - 1)));
+      if (r->type == LOOPBACK_PAD)
+      {
+        s->rx_tail += r->len;
+        __atomic_store_n(&s->rx->tail, s->rx_tail, __ATOMIC_RELEASE);
+        continue;
+      }
+      // the record stays in the ring until release()
+      current.type = IO_DATA;
+      current.stream = r->stream;
+      current.ppid = r->ppid;
+      current.data = (unsigned char *)(r + 1);
+      current.len = r->len;
+      current_sock = s;
+      current_len = record_size(r->len);
+      return true;
+    }
+    if (s->pending) break;
+    // the closed flag is read before the last check of the ring, it follows the last record
+    bool closed = __atomic_load_n(&s->rx->closed, __ATOMIC_ACQUIRE) != 0;
+    __atomic_store_n(&s->rx->waiting, 1, __ATOMIC_SEQ_CST);
+    if (s->rx_tail != __atomic_load_n(&s->rx->head, __ATOMIC_SEQ_CST)) continue;
+    if (__atomic_load_n(&s->rx->full, __ATOMIC_RELAXED) && __atomic_exchange_n(&s->rx->full, 0, __ATOMIC_SEQ_CST))
+      wake(s->tx_efd); // the eventfd of the peer's direction makes its engine readable
+    if (closed)
+    { // shut down by the peer
+      if (s->events.sctp_shutdown_event) s->pending |= PENDING_SHUTDOWN_EVENT;
+      if (s->events.sctp_association_event) s->pending |= PENDING_SHUTDOWN_COMP;
+      s->pending |= PENDING_EOF;
+    }
+    else if (s->hangup) s->pending |= PENDING_EOF; // the peer process is gone
+    break;
+  }
+
+  if (s->pending & PENDING_SHUTDOWN_EVENT)
+  {
+    s->pending &= ~PENDING_SHUTDOWN_EVENT;
+    struct sctp_shutdown_event *sse = (struct sctp_shutdown_event *)current.inline_data;
+    memset(sse, 0, sizeof(*sse));
+    sse->sse_type = SCTP_SHUTDOWN_EVENT;
+    sse->sse_length = sizeof(*sse);
+    current.type = IO_NOTIFICATION;
+    current.len = sizeof(*sse);
+    return true;
+  }
+  if (s->pending & PENDING_SHUTDOWN_COMP)
+  {
+    s->pending &= ~PENDING_SHUTDOWN_COMP;
+    struct sctp_assoc_change *sac = (struct sctp_assoc_change *)current.inline_data;
+    memset(sac, 0, sizeof(*sac));
+    sac->sac_type = SCTP_ASSOC_CHANGE;
+    sac->sac_length = sizeof(*sac);
+    sac->sac_state = SCTP_SHUTDOWN_COMP;
+    current.type = IO_NOTIFICATION;
+    current.len = sizeof(*sac);
+    return true;
+  }
+  if (s->pending & PENDING_EOF)
+  {
+    s->pending = 0;
+    s->finished = true;
+    epoll_ctl(event_fd, EPOLL_CTL_DEL, s->rx_efd, NULL);
+    if (!s->hangup) epoll_ctl(event_fd, EPOLL_CTL_DEL, s->fd, NULL);
+    current.type = IO_EOF;
+    current.ts_valid = false;
+    return true;
+  }
+  return false;
+}
+
+
+const LoopbackTransport::message_t *LoopbackTransport::receive()
+{
+  if (!state) return NULL;
+  release();
+  if (!state->errors.empty())
+  {
+    send_error_t& e = state->errors.front();
+    current.type = IO_SEND_ERROR;
+    current.fd = e.fd;
+    current.seq = e.seq;
+    current.stream = e.stream;
+    current.ppid = e.ppid;
+    current.context = e.context;
+    current.has_context = e.has_context;
+    current.err = e.err;
+    current.report = true;
+    current.ts_valid = false;
+    state->error_data.swap(e.data);
+    current.data = state->error_data.empty() ? current.inline_data : &state->error_data[0];
+    current.len = state->error_data.size();
+    state->errors.pop_front();
+    return &current;
+  }
+  for (;;)
+  {
+    if (state->ready.empty())
+    {
+      struct epoll_event events[LOOPBACK_EVENTS];
+      int n = epoll_wait(event_fd, events, LOOPBACK_EVENTS, 0);
+      if (n <= 0) return NULL;
+      bool found = false;
+      for (int i = 0; i < n; i++)
+      {
+        if (events[i].data.u64 == KEY_NOTIFY) continue; // reset by clear_event()
+        sock_t *s = find((int)(events[i].data.u64 >> 1));
+        if (!s) continue;
+        if (events[i].data.u64 & KEY_HANGUP)
+        { // reported until the socket is closed
+          s->hangup = true;
+          epoll_ctl(event_fd, EPOLL_CTL_DEL, s->fd, NULL);
+        }
+        else
+        {
+          uint64_t value;
+          if (read(s->rx_efd, &value, sizeof(value)) < 0) errno = 0;
+        }
+        set_ready(s);
+        found = true;
+      }
+      if (!found) return NULL;
+      continue;
+    }
+    sock_t *s = state->ready.front();
+    if (next_event(s))
+    {
+      if (++s->burst >= LOOPBACK_BURST && state->ready.size() > 1)
+      { // serving the other associations too
+        s->burst = 0;
+        state->ready.pop_front();
+        state->ready.push_back(s);
+      }
+      return &current;
+    }
+    state->ready.pop_front();
+    s->ready = false;
+  }
+}
+
+
+void LoopbackTransport::release()
+{
+  if (!current_sock) return;
+  current_sock->rx_tail += current_len;
+  __atomic_store_n(&current_sock->rx->tail, current_sock->rx_tail, __ATOMIC_RELEASE);
+  current_sock = NULL;
+}
+
+}
@@ -0,0 +1,114 @@
+/******************************************************************************
+* Copyright (c) 2000-2021 Ericsson Telecom AB
+* All rights reserved. This program and the accompanying materials
+* are made available under the terms of the Eclipse Public License v2.0
+* which accompanies this distribution, and is available at
+* https://www.eclipse.org/org/documents/epl-2.0/EPL-2.0.html
+*
+* Contributors:
+*  Peter Dimitrov- initial implementation and initial documentation
+*  Adam Delic
+*  Eduard Czimbalmos
+*  Endre Kulcsar
+*  Gabor Bettesch
+*  Gabor Szalai
+*  Tamas Buti
+*  Zoltan Medve
+******************************************************************************/
+//
+//  File:               SCTPasp_Loopback.hh
+//  Description:        shared memory loopback transport of the SCTPasp test port
+//  Prodnr:             CNL 113 469
+//
+// Connects the ports of the same host without SCTP. An association is a
+// shared memory file with one single producer, single consumer ring per
+// direction; the messages keep their stream and ppid. The rings are signalled
+// by an eventfd per direction, only when the reader waits for them.
+//
+// The listening socket is an AF_UNIX socket in the abstract namespace named
+// after the bound address and port, the connecting side passes the memory file
+// and the eventfds over it. The AF_UNIX socket of the association identifies
+// it towards the port and reports the loss of the peer process. The
+// association notifications are synthesised according to SCTP_EVENTS.
+
+
+#ifndef SCTPasp__Loopback_HH
+#define SCTPasp__Loopback_HH
+
+#include "SCTPasp_Transport.hh"
+#include "SCTPasp_Engine.hh"
+
+namespace SCTPasp__PortType {
+
+class LoopbackTransport : public Transport, public SocketEngine
+{
+public:
+  LoopbackTransport();
+  ~LoopbackTransport();
+
+  // ring_size is the size of the ring of each direction of the associations
+  // connected by this transport, rounded up to a power of two; returns 0 or errno
+  int start(size_t ring_size);
+
+  const char *get_transport_name() const { return "loopback"; }
+  bool kernel_sockets() const { return false; }
+  SocketEngine *get_engine() { return this; }
+
+  int socket(int family, bool nonblocking);
+  int bind(int fd, const struct sockaddr *addr, socklen_t len);
+  int listen(int fd, int backlog);
+  int accept(int fd, struct sockaddr *addr, socklen_t *len, bool nonblocking);
+  int connect(int fd, const struct sockaddr *addr, socklen_t len);
+  int set_nonblocking(int fd);
+  int setsockopt(int fd, int level, int name, const void *value, socklen_t len);
+  int getsockname(int fd, struct sockaddr *addr, socklen_t *len);
+  int getpeername(int fd, struct sockaddr *addr, socklen_t *len);
+  int close(int fd);
+
+  void stop();
+
+  // an epoll file descriptor watching the eventfds of the associations
+  int get_event_fd() const { return event_fd; }
+
+  void add_socket(int fd, uint32_t seq);
+  void close_socket(int fd);
+  bool send(int fd, unsigned int stream, uint32_t ppid, uint32_t context, bool has_context, const void *data,
+    size_t len, bool report);
+
+  void clear_event();
+  void notify();
+  const message_t *receive();
+  void release();
+
+  uint64_t get_send_errors() const { return send_errors; }
+
+private:
+  LoopbackTransport(const LoopbackTransport&);
+  LoopbackTransport& operator=(const LoopbackTransport&);
+
+  struct ring_t;
+  struct sock_t;
+  struct state_t;
+
+  sock_t *find(int fd) const;
+  int bind_name(sock_t *s, const struct sockaddr_storage& addr);
+  int bind_ephemeral(sock_t *s);
+  int attach(sock_t *s, int mem_fd, size_t size, bool client);
+  void close_sock(sock_t *s);
+  void set_ready(sock_t *s);
+  bool next_event(sock_t *s);
+  void send_error(sock_t *s, unsigned int stream, uint32_t ppid, uint32_t context, bool has_context, const void *data,
+    size_t len, int err, bool report);
+
+  int event_fd;
+  int notify_fd;
+  size_t ring_size;
+  state_t *state;
+  message_t current; // the message returned by receive()
+  sock_t *current_sock; // the ring of current is advanced by release()
+  uint64_t current_len;
+  uint64_t send_errors;
+};
+
+}
+#endif
@@ -24,6 +24,14 @@
 
 
 #include "SCTPasp_PT.hh"
+#include "SCTPasp_FlightRecorder.hh"
+#include "SCTPasp_Capture.hh"
+#include "SCTPasp_Replay.hh"
+#include "SCTPasp_IOThread.hh"
+#include "SCTPasp_Uring.hh"
+#include "SCTPasp_Transport.hh"
+#include "SCTPasp_Usrsctp.hh"
+#include "SCTPasp_Loopback.hh"
 
 #include <sys/types.h>
 #include <arpa/inet.h>
@@ -35,9 +43,36 @@
 #include <string.h>
 #include <errno.h>
 #include <limits.h>
+#include <time.h>
+#include <sys/timerfd.h>
+#include <map>
+#include <string>
+#include <vector>
+#include <deque>
+#include <set>
+#include <unordered_map>
+#include <algorithm>
 
-#define BUFLEN 1024
 #define MAP_LENGTH 10
+#define RTT_KEY_MAXLEN 16
+#define RTT_HISTOGRAM_BUCKETS 24
+// max. number of messages sent by the replay or the generator in one event handler call
+#define REPLAY_BATCH 1000
+#define GENERATOR_BATCH 1000
+// the replay sends a message again after this long if the socket cannot take it (us)
+#define REPLAY_RETRY_DELAY 100
+// max. number of messages taken from the socket engine in one event handler call
+#define ENGINE_BATCH 4096
+// the listener is paused for this long after an accept error (ms)
+#define ACCEPT_RETRY_DELAY 100
+// the dumps of the flight recorder on SCTP_COMM_LOST are at least this far apart,
+// the associations lost in between are dumped together (ms)
+#define FLIGHT_RECORDER_DUMP_HOLDOFF 1000
+// the values of SCTP_EXPOSE_POTENTIALLY_FAILED_STATE are an enum of linux/sctp.h,
+// SCTP_PF_EXPOSE_MAX tells if the headers have them
+#if defined(SCTP_EXPOSE_POTENTIALLY_FAILED_STATE) && !defined(SCTP_PF_EXPOSE_MAX)
+#define SCTP_PF_EXPOSE_ENABLE 2
+#endif
 #ifdef SCTP_ADAPTION_LAYER
   #ifdef LKSCTP_1_0_7
     #undef LKSCTP_1_0_7
@@ -74,17 +109,50 @@
 
 namespace SCTPasp__PortType {
 
-struct SCTPasp__PT_PROVIDER::fd_map_item
-{   // used by map operations
-  int fd; // socket descriptor
-  boolean erased;
-  boolean processing_message; // if true only part of the message is received
-  boolean einprogress; // connection establishment is in progress
-  void * buf; // buffer
-  ssize_t buflen; // length of the buffer
-  ssize_t nr; // number of received bytes
-  struct sockaddr_storage sin; // storing remote address
-  socklen_t saLen;
+// the transport of the ports not using usrsctp or the loopback, it has no state
+static KernelTransport kernel_transport;
+// the value of the enabled boolean socket options
+static const int option_on = 1;
+
+struct SCTPasp__PT_PROVIDER::socket_options
+{   // the options set on a socket with their values
+  struct option_t
+  {
+    int level;
+    int name;
+    const char *label;
+    std::vector<unsigned char> value;
+  };
+  std::vector<option_t> options;
+
+  void add(int level, int name, const char *label, const void *value, socklen_t len)
+  {
+    option_t option;
+    option.level = level;
+    option.name = name;
+    option.label = label;
+    option.value.assign((const unsigned char *)value, (const unsigned char *)value + len);
+    options.push_back(option);
+  }
+
+#ifdef SCTP_EVENT
+  void add_event(uint16_t type, bool on)
+  {
+    struct sctp_event event;
+    memset(&event, 0, sizeof (event));
+    event.se_type = type;
+    event.se_on = on;
+    add(IPPROTO_SCTP, SCTP_EVENT, "SCTP_EVENT", &event, sizeof (event));
+  }
+#endif
+};
+
+
+struct SCTPasp__PT_PROVIDER::profile_state
+{
+  std::map<std::string, socket_options> profiles; // by name
+  std::string port_profile; // bound to the whole port, empty if none
+  std::map<unsigned short, std::string> listener_profiles; // bound to the listeners by local port
 };
 
 
@@ -97,6 +165,478 @@ struct SCTPasp__PT_PROVIDER::fd_map_server_item // server item
 };
 
 
+static unsigned long long monotonic_ns()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+
+static uint32_t int2ppid(const INTEGER& ppid)
+{
+  uint32_t ui;
+  if (ppid.get_val().is_native() && ppid > 0)
+    ui = (int)ppid;
+  else {
+    OCTETSTRING os = int2oct(ppid, 4);
+    unsigned char* p = (unsigned char*)&ui;
+    *(p++) = os[3].get_octet();
+    *(p++) = os[2].get_octet();
+    *(p++) = os[1].get_octet();
+    *(p++) = os[0].get_octet();
+  }
+  return ui;
+}
+
+
+static INTEGER ull2int(unsigned long long value)
+{
+  INTEGER ret;
+  ret.set_long_long_val((long long)value);
+  return ret;
+}
+
+
+static void init2initmsg(const SCTPasp__Types::SCTP__INIT& init, struct sctp_initmsg& initmsg)
+{
+  (void) memset(&initmsg, 0, sizeof(struct sctp_initmsg));
+  initmsg.sinit_num_ostreams = (int) init.sinit__num__ostreams();
+  initmsg.sinit_max_instreams = (int) init.sinit__max__instreams();
+  initmsg.sinit_max_attempts = (int) init.sinit__max__attempts();
+  initmsg.sinit_max_init_timeo = (int) init.sinit__max__init__timeo();
+}
+
+
+// 0 disables the heartbeats
+static void set_hbinterval(struct sctp_paddrparams& paddr, long hbinterval)
+{
+  paddr.spp_flags &= ~SPP_HB;
+  paddr.spp_flags |= hbinterval == 0 ? SPP_HB_DISABLE : SPP_HB_ENABLE;
+  paddr.spp_hbinterval = hbinterval;
+}
+
+
+// 0 enables the path MTU discovery, otherwise the MTU is fixed
+static void set_pathmtu(struct sctp_paddrparams& paddr, long pathmtu)
+{
+  paddr.spp_flags &= ~SPP_PMTUD;
+  paddr.spp_flags |= pathmtu == 0 ? SPP_PMTUD_ENABLE : SPP_PMTUD_DISABLE;
+  paddr.spp_pathmtu = pathmtu;
+}
+
+
+// the detection times of -1 are omitted
+static OPTIONAL<INTEGER> optional_time(int ms)
+{
+  if (ms < 0) return OPTIONAL<INTEGER>(OMIT_VALUE);
+  return OPTIONAL<INTEGER>(INTEGER(ms));
+}
+
+
+static void events2subscribe(const SCTPasp__Types::SCTP__EVENTS& event, struct sctp_event_subscribe& events)
+{
+  events.sctp_data_io_event = (boolean) event.sctp__data__io__event();
+  events.sctp_association_event = (boolean) event.sctp__association__event();
+  events.sctp_address_event = (boolean) event.sctp__address__event();
+  events.sctp_send_failure_event = (boolean) event.sctp__send__failure__event();
+  events.sctp_peer_error_event = (boolean) event.sctp__peer__error__event();
+  events.sctp_shutdown_event = (boolean) event.sctp__shutdown__event();
+  events.sctp_partial_delivery_event = (boolean) event.sctp__partial__delivery__event();
+#if defined(LKSCTP_1_0_7) || defined(LKSCTP_1_0_9)
+  events.sctp_adaptation_layer_event = (boolean) event.sctp__adaption__layer__event();
+#else
+  events.sctp_adaption_layer_event = (boolean) event.sctp__adaption__layer__event();
+#endif
+}
+
+
+struct SCTPasp__PT_PROVIDER::rtt_correlator
+{   // matches outgoing requests and incoming responses by a key taken from the payload
+  struct key_config
+  {
+    uint32_t ppid;
+    int offset;
+    int length;
+  };
+  struct rtt_key
+  {
+    int fd;
+    uint32_t ppid;
+    int length;
+    unsigned char bytes[RTT_KEY_MAXLEN];
+    bool operator==(const rtt_key& other) const
+    {
+      return fd == other.fd && ppid == other.ppid && length == other.length &&
+        memcmp(bytes, other.bytes, length) == 0;
+    }
+  };
+  struct key_hash
+  {
+    size_t operator()(const rtt_key& key) const
+    { // FNV-1a
+      size_t h = 2166136261U;
+      h = (h ^ (unsigned)key.fd) * 16777619U;
+      h = (h ^ key.ppid) * 16777619U;
+      for (int i = 0; i < key.length; i++) h = (h ^ key.bytes[i]) * 16777619U;
+      return h;
+    }
+  };
+  struct expiry_item
+  {
+    unsigned long long sent; // expires at sent + timeout_ns
+    rtt_key key;
+  };
+  struct stats_t
+  {
+    unsigned long long requests;
+    unsigned long long responses;
+    unsigned long long timeouts;
+    unsigned long long unmatched;
+    unsigned long long min_ns;
+    unsigned long long max_ns;
+    unsigned long long sum_ns;
+    unsigned long long histogram[RTT_HISTOGRAM_BUCKETS];
+  };
+
+  std::vector<key_config> keys;
+  unsigned long long timeout_ns;
+  std::unordered_map<rtt_key, unsigned long long, key_hash> pending; // key -> time of sending
+  std::deque<expiry_item> expiry; // ordered by the time of sending, so by the deadline even if the timeout changes
+  std::map<int, stats_t> stats; // indexed by client_id
+
+  stats_t& get_stats(int fd)
+  {
+    std::map<int, stats_t>::iterator it = stats.find(fd);
+    if (it == stats.end())
+    {
+      stats_t st;
+      memset(&st, 0, sizeof(st));
+      st.min_ns = ~0ULL;
+      it = stats.insert(std::make_pair(fd, st)).first;
+    }
+    return it->second;
+  }
+
+  bool make_key(int fd, uint32_t ppid, const unsigned char *data, int len, rtt_key& key) const
+  {
+    for (size_t i = 0; i < keys.size(); i++)
+    {
+      if (keys[i].ppid != ppid) continue;
+      if (keys[i].offset + keys[i].length > len) return false;
+      memset(&key, 0, sizeof(key));
+      key.fd = fd;
+      key.ppid = ppid;
+      key.length = keys[i].length;
+      memcpy(key.bytes, data + keys[i].offset, keys[i].length);
+      return true;
+    }
+    return false;
+  }
+
+  void expire(unsigned long long now)
+  {
+    while (!expiry.empty() && expiry.front().sent + timeout_ns <= now)
+    {
+      const expiry_item& item = expiry.front();
+      std::unordered_map<rtt_key, unsigned long long, key_hash>::iterator it = pending.find(item.key);
+      // the key may have been answered or reused by a later request in the meantime
+      if (it != pending.end() && it->second == item.sent)
+      {
+        get_stats(item.key.fd).timeouts++;
+        pending.erase(it);
+      }
+      expiry.pop_front();
+    }
+  }
+
+  void request(int fd, uint32_t ppid, const unsigned char *data, int len)
+  {
+    rtt_key key;
+    if (!make_key(fd, ppid, data, len, key)) return;
+    unsigned long long now = monotonic_ns();
+    expire(now);
+    pending[key] = now;
+    expiry_item item;
+    item.sent = now;
+    item.key = key;
+    expiry.push_back(item);
+    get_stats(fd).requests++;
+  }
+
+  void response(int fd, uint32_t ppid, const unsigned char *data, int len)
+  {
+    rtt_key key;
+    if (!make_key(fd, ppid, data, len, key)) return;
+    unsigned long long now = monotonic_ns();
+    expire(now);
+    stats_t& st = get_stats(fd);
+    std::unordered_map<rtt_key, unsigned long long, key_hash>::iterator it = pending.find(key);
+    if (it == pending.end())
+    {
+      st.unmatched++;
+      return;
+    }
+    unsigned long long rtt_ns = now - it->second;
+    pending.erase(it);
+    st.responses++;
+    st.sum_ns += rtt_ns;
+    if (rtt_ns < st.min_ns) st.min_ns = rtt_ns;
+    if (rtt_ns > st.max_ns) st.max_ns = rtt_ns;
+    // bucket 0: below 1 us, bucket n: [2^(n-1), 2^n) us, the last one is open
+    unsigned long long us = rtt_ns / 1000;
+    int bucket = us ? 64 - __builtin_clzll(us) : 0;
+    if (bucket >= RTT_HISTOGRAM_BUCKETS) bucket = RTT_HISTOGRAM_BUCKETS - 1;
+    st.histogram[bucket]++;
+  }
+
+  void clear()
+  {
+    pending.clear();
+    expiry.clear();
+  }
+
+  // drops the statistics and the pending requests of a closed association,
+  // its client_id may be reused by a new one
+  void release(int fd)
+  {
+    stats.erase(fd);
+    std::unordered_map<rtt_key, unsigned long long, key_hash>::iterator it = pending.begin();
+    while (it != pending.end())
+    {
+      if (it->first.fd == fd) it = pending.erase(it);
+      else ++it;
+    }
+  }
+};
+
+
+struct SCTPasp__PT_PROVIDER::replay_state
+{
+  ReplayFile file;
+  std::vector<int> targets; // client_ids, indexed by the association number of the capture
+  double speed; // 0: as fast as possible
+  int loops; // 0: infinite
+  int loops_done;
+  size_t pos; // next message to send
+  unsigned long long start; // monotonic time of the first message of the current loop
+  unsigned long long late_threshold;
+  unsigned long long sent;
+  unsigned long long late;
+  unsigned long long dropped;
+
+  unsigned long long due(size_t i) const
+  {
+    uint64_t first = file[0].timestamp;
+    uint64_t offset = file[i].timestamp > first ? file[i].timestamp - first : 0;
+    return speed > 0 ? start + (unsigned long long)(offset / speed) : start;
+  }
+};
+
+
+struct SCTPasp__PT_PROVIDER::generator_state
+{
+  struct patch_t
+  {
+    size_t offset;
+    size_t length;
+    unsigned long long value; // the value written into the next message
+    unsigned long long increment;
+  };
+  struct template_t
+  {
+    unsigned int stream;
+    uint32_t ppid;
+    std::vector<unsigned char> data; // patched in place before sending
+    std::vector<patch_t> patches;
+  };
+  std::vector<template_t> templates;
+  std::vector<int> targets;
+  double rate; // messages per second, 0: as fast as possible
+  unsigned long long outstanding; // closed-loop mode if not 0
+  unsigned long long count; // 0: until stopped
+  unsigned long long deadline; // monotonic time of the end, 0: until stopped
+  unsigned long long start;
+  unsigned long long next; // number of the next message
+  unsigned long long sent;
+  unsigned long long errors;
+  unsigned long long responses;
+  unsigned long long unanswered; // requests of the closed associations without a response
+  unsigned long long in_flight;
+  std::map<int, unsigned long long> pending; // the requests in flight by client_id
+
+  unsigned long long due(unsigned long long n) const
+  {
+    return rate > 0 ? start + (unsigned long long)(n * 1e9 / rate) : start;
+  }
+
+  // a response is received on an association with requests in flight, on the
+  // stream and with the ppid of a template
+  bool response(int fd, unsigned int stream, uint32_t ppid)
+  {
+    std::map<int, unsigned long long>::iterator it = pending.find(fd);
+    if (it == pending.end() || it->second == 0) return false;
+    size_t i = 0;
+    while (i < templates.size() && (templates[i].stream != stream || templates[i].ppid != ppid)) i++;
+    if (i == templates.size()) return false;
+    it->second--;
+    in_flight--;
+    responses++;
+    return true;
+  }
+
+  // the requests in flight on a closed association are not answered any more
+  void release(int fd)
+  {
+    std::map<int, unsigned long long>::iterator it = pending.find(fd);
+    if (it == pending.end()) return;
+    unanswered += it->second;
+    in_flight -= it->second;
+    pending.erase(it);
+  }
+};
+
+
+struct SCTPasp__PT_PROVIDER::reflector_state
+{
+  struct copy_t
+  {
+    size_t src_offset;
+    size_t dst_offset;
+    size_t length;
+  };
+  struct rule_t
+  {
+    int stream; // -1: any
+    long long ppid; // -1: any
+    int response_stream; // -1: the stream of the request
+    long long response_ppid; // -1: the PPID of the request
+    boolean echo; // the request is sent back, response and copies are not used
+    std::vector<unsigned char> response; // as configured, never patched
+    std::vector<unsigned char> reply; // the response patched by the copies for the current request
+    std::vector<copy_t> copies;
+  };
+  std::vector<rule_t> rules;
+  boolean all_associations;
+  boolean forward_unmatched;
+  unsigned long long sample_interval; // every nth reflected message is forwarded, 0: none
+  unsigned long long reflected;
+  unsigned long long errors;
+  unsigned long long forwarded;
+};
+
+
+struct SCTPasp__PT_PROVIDER::filter_state
+{
+  struct mask_t
+  {
+    size_t offset;
+    std::vector<unsigned char> value; // pre-masked
+    std::vector<unsigned char> mask;
+  };
+  struct filter_t
+  {
+    int client_id; // -1: any
+    int stream; // -1: any
+    long long ppid; // -1: any
+    std::vector<mask_t> masks;
+    SCTPasp__Types::SCTP__FILTER__ACTION::enum_type action;
+    unsigned long long sample_interval;
+    unsigned long long matched;
+    unsigned long long delivered;
+    unsigned long long dropped;
+  };
+  std::vector<filter_t> filters;
+  unsigned long long unmatched;
+};
+
+
+struct SCTPasp__PT_PROVIDER::coalesce_state
+{
+  struct window_t
+  {
+    unsigned long long deadline; // end of the window
+    int repeats; // number of the suppressed notifications
+    SCTPasp__Types::SPC__STATE::enum_type state; // state of the last suppressed notification
+  };
+  std::map<int, window_t> windows; // indexed by client_id
+};
+
+
+// The admission control of the accepted associations. The listeners are
+// identified by their local port.
+struct SCTPasp__PT_PROVIDER::admission_state
+{
+  struct listener_t
+  {
+    int associations; // the accepted associations still open
+    int paused_by; // SCTP_OVERLOAD_REASON the listening sockets are not watched for, -1 if they are
+    std::vector<int> paused_fds; // the listening sockets removed from the event handler
+    boolean overloaded; // the overload is reported and has not ended yet
+    int reason; // SCTP_OVERLOAD_REASON of the overload
+    int refused; // the associations aborted in the overload
+  };
+  std::map<unsigned short, listener_t> listeners;
+  TokenBucket bucket; // of accept_rate, it holds the accepts of one second
+  listener_t& listener(unsigned short port)
+  {
+    std::map<unsigned short, listener_t>::iterator it = listeners.find(port);
+    if (it != listeners.end()) return it->second;
+    listener_t& l = listeners[port];
+    l.associations = 0;
+    l.paused_by = -1;
+    l.overloaded = FALSE;
+    l.reason = 0;
+    l.refused = 0;
+    return l;
+  }
+};
+
+
+// The token buckets of ASP_SCTP_Rate_Config. A limit applies to an association
+// and stream, the -1 of the keys stands for any; each association gets its own
+// bucket of the limit.
+struct SCTPasp__PT_PROVIDER::rate_state
+{
+  typedef std::pair<int, int> rate_key; // client_id and sinfo_stream
+  struct limit_t
+  {
+    double rate; // messages per second
+    double burst; // size of the bucket
+    boolean reject; // the messages over the rate are rejected instead of queued
+    size_t queue_limit; // 0: no limit
+  };
+  struct bucket_t
+  {
+    rate_key limit; // the key of the limit of the bucket
+    TokenBucket bucket;
+    std::deque<SCTPasp__Types::ASP__SCTP> queue;
+    unsigned long long sent, delayed, rejected;
+  };
+  std::map<rate_key, limit_t> limits;
+  std::map<rate_key, bucket_t> buckets; // by client_id and the stream of the limit
+  std::set<rate_key> backlog; // the buckets with queued messages
+
+  // the most specific limit of the message, limits.end() if there is none
+  std::map<rate_key, limit_t>::iterator find_limit(int client_id, int stream)
+  {
+    std::map<rate_key, limit_t>::iterator it;
+    if ((it = limits.find(rate_key(client_id, stream))) != limits.end()) return it;
+    if ((it = limits.find(rate_key(client_id, -1))) != limits.end()) return it;
+    if ((it = limits.find(rate_key(-1, stream))) != limits.end()) return it;
+    return limits.find(rate_key(-1, -1));
+  }
+};
+
+
+// The connects in progress ordered by their deadline. The entries of the
+// connects finished in time are dropped when their deadline is reached.
+struct SCTPasp__PT_PROVIDER::connect_timers
+{
+  std::multimap<unsigned long long, int> pending; // deadline -> client_id
+};
+
+
 SCTPasp__PT_PROVIDER::SCTPasp__PT_PROVIDER(const char *par_port_name)
   : PORT(par_port_name)
 {
@@ -105,6 +645,8 @@ SCTPasp__PT_PROVIDER::SCTPasp__PT_PROVIDER(const char *par_port_name)
   reconnect_max_attempts = 6;
   server_mode = FALSE;
   debug = FALSE;
+  rx_timestamp = FALSE;
+  lean_mode = FALSE;
   server_backlog = 1;
   local_IP_address = "0.0.0.0";
   (void) memset(&initmsg, 0, sizeof(struct sctp_initmsg));
@@ -125,13 +667,29 @@ SCTPasp__PT_PROVIDER::SCTPasp__PT_PROVIDER(const char *par_port_name)
 #else
   events.sctp_adaption_layer_event = TRUE;
 #endif
+  sender_dry_event = FALSE;
+  stream_reset_event = FALSE;
+  assoc_reset_event = FALSE;
+#ifdef SCTP_EVENT
+  sctp_event_supported = TRUE;
+#else
+  sctp_event_supported = FALSE;
+#endif
+#ifdef SCTP_SEND_FAILED_EVENT
+  send_failed_event_supported = TRUE;
+#else
+  send_failed_event_supported = FALSE;
+#endif
+  socket_template = new socket_options;
+  (void) memset(&paddrparams, 0, sizeof (paddrparams));
+  (void) memset(&assocparams, 0, sizeof (assocparams));
+  pf_threshold = -1;
+  failure_detection = new socket_options;
+  profiles = NULL;
   local_port_is_present = FALSE;
   peer_IP_address_is_present = FALSE;
   peer_port_is_present = FALSE;
 
-  fd_map=NULL;
-  list_len=0;
-
   fd_map_server=NULL;
   list_len_server=0;
 
@@ -139,19 +697,92 @@ SCTPasp__PT_PROVIDER::SCTPasp__PT_PROVIDER(const char *par_port_name)
   local_port=-1;
   peer_port=-1;
   receiving_fd=-1;
+
+  rtt = NULL;
+  rtt_timeout = 5000;
+
+  flight_recorder = NULL;
+  flight_recorder_dump_on_comm_lost = TRUE;
+  flight_recorder_dumped = 0;
+
+  capture = NULL;
+  capture_queue_size = 65536;
+
+  timer_fd = -1;
+  memset(timer_deadline, 0, sizeof(timer_deadline));
+  timer_dispatching = FALSE;
+  replay = NULL;
+  generator = NULL;
+  reflector = NULL;
+  filters = NULL;
+
+  bundle_max_count = 0;
+  bundle_max_delay = 0;
+  bundle = NULL_VALUE;
+  bundle_first = 0;
+
+  coalesce_window = 0;
+  coalesce = NULL;
+
+  connect_timeout = 0;
+  connect_deadlines = NULL;
+
+  max_associations = 0;
+  max_listener_associations = 0;
+  accept_rate = 0;
+  overload_pause = FALSE;
+  admission = NULL;
+
+  rate_limits = NULL;
+
+  engine = NULL;
+  io_thread_enabled = FALSE;
+  io_thread_cpu = -1;
+  io_thread_queue_size = 1024;
+  io_uring_enabled = FALSE;
+  io_uring_entries = 256;
+  io_seq = 0;
+
+  transport = &kernel_transport;
+  usrsctp_enabled = FALSE;
+  usrsctp_udp_port = 9899;
+  usrsctp_remote_udp_port = 9899;
+  loopback_enabled = FALSE;
+  loopback_ring_size = 262144;
 }
 
 
 SCTPasp__PT_PROVIDER::~SCTPasp__PT_PROVIDER()
 {
-  for(int i=0;i<list_len;i++) map_delete_item(i);
-  Free(fd_map);
+  delete rate_limits; // nothing is echoed back from the destructor
+  rate_limits = NULL;
+  for(int i=0;i<fd_map.size();i++) map_delete_item(i);
 
   if(!simple_mode)
   {
   for(int i=0;i<list_len_server;i++) map_delete_item_server(i);
   Free(fd_map_server);
   }
+  delete rtt;
+  delete flight_recorder;
+  delete capture;
+  delete replay;
+  delete generator;
+  delete reflector;
+  delete filters;
+  delete coalesce;
+  delete connect_deadlines;
+  delete admission;
+  delete socket_template;
+  delete failure_detection;
+  delete profiles;
+  if (timer_fd != -1) close(timer_fd);
+  if (engine)
+  {
+    engine->stop();
+    delete engine;
+  }
+  transport = &kernel_transport;
 }
 
 
@@ -208,115 +839,329 @@ void SCTPasp__PT_PROVIDER::set_parameter(const char *parameter_name,
     error("set_parameter(): Invalid parameter value: %s for parameter %s. Only yes and no can be used!" ,
     parameter_value, parameter_name);
   }
-  else if(strcmp(parameter_name, "server_backlog") == 0)
+  else if(strcmp(parameter_name, "lean_mode") == 0)
+  {
+  if (strcasecmp(parameter_value,"yes") == 0)
+    lean_mode = TRUE;
+  else if(strcasecmp(parameter_value,"no") == 0)
+    lean_mode = FALSE;
+  else
+    error("set_parameter(): Invalid parameter value: %s for parameter %s. Only yes and no can be used!" ,
+    parameter_value, parameter_name);
+  }
+  else if(strcmp(parameter_name, "notification_coalesce_window") == 0)
   {
   int value;
   if ( (sscanf(parameter_value, "%d", &value) == 1) && (value>=0) )
-    server_backlog = value;
+    coalesce_window = value;
   else
     error("set_parameter(): Invalid parameter value: %s for parameter %s. It should be positive integer!" ,
     parameter_value, parameter_name);
   }
-  else if(strcmp(parameter_name, "local_IP_address") == 0)
-  {
-    local_IP_address =  parameter_value;
-  }
-  else if(strcmp(parameter_name, "local_port") == 0)
-  {
-  unsigned short value;
-  if (sscanf(parameter_value, "%hu", &value) == 1)
+  else if(strcmp(parameter_name, "connect_timeout") == 0)
   {
-    local_port = value;
-    local_port_is_present = TRUE;
-  }
+  int value;
+  if ( (sscanf(parameter_value, "%d", &value) == 1) && (value>=0) )
+    connect_timeout = value;
   else
     error("set_parameter(): Invalid parameter value: %s for parameter %s. It should be positive integer!" ,
     parameter_value, parameter_name);
   }
-  else if(strcmp(parameter_name, "peer_IP_address") == 0)
-  {
-  peer_IP_address = parameter_value;
-  peer_IP_address_is_present = TRUE;
-  }
-  else if(strcmp(parameter_name, "peer_port") == 0)
+  else if(strcmp(parameter_name, "max_associations") == 0)
   {
-  unsigned short value;
-  if (sscanf(parameter_value, "%hu", &value) == 1)
-  {
-    peer_port = value;
-    peer_port_is_present = TRUE;
-  }
+  int value;
+  if ( (sscanf(parameter_value, "%d", &value) == 1) && (value>=0) )
+    max_associations = value;
   else
     error("set_parameter(): Invalid parameter value: %s for parameter %s. It should be positive integer!" ,
     parameter_value, parameter_name);
   }
-  else if(strcmp(parameter_name, "sinit_num_ostreams") == 0)
+  else if(strcmp(parameter_name, "max_listener_associations") == 0)
   {
-  long value;
-  if ( (sscanf(parameter_value, "%ld", &value) == 1) && (value>=0) )
-    initmsg.sinit_num_ostreams = value;
+  int value;
+  if ( (sscanf(parameter_value, "%d", &value) == 1) && (value>=0) )
+    max_listener_associations = value;
   else
     error("set_parameter(): Invalid parameter value: %s for parameter %s. It should be positive integer!" ,
     parameter_value, parameter_name);
   }
-  else if(strcmp(parameter_name, "sinit_max_instreams") == 0)
+  else if(strcmp(parameter_name, "accept_rate") == 0)
   {
-  long value;
-  if ( (sscanf(parameter_value, "%ld", &value) == 1) && (value>=0) )
-    initmsg.sinit_max_instreams = value;
+  int value;
+  if ( (sscanf(parameter_value, "%d", &value) == 1) && (value>=0) )
+    accept_rate = value;
   else
     error("set_parameter(): Invalid parameter value: %s for parameter %s. It should be positive integer!" ,
     parameter_value, parameter_name);
   }
-  else if(strcmp(parameter_name, "sinit_max_attempts") == 0)
+  else if(strcmp(parameter_name, "overload_action") == 0)
   {
-  long value;
-  if ( (sscanf(parameter_value, "%ld", &value) == 1) && (value>=0) )
-    initmsg.sinit_max_attempts = value;
+  if (strcasecmp(parameter_value,"abort") == 0)
+    overload_pause = FALSE;
+  else if(strcasecmp(parameter_value,"pause") == 0)
+    overload_pause = TRUE;
   else
-    error("set_parameter(): Invalid parameter value: %s for parameter %s. It should be positive integer!" ,
+    error("set_parameter(): Invalid parameter value: %s for parameter %s. Only abort and pause can be used!" ,
     parameter_value, parameter_name);
   }
-  else if(strcmp(parameter_name, "sinit_max_init_timeo") == 0)
+  else if(strcmp(parameter_name, "io_thread") == 0)
   {
-  long value;
-  if ( (sscanf(parameter_value, "%ld", &value) == 1) && (value>=0) )
-    initmsg.sinit_max_init_timeo = value;
+  if (strcasecmp(parameter_value,"yes") == 0)
+    io_thread_enabled = TRUE;
+  else if(strcasecmp(parameter_value,"no") == 0)
+    io_thread_enabled = FALSE;
   else
-    error("set_parameter(): Invalid parameter value: %s for parameter %s. It should be positive integer!" ,
+    error("set_parameter(): Invalid parameter value: %s for parameter %s. Only yes and no can be used!" ,
     parameter_value, parameter_name);
   }
-  else if(strcmp(parameter_name, "sctp_association_event") == 0)
+  else if(strcmp(parameter_name, "io_thread_cpu") == 0)
   {
-  if (strcasecmp(parameter_value,"enabled") == 0)
-    events.sctp_association_event = TRUE;
-  else if(strcasecmp(parameter_value,"disabled") == 0)
-    events.sctp_association_event = FALSE;
+  int value;
+  if ( (sscanf(parameter_value, "%d", &value) == 1) && (value>=0) )
+    io_thread_cpu = value;
   else
-    error("set_parameter(): Invalid parameter value: %s for parameter %s. It should be enabled or disabled!" ,
+    error("set_parameter(): Invalid parameter value: %s for parameter %s. It should be positive integer!" ,
     parameter_value, parameter_name);
   }
-  else if(strcmp(parameter_name, "sctp_address_event") == 0)
+  else if(strcmp(parameter_name, "io_thread_queue_size") == 0)
   {
-  if (strcasecmp(parameter_value,"enabled") == 0)
-    events.sctp_address_event = TRUE;
-  else if(strcasecmp(parameter_value,"disabled") == 0)
-    events.sctp_address_event = FALSE;
+  int value;
+  if ( (sscanf(parameter_value, "%d", &value) == 1) && (value>0) )
+    io_thread_queue_size = value;
   else
-    error("set_parameter(): Invalid parameter value: %s for parameter %s. It should be enabled or disabled!" ,
+    error("set_parameter(): Invalid parameter value: %s for parameter %s. It should be positive integer!" ,
     parameter_value, parameter_name);
   }
-  else if(strcmp(parameter_name, "sctp_send_failure_event") == 0)
+  else if(strcmp(parameter_name, "io_uring") == 0)
   {
-  if (strcasecmp(parameter_value,"enabled") == 0)
-    events.sctp_send_failure_event = TRUE;
-  else if(strcasecmp(parameter_value,"disabled") == 0)
-    events.sctp_send_failure_event = FALSE;
+  if (strcasecmp(parameter_value,"yes") == 0)
+    io_uring_enabled = TRUE;
+  else if(strcasecmp(parameter_value,"no") == 0)
+    io_uring_enabled = FALSE;
   else
-    error("set_parameter(): Invalid parameter value: %s for parameter %s. It should be enabled or disabled!" ,
+    error("set_parameter(): Invalid parameter value: %s for parameter %s. Only yes and no can be used!" ,
     parameter_value, parameter_name);
   }
-  else if(strcmp(parameter_name, "sctp_peer_error_event") == 0)
+  else if(strcmp(parameter_name, "io_uring_entries") == 0)
+  {
+  int value;
+  if ( (sscanf(parameter_value, "%d", &value) == 1) && (value>0) )
+    io_uring_entries = value;
+  else
+    error("set_parameter(): Invalid parameter value: %s for parameter %s. It should be positive integer!" ,
+    parameter_value, parameter_name);
+  }
+  else if(strcmp(parameter_name, "usrsctp") == 0)
+  {
+  if (strcasecmp(parameter_value,"yes") == 0)
+    usrsctp_enabled = TRUE;
+  else if(strcasecmp(parameter_value,"no") == 0)
+    usrsctp_enabled = FALSE;
+  else
+    error("set_parameter(): Invalid parameter value: %s for parameter %s. Only yes and no can be used!" ,
+    parameter_value, parameter_name);
+  }
+  else if(strcmp(parameter_name, "usrsctp_udp_port") == 0)
+  {
+  int value;
+  if ( (sscanf(parameter_value, "%d", &value) == 1) && (value>=0) && (value<=65535) )
+    usrsctp_udp_port = value;
+  else
+    error("set_parameter(): Invalid parameter value: %s for parameter %s. It should be a port number!" ,
+    parameter_value, parameter_name);
+  }
+  else if(strcmp(parameter_name, "usrsctp_remote_udp_port") == 0)
+  {
+  int value;
+  if ( (sscanf(parameter_value, "%d", &value) == 1) && (value>=0) && (value<=65535) )
+    usrsctp_remote_udp_port = value;
+  else
+    error("set_parameter(): Invalid parameter value: %s for parameter %s. It should be a port number!" ,
+    parameter_value, parameter_name);
+  }
+  else if(strcmp(parameter_name, "loopback") == 0)
+  {
+  if (strcasecmp(parameter_value,"yes") == 0)
+    loopback_enabled = TRUE;
+  else if(strcasecmp(parameter_value,"no") == 0)
+    loopback_enabled = FALSE;
+  else
+    error("set_parameter(): Invalid parameter value: %s for parameter %s. Only yes and no can be used!" ,
+    parameter_value, parameter_name);
+  }
+  else if(strcmp(parameter_name, "loopback_ring_size") == 0)
+  {
+  int value;
+  if ( (sscanf(parameter_value, "%d", &value) == 1) && (value>0) )
+    loopback_ring_size = value;
+  else
+    error("set_parameter(): Invalid parameter value: %s for parameter %s. It should be positive integer!" ,
+    parameter_value, parameter_name);
+  }
+  else if(strcmp(parameter_name, "rx_timestamp") == 0)
+  {
+  if (strcasecmp(parameter_value,"yes") == 0)
+    rx_timestamp = TRUE;
+  else if(strcasecmp(parameter_value,"no") == 0)
+    rx_timestamp = FALSE;
+  else
+    error("set_parameter(): Invalid parameter value: %s for parameter %s. Only yes and no can be used!" ,
+    parameter_value, parameter_name);
+  }
+  else if(strcmp(parameter_name, "server_backlog") == 0)
+  {
+  int value;
+  if ( (sscanf(parameter_value, "%d", &value) == 1) && (value>=0) )
+    server_backlog = value;
+  else
+    error("set_parameter(): Invalid parameter value: %s for parameter %s. It should be positive integer!" ,
+    parameter_value, parameter_name);
+  }
+  else if(strcmp(parameter_name, "local_IP_address") == 0)
+  {
+    local_IP_address =  parameter_value;
+  }
+  else if(strcmp(parameter_name, "local_port") == 0)
+  {
+  unsigned short value;
+  if (sscanf(parameter_value, "%hu", &value) == 1)
+  {
+    local_port = value;
+    local_port_is_present = TRUE;
+  }
+  else
+    error("set_parameter(): Invalid parameter value: %s for parameter %s. It should be positive integer!" ,
+    parameter_value, parameter_name);
+  }
+  else if(strcmp(parameter_name, "peer_IP_address") == 0)
+  {
+  peer_IP_address = parameter_value;
+  peer_IP_address_is_present = TRUE;
+  }
+  else if(strcmp(parameter_name, "peer_port") == 0)
+  {
+  unsigned short value;
+  if (sscanf(parameter_value, "%hu", &value) == 1)
+  {
+    peer_port = value;
+    peer_port_is_present = TRUE;
+  }
+  else
+    error("set_parameter(): Invalid parameter value: %s for parameter %s. It should be positive integer!" ,
+    parameter_value, parameter_name);
+  }
+  else if(strcmp(parameter_name, "sinit_num_ostreams") == 0)
+  {
+  long value;
+  if ( (sscanf(parameter_value, "%ld", &value) == 1) && (value>=0) )
+    initmsg.sinit_num_ostreams = value;
+  else
+    error("set_parameter(): Invalid parameter value: %s for parameter %s. It should be positive integer!" ,
+    parameter_value, parameter_name);
+  }
+  else if(strcmp(parameter_name, "sinit_max_instreams") == 0)
+  {
+  long value;
+  if ( (sscanf(parameter_value, "%ld", &value) == 1) && (value>=0) )
+    initmsg.sinit_max_instreams = value;
+  else
+    error("set_parameter(): Invalid parameter value: %s for parameter %s. It should be positive integer!" ,
+    parameter_value, parameter_name);
+  }
+  else if(strcmp(parameter_name, "sinit_max_attempts") == 0)
+  {
+  long value;
+  if ( (sscanf(parameter_value, "%ld", &value) == 1) && (value>=0) )
+    initmsg.sinit_max_attempts = value;
+  else
+    error("set_parameter(): Invalid parameter value: %s for parameter %s. It should be positive integer!" ,
+    parameter_value, parameter_name);
+  }
+  else if(strcmp(parameter_name, "sinit_max_init_timeo") == 0)
+  {
+  long value;
+  if ( (sscanf(parameter_value, "%ld", &value) == 1) && (value>=0) )
+    initmsg.sinit_max_init_timeo = value;
+  else
+    error("set_parameter(): Invalid parameter value: %s for parameter %s. It should be positive integer!" ,
+    parameter_value, parameter_name);
+  }
+  else if(strcmp(parameter_name, "spp_hbinterval") == 0)
+  {
+  long value;
+  if ( (sscanf(parameter_value, "%ld", &value) == 1) && (value>=0) )
+    set_hbinterval(paddrparams, value);
+  else
+    error("set_parameter(): Invalid parameter value: %s for parameter %s. It should be positive integer!" ,
+    parameter_value, parameter_name);
+  }
+  else if(strcmp(parameter_name, "spp_pathmaxrxt") == 0)
+  {
+  long value;
+  if ( (sscanf(parameter_value, "%ld", &value) == 1) && (value>0) && (value<=65535) )
+    paddrparams.spp_pathmaxrxt = value;
+  else
+    error("set_parameter(): Invalid parameter value: %s for parameter %s. It should be positive integer!" ,
+    parameter_value, parameter_name);
+  }
+  else if(strcmp(parameter_name, "spp_pathmtu") == 0)
+  {
+  long value;
+  if ( (sscanf(parameter_value, "%ld", &value) == 1) && (value>=0) )
+    set_pathmtu(paddrparams, value);
+  else
+    error("set_parameter(): Invalid parameter value: %s for parameter %s. It should be positive integer!" ,
+    parameter_value, parameter_name);
+  }
+  else if(strcmp(parameter_name, "sasoc_asocmaxrxt") == 0)
+  {
+  long value;
+  if ( (sscanf(parameter_value, "%ld", &value) == 1) && (value>0) && (value<=65535) )
+    assocparams.sasoc_asocmaxrxt = value;
+  else
+    error("set_parameter(): Invalid parameter value: %s for parameter %s. It should be positive integer!" ,
+    parameter_value, parameter_name);
+  }
+  else if(strcmp(parameter_name, "spt_pathpfthld") == 0)
+  {
+  long value;
+  if ( (sscanf(parameter_value, "%ld", &value) == 1) && (value>=0) && (value<=65535) )
+    pf_threshold = value;
+  else
+    error("set_parameter(): Invalid parameter value: %s for parameter %s. It should be positive integer!" ,
+    parameter_value, parameter_name);
+  }
+  else if(strcmp(parameter_name, "sctp_association_event") == 0)
+  {
+  if (strcasecmp(parameter_value,"enabled") == 0)
+    events.sctp_association_event = TRUE;
+  else if(strcasecmp(parameter_value,"disabled") == 0)
+    events.sctp_association_event = FALSE;
+  else
+    error("set_parameter(): Invalid parameter value: %s for parameter %s. It should be enabled or disabled!" ,
+    parameter_value, parameter_name);
+  }
+  else if(strcmp(parameter_name, "sctp_address_event") == 0)
+  {
+  if (strcasecmp(parameter_value,"enabled") == 0)
+    events.sctp_address_event = TRUE;
+  else if(strcasecmp(parameter_value,"disabled") == 0)
+    events.sctp_address_event = FALSE;
+  else
+    error("set_parameter(): Invalid parameter value: %s for parameter %s. It should be enabled or disabled!" ,
+    parameter_value, parameter_name);
+  }
+  else if(strcmp(parameter_name, "sctp_send_failure_event") == 0)
+  {
+  if (strcasecmp(parameter_value,"enabled") == 0)
+    events.sctp_send_failure_event = TRUE;
+  else if(strcasecmp(parameter_value,"disabled") == 0)
+    events.sctp_send_failure_event = FALSE;
+  else
+    error("set_parameter(): Invalid parameter value: %s for parameter %s. It should be enabled or disabled!" ,
+    parameter_value, parameter_name);
+  }
+  else if(strcmp(parameter_name, "sctp_peer_error_event") == 0)
   {
   if (strcasecmp(parameter_value,"enabled") == 0)
     events.sctp_peer_error_event = TRUE;
@@ -364,6 +1209,109 @@ void SCTPasp__PT_PROVIDER::set_parameter(const char *parameter_name,
     error("set_parameter(): Invalid parameter value: %s for parameter %s. It should be enabled or disabled!" ,
     parameter_value, parameter_name);
   }
+  else if(strcmp(parameter_name, "sctp_sender_dry_event") == 0)
+  {
+  if (strcasecmp(parameter_value,"enabled") == 0)
+    sender_dry_event = TRUE;
+  else if(strcasecmp(parameter_value,"disabled") == 0)
+    sender_dry_event = FALSE;
+  else
+    error("set_parameter(): Invalid parameter value: %s for parameter %s. It should be enabled or disabled!" ,
+    parameter_value, parameter_name);
+  }
+  else if(strcmp(parameter_name, "sctp_stream_reset_event") == 0)
+  {
+  if (strcasecmp(parameter_value,"enabled") == 0)
+    stream_reset_event = TRUE;
+  else if(strcasecmp(parameter_value,"disabled") == 0)
+    stream_reset_event = FALSE;
+  else
+    error("set_parameter(): Invalid parameter value: %s for parameter %s. It should be enabled or disabled!" ,
+    parameter_value, parameter_name);
+  }
+  else if(strcmp(parameter_name, "sctp_assoc_reset_event") == 0)
+  {
+  if (strcasecmp(parameter_value,"enabled") == 0)
+    assoc_reset_event = TRUE;
+  else if(strcasecmp(parameter_value,"disabled") == 0)
+    assoc_reset_event = FALSE;
+  else
+    error("set_parameter(): Invalid parameter value: %s for parameter %s. It should be enabled or disabled!" ,
+    parameter_value, parameter_name);
+  }
+  else if(strcmp(parameter_name, "rtt_correlator") == 0)
+  {
+    rtt_set_keys(parameter_value);
+  }
+  else if(strcmp(parameter_name, "rtt_timeout") == 0)
+  {
+  int value;
+  if ( (sscanf(parameter_value, "%d", &value) == 1) && (value>0) )
+  {
+    rtt_timeout = value;
+    if (rtt) rtt->timeout_ns = value * 1000000ULL;
+  }
+  else
+    error("set_parameter(): Invalid parameter value: %s for parameter %s. It should be positive integer!" ,
+    parameter_value, parameter_name);
+  }
+  else if(strcmp(parameter_name, "flight_recorder_size") == 0)
+  {
+  int value;
+  if ( (sscanf(parameter_value, "%d", &value) == 1) && (value>=0) )
+  {
+    delete flight_recorder;
+    flight_recorder = value > 0 ? new FlightRecorder(value) : NULL;
+  }
+  else
+    error("set_parameter(): Invalid parameter value: %s for parameter %s. It should be positive integer!" ,
+    parameter_value, parameter_name);
+  }
+  else if(strcmp(parameter_name, "flight_recorder_file") == 0)
+  {
+    flight_recorder_file = parameter_value;
+  }
+  else if(strcmp(parameter_name, "flight_recorder_dump_on_comm_lost") == 0)
+  {
+  if (strcasecmp(parameter_value,"yes") == 0)
+    flight_recorder_dump_on_comm_lost = TRUE;
+  else if(strcasecmp(parameter_value,"no") == 0)
+    flight_recorder_dump_on_comm_lost = FALSE;
+  else
+    error("set_parameter(): Invalid parameter value: %s for parameter %s. Only yes and no can be used!" ,
+    parameter_value, parameter_name);
+  }
+  else if(strcmp(parameter_name, "capture_file") == 0)
+  {
+    capture_file = parameter_value;
+  }
+  else if(strcmp(parameter_name, "capture_queue_size") == 0)
+  {
+  int value;
+  if ( (sscanf(parameter_value, "%d", &value) == 1) && (value>0) )
+    capture_queue_size = value;
+  else
+    error("set_parameter(): Invalid parameter value: %s for parameter %s. It should be positive integer!" ,
+    parameter_value, parameter_name);
+  }
+  else if(strcmp(parameter_name, "bundle_max_count") == 0)
+  {
+  int value;
+  if ( (sscanf(parameter_value, "%d", &value) == 1) && (value>=0) )
+    bundle_max_count = value;
+  else
+    error("set_parameter(): Invalid parameter value: %s for parameter %s. It should be positive integer!" ,
+    parameter_value, parameter_name);
+  }
+  else if(strcmp(parameter_name, "bundle_max_delay") == 0)
+  {
+  int value;
+  if ( (sscanf(parameter_value, "%d", &value) == 1) && (value>=0) )
+    bundle_max_delay = value;
+  else
+    error("set_parameter(): Invalid parameter value: %s for parameter %s. It should be positive integer!" ,
+    parameter_value, parameter_name);
+  }
   else
   TTCN_warning("%s: unknown & unhandled parameter: %s",
   get_name(), parameter_name);
@@ -374,24 +1322,30 @@ void SCTPasp__PT_PROVIDER::Handle_Fd_Event_Writable(int my_fd){
   int i= map_get_item(my_fd);
   if(i!=-1 && !simple_mode && !fd_map[i].erased && fd_map[i].einprogress )
     {
-      if (connect(fd_map[i].fd, (struct sockaddr *)&fd_map[i].sin,
+      if (transport->connect(fd_map[i].fd, (struct sockaddr *)&fd_map[i].sin,
         fd_map[i].saLen) == -1)
       {
-        Handler_Remove_Fd_Write(fd_map[i].fd);
-        if(errno == EISCONN)
+        if(errno == EALREADY)
+        { // signalled before the attempt finished
+          errno = 0;
+          return;
+        }
+        Handler_Remove_Fd(fd_map[i].fd, EVENT_ALL);
+        if(errno == EISCONN)
         {
           SCTPasp__Types::ASP__SCTP__RESULT asp_sctp_result;
           asp_sctp_result.client__id() = fd_map[i].fd;
           asp_sctp_result.error__status() = FALSE;
           asp_sctp_result.error__message() = OMIT_VALUE;
-          incoming_message(asp_sctp_result);
+          if (!lean_mode) incoming_message(asp_sctp_result);
           fd_map[i].einprogress = FALSE;
-          Handler_Add_Fd_Read(fd_map[i].fd);
+          watch_socket(fd_map[i].fd);
+          if (flight_recorder) flight_recorder->record(TRACE_CONNECT, fd_map[i].fd);
           log("Connection successfully established to (%s):(%d)",(const char*)peer_IP_address, peer_port);
         }
         else
         {
-          close(fd_map[i].fd);
+          if (flight_recorder) flight_recorder->record(TRACE_CONNECT_FAILED, fd_map[i].fd, 0, 0, errno);
           fd = -1;
           TTCN_warning("Connect error!");
           SCTPasp__Types::ASP__SCTP__RESULT asp_sctp_result;
@@ -437,6 +1391,25 @@ int get_port(struct sockaddr_storage *sa){
 }
 
 void SCTPasp__PT_PROVIDER::Handle_Fd_Event_Readable(int my_fd){
+  if (my_fd == timer_fd)
+  {
+    timer_expired();
+    return;
+  }
+  if (engine && my_fd == engine->get_event_fd())
+  {
+    engine_receive();
+    return;
+  }
+  if (!transport->kernel_sockets())
+  { // the finished connection attempts are signalled as readable, see watch_connect()
+    int i = map_get_item(my_fd);
+    if (i != -1 && fd_map[i].einprogress)
+    {
+      Handle_Fd_Event_Writable(my_fd);
+      return;
+    }
+  }
     // Accepting new client
   if(!simple_mode)
   {
@@ -444,23 +1417,7 @@ void SCTPasp__PT_PROVIDER::Handle_Fd_Event_Readable(int my_fd){
     {
       if(!fd_map_server[i].erased && fd_map_server[i].fd==my_fd)
       {
-        int newclient_fd;
-        struct sockaddr_storage peer_address;
-        socklen_t addrlen = sizeof(peer_address);
-        if ((newclient_fd = accept(fd_map_server[i].fd, (struct sockaddr *)&peer_address, &addrlen)) == -1)
-          error("Event handler: accept error (server mode)!");
-        else
-        {
-          map_put_item(newclient_fd);
-          setNonBlocking(newclient_fd);
-          Handler_Add_Fd_Read(newclient_fd);
-          incoming_message(SCTPasp__Types::ASP__SCTP__Connected(
-                        INTEGER(newclient_fd),
-                        *fd_map_server[i].local_IP_address,
-                        INTEGER(fd_map_server[i].local_port),
-                        get_ip(&peer_address),
-                        get_port(&peer_address)));
-        }
+        accept_association(my_fd, fd_map_server[i].local_port, fd_map_server[i].local_IP_address);
       }
     }
   }
@@ -468,114 +1425,319 @@ void SCTPasp__PT_PROVIDER::Handle_Fd_Event_Readable(int my_fd){
   {
     if(server_mode && fd==my_fd)
     {
-      int newclient_fd;
-      struct sockaddr_storage peer_address;
-      socklen_t addrlen = sizeof(peer_address);
-      if ((newclient_fd = accept(fd, (struct sockaddr *)&peer_address, &addrlen)) == -1)
-        error("Event handler: accept error (server mode)!");
-      else
-      {
-        map_put_item(newclient_fd);
-        setNonBlocking(newclient_fd);
-        Handler_Add_Fd_Read(newclient_fd);
-     }
+      accept_association(my_fd, local_port, NULL);
     }
   }
   // Receiving data
   int i= map_get_item(my_fd);
-  if(i!=-1) // valid fd
+  int reads = 0; // in bundle mode the socket is read until it would block, at most bundle_max_count times
+  while(i!=-1) // valid fd
     {
       log("Calling Event_Handler.");
       receiving_fd = fd_map[i].fd;
 
-      struct cmsghdr   *cmsg;
-      struct sctp_sndrcvinfo  *sri;
-      char cbuf[sizeof (*cmsg) + sizeof (*sri)];
-      struct msghdr   msg;
-      struct iovec   iov;
-      size_t   cmsglen = sizeof (*cmsg) + sizeof (*sri);
+      received_t received;
+      receive_result_t value = receive_message(fd_map[i], reads > 0 ? MSG_DONTWAIT : 0, received);
+      switch(value)
+      {
+        case WHOLE_MESSAGE_RECEIVED:
+          log("Event_Handler: whole message is received, %d bytes.", (int)fd_map[i].nr);
+          process_message(i, received.notification, received.stream, received.ppid);
+          discard_message(fd_map[i]);
+          break;
+        case PARTIAL_RECEIVE:
+          log("Event_Handler: part of the message is received, the buffer has %d bytes.", (int)fd_map[i].nr);
+          if (flight_recorder) flight_recorder->record(TRACE_RX_PARTIAL, receiving_fd, fd_map[i].nr);
+          break;
+        case EOF_OR_ERROR:
+          connection_lost(i);
+          break;
+        case WOULD_BLOCK:
+          break;
+      }//endswitch
+      if ((value == WHOLE_MESSAGE_RECEIVED || value == PARTIAL_RECEIVE) && ++reads < bundle_max_count)
+        i = map_get_item(my_fd);
+      else i = -1;
+    }// endwhile
+
+  bundle_schedule();
 
-      if ( !fd_map[i].processing_message )
+}
+
+
+// Processes a whole message or notification received on fd_map[i], held in
+// fd_map[i].buf. The buffer is released by the caller.
+void SCTPasp__PT_PROVIDER::process_message(int i, boolean notification, unsigned int stream, uint32_t ppid)
+{
+  if (notification)
+  {
+    log("Calling event_handler for an incoming notification.");
+    if (bundle.size_of() > 0) bundle_flush(); // keeping the order of the messages
+    if (capture) capture_message(i, false, true, CAPTURE_NOTIFICATION_STREAM,
+      CAPTURE_NOTIFICATION_PPID, fd_map[i].buf, fd_map[i].nr);
+    handle_event(fd_map[i].buf, fd_map[i].nr);
+  }
+  else
+  {
+    log("Incoming data.");
+    if (flight_recorder) flight_recorder->record(TRACE_RX_DATA, receiving_fd, fd_map[i].nr, stream, ppid);
+    if (rtt) rtt->response(receiving_fd, ppid, (const unsigned char *)fd_map[i].buf, fd_map[i].nr);
+    if (capture) capture_message(i, false, false, stream, ppid, fd_map[i].buf, fd_map[i].nr);
+    boolean deliver = TRUE;
+    if (reflector && (reflector->all_associations || fd_map[i].reflector_target))
+      deliver = reflect(i, stream, ppid);
+    if (deliver && filters)
+      deliver = filter_message(receiving_fd, stream, ppid, (const unsigned char *)fd_map[i].buf, fd_map[i].nr);
+    if (deliver)
+    {
+      INTEGER i_ppid;
+      if (ppid <= (unsigned long)INT_MAX)
+        i_ppid = ppid;
+      else {
+        char sbuf[16];
+        sprintf(sbuf, "%u", ppid);
+        i_ppid = INTEGER(sbuf);
+      }
+      SCTPasp__Types::ASP__SCTP asp_sctp(
+              INTEGER(receiving_fd),
+              INTEGER(stream),
+              i_ppid,
+              OCTETSTRING(fd_map[i].nr,(const unsigned char *)fd_map[i].buf),
+              OMIT_VALUE,
+              OMIT_VALUE);
+      if (fd_map[i].rx_ts_valid)
       {
-        fd_map[i].buf = Malloc(BUFLEN);
-        fd_map[i].buflen = BUFLEN;
-        iov.iov_base = fd_map[i].buf;
-        iov.iov_len = fd_map[i].buflen;
+        INTEGER tv_sec;
+        tv_sec.set_long_long_val(fd_map[i].rx_ts.tv_sec);
+        asp_sctp.rx__timestamp() = SCTPasp__Types::SCTP__TIMESTAMP(tv_sec,
+              INTEGER((int)fd_map[i].rx_ts.tv_nsec));
       }
-      else
+      if (bundle_max_count > 0)
       {
-        // Set the next read offset
-        log("Event_Handler: setting the next read offset.");
-        iov.iov_base = (char *)fd_map[i].buf + fd_map[i].nr;
-        iov.iov_len = fd_map[i].buflen - fd_map[i].nr;
+        if (bundle.size_of() == 0) bundle_first = monotonic_ns();
+        bundle[bundle.size_of()] = asp_sctp;
+        if (bundle.size_of() >= bundle_max_count) bundle_flush();
       }
+      else incoming_message(asp_sctp);
+    }
+    if (generator && fd_map[i].generator_target && generator->response(receiving_fd, stream, ppid) &&
+        generator->outstanding != 0 && generator->in_flight + 1 == generator->outstanding)
+      generator_run(); // the generator was waiting for this response
+  }
+}
 
-      // Set up the msghdr structure for receiving
-      memset(&msg, 0, sizeof (msg));
-      msg.msg_iov = &iov;
-      msg.msg_iovlen = 1;
-      msg.msg_control = cbuf;
-      msg.msg_controllen = cmsglen;
 
-      memset(cbuf, 0, sizeof (*cmsg) + sizeof (*sri));
-      cmsg = (struct cmsghdr *)cbuf;
-      sri = (struct sctp_sndrcvinfo *)(cmsg + 1);
+// Handles the loss of the association of fd_map[i].
+void SCTPasp__PT_PROVIDER::connection_lost(int i)
+{
+  // an EOF is the normal end of an association as well, the ring is dumped on SCTP_COMM_LOST only
+  if (flight_recorder) flight_recorder->record(TRACE_RX_EOF, receiving_fd);
+  if (!server_mode) fd = -1; // setting closed socket to -1 in client mode (and reconnect mode)
+  map_delete_item(i);
+  if (bundle.size_of() > 0) bundle_flush();
+  if (coalesce) coalesce_expired(receiving_fd);
+  // the EOF is not a detected failure, no detection_time
+  if (events.sctp_association_event) incoming_message(SCTPasp__Types::ASP__SCTP__ASSOC__CHANGE(
+          INTEGER(receiving_fd),
+          SCTPasp__Types::SAC__STATE(SCTP_COMM_LOST),
+          OMIT_VALUE));
+  log("The association is lost, the socket is closed.");
+  if (reconnect) forced_reconnect(reconnect_max_attempts);
+}
+
 
-      return_value_t value = getmsg(receiving_fd, &msg);
-      switch(value)
+void SCTPasp__PT_PROVIDER::bundle_schedule()
+{
+  if (bundle.size_of() > 0)
+  {
+    if (bundle_max_delay == 0) bundle_flush();
+    else if (timer_deadline[TIMER_BUNDLE] == 0) timer_arm(TIMER_BUNDLE, bundle_first + bundle_max_delay * 1000ULL);
+  }
+}
+
+
+// Starts receiving on a connected socket, in the TITAN thread or by the socket engine.
+void SCTPasp__PT_PROVIDER::watch_socket(int fd)
+{
+  if (engine)
+  {
+    int index = map_get_item(fd);
+    fd_map[index].io_seq = ++io_seq;
+    if (io_seq == 0) fd_map[index].io_seq = ++io_seq; // 0 means not registered
+    engine->add_socket(fd, fd_map[index].io_seq);
+  }
+  else Handler_Add_Fd_Read(fd);
+}
+
+
+// Waits for the end of a non-blocking connection attempt.
+void SCTPasp__PT_PROVIDER::watch_connect(int fd)
+{
+  if (transport->kernel_sockets()) Handler_Add_Fd_Write(fd);
+  else Handler_Add_Fd_Read(fd);
+}
+
+
+// Delivers the messages received by the socket engine.
+void SCTPasp__PT_PROVIDER::engine_receive()
+{
+  engine->clear_event();
+  const SocketEngine::message_t *m;
+  int n = 0;
+  while ((m = engine->receive()) != NULL)
+  {
+    int i = map_get_item(m->fd);
+    // messages of a closed socket or of an earlier socket with the same descriptor are dropped
+    if (i != -1 && fd_map[i].io_seq == m->seq)
+    {
+      receiving_fd = m->fd;
+      switch (m->type)
       {
-        case WHOLE_MESSAGE_RECEIVED:
-          fd_map[i].processing_message = FALSE;
-          // Intercept notifications here
-          if (msg.msg_flags & MSG_NOTIFICATION)
-          {
-            log("Calling event_handler for an incoming notification.");
-            handle_event(fd_map[i].buf);
-          }
-          else
+        case SocketEngine::IO_DATA:
+        case SocketEngine::IO_NOTIFICATION:
+          fd_map[i].buf = (void *)m->data;
+          fd_map[i].nr = m->len;
+          fd_map[i].rx_ts_valid = m->ts_valid;
+          fd_map[i].rx_ts = m->ts;
+          process_message(i, m->type == SocketEngine::IO_NOTIFICATION, m->stream, m->ppid);
+          if (fd_map[i].fd == m->fd)
           {
-            log("Incoming data.");
-            unsigned int ui = ntohl(sri->sinfo_ppid);
-            INTEGER i_ppid;
-            if (ui <= (unsigned long)INT_MAX)
-              i_ppid = ui;
-            else {
-              char sbuf[16];
-              sprintf(sbuf, "%u", ui);
-              i_ppid = INTEGER(sbuf);
-            }
-            incoming_message(SCTPasp__Types::ASP__SCTP(
-                    INTEGER(receiving_fd),
-                    INTEGER(sri->sinfo_stream),
-                    i_ppid,
-                    OCTETSTRING(fd_map[i].nr,(const unsigned char *)fd_map[i].buf)));
+            fd_map[i].buf = NULL;
+            fd_map[i].rx_ts_valid = FALSE;
           }
-          Free(fd_map[i].buf);
-          fd_map[i].buf = NULL;
           break;
-        case PARTIAL_RECEIVE:
-          fd_map[i].processing_message = TRUE;
+        case SocketEngine::IO_EOF:
+          connection_lost(i);
           break;
-        case EOF_OR_ERROR:
-          if (!server_mode) fd = -1; // setting closed socket to -1 in client mode (and reconnect mode)
-          map_delete_item(i);
-          if (events.sctp_association_event) incoming_message(SCTPasp__Types::ASP__SCTP__ASSOC__CHANGE(
-                  INTEGER(receiving_fd),
-                  SCTPasp__Types::SAC__STATE(SCTP_COMM_LOST)));
-          log("getmsg() returned with NULL. Socket is closed.");
-          if (reconnect) forced_reconnect(reconnect_max_attempts);
-
+        case SocketEngine::IO_SEND_ERROR:
+        {
+          if (flight_recorder) flight_recorder->record(TRACE_TX_ERROR, m->fd, m->len, m->stream, m->err);
+          SCTPasp__Types::ASP__SCTP__SENDMSG__ERROR asp_sctp_sendmsg_error;
+          if (server_mode) asp_sctp_sendmsg_error.client__id() = m->fd;
+          else asp_sctp_sendmsg_error.client__id() = OMIT_VALUE;
+          asp_sctp_sendmsg_error.sinfo__stream() = m->stream;
+          asp_sctp_sendmsg_error.sinfo__ppid() = ull2int(m->ppid);
+          asp_sctp_sendmsg_error.data() = OCTETSTRING(m->len, m->data);
+          if (m->has_context) asp_sctp_sendmsg_error.sinfo__context() = ull2int(m->context);
+          else asp_sctp_sendmsg_error.sinfo__context() = OMIT_VALUE;
+          incoming_message(asp_sctp_sendmsg_error);
+          TTCN_warning("Sendmsg error! Strerror=%s", strerror(m->err));
           break;
-      }//endswitch
-    }// endif
-
-
+        }
+        default:
+          break;
+      }
+    }
+    engine->release();
+    if (++n >= ENGINE_BATCH)
+    { // letting the other event handlers run, the rest is delivered in the next call
+      engine->notify();
+      break;
+    }
+  }
+  engine->flush(); // restarting the receives, the answers of the reflector
+  bundle_schedule();
 }
 
 
 void SCTPasp__PT_PROVIDER::user_map(const char *system_port)
 {
   log("Calling user_map(%s).",system_port);
+  build_socket_template();
+  if (capture_file.lengthof() > 0)
+  {
+    capture = new CaptureWriter;
+    int err = capture->open(capture_file, capture_queue_size);
+    if (err != 0)
+    {
+      delete capture;
+      capture = NULL;
+      error("user_map(): cannot open the capture file %s: %s", (const char *)capture_file, strerror(err));
+    }
+    log("Capturing the traffic into %s.", (const char *)capture_file);
+  }
+  if (io_thread_enabled && io_uring_enabled)
+  {
+    error("user_map(): io_thread and io_uring are mutually exclusive!");
+  }
+  if (usrsctp_enabled && (io_thread_enabled || io_uring_enabled))
+  {
+    error("user_map(): usrsctp cannot be used together with io_thread or io_uring!");
+  }
+  if (loopback_enabled && (usrsctp_enabled || io_thread_enabled || io_uring_enabled))
+  {
+    error("user_map(): loopback cannot be used together with usrsctp, io_thread or io_uring!");
+  }
+  if (loopback_enabled)
+  { // the rings of the associations are served by the transport itself
+    LoopbackTransport *loopback = new LoopbackTransport;
+    int err = loopback->start(loopback_ring_size);
+    if (err != 0)
+    {
+      delete loopback;
+      error("user_map(): cannot start the loopback transport: %s", strerror(err));
+    }
+    transport = loopback;
+    engine = loopback;
+    log("The SCTP stack is the shared memory loopback, ring size: %d bytes.", loopback_ring_size);
+  }
+  else if (usrsctp_enabled)
+  { // usrsctp receives in its own threads, it is the socket engine of its sockets
+    UsrsctpTransport *usrsctp = new UsrsctpTransport;
+    int err = usrsctp->start(usrsctp_udp_port, usrsctp_remote_udp_port);
+    if (err != 0)
+    {
+      delete usrsctp;
+      error("user_map(): cannot start usrsctp: %s", strerror(err));
+    }
+    transport = usrsctp;
+    engine = usrsctp;
+    log("The SCTP stack is usrsctp, UDP encapsulation port: %d, remote UDP encapsulation port: %d.",
+      usrsctp_udp_port, usrsctp_remote_udp_port);
+  }
+  else if (io_thread_enabled)
+  {
+    IOThread *io_thread = new IOThread;
+    int err = io_thread->start(io_thread_queue_size, io_thread_cpu);
+    if (err != 0)
+    {
+      delete io_thread;
+      error("user_map(): cannot start the I/O thread: %s", strerror(err));
+    }
+    engine = io_thread;
+    log("The sockets are served by the I/O thread.");
+  }
+  else if (io_uring_enabled)
+  {
+    UringEngine *uring = new UringEngine;
+    int err = uring->start(io_uring_entries);
+    if (err != 0)
+    { // falling back to the sockets served by the TITAN thread
+      delete uring;
+      TTCN_warning("SCTPasp Test Port (%s): io_uring cannot be used: %s, the sockets are served without it.",
+        get_name(), strerror(err));
+    }
+    else
+    {
+      engine = uring;
+      log("The sockets are served by io_uring.");
+    }
+  }
+  if (engine) Handler_Add_Fd_Read(engine->get_event_fd());
+  if (sctp_event_supported && !probe_sctp_event(SCTP_ASSOC_CHANGE))
+  { // a kernel older than the headers, the notifications are subscribed at once
+    log("SCTP_EVENT is not supported, falling back to SCTP_EVENTS.");
+    sctp_event_supported = FALSE;
+    build_socket_template();
+  }
+#ifdef SCTP_SEND_FAILED_EVENT
+  if (sctp_event_supported && send_failed_event_supported && !probe_sctp_event(SCTP_SEND_FAILED_EVENT))
+  { // a kernel knowing SCTP_EVENT but not the newer notification
+    log("SCTP_SEND_FAILED_EVENT is not supported, falling back to SCTP_SEND_FAILED.");
+    send_failed_event_supported = FALSE;
+    build_socket_template();
+  }
+#endif
   if(simple_mode)
   {
     if ( server_mode && reconnect )
@@ -595,13 +1757,13 @@ void SCTPasp__PT_PROVIDER::user_map(const char *system_port)
       struct sockaddr_storage sa; 
       socklen_t saLen=sizeof(sa);
       int sock_type=fill_addr_struct(local_IP_address,local_port,&sa,saLen);
-      fd=create_socket(sock_type);
+      fd=create_socket(sock_type, false);
       
-      if(bind(fd,(const struct sockaddr *)&sa,saLen)!=0){
+      if(transport->bind(fd,(const struct sockaddr *)&sa,saLen)!=0){
         error("bind failed: %d, %s", errno, strerror(errno));
       }
       
-      if (listen(fd, server_backlog) == -1) error("Listen error!");
+      if (transport->listen(fd, server_backlog) == -1) error("Listen error!");
       log("Listening @ (%s):(%d)", (const char*)local_IP_address, local_port);
       Handler_Add_Fd_Read(fd);
     } else if (reconnect) {
@@ -622,19 +1784,60 @@ void SCTPasp__PT_PROVIDER::user_map(const char *system_port)
 void SCTPasp__PT_PROVIDER::user_unmap(const char *system_port)
 {
   log("Calling user_unmap(%s).",system_port);
+  delete admission; // the closed associations are not counted
+  admission = NULL;
+  delete rate_limits; // the queued messages are dropped with the associations
+  rate_limits = NULL;
   if(!simple_mode)
   {
-    for(int i=0;i<list_len;i++) map_delete_item(i);
+    for(int i=0;i<fd_map.size();i++) map_delete_item(i);
     for(int i=0;i<list_len_server;i++) map_delete_item_server(i);
   }
   else
   {
-    for(int i=0;i<list_len;i++) map_delete_item(i);
+    for(int i=0;i<fd_map.size();i++) map_delete_item(i);
     if(server_mode && fd != -1) {
-      close(fd);
+      transport->close(fd);
       Handler_Remove_Fd(fd, EVENT_ALL);
     }
   }
+  delete replay;
+  replay = NULL;
+  delete generator;
+  generator = NULL;
+  if (reflector) reflector_disable();
+  bundle = NULL_VALUE;
+  delete coalesce;
+  coalesce = NULL;
+  delete connect_deadlines;
+  connect_deadlines = NULL;
+  if (flight_recorder && timer_deadline[TIMER_DUMP] != 0) flight_recorder_dump(NULL); // the end of a loss burst
+  flight_recorder_dumped = 0;
+  timer_close();
+  if (engine)
+  {
+    Handler_Remove_Fd(engine->get_event_fd(), EVENT_ALL);
+    engine->stop();
+    if (engine->get_send_errors() > 0)
+      TTCN_warning("SCTPasp Test Port (%s): %llu messages could not be sent by the socket engine.",
+        get_name(), (unsigned long long)engine->get_send_errors());
+    if (engine->get_receive_errors() > 0)
+      TTCN_warning("SCTPasp Test Port (%s): %llu received messages were dropped by the socket engine.",
+        get_name(), (unsigned long long)engine->get_receive_errors());
+    delete engine;
+    engine = NULL;
+    transport = &kernel_transport;
+  }
+  if (capture)
+  {
+    capture->close();
+    log("Capture finished, %llu messages written.", (unsigned long long)capture->get_written());
+    if (capture->get_dropped() > 0)
+      TTCN_warning("SCTPasp Test Port (%s): %llu messages were not captured, the capture queue was full.",
+        get_name(), (unsigned long long)capture->get_dropped());
+    delete capture;
+    capture = NULL;
+  }
   log("Leaving user_unmap().");
 }
 
@@ -682,7 +1885,8 @@ void SCTPasp__PT_PROVIDER::outgoing_send(const SCTPasp__Types::ASP__SCTP__Connec
   socklen_t saLen;
   int sock_type=fill_addr_struct(peer_IP_address,peer_port,&sa,saLen);
   
-  fd=create_socket(sock_type);
+  // the simple mode connects in blocking mode
+  fd=create_socket(sock_type, !simple_mode);
 
   if(simple_mode && local_port_is_present){
     // we should bind
@@ -692,14 +1896,12 @@ void SCTPasp__PT_PROVIDER::outgoing_send(const SCTPasp__Types::ASP__SCTP__Connec
     if(sock_type!=loc_sock_type)
       error("The local and peer IP addreses are different type: %s %i %s %i", (const char*)peer_IP_address,sock_type,(const char*)local_IP_address,loc_sock_type);
     
-    if(bind(fd,(const struct sockaddr *)&loc_sa,loc_saLen)!=0){
+    if(transport->bind(fd,(const struct sockaddr *)&loc_sa,loc_saLen)!=0){
       error("bind failed %d %s",errno, strerror(errno));
     }
   }
   log("Connecting to (%s):(%d)", (const char*)peer_IP_address, peer_port);
-  // setting non-blocking mode
-  if(!simple_mode) setNonBlocking(fd);
-  if (connect(fd, (const struct sockaddr *)&sa, saLen) == -1)
+  if (transport->connect(fd, (const struct sockaddr *)&sa, saLen) == -1)
   {
     if(errno == EINPROGRESS && !simple_mode)
     {
@@ -708,12 +1910,14 @@ void SCTPasp__PT_PROVIDER::outgoing_send(const SCTPasp__Types::ASP__SCTP__Connec
       fd_map[i].einprogress = TRUE;
       fd_map[i].sin = sa;
       fd_map[i].saLen = saLen;
-      Handler_Add_Fd_Write(fd);
+      watch_connect(fd);
+      connect_arm(i, send_par.connect__timeout().ispresent() ? (int)send_par.connect__timeout()() : connect_timeout);
       log("Connection in progress to (%s):(%d)",(const char*)peer_IP_address, peer_port);
     }
     else
     {
-      close(fd);
+      if (flight_recorder) flight_recorder->record(TRACE_CONNECT_FAILED, fd, 0, 0, errno);
+      transport->close(fd);
       fd = -1;
       TTCN_warning("Connect error!");
       SCTPasp__Types::ASP__SCTP__RESULT asp_sctp_result;
@@ -730,10 +1934,11 @@ void SCTPasp__PT_PROVIDER::outgoing_send(const SCTPasp__Types::ASP__SCTP__Connec
     asp_sctp_result.client__id() = fd;
     asp_sctp_result.error__status() = FALSE;
     asp_sctp_result.error__message() = OMIT_VALUE;
-    incoming_message(asp_sctp_result);
+    if (!lean_mode) incoming_message(asp_sctp_result);
     map_put_item(fd);
     if(simple_mode) setNonBlocking(fd);
-    Handler_Add_Fd_Read(fd);
+    watch_socket(fd);
+    if (flight_recorder) flight_recorder->record(TRACE_CONNECT, fd);
     log("Connection successfully established to (%s):(%d)", (const char*)peer_IP_address, peer_port);
   }
   log("Leaving outgoing_send (ASP_SCTP_CONNECT).");
@@ -770,16 +1975,14 @@ void SCTPasp__PT_PROVIDER::outgoing_send(const SCTPasp__Types::ASP__SCTP__Connec
     if(sock_type!=loc_sock_type)
       error("The local and peer IP addreses are different type: %s %i %s %i", (const char*)peer_IP_address,sock_type,(const char*)local_IP_address,loc_sock_type);
     
-    fd=create_socket(sock_type);
+    fd=create_socket(sock_type, true);
     
-    if(bind(fd,(const struct sockaddr *)&loc_sa,loc_saLen)!=0){
+    if(transport->bind(fd,(const struct sockaddr *)&loc_sa,loc_saLen)!=0){
       error("bind failed %d %s",errno, strerror(errno));
     }
 
     log("Connecting to (%s):(%d)", (const char*)peer_IP_address, peer_port);
-    // setting non-blocking mode
-    setNonBlocking(fd);
-    if (connect(fd, (struct sockaddr *)&sa, saLen) == -1)
+    if (transport->connect(fd, (struct sockaddr *)&sa, saLen) == -1)
     {
       if(errno == EINPROGRESS)
       {
@@ -788,12 +1991,14 @@ void SCTPasp__PT_PROVIDER::outgoing_send(const SCTPasp__Types::ASP__SCTP__Connec
         fd_map[i].einprogress = TRUE;
         fd_map[i].sin = sa;
         fd_map[i].saLen = saLen;
-        Handler_Add_Fd_Write(fd);
+        watch_connect(fd);
+        connect_arm(i, send_par.connect__timeout().ispresent() ? (int)send_par.connect__timeout()() : connect_timeout);
         log("Connection in progress to (%s):(%d)",(const char*)peer_IP_address, peer_port);
       }
       else
       {
-        close(fd);
+        if (flight_recorder) flight_recorder->record(TRACE_CONNECT_FAILED, fd, 0, 0, errno);
+        transport->close(fd);
         fd = -1;
         TTCN_warning("Connect error!");
         SCTPasp__Types::ASP__SCTP__RESULT asp_sctp_result;
@@ -810,9 +2015,10 @@ void SCTPasp__PT_PROVIDER::outgoing_send(const SCTPasp__Types::ASP__SCTP__Connec
       asp_sctp_result.client__id() = fd;
       asp_sctp_result.error__status() = FALSE;
       asp_sctp_result.error__message() = OMIT_VALUE;
-      incoming_message(asp_sctp_result);
+      if (!lean_mode) incoming_message(asp_sctp_result);
       map_put_item(fd);
-      Handler_Add_Fd_Read(fd);
+      watch_socket(fd);
+      if (flight_recorder) flight_recorder->record(TRACE_CONNECT, fd);
       log("Connection successfully established to (%s):(%d)", (const char*)peer_IP_address, peer_port);
     }
   }
@@ -830,13 +2036,13 @@ void SCTPasp__PT_PROVIDER::outgoing_send(const SCTPasp__Types::ASP__SCTP__Listen
     socklen_t loc_saLen;
     int loc_sock_type=fill_addr_struct(loc_name,(int) send_par.local__portnumber(),&loc_sa,loc_saLen);
 
-    fd=create_socket(loc_sock_type);
+    fd=create_socket(loc_sock_type, false);
     
-    if(bind(fd,(const struct sockaddr *)&loc_sa,loc_saLen)!=0){
+    if(transport->bind(fd,(const struct sockaddr *)&loc_sa,loc_saLen)!=0){
       error("bind failed %d %s",errno, strerror(errno));
     }
  
-    if (listen(fd, server_backlog) == -1) error("Listen error!");
+    if (transport->listen(fd, server_backlog) == -1) error("Listen error!");
     map_put_item_server(fd, loc_name, (int) send_par.local__portnumber());
     log("Listening @ (%s):(%d)", (const char *)loc_name, (int) send_par.local__portnumber());
     Handler_Add_Fd_Read(fd);
@@ -845,7 +2051,7 @@ void SCTPasp__PT_PROVIDER::outgoing_send(const SCTPasp__Types::ASP__SCTP__Listen
     asp_sctp_result.client__id() = fd;
     asp_sctp_result.error__status() = FALSE;
     asp_sctp_result.error__message() = OMIT_VALUE;
-    incoming_message(asp_sctp_result);
+    if (!lean_mode) incoming_message(asp_sctp_result);
 #endif
   }
   log("Leaving outgoing_send (ASP_SCTP_LISTEN).");
@@ -859,14 +2065,10 @@ void SCTPasp__PT_PROVIDER::outgoing_send(const SCTPasp__Types::ASP__SCTP__SetSoc
   {
     case SCTPasp__Types::ASP__SCTP__SetSocketOptions::ALT_Sctp__init:
     {
-      (void) memset(&initmsg, 0, sizeof(struct sctp_initmsg));
-      const SCTPasp__Types::SCTP__INIT& init = send_par.Sctp__init();
-      initmsg.sinit_num_ostreams = (int) init.sinit__num__ostreams();
-      initmsg.sinit_max_instreams = (int) init.sinit__max__instreams();
-      initmsg.sinit_max_attempts = (int) init.sinit__max__attempts();
-      initmsg.sinit_max_init_timeo = (int) init.sinit__max__init__timeo();
+      init2initmsg(send_par.Sctp__init(), initmsg);
+      build_socket_template();
       log("Setting SCTP socket options (initmsg).");
-      if (setsockopt(fd, IPPROTO_SCTP, SCTP_INITMSG, &initmsg,
+      if (transport->setsockopt(fd, IPPROTO_SCTP, SCTP_INITMSG, &initmsg,
         sizeof(struct sctp_initmsg)) < 0)
       {
          TTCN_warning("Setsockopt error!");
@@ -883,25 +2085,16 @@ void SCTPasp__PT_PROVIDER::outgoing_send(const SCTPasp__Types::ASP__SCTP__SetSoc
         asp_sctp_result.client__id() = fd;
         asp_sctp_result.error__status() = FALSE;
         asp_sctp_result.error__message() = OMIT_VALUE;
-        incoming_message(asp_sctp_result);
+        if (!lean_mode) incoming_message(asp_sctp_result);
       }
       break;
     }
     case SCTPasp__Types::ASP__SCTP__SetSocketOptions::ALT_Sctp__events:
     {
-      const SCTPasp__Types::SCTP__EVENTS& event = send_par.Sctp__events();
-      events.sctp_data_io_event = (boolean) event.sctp__data__io__event();
-      events.sctp_association_event = (boolean) event.sctp__association__event();
-      events.sctp_address_event = (boolean) event.sctp__address__event();
-      events.sctp_send_failure_event = (boolean) event.sctp__send__failure__event();
-      events.sctp_peer_error_event = (boolean) event.sctp__peer__error__event();
-      events.sctp_shutdown_event = (boolean) event.sctp__shutdown__event();
-      events.sctp_partial_delivery_event = (boolean) event.sctp__partial__delivery__event();
-#if defined(LKSCTP_1_0_7) || defined(LKSCTP_1_0_9)
-      events.sctp_adaptation_layer_event = (boolean) event.sctp__adaption__layer__event();
-#else
-      events.sctp_adaption_layer_event = (boolean) event.sctp__adaption__layer__event();
-#endif
+      struct sctp_event_subscribe previous = events;
+      events2subscribe(send_par.Sctp__events(), events);
+      build_socket_template();
+      resubscribe_events(previous);
       break;
     }
     case SCTPasp__Types::ASP__SCTP__SetSocketOptions::ALT_So__linger:
@@ -913,7 +2106,7 @@ void SCTPasp__PT_PROVIDER::outgoing_send(const SCTPasp__Types::ASP__SCTP__SetSoc
       so_linger.l_linger =  (int) so.l__linger();
       // Setting a socket level option
       log("Setting SCTP socket options (so_linger).");
-      if (setsockopt(fd, SOL_SOCKET, SCTP_EVENTS, &so_linger, sizeof (so_linger)) < 0)
+      if (transport->setsockopt(fd, SOL_SOCKET, SO_LINGER, &so_linger, sizeof (so_linger)) < 0)
       {
         TTCN_warning("Setsockopt error!");
         SCTPasp__Types::ASP__SCTP__RESULT asp_sctp_result;
@@ -929,7 +2122,7 @@ void SCTPasp__PT_PROVIDER::outgoing_send(const SCTPasp__Types::ASP__SCTP__SetSoc
         asp_sctp_result.client__id() = fd;
         asp_sctp_result.error__status() = FALSE;
         asp_sctp_result.error__message() = OMIT_VALUE;
-        incoming_message(asp_sctp_result);
+        if (!lean_mode) incoming_message(asp_sctp_result);
       }
       break;
     }
@@ -944,7 +2137,7 @@ void SCTPasp__PT_PROVIDER::outgoing_send(const SCTPasp__Types::ASP__SCTP__SetSoc
       sctp_rtoinfo.srto_min =  (int) rto.srto__min();
       // Setting a SCTP level socket option
       log("Setting SCTP socket options (sctp_rtoinfo).");
-      if (setsockopt(local_fd, IPPROTO_SCTP, SCTP_RTOINFO, &sctp_rtoinfo,
+      if (transport->setsockopt(local_fd, IPPROTO_SCTP, SCTP_RTOINFO, &sctp_rtoinfo,
         sizeof (sctp_rtoinfo)) < 0)
       {
         TTCN_warning("Setsockopt error!");
@@ -961,10 +2154,54 @@ void SCTPasp__PT_PROVIDER::outgoing_send(const SCTPasp__Types::ASP__SCTP__SetSoc
         asp_sctp_result.client__id() = local_fd;
         asp_sctp_result.error__status() = FALSE;
         asp_sctp_result.error__message() = OMIT_VALUE;
-        incoming_message(asp_sctp_result);
+        if (!lean_mode) incoming_message(asp_sctp_result);
       }
       break;
     }
+    case SCTPasp__Types::ASP__SCTP__SetSocketOptions::ALT_Sctp__paddrparams:
+    {
+      const SCTPasp__Types::SCTP__PADDRPARAMS& p = send_par.Sctp__paddrparams();
+      struct sctp_paddrparams paddr;
+      struct sctp_assocparams assoc;
+      (void) memset(&paddr, 0, sizeof (paddr));
+      (void) memset(&assoc, 0, sizeof (assoc));
+      if (p.spp__hbinterval().ispresent()) set_hbinterval(paddr, (int) p.spp__hbinterval()());
+      if (p.spp__pathmaxrxt().ispresent()) paddr.spp_pathmaxrxt = (int) p.spp__pathmaxrxt()();
+      if (p.spp__pathmtu().ispresent()) set_pathmtu(paddr, (int) p.spp__pathmtu()());
+      socket_options options;
+      add_failure_detection(options, paddr, assoc, -1);
+      log("Setting SCTP socket options (sctp_paddrparams).");
+      set_association_options((int) p.client__id(), options);
+      break;
+    }
+    case SCTPasp__Types::ASP__SCTP__SetSocketOptions::ALT_Sctp__associnfo:
+    {
+      const SCTPasp__Types::SCTP__ASSOCINFO& a = send_par.Sctp__associnfo();
+      struct sctp_paddrparams paddr;
+      struct sctp_assocparams assoc;
+      (void) memset(&paddr, 0, sizeof (paddr));
+      (void) memset(&assoc, 0, sizeof (assoc));
+      assoc.sasoc_asocmaxrxt = (int) a.sasoc__asocmaxrxt();
+      socket_options options;
+      add_failure_detection(options, paddr, assoc, -1);
+      log("Setting SCTP socket options (sctp_associnfo).");
+      set_association_options((int) a.client__id(), options);
+      break;
+    }
+    case SCTPasp__Types::ASP__SCTP__SetSocketOptions::ALT_Sctp__paddrthlds:
+    {
+      const SCTPasp__Types::SCTP__PADDRTHLDS& t = send_par.Sctp__paddrthlds();
+      struct sctp_paddrparams paddr;
+      struct sctp_assocparams assoc;
+      (void) memset(&paddr, 0, sizeof (paddr));
+      (void) memset(&assoc, 0, sizeof (assoc));
+      if (t.spt__pathmaxrxt().ispresent()) paddr.spp_pathmaxrxt = (int) t.spt__pathmaxrxt()();
+      socket_options options;
+      add_failure_detection(options, paddr, assoc, (int) t.spt__pathpfthld());
+      log("Setting SCTP socket options (sctp_paddrthlds).");
+      set_association_options((int) t.client__id(), options);
+      break;
+    }
     default:
       error("Setsocketoptions error: UNBOUND value!");
       break;
@@ -980,214 +2217,1658 @@ void SCTPasp__PT_PROVIDER::outgoing_send(const SCTPasp__Types::ASP__SCTP__Close&
   {
     if(send_par.client__id().ispresent())
     {
-      int local_fd = (int) (const INTEGER&) send_par.client__id();
-      log("NORMAL MODE: closing client/server socket (fd = %d).", local_fd);
-      map_delete_item_fd(local_fd);
-      map_delete_item_fd_server(local_fd);
+      int local_fd = (int) (const INTEGER&) send_par.client__id();
+      log("NORMAL MODE: closing client/server socket (fd = %d).", local_fd);
+      map_delete_item_fd(local_fd);
+      map_delete_item_fd_server(local_fd);
+    }
+    else
+    {   // if OMIT is given then all sockets will be closed
+      log("NORMAL MODE: closing all sockets.");
+      for(int i=0;i<fd_map.size();i++) map_delete_item(i);
+      for(int i=0;i<list_len_server;i++) map_delete_item_server(i);
+    }
+  }
+  else
+  {
+    if (server_mode)
+    {   // closing the given connection
+      if(send_par.client__id().ispresent())
+      {
+        int local_fd = (int) (const INTEGER&) send_par.client__id();
+        log("SERVER MODE: closing client socket (fd = %d).", local_fd);
+        map_delete_item_fd(local_fd);
+      }
+      else
+      {   // if OMIT is given in server mode then all clients will be closed
+        log("SERVER MODE: closing all client sockets.");
+        for(int i=0;i<fd_map.size();i++) map_delete_item(i);
+      }
+    }
+    else
+    {   // closing the connection to the server
+      if ( send_par.client__id().ispresent() )
+        error("In client mode the client_id field of ASP_SCTP_Close should be set to OMIT!");
+      log("CLIENT MODE: closing socket (fd = %d).", fd);
+      map_delete_item_fd(fd);
+      fd=-1;
+    }
+  }
+  log("Leaving outgoing_send (ASP_SCTP_CLOSE).");
+}
+
+
+void SCTPasp__PT_PROVIDER::outgoing_send(const SCTPasp__Types::ASP__SCTP__Close__List& send_par)
+{
+  log("Calling outgoing_send (ASP_SCTP_CLOSE_LIST).");
+  boolean abort = send_par.mode() == SCTPasp__Types::SCTP__CLOSE__MODE::SCTP__CLOSE__ABORT;
+  int closed = 0;
+  if (simple_mode && !server_mode)
+  {   // closing the connection to the server
+    if (send_par.client__ids().ispresent())
+      error("In client mode the client_ids field of ASP_SCTP_Close_List should be set to OMIT!");
+    int index = map_get_item(fd);
+    if (index != -1)
+    {
+      close_association(index, abort);
+      closed++;
+    }
+    fd = -1;
+  }
+  else if (send_par.client__ids().ispresent())
+  {
+    const SCTPasp__Types::SCTP__CLIENT__ID__LIST& client_ids = send_par.client__ids();
+    for (int i = 0; i < client_ids.size_of(); i++)
+    {
+      int local_fd = (int) client_ids[i];
+      int index = map_get_item(local_fd);
+      if (index != -1)
+      {
+        close_association(index, abort);
+        closed++;
+      }
+      else if (!simple_mode) map_delete_item_fd_server(local_fd);
+    }
+  }
+  else
+  {   // if OMIT is given then all associations (and in normal mode the server sockets) will be closed
+    for (int i = 0; i < fd_map.size(); i++)
+    {
+      if (fd_map[i].erased) continue;
+      close_association(i, abort);
+      closed++;
+    }
+    if (!simple_mode) for (int i = 0; i < list_len_server; i++) map_delete_item_server(i);
+  }
+  log("%d associations closed (%s).", closed, abort ? "abort" : "graceful");
+  log("Leaving outgoing_send (ASP_SCTP_CLOSE_LIST).");
+}
+
+
+void SCTPasp__PT_PROVIDER::outgoing_send(const SCTPasp__Types::ASP__SCTP__Profile__Config& send_par)
+{
+  log("Calling outgoing_send (ASP_SCTP_PROFILE_CONFIG).");
+  const SCTPasp__Types::SCTP__SOCKET__OPTIONS& o = send_par.options();
+  socket_options options;
+  if (o.sctp__init().ispresent())
+  {
+    struct sctp_initmsg init;
+    init2initmsg(o.sctp__init()(), init);
+    options.add(IPPROTO_SCTP, SCTP_INITMSG, "initmsg", &init, sizeof (init));
+  }
+  if (o.sctp__events().ispresent())
+  { // the notifications are delivered as set by the test port parameters and Sctp_events
+    struct sctp_event_subscribe subscribe;
+    (void) memset(&subscribe, 0, sizeof (subscribe));
+    events2subscribe(o.sctp__events()(), subscribe);
+    // SCTP_EVENTS would turn off the types subscribed by SCTP_EVENT only
+    if (sctp_event_supported) add_event_subscription(options, subscribe, NULL);
+    else add_events_option(options, subscribe);
+  }
+  if (o.so__linger().ispresent())
+  {
+    struct linger so_linger;
+    (void) memset(&so_linger, 0, sizeof (so_linger));
+    so_linger.l_onoff = (int) o.so__linger()().l__onoff();
+    so_linger.l_linger = (int) o.so__linger()().l__linger();
+    options.add(SOL_SOCKET, SO_LINGER, "so_linger", &so_linger, sizeof (so_linger));
+  }
+  if (o.sctp__rto().ispresent())
+  {
+    struct sctp_rtoinfo rtoinfo;
+    (void) memset(&rtoinfo, 0, sizeof (rtoinfo));
+    rtoinfo.srto_initial = (int) o.sctp__rto()().srto__initial();
+    rtoinfo.srto_max = (int) o.sctp__rto()().srto__max();
+    rtoinfo.srto_min = (int) o.sctp__rto()().srto__min();
+    options.add(IPPROTO_SCTP, SCTP_RTOINFO, "sctp_rtoinfo", &rtoinfo, sizeof (rtoinfo));
+  }
+  if (o.so__sndbuf().ispresent())
+  {
+    int value = (int) o.so__sndbuf()();
+    options.add(SOL_SOCKET, SO_SNDBUF, "SO_SNDBUF", &value, sizeof (value));
+  }
+  if (o.so__rcvbuf().ispresent())
+  {
+    int value = (int) o.so__rcvbuf()();
+    options.add(SOL_SOCKET, SO_RCVBUF, "SO_RCVBUF", &value, sizeof (value));
+  }
+  if (o.sctp__nodelay().ispresent())
+  {
+    int value = (boolean) o.sctp__nodelay()() ? 1 : 0;
+    options.add(IPPROTO_SCTP, SCTP_NODELAY, "SCTP_NODELAY", &value, sizeof (value));
+  }
+  if (o.sctp__sack__delay().ispresent())
+  {
+#ifdef SCTP_DELAYED_SACK
+    struct sctp_sack_info sack;
+    (void) memset(&sack, 0, sizeof (sack));
+    sack.sack_delay = (int) o.sctp__sack__delay()();
+    sack.sack_freq = sack.sack_delay == 0 ? 1 : 0; // 0 ms: every packet is acknowledged at once
+    options.add(IPPROTO_SCTP, SCTP_DELAYED_SACK, "SCTP_DELAYED_SACK", &sack, sizeof (sack));
+#else
+    error("ASP_SCTP_Profile_Config: sctp_sack_delay is not supported by the SCTP library!");
+#endif
+  }
+  if (profiles == NULL) profiles = new profile_state;
+  const char *name = (const char *) send_par.name();
+  profiles->profiles[name] = options;
+  log("The socket option profile %s is configured with %d options.", name, (int) options.options.size());
+  profile_update(name, send_par.apply__to__live());
+  log("Leaving outgoing_send (ASP_SCTP_PROFILE_CONFIG).");
+}
+
+
+void SCTPasp__PT_PROVIDER::outgoing_send(const SCTPasp__Types::ASP__SCTP__Profile__Bind& send_par)
+{
+  log("Calling outgoing_send (ASP_SCTP_PROFILE_BIND).");
+  const char *name = NULL;
+  if (send_par.name().ispresent())
+  {
+    name = (const char *) send_par.name()();
+    if (profiles == NULL || profiles->profiles.find(name) == profiles->profiles.end())
+      error("ASP_SCTP_Profile_Bind: unknown profile %s!", name);
+  }
+  if (profiles == NULL) profiles = new profile_state;
+  if (send_par.local__portnumber().ispresent())
+  {
+    unsigned short port = (int) send_par.local__portnumber()();
+    if (name) profiles->listener_profiles[port] = name;
+    else profiles->listener_profiles.erase(port);
+    log("The socket option profile of the listener %d: %s", (int) port, name ? name : "none");
+  }
+  else
+  {
+    profiles->port_profile = name ? name : "";
+    log("The socket option profile of the port: %s", name ? name : "none");
+  }
+  profile_update(name, send_par.apply__to__live());
+  log("Leaving outgoing_send (ASP_SCTP_PROFILE_BIND).");
+}
+
+
+void SCTPasp__PT_PROVIDER::outgoing_send(const SCTPasp__Types::ASP__SCTP& send_par)
+{
+  log("Calling outgoing_send (ASP_SCTP).");
+  int target;
+  int target_index;
+  if(!simple_mode)
+  {
+    if (!send_par.client__id().ispresent())
+      error("In NORMAL mode the client_id field of ASP_SCTP should be set to a valid value and not to omit!");
+    target = (int) (const INTEGER&) send_par.client__id();
+    target_index = map_get_item(target);
+    if ( (target_index==-1) && (map_get_item_server(target)==-1)) error("Bad client id! %d",target);
+  }
+  else
+  {
+    if (server_mode)
+    {
+      if (!send_par.client__id().ispresent())
+        error("In server mode the client_id field of ASP_SCTP should be set to a valid value and not to omit!");
+    }
+    else // client mode
+    {
+      if (send_par.client__id().ispresent())
+        error("In client mode the client_id field of ASP_SCTP should be set to OMIT!");
+    }
+    target = fd;
+    if (server_mode)
+      target = (int) (const INTEGER&) send_par.client__id();
+    target_index = map_get_item(target);
+    if (target_index==-1) error("Bad client id! %d",target);
+  }
+
+  // the messages over the rate limit are queued or rejected
+  if (rate_limits && !rate_admit(target, send_par))
+  {
+    log("Leaving outgoing_send (ASP_SCTP).");
+    return;
+  }
+  send_asp(target, target_index, send_par);
+  if (engine) engine->flush();
+  log("Leaving outgoing_send (ASP_SCTP).");
+}
+
+
+// Sends the message of send_par, the failure is reported in ASP_SCTP_SENDMSG_ERROR.
+void SCTPasp__PT_PROVIDER::send_asp(int target, int target_index, const SCTPasp__Types::ASP__SCTP& send_par)
+{
+  uint32_t ui = int2ppid(send_par.sinfo__ppid());
+  // returned in ASP_SCTP_SEND_FAILED and ASP_SCTP_SENDMSG_ERROR, it is not sent to the peer
+  boolean has_context = send_par.sinfo__context().ispresent();
+  uint32_t context = has_context ? int2ppid(send_par.sinfo__context()()) : 0;
+
+  log("Sending SCTP message to file descriptor %d.", target);
+  int err = send_data(target, target_index, (int) send_par.sinfo__stream(), ui,
+    (const unsigned char *)send_par.data(), send_par.data().lengthof(), TRUE, context, has_context);
+  if (err != 0)
+  {
+    sendmsg_error(target, send_par);
+    TTCN_warning("Sendmsg error! Strerror=%s", strerror(err));
+  }
+}
+
+
+// Echoes back the ASP_SCTP that could not be sent.
+void SCTPasp__PT_PROVIDER::sendmsg_error(int target, const SCTPasp__Types::ASP__SCTP& send_par)
+{
+  SCTPasp__Types::ASP__SCTP__SENDMSG__ERROR asp_sctp_sendmsg_error;
+  if (server_mode) asp_sctp_sendmsg_error.client__id() = target;
+  else asp_sctp_sendmsg_error.client__id() = OMIT_VALUE;
+  asp_sctp_sendmsg_error.sinfo__stream() = send_par.sinfo__stream();
+  asp_sctp_sendmsg_error.sinfo__ppid() = send_par.sinfo__ppid();
+  asp_sctp_sendmsg_error.data() = send_par.data();
+  asp_sctp_sendmsg_error.sinfo__context() = send_par.sinfo__context();
+  incoming_message(asp_sctp_sendmsg_error);
+}
+
+
+int SCTPasp__PT_PROVIDER::send_data(int target, int target_index, unsigned int stream, uint32_t ppid,
+  const unsigned char *buf, size_t len, boolean report_error, uint32_t context, boolean has_context)
+{
+  if (has_context && target_index != -1) fd_map[target_index].context_sent = true;
+  if (target_index != -1 && fd_map[target_index].io_seq != 0)
+  { // the message is sent by the socket engine, its errors are reported asynchronously
+    if (!engine->send(target, stream, ppid, context, has_context, buf, len, report_error))
+    {
+      if (flight_recorder) flight_recorder->record(TRACE_TX_ERROR, target, len, stream, ENOBUFS);
+      return ENOBUFS;
+    }
+    if (flight_recorder) flight_recorder->record(TRACE_TX_DATA, target, len, stream, ppid);
+    if (rtt) rtt->request(target, ppid, buf, len);
+    if (capture) capture_message(target_index, true, false, stream, ppid, buf, len);
+    return 0;
+  }
+
+  int err = send_message(target, stream, ppid, buf, len, context);
+  if (err != 0)
+  {
+    if (flight_recorder) flight_recorder->record(TRACE_TX_ERROR, target, len, stream, err);
+    return err;
+  }
+  if (flight_recorder) flight_recorder->record(TRACE_TX_DATA, target, len, stream, ppid);
+  if (rtt) rtt->request(target, ppid, buf, len);
+  if (capture) capture_message(target_index, true, false, stream, ppid, buf, len);
+  return 0;
+}
+
+
+void SCTPasp__PT_PROVIDER::outgoing_send(const SCTPasp__Types::ASP__SCTP__RTT__Config& send_par)
+{
+  log("Calling outgoing_send (ASP_SCTP_RTT_CONFIG).");
+  if (send_par.timeout().ispresent())
+  {
+    if ((int) send_par.timeout()() <= 0) error("The timeout field of ASP_SCTP_RTT_Config should be positive!");
+    rtt_timeout = (int) send_par.timeout()();
+  }
+  if (send_par.keys().size_of() == 0)
+  {
+    log("Disabling the RTT correlator.");
+    delete rtt;
+    rtt = NULL;
+  }
+  else
+  {
+    if (!rtt) rtt = new rtt_correlator;
+    rtt->keys.clear();
+    rtt->clear();
+    rtt->timeout_ns = rtt_timeout * 1000000ULL;
+    for (int i = 0; i < send_par.keys().size_of(); i++)
+    {
+      const SCTPasp__Types::SCTP__RTT__KEY& key = send_par.keys()[i];
+      rtt_correlator::key_config kc;
+      kc.ppid = (uint32_t) key.sinfo__ppid().get_long_long_val();
+      kc.offset = (int) key.key__offset();
+      kc.length = (int) key.key__length();
+      rtt->keys.push_back(kc);
+      log("RTT correlator key: ppid %u, offset %d, length %d.", kc.ppid, kc.offset, kc.length);
+    }
+  }
+  log("Leaving outgoing_send (ASP_SCTP_RTT_CONFIG).");
+}
+
+
+void SCTPasp__PT_PROVIDER::outgoing_send(const SCTPasp__Types::ASP__SCTP__RTT__Query& send_par)
+{
+  log("Calling outgoing_send (ASP_SCTP_RTT_QUERY).");
+  SCTPasp__Types::ASP__SCTP__RTT__Report report;
+  report.stats() = NULL_VALUE;
+  if (rtt)
+  {
+    rtt->expire(monotonic_ns());
+    int n = 0;
+    for (std::map<int, rtt_correlator::stats_t>::iterator it = rtt->stats.begin(); it != rtt->stats.end(); ++it)
+    {
+      if (send_par.client__id().ispresent() && it->first != (int) send_par.client__id()()) continue;
+      const rtt_correlator::stats_t& st = it->second;
+      SCTPasp__Types::SCTP__RTT__STATS& entry = report.stats()[n++];
+      entry.client__id() = it->first;
+      entry.requests() = ull2int(st.requests);
+      entry.responses() = ull2int(st.responses);
+      entry.timeouts() = ull2int(st.timeouts);
+      entry.unmatched() = ull2int(st.unmatched);
+      // RTT values are reported in microseconds
+      entry.min__rtt() = ull2int(st.responses ? st.min_ns / 1000 : 0);
+      entry.max__rtt() = ull2int(st.max_ns / 1000);
+      entry.avg__rtt() = ull2int(st.responses ? st.sum_ns / st.responses / 1000 : 0);
+      for (int b = 0; b < RTT_HISTOGRAM_BUCKETS; b++)
+        entry.histogram()[b] = ull2int(st.histogram[b]);
+    }
+    if (send_par.reset())
+    {
+      if (send_par.client__id().ispresent()) rtt->stats.erase((int) send_par.client__id()());
+      else rtt->stats.clear();
+    }
+  }
+  incoming_message(report);
+  log("Leaving outgoing_send (ASP_SCTP_RTT_QUERY).");
+}
+
+
+void SCTPasp__PT_PROVIDER::outgoing_send(const SCTPasp__Types::ASP__SCTP__FlightRecorder__Dump& send_par)
+{
+  log("Calling outgoing_send (ASP_SCTP_FLIGHTRECORDER_DUMP).");
+  SCTPasp__Types::ASP__SCTP__RESULT asp_sctp_result;
+  asp_sctp_result.client__id() = OMIT_VALUE;
+  if (!flight_recorder)
+  {
+    asp_sctp_result.error__status() = TRUE;
+    asp_sctp_result.error__message() = "The flight recorder is not enabled";
+  }
+  else
+  {
+    int err = flight_recorder_dump(send_par.filename().ispresent() ? (const char *)send_par.filename()() : NULL);
+    asp_sctp_result.error__status() = err != 0;
+    if (err != 0) asp_sctp_result.error__message() = strerror(err);
+    else asp_sctp_result.error__message() = OMIT_VALUE;
+  }
+  incoming_message(asp_sctp_result);
+  log("Leaving outgoing_send (ASP_SCTP_FLIGHTRECORDER_DUMP).");
+}
+
+
+void SCTPasp__PT_PROVIDER::capture_message(int index, bool outgoing, bool notification,
+  unsigned int stream, uint32_t ppid, const void *data, size_t len)
+{
+  if (index == -1)
+  {
+    capture->submit(outgoing, notification, -1, stream, ppid, data, len, NULL, NULL);
+    return;
+  }
+  Association& item = fd_map[index];
+  if (!item.addr_valid)
+  { // the addresses are queried once per association
+    socklen_t addrlen = sizeof(item.local_addr);
+    if (transport->getsockname(item.fd, (struct sockaddr *)&item.local_addr, &addrlen) != 0)
+      item.local_addr.ss_family = AF_UNSPEC;
+    addrlen = sizeof(item.peer_addr);
+    if (transport->getpeername(item.fd, (struct sockaddr *)&item.peer_addr, &addrlen) != 0)
+      item.peer_addr.ss_family = AF_UNSPEC;
+    item.addr_valid = TRUE;
+    errno = 0;
+  }
+  uint64_t timestamp = 0;
+  if (!outgoing && item.rx_ts_valid)
+    timestamp = (uint64_t)item.rx_ts.tv_sec * 1000000000ULL + item.rx_ts.tv_nsec;
+  capture->submit(outgoing, notification, item.fd, stream, ppid, data, len,
+    &item.local_addr, &item.peer_addr, timestamp);
+}
+
+
+void SCTPasp__PT_PROVIDER::outgoing_send(const SCTPasp__Types::ASP__SCTP__Replay__Start& send_par)
+{
+  log("Calling outgoing_send (ASP_SCTP_REPLAY_START).");
+  if (replay) replay_stop(FALSE);
+  if ((double) send_par.speed() < 0) error("The speed field of ASP_SCTP_Replay_Start should not be negative!");
+  if ((int) send_par.loops() < 0) error("The loops field of ASP_SCTP_Replay_Start should not be negative!");
+
+  std::vector<int> targets;
+  get_targets(send_par.client__ids(), "ASP_SCTP_Replay_Start", targets);
+  replay = new replay_state;
+  replay->targets.swap(targets);
+  replay->speed = (double) send_par.speed();
+  replay->loops = (int) send_par.loops();
+  replay->loops_done = 0;
+  replay->pos = 0;
+  replay->late_threshold = (send_par.late__threshold().ispresent() ?
+    (int) send_par.late__threshold()() : 1000) * 1000ULL;
+  replay->sent = replay->late = replay->dropped = 0;
+
+  SCTPasp__Types::ASP__SCTP__RESULT asp_sctp_result;
+  asp_sctp_result.client__id() = OMIT_VALUE;
+  int err = replay->file.open(send_par.filename(),
+    send_par.src__port().ispresent() ? (int) send_par.src__port()() : 0);
+  if (err == 0 && replay->file.size() == 0) err = ENOMSG;
+  if (err != 0)
+  {
+    asp_sctp_result.error__status() = TRUE;
+    asp_sctp_result.error__message() = err == EINVAL ? "Unsupported capture file format" : strerror(err);
+    delete replay;
+    replay = NULL;
+  }
+  else
+  {
+    log("Replaying %lu messages of %u associations from %s.", (unsigned long)replay->file.size(),
+      replay->file.get_associations(), (const char *)send_par.filename());
+    asp_sctp_result.error__status() = FALSE;
+    asp_sctp_result.error__message() = OMIT_VALUE;
+    replay->start = monotonic_ns();
+    timer_arm(TIMER_REPLAY, replay->start);
+  }
+  incoming_message(asp_sctp_result);
+  log("Leaving outgoing_send (ASP_SCTP_REPLAY_START).");
+}
+
+
+void SCTPasp__PT_PROVIDER::outgoing_send(const SCTPasp__Types::ASP__SCTP__Replay__Stop& /*send_par*/)
+{
+  log("Calling outgoing_send (ASP_SCTP_REPLAY_STOP).");
+  if (replay) replay_stop(FALSE);
+  else
+  {
+    SCTPasp__Types::ASP__SCTP__RESULT asp_sctp_result;
+    asp_sctp_result.client__id() = OMIT_VALUE;
+    asp_sctp_result.error__status() = TRUE;
+    asp_sctp_result.error__message() = "No replay is running";
+    incoming_message(asp_sctp_result);
+  }
+  log("Leaving outgoing_send (ASP_SCTP_REPLAY_STOP).");
+}
+
+
+void SCTPasp__PT_PROVIDER::replay_run()
+{
+  unsigned long long now = monotonic_ns();
+  int budget = REPLAY_BATCH;
+  while (replay->pos < replay->file.size())
+  {
+    unsigned long long due = replay->due(replay->pos);
+    if (due > now)
+    {
+      timer_arm(TIMER_REPLAY, due);
+      return;
+    }
+    if (budget-- == 0)
+    { // giving the other events a chance
+      timer_arm(TIMER_REPLAY, now);
+      return;
+    }
+    const ReplayFile::message_t& m = replay->file[replay->pos];
+    int target = replay->targets[m.association % replay->targets.size()];
+    int index = map_get_item(target);
+    int err = index == -1 ? EBADF : send_data(target, index, m.stream, m.ppid, m.data, m.len);
+    if (err == EAGAIN || err == EWOULDBLOCK || err == ENOBUFS)
+    { // the socket or the queue of the socket engine is full, the message is not lost
+      timer_arm(TIMER_REPLAY, now + REPLAY_RETRY_DELAY * 1000ULL);
+      return;
+    }
+    if (now - due > replay->late_threshold) replay->late++;
+    if (err != 0) replay->dropped++;
+    else replay->sent++;
+    if (++replay->pos == replay->file.size())
+    {
+      replay->loops_done++;
+      if (replay->loops != 0 && replay->loops_done >= replay->loops) break;
+      replay->pos = 0;
+      replay->start = now;
+    }
+  }
+  replay_stop(TRUE);
+}
+
+
+void SCTPasp__PT_PROVIDER::replay_stop(boolean finished)
+{
+  timer_cancel(TIMER_REPLAY);
+  log("Replay %s: %llu sent, %llu late, %llu dropped.", finished ? "finished" : "stopped",
+    replay->sent, replay->late, replay->dropped);
+  SCTPasp__Types::ASP__SCTP__Replay__Report report(ull2int(replay->sent), ull2int(replay->late),
+    ull2int(replay->dropped), INTEGER(replay->loops_done), BOOLEAN(finished));
+  delete replay;
+  replay = NULL;
+  incoming_message(report);
+}
+
+
+void SCTPasp__PT_PROVIDER::outgoing_send(const SCTPasp__Types::ASP__SCTP__Generator__Start& send_par)
+{
+  log("Calling outgoing_send (ASP_SCTP_GENERATOR_START).");
+  if (generator) generator_stop(FALSE);
+  if (send_par.templates().size_of() == 0) error("The templates field of ASP_SCTP_Generator_Start should not be empty!");
+  if ((double) send_par.rate() < 0) error("The rate field of ASP_SCTP_Generator_Start should not be negative!");
+  if (send_par.outstanding().ispresent() && (int) send_par.outstanding()() <= 0)
+    error("The outstanding field of ASP_SCTP_Generator_Start should be positive!");
+  if ((double) send_par.rate() == 0 && !send_par.outstanding().ispresent()
+      && !send_par.count().ispresent() && !send_par.duration().ispresent())
+    error("ASP_SCTP_Generator_Start: an unlimited rate requires the outstanding, count or duration field!");
+
+  std::vector<int> targets;
+  get_targets(send_par.client__ids(), "ASP_SCTP_Generator_Start", targets);
+  generator = new generator_state;
+  generator->targets.swap(targets);
+  for (int i = 0; i < send_par.templates().size_of(); i++)
+  {
+    const SCTPasp__Types::SCTP__GENERATOR__TEMPLATE& t = send_par.templates()[i];
+    generator_state::template_t gt;
+    gt.stream = (int) t.sinfo__stream();
+    gt.ppid = int2ppid(t.sinfo__ppid());
+    const unsigned char *data = (const unsigned char *)t.data();
+    gt.data.assign(data, data + t.data().lengthof());
+    for (int j = 0; j < t.patches().size_of(); j++)
+    {
+      generator_state::patch_t p;
+      p.offset = (int) t.patches()[j].offset();
+      p.length = (int) t.patches()[j].length();
+      if (p.offset + p.length > gt.data.size())
+      {
+        delete generator;
+        generator = NULL;
+        error("ASP_SCTP_Generator_Start: patch %d of template %d is out of the data!", j, i);
+      }
+      p.value = t.patches()[j].initial__value().get_long_long_val();
+      p.increment = t.patches()[j].increment().get_long_long_val();
+      gt.patches.push_back(p);
+    }
+    generator->templates.push_back(gt);
+  }
+  generator->rate = (double) send_par.rate();
+  generator->outstanding = send_par.outstanding().ispresent() ? (int) send_par.outstanding()() : 0;
+  generator->count = send_par.count().ispresent() ? send_par.count()().get_long_long_val() : 0;
+  generator->start = monotonic_ns();
+  generator->deadline = send_par.duration().ispresent() ?
+    generator->start + (unsigned long long)((double) send_par.duration()() * 1e9) : 0;
+  generator->next = generator->sent = generator->errors = generator->responses = generator->in_flight = 0;
+  generator->unanswered = 0;
+  for (size_t i = 0; i < generator->targets.size(); i++)
+    fd_map[map_get_item(generator->targets[i])].generator_target = TRUE;
+
+  SCTPasp__Types::ASP__SCTP__RESULT asp_sctp_result;
+  asp_sctp_result.client__id() = OMIT_VALUE;
+  asp_sctp_result.error__status() = FALSE;
+  asp_sctp_result.error__message() = OMIT_VALUE;
+  incoming_message(asp_sctp_result);
+  timer_arm(TIMER_GENERATOR, generator->start);
+  log("Leaving outgoing_send (ASP_SCTP_GENERATOR_START).");
+}
+
+
+void SCTPasp__PT_PROVIDER::outgoing_send(const SCTPasp__Types::ASP__SCTP__Generator__Stop& /*send_par*/)
+{
+  log("Calling outgoing_send (ASP_SCTP_GENERATOR_STOP).");
+  if (generator) generator_stop(FALSE);
+  else
+  {
+    SCTPasp__Types::ASP__SCTP__RESULT asp_sctp_result;
+    asp_sctp_result.client__id() = OMIT_VALUE;
+    asp_sctp_result.error__status() = TRUE;
+    asp_sctp_result.error__message() = "The generator is not running";
+    incoming_message(asp_sctp_result);
+  }
+  log("Leaving outgoing_send (ASP_SCTP_GENERATOR_STOP).");
+}
+
+
+void SCTPasp__PT_PROVIDER::get_targets(const SCTPasp__Types::SCTP__CLIENT__ID__LIST& client_ids,
+  const char *asp_name, std::vector<int>& targets)
+{
+  if (client_ids.size_of() == 0)
+  {
+    if (!simple_mode || server_mode)
+      error("The client_ids field of %s should not be empty in NORMAL and server mode!", asp_name);
+    if (map_get_item(fd) == -1) error("%s: there is no open association!", asp_name);
+    targets.push_back(fd);
+  }
+  for (int i = 0; i < client_ids.size_of(); i++)
+  {
+    int target = (int) client_ids[i];
+    if (map_get_item(target) == -1) error("Bad client id! %d", target);
+    targets.push_back(target);
+  }
+}
+
+
+void SCTPasp__PT_PROVIDER::generator_run()
+{
+  unsigned long long now = monotonic_ns();
+  if (generator->deadline != 0 && now >= generator->deadline)
+  {
+    generator_stop(TRUE);
+    return;
+  }
+  int budget = GENERATOR_BATCH;
+  while (generator->count == 0 || generator->next < generator->count)
+  {
+    if (generator->outstanding != 0 && generator->in_flight >= generator->outstanding)
+    { // continued by the next response
+      if (generator->deadline != 0) timer_arm(TIMER_GENERATOR, generator->deadline);
+      return;
+    }
+    unsigned long long due = generator->due(generator->next);
+    if (due > now)
+    {
+      timer_arm(TIMER_GENERATOR, generator->deadline != 0 && generator->deadline < due ? generator->deadline : due);
+      return;
+    }
+    if (budget-- == 0)
+    { // giving the other events a chance
+      timer_arm(TIMER_GENERATOR, now);
+      return;
+    }
+    unsigned long long n = generator->next++;
+    generator_state::template_t& t = generator->templates[n % generator->templates.size()];
+    for (size_t p = 0; p < t.patches.size(); p++)
+    { // big endian counter
+      generator_state::patch_t& patch = t.patches[p];
+      unsigned long long value = patch.value;
+      for (size_t b = patch.length; b > 0; b--, value >>= 8) t.data[patch.offset + b - 1] = value & 0xff;
+      patch.value += patch.increment;
+    }
+    int target = generator->targets[n % generator->targets.size()];
+    int index = map_get_item(target);
+    if (index == -1 || send_data(target, index, t.stream, t.ppid, t.data.data(), t.data.size()) != 0)
+      generator->errors++;
+    else
+    {
+      generator->sent++;
+      generator->in_flight++;
+      generator->pending[target]++;
+    }
+  }
+  generator_stop(TRUE);
+}
+
+
+void SCTPasp__PT_PROVIDER::generator_stop(boolean finished)
+{
+  timer_cancel(TIMER_GENERATOR);
+  double elapsed = (monotonic_ns() - generator->start) / 1e9;
+  // the requests still in flight are not answered
+  unsigned long long unanswered = generator->unanswered + generator->in_flight;
+  log("Generator %s: %llu sent, %llu errors, %llu responses, %llu unanswered in %.3f s.",
+    finished ? "finished" : "stopped", generator->sent, generator->errors, generator->responses, unanswered, elapsed);
+  for (size_t i = 0; i < generator->targets.size(); i++)
+  {
+    int index = map_get_item(generator->targets[i]);
+    if (index != -1) fd_map[index].generator_target = FALSE;
+  }
+  SCTPasp__Types::ASP__SCTP__Generator__Report report(ull2int(generator->sent), ull2int(generator->errors),
+    ull2int(generator->responses), ull2int(unanswered), FLOAT(elapsed), FLOAT(elapsed > 0 ? generator->sent / elapsed : 0.0),
+    BOOLEAN(finished));
+  delete generator;
+  generator = NULL;
+  incoming_message(report);
+}
+
+
+void SCTPasp__PT_PROVIDER::outgoing_send(const SCTPasp__Types::ASP__SCTP__Reflector__Config& send_par)
+{
+  log("Calling outgoing_send (ASP_SCTP_REFLECTOR_CONFIG).");
+  if (reflector) reflector_disable();
+  if (send_par.sample__interval().ispresent() && (int) send_par.sample__interval()() < 0)
+    error("The sample_interval field of ASP_SCTP_Reflector_Config should not be negative!");
+
+  if (send_par.rules().size_of() != 0)
+  {
+    std::vector<int> targets;
+    for (int i = 0; i < send_par.client__ids().size_of(); i++)
+    {
+      int target = (int) send_par.client__ids()[i];
+      if (map_get_item(target) == -1) error("Bad client id! %d", target);
+      targets.push_back(target);
+    }
+    reflector_state *r = new reflector_state;
+    for (int i = 0; i < send_par.rules().size_of(); i++)
+    {
+      const SCTPasp__Types::SCTP__REFLECTOR__RULE& rule = send_par.rules()[i];
+      reflector_state::rule_t rr;
+      rr.stream = rule.sinfo__stream().ispresent() ? (int) rule.sinfo__stream()() : -1;
+      rr.ppid = rule.sinfo__ppid().ispresent() ? int2ppid(rule.sinfo__ppid()()) : -1;
+      rr.response_stream = rule.response__stream().ispresent() ? (int) rule.response__stream()() : -1;
+      rr.response_ppid = rule.response__ppid().ispresent() ? int2ppid(rule.response__ppid()()) : -1;
+      rr.echo = !rule.response().ispresent();
+      if (!rr.echo)
+      {
+        const OCTETSTRING& response = rule.response()();
+        if (response.lengthof() == 0)
+        { // an SCTP message cannot be empty
+          delete r;
+          error("ASP_SCTP_Reflector_Config: the response of rule %d is empty!", i);
+        }
+        rr.response.assign((const unsigned char *)response, (const unsigned char *)response + response.lengthof());
+        rr.reply = rr.response;
+      }
+      for (int j = 0; j < rule.copies().size_of(); j++)
+      {
+        reflector_state::copy_t c;
+        c.src_offset = (int) rule.copies()[j].src__offset();
+        c.dst_offset = (int) rule.copies()[j].dst__offset();
+        c.length = (int) rule.copies()[j].length();
+        if (rr.echo || c.dst_offset + c.length > rr.response.size())
+        {
+          delete r;
+          error("ASP_SCTP_Reflector_Config: copy %d of rule %d is out of the response!", j, i);
+        }
+        rr.copies.push_back(c);
+      }
+      r->rules.push_back(rr);
+    }
+    r->all_associations = targets.empty();
+    r->forward_unmatched = send_par.forward__unmatched();
+    r->sample_interval = send_par.sample__interval().ispresent() ? (int) send_par.sample__interval()() : 0;
+    r->reflected = r->errors = r->forwarded = 0;
+    for (size_t i = 0; i < targets.size(); i++) fd_map[map_get_item(targets[i])].reflector_target = TRUE;
+    reflector = r;
+  }
+
+  SCTPasp__Types::ASP__SCTP__RESULT asp_sctp_result;
+  asp_sctp_result.client__id() = OMIT_VALUE;
+  asp_sctp_result.error__status() = FALSE;
+  asp_sctp_result.error__message() = OMIT_VALUE;
+  incoming_message(asp_sctp_result);
+  log("Leaving outgoing_send (ASP_SCTP_REFLECTOR_CONFIG).");
+}
+
+
+// Answers the message received on fd_map[index]. Returns TRUE if the message should be
+// delivered to the TTCN-3 as well.
+boolean SCTPasp__PT_PROVIDER::reflect(int index, unsigned int stream, uint32_t ppid)
+{
+  const unsigned char *request = (const unsigned char *)fd_map[index].buf;
+  size_t request_len = fd_map[index].nr;
+  for (size_t r = 0; r < reflector->rules.size(); r++)
+  {
+    reflector_state::rule_t& rule = reflector->rules[r];
+    if ((rule.stream != -1 && (unsigned int)rule.stream != stream) ||
+        (rule.ppid != -1 && (uint32_t)rule.ppid != ppid)) continue;
+
+    const unsigned char *data = request;
+    size_t len = request_len;
+    if (!rule.echo)
+    {
+      // only the copied parts differ from the response, they are restored first,
+      // so the parts missing from a short request come from the response
+      for (size_t c = 0; c < rule.copies.size(); c++)
+      {
+        const reflector_state::copy_t& copy = rule.copies[c];
+        memcpy(rule.reply.data() + copy.dst_offset, rule.response.data() + copy.dst_offset, copy.length);
+      }
+      for (size_t c = 0; c < rule.copies.size(); c++)
+      {
+        const reflector_state::copy_t& copy = rule.copies[c];
+        if (copy.src_offset >= request_len) continue;
+        size_t n = request_len - copy.src_offset < copy.length ? request_len - copy.src_offset : copy.length;
+        memcpy(rule.reply.data() + copy.dst_offset, request + copy.src_offset, n);
+      }
+      data = rule.reply.data();
+      len = rule.reply.size();
+    }
+    if (send_data(fd_map[index].fd, index,
+          rule.response_stream != -1 ? (unsigned int)rule.response_stream : stream,
+          rule.response_ppid != -1 ? (uint32_t)rule.response_ppid : ppid, data, len) == 0)
+      reflector->reflected++;
+    else reflector->errors++;
+    if (reflector->sample_interval != 0 && (reflector->reflected + reflector->errors) % reflector->sample_interval == 0)
+    {
+      reflector->forwarded++;
+      return TRUE;
+    }
+    return FALSE;
+  }
+  if (!reflector->forward_unmatched) return FALSE;
+  reflector->forwarded++;
+  return TRUE;
+}
+
+
+void SCTPasp__PT_PROVIDER::reflector_disable()
+{
+  log("Reflector disabled: %llu reflected, %llu errors, %llu forwarded.",
+    reflector->reflected, reflector->errors, reflector->forwarded);
+  for (int i = 0; i < fd_map.size(); i++) fd_map[i].reflector_target = FALSE;
+  delete reflector;
+  reflector = NULL;
+}
+
+
+void SCTPasp__PT_PROVIDER::outgoing_send(const SCTPasp__Types::ASP__SCTP__Filter__Config& send_par)
+{
+  log("Calling outgoing_send (ASP_SCTP_FILTER_CONFIG).");
+  filter_state *f = NULL;
+  if (send_par.filters().size_of() != 0)
+  {
+    f = new filter_state;
+    f->unmatched = 0;
+    for (int i = 0; i < send_par.filters().size_of(); i++)
+    {
+      const SCTPasp__Types::SCTP__FILTER& filter = send_par.filters()[i];
+      filter_state::filter_t ff;
+      ff.client_id = filter.client__id().ispresent() ? (int) filter.client__id()() : -1;
+      ff.stream = filter.sinfo__stream().ispresent() ? (int) filter.sinfo__stream()() : -1;
+      ff.ppid = filter.sinfo__ppid().ispresent() ? int2ppid(filter.sinfo__ppid()()) : -1;
+      ff.action = filter.action();
+      ff.sample_interval = filter.sample__interval().ispresent() ? (int) filter.sample__interval()() : 0;
+      if (ff.action == SCTPasp__Types::SCTP__FILTER__ACTION::SCTP__FILTER__SAMPLE && (long long) ff.sample_interval <= 0)
+      {
+        delete f;
+        error("ASP_SCTP_Filter_Config: the sample_interval of filter %d should be positive!", i);
+      }
+      for (int j = 0; j < filter.masks().size_of(); j++)
+      {
+        const SCTPasp__Types::SCTP__FILTER__MASK& mask = filter.masks()[j];
+        int len = mask.value().lengthof();
+        if (mask.mask().ispresent() && mask.mask()().lengthof() != len)
+        {
+          delete f;
+          error("ASP_SCTP_Filter_Config: the value and the mask of mask %d of filter %d differ in length!", j, i);
+        }
+        filter_state::mask_t m;
+        m.offset = (int) mask.offset();
+        const unsigned char *value = (const unsigned char *)mask.value();
+        m.value.assign(value, value + len);
+        if (mask.mask().ispresent())
+        {
+          const unsigned char *bits = (const unsigned char *)mask.mask()();
+          m.mask.assign(bits, bits + len);
+        }
+        else m.mask.assign(len, 0xff);
+        for (int k = 0; k < len; k++) m.value[k] &= m.mask[k];
+        ff.masks.push_back(m);
+      }
+      ff.matched = ff.delivered = ff.dropped = 0;
+      f->filters.push_back(ff);
+    }
+  }
+  delete filters;
+  filters = f;
+
+  SCTPasp__Types::ASP__SCTP__RESULT asp_sctp_result;
+  asp_sctp_result.client__id() = OMIT_VALUE;
+  asp_sctp_result.error__status() = FALSE;
+  asp_sctp_result.error__message() = OMIT_VALUE;
+  incoming_message(asp_sctp_result);
+  log("Leaving outgoing_send (ASP_SCTP_FILTER_CONFIG).");
+}
+
+
+void SCTPasp__PT_PROVIDER::outgoing_send(const SCTPasp__Types::ASP__SCTP__Filter__Query& send_par)
+{
+  log("Calling outgoing_send (ASP_SCTP_FILTER_QUERY).");
+  SCTPasp__Types::ASP__SCTP__Filter__Report report;
+  report.counters() = NULL_VALUE;
+  report.unmatched() = 0;
+  if (filters)
+  {
+    for (size_t i = 0; i < filters->filters.size(); i++)
+    {
+      filter_state::filter_t& f = filters->filters[i];
+      report.counters()[i] = SCTPasp__Types::SCTP__FILTER__COUNTERS(ull2int(f.matched),
+        ull2int(f.delivered), ull2int(f.dropped));
+      if (send_par.reset()) f.matched = f.delivered = f.dropped = 0;
+    }
+    report.unmatched() = ull2int(filters->unmatched);
+    if (send_par.reset()) filters->unmatched = 0;
+  }
+  incoming_message(report);
+  log("Leaving outgoing_send (ASP_SCTP_FILTER_QUERY).");
+}
+
+
+void SCTPasp__PT_PROVIDER::outgoing_send(const SCTPasp__Types::ASP__SCTP__Rate__Config& send_par)
+{
+  log("Calling outgoing_send (ASP_SCTP_RATE_CONFIG).");
+  if ((int) send_par.rate() < 0) error("The rate field of ASP_SCTP_Rate_Config should not be negative!");
+  if (send_par.burst().ispresent() && (int) send_par.burst()() <= 0)
+    error("The burst field of ASP_SCTP_Rate_Config should be positive!");
+  if (send_par.queue__limit().ispresent() && (int) send_par.queue__limit()() < 0)
+    error("The queue_limit field of ASP_SCTP_Rate_Config should not be negative!");
+  if (!rate_limits) rate_limits = new rate_state;
+  rate_state::rate_key key(send_par.client__id().ispresent() ? (int) send_par.client__id()() : -1,
+    send_par.sinfo__stream().ispresent() ? (int) send_par.sinfo__stream()() : -1);
+  if ((int) send_par.rate() == 0)
+  { // the queued messages of the removed limit are sent at once
+    rate_limits->limits.erase(key);
+    std::map<rate_state::rate_key, rate_state::bucket_t>::iterator it = rate_limits->buckets.begin();
+    while (it != rate_limits->buckets.end())
+    {
+      if (it->second.limit != key)
+      {
+        ++it;
+        continue;
+      }
+      int target = it->first.first;
+      for (size_t i = 0; i < it->second.queue.size(); i++)
+        send_asp(target, map_get_item(target), it->second.queue[i]);
+      rate_limits->backlog.erase(it->first);
+      rate_limits->buckets.erase(it++);
+    }
+    if (engine) engine->flush();
+    log("Rate limit removed: client %d, stream %d.", key.first, key.second);
+  }
+  else
+  {
+    rate_state::limit_t& l = rate_limits->limits[key];
+    l.rate = (int) send_par.rate();
+    l.burst = send_par.burst().ispresent() ? (int) send_par.burst()() : 1;
+    l.reject = send_par.action() == SCTPasp__Types::SCTP__RATE__ACTION::SCTP__RATE__REJECT;
+    l.queue_limit = send_par.queue__limit().ispresent() ? (int) send_par.queue__limit()() : 0;
+    log("Rate limit: client %d, stream %d, %.0f messages/s, burst %.0f.", key.first, key.second, l.rate, l.burst);
+    // the buckets of the keys the new limit is the most specific for take it over
+    std::map<rate_state::rate_key, rate_state::bucket_t>::iterator it;
+    for (it = rate_limits->buckets.begin(); it != rate_limits->buckets.end(); ++it)
+    {
+      std::map<rate_state::rate_key, rate_state::limit_t>::iterator found =
+        rate_limits->find_limit(it->first.first, it->first.second);
+      if (found->first.second == it->first.second) it->second.limit = found->first;
+    }
+    // the queues are served at the new rate from now on
+    if (!rate_limits->backlog.empty()) timer_arm(TIMER_RATE, monotonic_ns());
+  }
+
+  SCTPasp__Types::ASP__SCTP__RESULT asp_sctp_result;
+  asp_sctp_result.client__id() = OMIT_VALUE;
+  asp_sctp_result.error__status() = FALSE;
+  asp_sctp_result.error__message() = OMIT_VALUE;
+  incoming_message(asp_sctp_result);
+  log("Leaving outgoing_send (ASP_SCTP_RATE_CONFIG).");
+}
+
+
+void SCTPasp__PT_PROVIDER::outgoing_send(const SCTPasp__Types::ASP__SCTP__Rate__Query& send_par)
+{
+  log("Calling outgoing_send (ASP_SCTP_RATE_QUERY).");
+  SCTPasp__Types::ASP__SCTP__Rate__Report report;
+  report.stats() = NULL_VALUE;
+  if (rate_limits)
+  {
+    int n = 0;
+    std::map<rate_state::rate_key, rate_state::bucket_t>::iterator it;
+    for (it = rate_limits->buckets.begin(); it != rate_limits->buckets.end(); ++it)
+    {
+      rate_state::bucket_t& b = it->second;
+      std::map<rate_state::rate_key, rate_state::limit_t>::iterator l = rate_limits->limits.find(b.limit);
+      report.stats()[n++] = SCTPasp__Types::SCTP__RATE__STATS(INTEGER(it->first.first),
+        it->first.second == -1 ? OPTIONAL<INTEGER>(OMIT_VALUE) : OPTIONAL<INTEGER>(INTEGER(it->first.second)),
+        INTEGER(l != rate_limits->limits.end() ? (int) l->second.rate : 0), ull2int(b.sent), ull2int(b.delayed),
+        ull2int(b.rejected), INTEGER((int) b.queue.size()));
+      if (send_par.reset()) b.sent = b.delayed = b.rejected = 0;
+    }
+  }
+  incoming_message(report);
+  log("Leaving outgoing_send (ASP_SCTP_RATE_QUERY).");
+}
+
+
+// Applies the first matching receive filter. Returns TRUE if the message should be
+// delivered to the TTCN-3.
+boolean SCTPasp__PT_PROVIDER::filter_message(int client_id, unsigned int stream, uint32_t ppid,
+  const unsigned char *data, size_t len)
+{
+  for (size_t i = 0; i < filters->filters.size(); i++)
+  {
+    filter_state::filter_t& f = filters->filters[i];
+    if ((f.client_id != -1 && f.client_id != client_id) ||
+        (f.stream != -1 && (unsigned int)f.stream != stream) ||
+        (f.ppid != -1 && (uint32_t)f.ppid != ppid)) continue;
+    size_t m = 0;
+    for (; m < f.masks.size(); m++)
+    {
+      const filter_state::mask_t& mask = f.masks[m];
+      if (mask.offset + mask.value.size() > len) break;
+      size_t k = 0;
+      while (k < mask.value.size() && (data[mask.offset + k] & mask.mask[k]) == mask.value[k]) k++;
+      if (k < mask.value.size()) break;
+    }
+    if (m < f.masks.size()) continue;
+
+    f.matched++;
+    boolean deliver;
+    switch (f.action)
+    {
+      case SCTPasp__Types::SCTP__FILTER__ACTION::SCTP__FILTER__DROP:
+        deliver = FALSE;
+        break;
+      case SCTPasp__Types::SCTP__FILTER__ACTION::SCTP__FILTER__SAMPLE:
+        deliver = (f.matched - 1) % f.sample_interval == 0;
+        break;
+      default:
+        deliver = TRUE;
+        break;
+    }
+    if (deliver) f.delivered++;
+    else f.dropped++;
+    return deliver;
+  }
+  filters->unmatched++;
+  return TRUE;
+}
+
+
+void SCTPasp__PT_PROVIDER::bundle_flush()
+{
+  timer_cancel(TIMER_BUNDLE);
+  log("Delivering a bundle of %d messages.", bundle.size_of());
+  incoming_message(bundle);
+  bundle = NULL_VALUE;
+}
+
+
+// Delivers the first PEER_ADDR_CHANGE of an association at once and suppresses the
+// following ones within coalesce_window. The suppressed notifications are reported in one
+// ASP with repeat_count when the window ends.
+void SCTPasp__PT_PROVIDER::peer_addr_change(int client_id, SCTPasp__Types::SPC__STATE::enum_type state,
+  int detection)
+{
+  if (!coalesce) coalesce = new coalesce_state;
+  unsigned long long now = monotonic_ns();
+  std::map<int, coalesce_state::window_t>::iterator it = coalesce->windows.find(client_id);
+  if (it != coalesce->windows.end() && now < it->second.deadline)
+  {
+    it->second.repeats++;
+    it->second.state = state;
+    return;
+  }
+  if (it != coalesce->windows.end()) coalesce_expired(client_id);
+  incoming_message(SCTPasp__Types::ASP__SCTP__PEER__ADDR__CHANGE(INTEGER(client_id),
+    SCTPasp__Types::SPC__STATE(state), OMIT_VALUE, optional_time(detection)));
+  coalesce_state::window_t& w = coalesce->windows[client_id];
+  w.deadline = now + coalesce_window * 1000000ULL;
+  w.repeats = 0;
+  w.state = state;
+  if (timer_deadline[TIMER_COALESCE] == 0 || w.deadline < timer_deadline[TIMER_COALESCE])
+    timer_arm(TIMER_COALESCE, w.deadline);
+}
+
+
+// Closes the window of client_id, or the expired windows if client_id is -1.
+void SCTPasp__PT_PROVIDER::coalesce_expired(int client_id)
+{
+  unsigned long long now = monotonic_ns();
+  unsigned long long next = 0;
+  std::map<int, coalesce_state::window_t>::iterator it = coalesce->windows.begin();
+  while (it != coalesce->windows.end())
+  {
+    if (client_id == -1 ? it->second.deadline > now : it->first != client_id)
+    {
+      if (next == 0 || it->second.deadline < next) next = it->second.deadline;
+      ++it;
+      continue;
+    }
+    if (it->second.repeats > 0)
+      incoming_message(SCTPasp__Types::ASP__SCTP__PEER__ADDR__CHANGE(INTEGER(it->first),
+        SCTPasp__Types::SPC__STATE(it->second.state), INTEGER(it->second.repeats), OMIT_VALUE));
+    coalesce->windows.erase(it++);
+  }
+  if (next == 0) timer_cancel(TIMER_COALESCE);
+  else timer_arm(TIMER_COALESCE, next);
+}
+
+
+// Starts the connect timeout of the association in progress, a timeout of 0 disables it.
+void SCTPasp__PT_PROVIDER::connect_arm(int index, int timeout)
+{
+  if (timeout <= 0) return;
+  if (!connect_deadlines) connect_deadlines = new connect_timers;
+  unsigned long long deadline = monotonic_ns() + timeout * 1000000ULL;
+  fd_map[index].connect_deadline = deadline;
+  connect_deadlines->pending.insert(std::make_pair(deadline, fd_map[index].fd));
+  if (timer_deadline[TIMER_CONNECT] == 0 || deadline < timer_deadline[TIMER_CONNECT])
+    timer_arm(TIMER_CONNECT, deadline);
+}
+
+
+// Closes the associations whose connect has not finished by their deadline.
+void SCTPasp__PT_PROVIDER::connect_expired()
+{
+  unsigned long long now = monotonic_ns();
+  std::multimap<unsigned long long, int>::iterator it = connect_deadlines->pending.begin();
+  while (it != connect_deadlines->pending.end() && it->first <= now)
+  {
+    unsigned long long deadline = it->first;
+    int client_id = it->second;
+    connect_deadlines->pending.erase(it++);
+    int i = map_get_item(client_id);
+    // the connect is finished or the socket is reused by a later connect
+    if (i == -1 || !fd_map[i].einprogress || fd_map[i].connect_deadline != deadline) continue;
+    if (flight_recorder) flight_recorder->record(TRACE_CONNECT_FAILED, client_id, 0, 0, ETIMEDOUT);
+    if (fd == client_id) fd = -1;
+    TTCN_warning("Connect error!");
+    SCTPasp__Types::ASP__SCTP__RESULT asp_sctp_result;
+    asp_sctp_result.client__id() = client_id;
+    asp_sctp_result.error__status() = TRUE;
+    asp_sctp_result.error__message() = "Connection establishment timed out";
+    incoming_message(asp_sctp_result);
+    map_delete_item(i);
+    log("Connection establishment of client %d timed out.", client_id);
+  }
+  if (!connect_deadlines->pending.empty()) timer_arm(TIMER_CONNECT, connect_deadlines->pending.begin()->first);
+}
+
+
+// Accepts an association on the listening socket if the admission control lets it
+// in. The associations over the limits are aborted, or the listener is paused until
+// they can be accepted. local_IP_address is reported in ASP_SCTP_Connected, NULL in
+// simple mode.
+void SCTPasp__PT_PROVIDER::accept_association(int listener_fd, unsigned short listener_port,
+  const CHARSTRING *local_IP_address)
+{
+  if (!admission)
+  {
+    admission = new admission_state;
+    admission->bucket.reset(accept_rate, monotonic_ns());
+  }
+  int reason;
+  if (overload_pause && (reason = admission_check(listener_port)) != -1)
+  {
+    admission_refused(listener_fd, listener_port, reason, -1, 0);
+    return;
+  }
+  int newclient_fd;
+  struct sockaddr_storage peer_address;
+  socklen_t addrlen = sizeof(peer_address);
+  if ((newclient_fd = transport->accept(listener_fd, (struct sockaddr *)&peer_address, &addrlen, true)) == -1)
+  {
+    switch (errno)
+    {
+      case EAGAIN:
+      case ECONNABORTED:
+      case EINTR:
+        break; // the connection is gone or was accepted already
+      case EMFILE:
+      case ENFILE:
+      case ENOBUFS:
+      case ENOMEM:
+        admission_refused(listener_fd, listener_port,
+          SCTPasp__Types::SCTP__OVERLOAD__REASON::SCTP__OVERLOAD__ACCEPT__ERROR, -1, errno);
+        break;
+      default:
+        error("Event handler: accept error (server mode)!");
+    }
+    errno = 0;
+    return;
+  }
+  if (!overload_pause && (reason = admission_check(listener_port)) != -1)
+  {
+    admission_refused(listener_fd, listener_port, reason, newclient_fd, 0);
+    return;
+  }
+  if (accept_rate > 0) admission->bucket.take(); // only the accepted associations take a token
+  map_put_item(newclient_fd);
+  fd_map[map_get_item(newclient_fd)].listener_port = listener_port;
+  admission_state::listener_t& l = admission->listener(listener_port);
+  l.associations++;
+  if (l.overloaded)
+  {
+    l.overloaded = FALSE;
+    log("The overload of the listener on port %d is over, %d associations were refused.",
+      listener_port, l.refused);
+    incoming_message(SCTPasp__Types::ASP__SCTP__OVERLOAD(INTEGER(listener_port), FALSE,
+      SCTPasp__Types::SCTP__OVERLOAD__REASON((SCTPasp__Types::SCTP__OVERLOAD__REASON::enum_type)l.reason),
+      INTEGER(fd_map.count()), INTEGER(l.associations), INTEGER(l.refused), OMIT_VALUE));
+  }
+  apply_bound_profile(newclient_fd, listener_port);
+  watch_socket(newclient_fd);
+  if (flight_recorder) flight_recorder->record(TRACE_ACCEPT, newclient_fd, 0, 0, listener_fd);
+  if (local_IP_address)
+    incoming_message(SCTPasp__Types::ASP__SCTP__Connected(
+                  INTEGER(newclient_fd),
+                  *local_IP_address,
+                  INTEGER(listener_port),
+                  get_ip(&peer_address),
+                  get_port(&peer_address)));
+}
+
+
+// Returns the SCTP_OVERLOAD_REASON if no association can be accepted on
+// listener_port, -1 otherwise. The token of the accept rate is taken by the
+// caller once the association is accepted.
+int SCTPasp__PT_PROVIDER::admission_check(unsigned short listener_port)
+{
+  if (max_associations > 0 && fd_map.count() >= max_associations)
+    return SCTPasp__Types::SCTP__OVERLOAD__REASON::SCTP__OVERLOAD__PORT__LIMIT;
+  if (max_listener_associations > 0 && admission->listener(listener_port).associations >= max_listener_associations)
+    return SCTPasp__Types::SCTP__OVERLOAD__REASON::SCTP__OVERLOAD__LISTENER__LIMIT;
+  if (accept_rate > 0)
+  {
+    admission->bucket.refill(accept_rate, accept_rate, monotonic_ns());
+    if (admission->bucket.tokens < 1) return SCTPasp__Types::SCTP__OVERLOAD__REASON::SCTP__OVERLOAD__ACCEPT__RATE;
+  }
+  return -1;
+}
+
+
+// Refuses an association on listener_port: client_fd is aborted if the association
+// is accepted already, otherwise the listener is paused. The start of the overload
+// is reported once, its end by the next accepted association.
+void SCTPasp__PT_PROVIDER::admission_refused(int listener_fd, unsigned short listener_port, int reason,
+  int client_fd, int accept_errno)
+{
+  admission_state::listener_t& l = admission->listener(listener_port);
+  if (!l.overloaded)
+  {
+    l.overloaded = TRUE;
+    l.reason = reason;
+    l.refused = 0;
+    log("The listener on port %d is overloaded.", listener_port);
+    incoming_message(SCTPasp__Types::ASP__SCTP__OVERLOAD(INTEGER(listener_port), TRUE,
+      SCTPasp__Types::SCTP__OVERLOAD__REASON((SCTPasp__Types::SCTP__OVERLOAD__REASON::enum_type)reason),
+      INTEGER(fd_map.count()), INTEGER(l.associations), OMIT_VALUE,
+      accept_errno != 0 ? OPTIONAL<CHARSTRING>(CHARSTRING(strerror(accept_errno))) : OPTIONAL<CHARSTRING>(OMIT_VALUE)));
+  }
+  if (client_fd != -1)
+  { // aborted by SO_LINGER with zero timeout
+    struct linger so_linger;
+    so_linger.l_onoff = 1;
+    so_linger.l_linger = 0;
+    if (transport->setsockopt(client_fd, SOL_SOCKET, SO_LINGER, &so_linger, sizeof (so_linger)) < 0) errno = 0;
+    transport->close(client_fd);
+    l.refused++;
+    return;
+  }
+  Handler_Remove_Fd_Read(listener_fd);
+  if (std::find(l.paused_fds.begin(), l.paused_fds.end(), listener_fd) == l.paused_fds.end())
+    l.paused_fds.push_back(listener_fd);
+  l.paused_by = reason;
+  // the limits of the associations are checked again when an association is closed
+  unsigned long long deadline = 0;
+  if (reason == SCTPasp__Types::SCTP__OVERLOAD__REASON::SCTP__OVERLOAD__ACCEPT__RATE)
+    deadline = admission->bucket.next_token(accept_rate);
+  else if (reason == SCTPasp__Types::SCTP__OVERLOAD__REASON::SCTP__OVERLOAD__ACCEPT__ERROR)
+    deadline = monotonic_ns() + ACCEPT_RETRY_DELAY * 1000000ULL;
+  if (deadline != 0 && (timer_deadline[TIMER_ADMISSION] == 0 || deadline < timer_deadline[TIMER_ADMISSION]))
+    timer_arm(TIMER_ADMISSION, deadline);
+}
+
+
+// Called when an association is closed, resumes the listeners paused by the
+// association limits.
+void SCTPasp__PT_PROVIDER::admission_released(unsigned short listener_port)
+{
+  std::map<unsigned short, admission_state::listener_t>::iterator it;
+  if (listener_port != 0)
+  {
+    it = admission->listeners.find(listener_port);
+    if (it != admission->listeners.end() && it->second.associations > 0) it->second.associations--;
+  }
+  for (it = admission->listeners.begin(); it != admission->listeners.end(); ++it)
+  {
+    if (it->second.paused_by == SCTPasp__Types::SCTP__OVERLOAD__REASON::SCTP__OVERLOAD__PORT__LIMIT ?
+        max_associations == 0 || fd_map.count() < max_associations :
+        it->second.paused_by == SCTPasp__Types::SCTP__OVERLOAD__REASON::SCTP__OVERLOAD__LISTENER__LIMIT &&
+        (max_listener_associations == 0 || it->second.associations < max_listener_associations))
+      admission_resume(it->first);
+  }
+}
+
+
+// Watches the listening sockets paused on listener_port again, except the ones
+// closed in the meantime.
+void SCTPasp__PT_PROVIDER::admission_resume(unsigned short listener_port)
+{
+  admission_state::listener_t& l = admission->listener(listener_port);
+  l.paused_by = -1;
+  for (size_t i = 0; i < l.paused_fds.size(); i++)
+  {
+    int listener_fd = l.paused_fds[i];
+    if (simple_mode)
+    {
+      if (server_mode && listener_fd == fd) Handler_Add_Fd_Read(listener_fd);
+    }
+    else
+    {
+      int index = map_get_item_server(listener_fd);
+      if (index != -1 && fd_map_server[index].local_port == listener_port) Handler_Add_Fd_Read(listener_fd);
+    }
+  }
+  l.paused_fds.clear();
+}
+
+
+// Takes a token of the bucket of the message. Returns FALSE if the message is
+// over the rate: it is queued until the bucket refills, or rejected in
+// ASP_SCTP_SENDMSG_ERROR.
+boolean SCTPasp__PT_PROVIDER::rate_admit(int target, const SCTPasp__Types::ASP__SCTP& send_par)
+{
+  int stream = (int) send_par.sinfo__stream();
+  std::map<rate_state::rate_key, rate_state::limit_t>::iterator l = rate_limits->find_limit(target, stream);
+  if (l == rate_limits->limits.end()) return TRUE;
+  unsigned long long now = monotonic_ns();
+  rate_state::rate_key key(target, l->first.second);
+  std::map<rate_state::rate_key, rate_state::bucket_t>::iterator it = rate_limits->buckets.find(key);
+  if (it == rate_limits->buckets.end())
+  {
+    rate_state::bucket_t& b = rate_limits->buckets[key];
+    b.bucket.reset(l->second.burst, now);
+    b.sent = b.delayed = b.rejected = 0;
+    it = rate_limits->buckets.find(key);
+  }
+  rate_state::bucket_t& b = it->second;
+  b.limit = l->first;
+  b.bucket.refill(l->second.rate, l->second.burst, now);
+  // A new limit may move the stream to another bucket of the association: its
+  // queued messages move along, so that the later ones cannot overtake them.
+  rate_state::rate_key other(target, key.second == -1 ? stream : -1);
+  std::map<rate_state::rate_key, rate_state::bucket_t>::iterator o = rate_limits->buckets.find(other);
+  if (o != rate_limits->buckets.end() && !o->second.queue.empty())
+  {
+    std::deque<SCTPasp__Types::ASP__SCTP>& from = o->second.queue;
+    std::deque<SCTPasp__Types::ASP__SCTP> moved;
+    std::deque<SCTPasp__Types::ASP__SCTP>::iterator m = from.begin();
+    while (m != from.end())
+    {
+      if ((int) m->sinfo__stream() == stream)
+      {
+        moved.push_back(*m);
+        m = from.erase(m);
+      }
+      else ++m;
+    }
+    if (from.empty()) rate_limits->backlog.erase(other);
+    if (!moved.empty())
+    {
+      b.queue.insert(b.queue.begin(), moved.begin(), moved.end());
+      rate_limits->backlog.insert(key);
+      if (timer_deadline[TIMER_RATE] == 0) timer_arm(TIMER_RATE, now);
+    }
+  }
+  if (b.queue.empty() && b.bucket.take())
+  {
+    b.sent++;
+    return TRUE;
+  }
+  if (l->second.reject || (l->second.queue_limit > 0 && b.queue.size() >= l->second.queue_limit))
+  {
+    b.rejected++;
+    log("The message to client %d on stream %d is over the rate limit, it is rejected.", target, stream);
+    sendmsg_error(target, send_par);
+    return FALSE;
+  }
+  b.queue.push_back(send_par);
+  b.delayed++;
+  if (b.queue.size() == 1)
+  {
+    rate_limits->backlog.insert(key);
+    unsigned long long deadline = b.bucket.next_token(l->second.rate);
+    if (timer_deadline[TIMER_RATE] == 0 || deadline < timer_deadline[TIMER_RATE]) timer_arm(TIMER_RATE, deadline);
+  }
+  return FALSE;
+}
+
+
+// Sends the queued messages the buckets have tokens for.
+void SCTPasp__PT_PROVIDER::rate_expired()
+{
+  unsigned long long now = monotonic_ns();
+  unsigned long long next = 0;
+  std::set<rate_state::rate_key>::iterator k = rate_limits->backlog.begin();
+  while (k != rate_limits->backlog.end())
+  {
+    rate_state::bucket_t& b = rate_limits->buckets[*k];
+    std::map<rate_state::rate_key, rate_state::limit_t>::iterator found = rate_limits->limits.find(b.limit);
+    if (found == rate_limits->limits.end())
+    { // cannot happen: the buckets of a removed limit are emptied
+      rate_limits->backlog.erase(k++);
+      continue;
+    }
+    const rate_state::limit_t& l = found->second;
+    b.bucket.refill(l.rate, l.burst, now);
+    int target = k->first;
+    int target_index = map_get_item(target);
+    while (!b.queue.empty() && b.bucket.take())
+    {
+      b.sent++;
+      send_asp(target, target_index, b.queue.front());
+      b.queue.pop_front();
     }
-    else
-    {   // if OMIT is given then all sockets will be closed
-      log("NORMAL MODE: closing all sockets.");
-      for(int i=0;i<list_len;i++) map_delete_item(i);
-      for(int i=0;i<list_len_server;i++) map_delete_item_server(i);
+    if (b.queue.empty())
+    {
+      rate_limits->backlog.erase(k++);
+      continue;
     }
+    unsigned long long deadline = b.bucket.next_token(l.rate);
+    if (next == 0 || deadline < next) next = deadline;
+    ++k;
   }
-  else
+  if (next != 0) timer_arm(TIMER_RATE, next);
+}
+
+
+// Drops the buckets of a closed association, its queued messages are echoed
+// back in ASP_SCTP_SENDMSG_ERROR.
+void SCTPasp__PT_PROVIDER::rate_release(int client_id)
+{
+  std::map<rate_state::rate_key, rate_state::bucket_t>::iterator it =
+    rate_limits->buckets.lower_bound(rate_state::rate_key(client_id, -1));
+  while (it != rate_limits->buckets.end() && it->first.first == client_id)
   {
-    if (server_mode)
-    {   // closing the given connection
-      if(send_par.client__id().ispresent())
-      {
-        int local_fd = (int) (const INTEGER&) send_par.client__id();
-        log("SERVER MODE: closing client socket (fd = %d).", local_fd);
-        map_delete_item_fd(local_fd);
-      }
-      else
-      {   // if OMIT is given in server mode then all clients will be closed
-        log("SERVER MODE: closing all client sockets.");
-        for(int i=0;i<list_len;i++) map_delete_item(i);
-      }
-    }
-    else
-    {   // closing the connection to the server
-      if ( send_par.client__id().ispresent() )
-        error("In client mode the client_id field of ASP_SCTP_Close should be set to OMIT!");
-      log("CLIENT MODE: closing socket (fd = %d).", fd);
-      map_delete_item_fd(fd);
-      fd=-1;
+    if (!it->second.queue.empty())
+    {
+      log("%d queued messages of client %d are dropped.", (int)it->second.queue.size(), client_id);
+      rate_limits->backlog.erase(it->first);
+      for (size_t i = 0; i < it->second.queue.size(); i++) sendmsg_error(client_id, it->second.queue[i]);
     }
+    rate_limits->buckets.erase(it++);
   }
-  log("Leaving outgoing_send (ASP_SCTP_CLOSE).");
 }
 
 
-void SCTPasp__PT_PROVIDER::outgoing_send(const SCTPasp__Types::ASP__SCTP& send_par)
+// Resumes the listeners paused by the accept rate or by an accept error.
+void SCTPasp__PT_PROVIDER::admission_expired()
 {
-  log("Calling outgoing_send (ASP_SCTP).");
-  struct cmsghdr   *cmsg;
-  struct sctp_sndrcvinfo  *sri;
-  char cbuf[sizeof (*cmsg) + sizeof (*sri)];
-  struct msghdr   msg;
-  struct iovec   iov;
-  const unsigned char *buf;
+  std::map<unsigned short, admission_state::listener_t>::iterator it;
+  for (it = admission->listeners.begin(); it != admission->listeners.end(); ++it)
+    if (it->second.paused_by == SCTPasp__Types::SCTP__OVERLOAD__REASON::SCTP__OVERLOAD__ACCEPT__RATE ||
+        it->second.paused_by == SCTPasp__Types::SCTP__OVERLOAD__REASON::SCTP__OVERLOAD__ACCEPT__ERROR)
+      admission_resume(it->first);
+}
 
-  buf = (const unsigned char *)send_par.data();
-  iov.iov_len = send_par.data().lengthof();
 
-  memset(&msg, 0, sizeof (msg));
-  iov.iov_base = (char *)buf;
-  msg.msg_iov = &iov;
-  msg.msg_iovlen = 1;
-  msg.msg_control = cbuf;
-  msg.msg_controllen = sizeof (*cmsg) + sizeof (*sri);
+void SCTPasp__PT_PROVIDER::timer_arm(port_timer_t timer, unsigned long long deadline)
+{
+  timer_deadline[timer] = deadline;
+  if (!timer_dispatching) timer_update();
+}
 
-  memset(cbuf, 0, sizeof (*cmsg) + sizeof (*sri));
-  cmsg = (struct cmsghdr *)cbuf;
-  sri = (struct sctp_sndrcvinfo *)(cmsg + 1);
 
-  cmsg->cmsg_len = sizeof (*cmsg) + sizeof (*sri);
-  cmsg->cmsg_level = IPPROTO_SCTP;
-  cmsg->cmsg_type  = SCTP_SNDRCV;
+void SCTPasp__PT_PROVIDER::timer_cancel(port_timer_t timer)
+{
+  if (timer_deadline[timer] == 0) return;
+  timer_deadline[timer] = 0;
+  if (!timer_dispatching) timer_update();
+}
 
-  sri->sinfo_stream = (int) send_par.sinfo__stream();
 
-  int target;
-  if(!simple_mode)
+void SCTPasp__PT_PROVIDER::timer_update()
+{
+  unsigned long long next = 0;
+  for (int t = 0; t < TIMER_MAX; t++)
+    if (timer_deadline[t] != 0 && (next == 0 || timer_deadline[t] < next)) next = timer_deadline[t];
+  if (timer_fd == -1)
   {
-    if (!send_par.client__id().ispresent())
-      error("In NORMAL mode the client_id field of ASP_SCTP should be set to a valid value and not to omit!");
-    target = (int) (const INTEGER&) send_par.client__id();
-    if ( (map_get_item(target)==-1) && (map_get_item_server(target)==-1)) error("Bad client id! %d",target);
+    if (next == 0) return;
+    timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (timer_fd == -1) error("timerfd_create() error: %d %s", errno, strerror(errno));
+    Handler_Add_Fd_Read(timer_fd);
   }
-  else
+  struct itimerspec its;
+  memset(&its, 0, sizeof(its)); // disarms the timer if nothing is scheduled
+  its.it_value.tv_sec = next / 1000000000ULL;
+  its.it_value.tv_nsec = next % 1000000000ULL;
+  if (timerfd_settime(timer_fd, TFD_TIMER_ABSTIME, &its, NULL) == -1)
+    error("timerfd_settime() error: %d %s", errno, strerror(errno));
+}
+
+
+void SCTPasp__PT_PROVIDER::timer_expired()
+{
+  uint64_t expirations;
+  if (read(timer_fd, &expirations, sizeof(expirations)) < 0) errno = 0;
+  unsigned long long now = monotonic_ns();
+  timer_dispatching = TRUE;
+  for (int t = 0; t < TIMER_MAX; t++)
   {
-    if (server_mode)
-    {
-      if (!send_par.client__id().ispresent())
-        error("In server mode the client_id field of ASP_SCTP should be set to a valid value and not to omit!");
-    }
-    else // client mode
+    if (timer_deadline[t] == 0 || timer_deadline[t] > now) continue;
+    timer_deadline[t] = 0;
+    switch (t)
     {
-      if (send_par.client__id().ispresent())
-        error("In client mode the client_id field of ASP_SCTP should be set to OMIT!");
+      case TIMER_REPLAY:
+        if (replay) replay_run();
+        break;
+      case TIMER_GENERATOR:
+        if (generator) generator_run();
+        break;
+      case TIMER_BUNDLE:
+        if (bundle.size_of() > 0) bundle_flush();
+        break;
+      case TIMER_COALESCE:
+        if (coalesce) coalesce_expired(-1);
+        break;
+      case TIMER_CONNECT:
+        if (connect_deadlines) connect_expired();
+        break;
+      case TIMER_ADMISSION:
+        if (admission) admission_expired();
+        break;
+      case TIMER_RATE:
+        if (rate_limits) rate_expired();
+        break;
+      case TIMER_DUMP:
+        if (flight_recorder)
+        {
+          flight_recorder_dumped = now;
+          flight_recorder_dump(NULL);
+        }
+        break;
+      default:
+        break;
     }
-    target = fd;
-    if (server_mode)
-      target = (int) (const INTEGER&) send_par.client__id();
-    if (map_get_item(target)==-1) error("Bad client id! %d",target);
   }
+  timer_dispatching = FALSE;
+  timer_update();
+  if (engine) engine->flush(); // the messages of the replay and the generator
+}
 
-  uint32_t ui;
-  if (send_par.sinfo__ppid().get_val().is_native() && send_par.sinfo__ppid() > 0)
-    ui = (int)send_par.sinfo__ppid();
-  else {
-    OCTETSTRING os = int2oct(send_par.sinfo__ppid(), 4);
-    unsigned char* p = (unsigned char*)&ui;
-    *(p++) = os[3].get_octet();
-    *(p++) = os[2].get_octet();
-    *(p++) = os[1].get_octet();
-    *(p++) = os[0].get_octet();
-  }
-  sri->sinfo_ppid = htonl(ui);
 
-  log("Sending SCTP message to file descriptor %d.", target);
-  if (sendmsg(target, &msg, 0) < 0)
+void SCTPasp__PT_PROVIDER::timer_close()
+{
+  memset(timer_deadline, 0, sizeof(timer_deadline));
+  if (timer_fd != -1)
   {
-    SCTPasp__Types::ASP__SCTP__SENDMSG__ERROR asp_sctp_sendmsg_error;
-    if (server_mode) asp_sctp_sendmsg_error.client__id() = target;
-    else asp_sctp_sendmsg_error.client__id() = OMIT_VALUE;
-    asp_sctp_sendmsg_error.sinfo__stream() = send_par.sinfo__stream();
-    asp_sctp_sendmsg_error.sinfo__ppid() = send_par.sinfo__ppid();
-    asp_sctp_sendmsg_error.data() = send_par.data();
-    incoming_message(asp_sctp_sendmsg_error);
-    TTCN_warning("Sendmsg error! Strerror=%s", strerror(errno));
-
-    errno = 0;
+    Handler_Remove_Fd(timer_fd, EVENT_ALL);
+    close(timer_fd);
+    timer_fd = -1;
   }
-  log("Leaving outgoing_send (ASP_SCTP).");
 }
 
 
-SCTPasp__PT_PROVIDER::return_value_t SCTPasp__PT_PROVIDER::getmsg(int fd, struct msghdr *msg)
+int SCTPasp__PT_PROVIDER::flight_recorder_dump(const char *filename)
 {
-  log("Calling getmsg().");
-  int index = map_get_item(fd);
-  if ( !fd_map[index].processing_message ) fd_map[index].nr = 0;
-
-  ssize_t value = recvmsg(fd, msg, 0);
-  if (value <= 0) // EOF or error
+  char *default_name = NULL;
+  if (filename == NULL)
   {
-    log("Leaving getmsg(): EOF or error.");
-    errno = 0;
-    return EOF_OR_ERROR;
+    if (flight_recorder_file.lengthof() > 0) filename = flight_recorder_file;
+    else filename = default_name = mprintf("SCTPasp_%s_%d.trace", get_name(), (int)getpid());
   }
-  fd_map[index].nr += value;
-  log("getmsg(): [%d] bytes received. Receiving buffer now has [%d] bytes.", value, fd_map[index].nr);
-  // Whole message is received, return it.
-  if (msg->msg_flags & MSG_EOR)
+  int err = flight_recorder->dump(filename);
+  if (err != 0) TTCN_warning("SCTPasp Test Port (%s): cannot dump the flight recorder to %s: %s",
+    get_name(), filename, strerror(err));
+  else log("Flight recorder dumped to %s.", filename);
+  Free(default_name);
+  return err;
+}
+
+
+void SCTPasp__PT_PROVIDER::flight_recorder_comm_lost()
+{ // the first loss is dumped at once, the rest of the burst when the hold-off is over,
+  // so a burst of losses costs two dumps and the last one holds all of them
+  unsigned long long now = monotonic_ns();
+  unsigned long long next = flight_recorder_dumped + FLIGHT_RECORDER_DUMP_HOLDOFF * 1000000ULL;
+  if (flight_recorder_dumped == 0 || now >= next)
   {
-    log("Leaving getmsg(): whole message is received.");
-    return WHOLE_MESSAGE_RECEIVED;
+    flight_recorder_dumped = now;
+    flight_recorder_dump(NULL);
   }
+  else if (timer_deadline[TIMER_DUMP] == 0) timer_arm(TIMER_DUMP, next);
+}
+
 
-  // Maybe we need a bigger buffer, do realloc().
-  if (fd_map[index].buflen == fd_map[index].nr)
+void SCTPasp__PT_PROVIDER::rtt_set_keys(const char *keys)
+{ // format: <ppid>:<offset>:<length>[,<ppid>:<offset>:<length>...]
+  delete rtt;
+  rtt = NULL;
+  if (*keys == '\0') return;
+  rtt = new rtt_correlator;
+  rtt->timeout_ns = rtt_timeout * 1000000ULL;
+  const char *p = keys;
+  while (*p != '\0')
   {
-    log("getmsg(): resizing receiving buffer: [%d] bytes -> [%d] bytes",
-      fd_map[index].buflen, (fd_map[index].buflen * 2));
-    fd_map[index].buf = Realloc(fd_map[index].buf, fd_map[index].buflen * 2);
-    fd_map[index].buflen *= 2;
+    unsigned int ppid;
+    int offset, length, consumed;
+    if (sscanf(p, "%u:%d:%d%n", &ppid, &offset, &length, &consumed) != 3 ||
+        offset < 0 || length < 1 || length > RTT_KEY_MAXLEN)
+      error("set_parameter(): Invalid parameter value: %s for parameter rtt_correlator. "
+        "It should be a comma separated list of <ppid>:<offset>:<length> items, length is 1-%d!",
+        keys, RTT_KEY_MAXLEN);
+    rtt_correlator::key_config kc;
+    kc.ppid = ppid;
+    kc.offset = offset;
+    kc.length = length;
+    rtt->keys.push_back(kc);
+    p += consumed;
+    if (*p == ',') p++;
+    else if (*p != '\0')
+      error("set_parameter(): Invalid parameter value: %s for parameter rtt_correlator. "
+        "It should be a comma separated list of <ppid>:<offset>:<length> items, length is 1-%d!",
+        keys, RTT_KEY_MAXLEN);
   }
-  log("Leaving getmsg(): part of the message is received.");
-  return PARTIAL_RECEIVE;
 }
 
 
-void SCTPasp__PT_PROVIDER::handle_event(void *buf)
+void SCTPasp__PT_PROVIDER::handle_event(const void *buf, size_t len)
 {
-  union sctp_notification  *snp;
-  snp = (sctp_notification *)buf;
-  switch (snp->sn_header.sn_type)
+  notification_t n;
+  if (!decode_notification(buf, len, n))
+  {
+    TTCN_warning("SCTPasp Test Port (%s): Truncated notification received (%d bytes)!", get_name(), (int)len);
+    return;
+  }
+  if (flight_recorder) flight_recorder->record(TRACE_RX_NOTIFICATION, receiving_fd, n.length, n.state, n.sn_type);
+  switch (n.type)
   {
-    case SCTP_ASSOC_CHANGE:
+    case NOTIFICATION_ASSOC_CHANGE:
     {
       log("incoming SCTP_ASSOC_CHANGE event.");
-      struct sctp_assoc_change *sac;
-      sac = &snp->sn_assoc_change;
-
-// #ifdef LKSCTP_1_0_7
-      SCTPasp__Types::SAC__STATE sac_state_ttcn;
-      switch(sac->sac_state)
-      {
-       case SCTP_COMM_UP:
-         sac_state_ttcn = SCTPasp__Types::SAC__STATE::SCTP__COMM__UP;
-         break;
-
-       case SCTP_COMM_LOST:
-         sac_state_ttcn = SCTPasp__Types::SAC__STATE::SCTP__COMM__LOST;
-         break;
-
-       case SCTP_RESTART:
-         sac_state_ttcn = SCTPasp__Types::SAC__STATE::SCTP__RESTART;
-         break;
-
-       case SCTP_SHUTDOWN_COMP:
-         sac_state_ttcn = SCTPasp__Types::SAC__STATE::SCTP__SHUTDOWN__COMP;
-         break;
-
-       case SCTP_CANT_STR_ASSOC:
-         sac_state_ttcn = SCTPasp__Types::SAC__STATE::SCTP__CANT__STR__ASSOC;
-         break;
-
-      default:
-         sac_state_ttcn = SCTPasp__Types::SAC__STATE::SCTP__UNKNOWN__SAC__STATE;
-         TTCN_warning("Unexpected sac_state value received %d", sac->sac_state);
-         break;
-      }
-// #endif
-
-      if(sac->sac_state == SCTP_COMM_LOST)
+      // the states of the core are in the order of SAC_STATE
+      SCTPasp__Types::SAC__STATE sac_state_ttcn((SCTPasp__Types::SAC__STATE::enum_type)n.assoc_state);
+      if (n.assoc_state == ASSOC_UNKNOWN) TTCN_warning("Unexpected sac_state value received %d", n.state);
+      int detection = -1;
+      int index = map_get_item(receiving_fd);
+      if (n.assoc_state == ASSOC_COMM_LOST) detection = detection_time(index);
+      else if (index != -1 && (n.assoc_state == ASSOC_COMM_UP || n.assoc_state == ASSOC_RESTART))
+        fd_map[index].failure_start = 0;
+
+      if(n.assoc_state == ASSOC_COMM_LOST)
       {
+        if (flight_recorder && flight_recorder_dump_on_comm_lost) flight_recorder_comm_lost();
         if(simple_mode)
         {
           if (!server_mode) fd = -1; // setting closed socket to -1 in client mode (and reconnect mode)
@@ -1201,98 +3882,93 @@ void SCTPasp__PT_PROVIDER::handle_event(void *buf)
       }
       if (events.sctp_association_event) incoming_message(SCTPasp__Types::ASP__SCTP__ASSOC__CHANGE(
                   INTEGER(receiving_fd),
-		  sac_state_ttcn
+		  sac_state_ttcn,
+                  optional_time(detection)
                   ));
 
       if(simple_mode)
       {
-        if (reconnect && (sac->sac_state == SCTP_COMM_LOST) ) forced_reconnect(reconnect_max_attempts);
+        if (reconnect && (n.assoc_state == ASSOC_COMM_LOST) ) forced_reconnect(reconnect_max_attempts);
       }
       break;
     }
-    case SCTP_PEER_ADDR_CHANGE:{    
+    case NOTIFICATION_PEER_ADDR_CHANGE:{
       log("incoming SCTP_PEER_ADDR_CHANGE event.");
-      struct sctp_paddr_change *spc;
-      spc = &snp->sn_paddr_change;
-// #ifdef LKSCTP_1_0_7
-      SCTPasp__Types::SPC__STATE spc_state_ttcn;
-      switch(spc->spc_state)
-      {
-       case SCTP_ADDR_AVAILABLE:
-         spc_state_ttcn = SCTPasp__Types::SPC__STATE::SCTP__ADDR__AVAILABLE;
-         break;
-
-       case SCTP_ADDR_UNREACHABLE:
-         spc_state_ttcn = SCTPasp__Types::SPC__STATE::SCTP__ADDR__UNREACHABLE;
-         break;
-
-       case SCTP_ADDR_REMOVED:
-         spc_state_ttcn = SCTPasp__Types::SPC__STATE::SCTP__ADDR__REMOVED;
-         break;
-
-       case SCTP_ADDR_ADDED:
-         spc_state_ttcn = SCTPasp__Types::SPC__STATE::SCTP__ADDR__ADDED;
-         break;
-
-       case SCTP_ADDR_MADE_PRIM:
-         spc_state_ttcn = SCTPasp__Types::SPC__STATE::SCTP__ADDR__MADE__PRIM;
-         break;
-#if  defined(LKSCTP_1_0_7) || defined(LKSCTP_1_0_9)
-       case SCTP_ADDR_CONFIRMED:
-         spc_state_ttcn = SCTPasp__Types::SPC__STATE::SCTP__ADDR__CONFIRMED;
-         break;
-#endif
-      default:
-         spc_state_ttcn = SCTPasp__Types::SPC__STATE::SCTP__UNKNOWN__SPC__STATE;
-         TTCN_warning("Unexpected spc_state value received %d", spc->spc_state);
-         break;
+      // the states of the core are in the order of SPC_STATE
+      SCTPasp__Types::SPC__STATE::enum_type spc_state_ttcn = (SCTPasp__Types::SPC__STATE::enum_type)n.addr_state;
+      if (n.addr_state == ADDR_UNKNOWN) TTCN_warning("Unexpected spc_state value received %d", n.state);
+      int detection = -1;
+      int index = map_get_item(receiving_fd);
+      if (n.addr_state == ADDR_UNREACHABLE || n.addr_state == ADDR_POTENTIALLY_FAILED)
+      { // the failure detection starts at the first failed path
+        detection = detection_time(index);
+        if (index != -1 && fd_map[index].failure_start == 0) fd_map[index].failure_start = monotonic_ns();
       }
-// #endif
-      if (events.sctp_address_event) incoming_message(SCTPasp__Types::ASP__SCTP__PEER__ADDR__CHANGE(
+      else if (index != -1 && (n.addr_state == ADDR_AVAILABLE || n.addr_state == ADDR_CONFIRMED))
+        fd_map[index].failure_start = 0;
+      if (events.sctp_address_event)
+      {
+        if (coalesce_window > 0) peer_addr_change(receiving_fd, spc_state_ttcn, detection);
+        else incoming_message(SCTPasp__Types::ASP__SCTP__PEER__ADDR__CHANGE(
                   INTEGER(receiving_fd),
-		              spc_state_ttcn
+		              spc_state_ttcn,
+                  OMIT_VALUE,
+                  optional_time(detection)
                   ));
+      }
       break;
       }
-    case SCTP_REMOTE_ERROR:
+    case NOTIFICATION_REMOTE_ERROR:
       log("incoming SCTP_REMOTE_ERROR event.");
-      //struct sctp_remote_error *sre;
-      //sre = &snp->sn_remote_error;
       if (events.sctp_peer_error_event) incoming_message(SCTPasp__Types::ASP__SCTP__REMOTE__ERROR(INTEGER(receiving_fd)));
       break;
-    case SCTP_SEND_FAILED:
+    case NOTIFICATION_SEND_FAILED:
+    {
       log("incoming SCTP_SEND_FAILED event.");
-      //struct sctp_send_failed *ssf;
-      //ssf = &snp->sn_send_failed;
-      if (events.sctp_send_failure_event) incoming_message(SCTPasp__Types::ASP__SCTP__SEND__FAILED(INTEGER(receiving_fd)));
+      if (!events.sctp_send_failure_event) break;
+      SCTPasp__Types::ASP__SCTP__SEND__FAILED asp_sctp_send_failed(INTEGER(receiving_fd), OMIT_VALUE, OMIT_VALUE,
+        OMIT_VALUE, OMIT_VALUE, OMIT_VALUE);
+      if (n.send_info)
+      { // the failed message, as it was sent
+        asp_sctp_send_failed.error() = ull2int(n.error);
+        asp_sctp_send_failed.sinfo__stream() = INTEGER(n.stream);
+        asp_sctp_send_failed.sinfo__ppid() = ull2int(n.ppid);
+        // the kernel returns the context without telling if it was given, it is echoed
+        // if the association has sent messages with sinfo_context
+        int index = map_get_item(receiving_fd);
+        if (n.context != 0 || (index != -1 && fd_map[index].context_sent))
+          asp_sctp_send_failed.sinfo__context() = ull2int(n.context);
+        asp_sctp_send_failed.data() = OCTETSTRING(n.data_len, n.data);
+      }
+      incoming_message(asp_sctp_send_failed);
       break;
-    case SCTP_SHUTDOWN_EVENT:
+    }
+    case NOTIFICATION_SHUTDOWN_EVENT:
       log("incoming SCTP_SHUTDOWN_EVENT event.");
-      //struct sctp_shutdown_event *sse;
-      //sse = &snp->sn_shutdown_event;
       if (events.sctp_shutdown_event) incoming_message(SCTPasp__Types::ASP__SCTP__SHUTDOWN__EVENT(INTEGER(receiving_fd)));
       break;
-#if  defined(LKSCTP_1_0_7) || defined(LKSCTP_1_0_9)
-    case SCTP_ADAPTATION_INDICATION:
+    case NOTIFICATION_ADAPTATION_INDICATION:
       log("incoming SCTP_ADAPTION_INDICATION event.");
-      //struct sctp_adaptation_event *sai;
-      //sai = &snp->sn_adaptation_event;
+#if  defined(LKSCTP_1_0_7) || defined(LKSCTP_1_0_9)
       if (events.sctp_adaptation_layer_event) incoming_message(SCTPasp__Types::ASP__SCTP__ADAPTION__INDICATION(INTEGER(receiving_fd)));
-      break;
 #else
-    case SCTP_ADAPTION_INDICATION:
-      log("incoming SCTP_ADAPTION_INDICATION event.");
-      //struct sctp_adaption_event *sai;
-      //sai = &snp->sn_adaption_event;
       if (events.sctp_adaption_layer_event) incoming_message(SCTPasp__Types::ASP__SCTP__ADAPTION__INDICATION(INTEGER(receiving_fd)));
-      break;
 #endif
-    case SCTP_PARTIAL_DELIVERY_EVENT:
+      break;
+    case NOTIFICATION_PARTIAL_DELIVERY_EVENT:
       log("incoming SCTP_PARTIAL_DELIVERY_EVENT event.");
-      //struct sctp_pdapi_event *pdapi;
-      //pdapi = &snp->sn_pdapi_event;
       if (events.sctp_partial_delivery_event) incoming_message(SCTPasp__Types::ASP__SCTP__PARTIAL__DELIVERY__EVENT(INTEGER(receiving_fd)));
       break;
+    case NOTIFICATION_SENDER_DRY:
+      log("incoming SCTP_SENDER_DRY_EVENT event.");
+      if (sender_dry_event) incoming_message(SCTPasp__Types::ASP__SCTP__SENDER__DRY(INTEGER(receiving_fd)));
+      break;
+    case NOTIFICATION_STREAM_RESET:
+      log("incoming SCTP_STREAM_RESET_EVENT event.");
+      break;
+    case NOTIFICATION_ASSOC_RESET:
+      log("incoming SCTP_ASSOC_RESET_EVENT event.");
+      break;
     default:
       TTCN_warning("Unknown notification type!");
       break;
@@ -1325,6 +4001,11 @@ void SCTPasp__PT_PROVIDER::error(const char *fmt, ...)
   TTCN_Logger::log_event_va_list(fmt, ap);
   TTCN_Logger::end_event();
   va_end(ap);
+  if (flight_recorder)
+  {
+    flight_recorder->record(TRACE_ERROR, -1);
+    flight_recorder_dump(NULL);
+  }
   TTCN_error("Fatal error in SCTPasp Test Port %s (see above).", get_name());
 }
 
@@ -1340,10 +4021,10 @@ void SCTPasp__PT_PROVIDER::forced_reconnect(int attempts)
   int i;
   for(i = 0; i < attempts; i++)
   {
-    fd=create_socket(sock_type);
-    if (connect(fd, (struct sockaddr *)&sa, saLen) == -1)
+    fd=create_socket(sock_type, false);
+    if (transport->connect(fd, (struct sockaddr *)&sa, saLen) == -1)
     {
-      close(fd);
+      transport->close(fd);
       fd = -1;
       TTCN_warning("Connect error!");
       errno = 0;
@@ -1355,7 +4036,8 @@ void SCTPasp__PT_PROVIDER::forced_reconnect(int attempts)
     {
       map_put_item(fd);
       setNonBlocking(fd);
-      Handler_Add_Fd_Read(fd);
+      watch_socket(fd);
+      if (flight_recorder) flight_recorder->record(TRACE_CONNECT, fd);
       log("[reconnect] Connection successfully established to (%s):(%d)", (const char *)peer_IP_address, peer_port);
       break;
     }
@@ -1367,66 +4049,71 @@ void SCTPasp__PT_PROVIDER::forced_reconnect(int attempts)
 
 void SCTPasp__PT_PROVIDER::map_put_item(int fd)
 {
-  int i=0;
-  while((i<list_len) && !fd_map[i].erased) i++; // searching for the free item
-  if(i==list_len)
-  {  // list is full add new elemnts
-    list_len+=MAP_LENGTH;
-    fd_map=(fd_map_item *)Realloc(fd_map,(list_len)*sizeof(fd_map_item));
-    for(int k=i;k<list_len;k++)
-    {  // init new elements
-      fd_map[k].fd=-1;
-      fd_map[k].erased=TRUE;
-      fd_map[k].einprogress=FALSE;
-      fd_map[k].buf=NULL;
-      fd_map[k].buflen=0;
-      fd_map[k].processing_message=FALSE;
-      fd_map[k].nr=0;
-      fd_map[k].saLen=0;
-      memset(&fd_map[k].sin,0,sizeof(struct sockaddr_storage));
-    }
-  }
-  fd_map[i].fd=fd;        // adding new connection
-  fd_map[i].erased=FALSE;
+  if (fd_map.put(fd) == -1) error("map_put_item: the socket %d cannot be stored: %s", fd, strerror(errno));
 }
 
 
 int SCTPasp__PT_PROVIDER::map_get_item(int fd)
 {
-  for(int i = 0; i < list_len; i++)
-    if( !(fd_map[i].erased) && (fd_map[i].fd == fd) ) return i;
-  return(-1);
+  return fd_map.get(fd);
 }
 
 
 void SCTPasp__PT_PROVIDER::map_delete_item_fd(int fd)
 {
-  if(fd!=-1)
-    for(int i = 0; i < list_len; i++)
-      if( fd_map[i].fd == fd )
-      {
-        map_delete_item(i);
-        break;
-      }
+  int index = fd_map.get(fd);
+  if (index != -1) map_delete_item(index);
 }
 
 
 void SCTPasp__PT_PROVIDER::map_delete_item(int index)
 {
-  if((index>=list_len) || (index<0)) error("map_delete_item: index out of range (0-%d): %d",list_len-1,index);
+  if((index>=fd_map.size()) || (index<0)) error("map_delete_item: index out of range (0-%d): %d",fd_map.size()-1,index);
+
+  if(fd_map[index].fd!=-1) {
+    if (flight_recorder) flight_recorder->record(TRACE_CLOSE, fd_map[index].fd);
+    if (fd_map[index].io_seq != 0)
+    { // the socket belongs to the socket engine, it is closed there; it is not watched by TITAN
+      engine->close_socket(fd_map[index].fd);
+    }
+    else {
+      transport->close(fd_map[index].fd);Handler_Remove_Fd(fd_map[index].fd, EVENT_ALL);
+    }
+  }
+  int client_id = fd_map[index].fd;
+  unsigned short listener_port = fd_map[index].listener_port;
+  boolean generator_target = fd_map[index].generator_target;
+  fd_map.erase(index);
+  if (generator && generator_target)
+  {
+    boolean waiting = generator->outstanding != 0 && generator->in_flight >= generator->outstanding;
+    generator->release(client_id);
+    // the generator waiting for the responses of the closed association goes on
+    if (waiting && generator->in_flight < generator->outstanding) timer_arm(TIMER_GENERATOR, monotonic_ns());
+  }
+  if (admission) admission_released(listener_port);
+  if (rate_limits) rate_release(client_id);
+  if (rtt) rtt->release(client_id);
+}
 
-  if(fd_map[index].fd!=-1) {close(fd_map[index].fd);Handler_Remove_Fd(fd_map[index].fd, EVENT_ALL);}
-  fd_map[index].fd=-1;
-  fd_map[index].erased=TRUE;
-  fd_map[index].einprogress=FALSE;
-  if(fd_map[index].buf) Free(fd_map[index].buf);
-  fd_map[index].buf=NULL;
-  fd_map[index].buflen=0;
-  fd_map[index].processing_message=FALSE;
-  fd_map[index].nr=0;
-  fd_map[index].saLen=0;
-  memset(&fd_map[index].sin,0,sizeof(struct sockaddr_storage));
 
+// Closes an association, by the ABORT primitive (SO_LINGER with zero timeout)
+// instead of the SHUTDOWN handshake if abort is set.
+void SCTPasp__PT_PROVIDER::close_association(int index, boolean abort)
+{
+  if (abort)
+  {
+    struct linger so_linger;
+    so_linger.l_onoff = 1;
+    so_linger.l_linger = 0;
+    if (transport->setsockopt(fd_map[index].fd, SOL_SOCKET, SO_LINGER, &so_linger, sizeof (so_linger)) < 0)
+    {
+      TTCN_warning("SCTPasp Test Port (%s): Cannot abort the association %d, it is closed gracefully: %s",
+        get_name(), fd_map[index].fd, strerror(errno));
+      errno = 0;
+    }
+  }
+  map_delete_item(index);
 }
 
 
@@ -1481,7 +4168,10 @@ void SCTPasp__PT_PROVIDER::map_delete_item_server(int index)
 {
   if((index>=list_len_server) || (index<0)) error("map_delete_item: index out of range (0-%d): %d",list_len_server-1,index);
 
-  if(fd_map_server[index].fd!=-1) {close(fd_map_server[index].fd);Handler_Remove_Fd(fd_map_server[index].fd, EVENT_ALL);}
+  if(fd_map_server[index].fd!=-1) {
+    if (flight_recorder) flight_recorder->record(TRACE_CLOSE, fd_map_server[index].fd);
+    transport->close(fd_map_server[index].fd);Handler_Remove_Fd(fd_map_server[index].fd, EVENT_ALL);
+  }
   fd_map_server[index].fd=-1;
   fd_map_server[index].erased=TRUE;
   if(fd_map_server[index].local_IP_address != NULL){ delete fd_map_server[index].local_IP_address;}
@@ -1551,38 +4241,288 @@ int SCTPasp__PT_PROVIDER::fill_addr_struct(const char* name, int port, struct so
   
 }
 
-int SCTPasp__PT_PROVIDER::create_socket(int addr_family)
+// The options of the created sockets are collected when the port is mapped and
+// when ASP_SCTP_SetSocketOptions changes them. The accepted associations
+// inherit them from the listening socket.
+void SCTPasp__PT_PROVIDER::build_socket_template()
 {
-  int local_fd;
-  log("Creating SCTP socket.");
-  usleep(200000);
-  if ((local_fd = socket(addr_family, SOCK_STREAM, IPPROTO_SCTP)) == -1)
-    error("Socket error: cannot create socket! %d %s %d %d",errno, strerror(errno),addr_family,AF_INET);
+  socket_template->options.clear();
+  socket_template->add(IPPROTO_SCTP, SCTP_INITMSG, "initmsg", &initmsg, sizeof (initmsg));
+  if (sctp_event_supported) add_event_subscription(*socket_template, events, NULL);
+  else add_events_option(*socket_template, events);
+  if (rx_timestamp) socket_template->add(SOL_SOCKET, SO_TIMESTAMPNS, "SO_TIMESTAMPNS", &option_on, sizeof (option_on));
+  failure_detection->options.clear();
+  add_failure_detection(*failure_detection, paddrparams, assocparams, pf_threshold);
+}
+
 
-  log("Setting SCTP socket options (initmsg).");
-  if (setsockopt(local_fd, IPPROTO_SCTP, SCTP_INITMSG, &initmsg,
-    sizeof(struct sctp_initmsg)) < 0)
+// Adds the options of the heartbeats, the retransmission limits, the path MTU and
+// the potentially failed state (pf_threshold, -1 if not set). Set on a listening
+// socket, they are inherited by the accepted associations.
+void SCTPasp__PT_PROVIDER::add_failure_detection(socket_options& options, const struct sctp_paddrparams& paddr,
+  const struct sctp_assocparams& assoc, int pf_threshold)
+{
+  if (paddr.spp_flags != 0 || paddr.spp_pathmaxrxt != 0)
+    options.add(IPPROTO_SCTP, SCTP_PEER_ADDR_PARAMS, "sctp_paddrparams", &paddr, sizeof (paddr));
+  if (assoc.sasoc_asocmaxrxt != 0)
+    options.add(IPPROTO_SCTP, SCTP_ASSOCINFO, "sctp_associnfo", &assoc, sizeof (assoc));
+#ifdef SCTP_PEER_ADDR_THLDS
+  if (pf_threshold >= 0)
   {
-    TTCN_warning("Setsockopt error!");
-    errno = 0;
+#ifdef SCTP_EXPOSE_POTENTIALLY_FAILED_STATE
+    // the potentially failed paths are notified
+    struct sctp_assoc_value expose;
+    (void) memset(&expose, 0, sizeof (expose));
+    expose.assoc_value = SCTP_PF_EXPOSE_ENABLE;
+    options.add(IPPROTO_SCTP, SCTP_EXPOSE_POTENTIALLY_FAILED_STATE, "SCTP_EXPOSE_POTENTIALLY_FAILED_STATE",
+      &expose, sizeof (expose));
+#endif
+    struct sctp_paddrthlds thlds;
+    (void) memset(&thlds, 0, sizeof (thlds));
+    thlds.spt_pathmaxrxt = paddr.spp_pathmaxrxt;
+    thlds.spt_pathpfthld = pf_threshold;
+    options.add(IPPROTO_SCTP, SCTP_PEER_ADDR_THLDS, "sctp_paddrthlds", &thlds, sizeof (thlds));
   }
+#endif
+}
 
-  log("Setting SCTP socket options (events).");
-  if (setsockopt(local_fd, IPPROTO_SCTP, SCTP_EVENTS, &events, sizeof (events)) < 0)
+
+// Sets the options on the association of client_id and reports the result.
+void SCTPasp__PT_PROVIDER::set_association_options(int client_id, const socket_options& options)
+{
+  int err = options.options.empty() ? ENOPROTOOPT : apply_socket_options(client_id, options);
+  SCTPasp__Types::ASP__SCTP__RESULT asp_sctp_result;
+  asp_sctp_result.client__id() = client_id;
+  asp_sctp_result.error__status() = err != 0;
+  if (err != 0)
   {
     TTCN_warning("Setsockopt error!");
+    asp_sctp_result.error__message() = strerror(err);
+    incoming_message(asp_sctp_result);
+  }
+  else
+  {
+    asp_sctp_result.error__message() = OMIT_VALUE;
+    if (!lean_mode) incoming_message(asp_sctp_result);
+  }
+}
+
+
+// The time since the first potentially failed or unreachable path of fd_map[index],
+// in milliseconds: the failure detection time of a lost association or of a
+// further failed path. -1 if no path has failed since the peer was reachable.
+int SCTPasp__PT_PROVIDER::detection_time(int index)
+{
+  if (index == -1 || fd_map[index].failure_start == 0) return -1;
+  return (int)((monotonic_ns() - fd_map[index].failure_start) / 1000000ULL);
+}
+
+
+// Adds the notification types of subscribe one by one (SCTP_EVENT), so the
+// disabled ones are not queued by the kernel at all. Only the types changed
+// since previous are added if it is given.
+void SCTPasp__PT_PROVIDER::add_event_subscription(socket_options& options, const struct sctp_event_subscribe& subscribe,
+  const struct sctp_event_subscribe *previous)
+{
+#ifdef SCTP_EVENT
+  // the first fields of sctp_event_subscribe are in the order of the notification types
+  const unsigned char *on = (const unsigned char *)&subscribe;
+  const unsigned char *was = (const unsigned char *)previous;
+  for (int i = 0; i <= SCTP_ADAPTATION_INDICATION - SCTP_SN_TYPE_BASE; i++)
+  {
+    if (was != NULL && (was[i] != 0) == (on[i] != 0)) continue;
+#ifdef SCTP_SEND_FAILED_EVENT
+    if (SCTP_SN_TYPE_BASE + i == SCTP_SEND_FAILED && send_failed_event_supported)
+    { // the failed messages are returned with their sinfo_context in the newer notification
+      options.add_event(SCTP_SEND_FAILED, false);
+      options.add_event(SCTP_SEND_FAILED_EVENT, on[i] != 0);
+      continue;
+    }
+#endif
+    options.add_event(SCTP_SN_TYPE_BASE + i, on[i] != 0);
+  }
+  if (previous == NULL)
+  {
+    options.add_event(SCTP_SENDER_DRY_EVENT, sender_dry_event);
+    options.add_event(SCTP_STREAM_RESET_EVENT, stream_reset_event);
+    options.add_event(SCTP_ASSOC_RESET_EVENT, assoc_reset_event);
+  }
+#endif
+}
+
+
+// Adds the whole subscription at once (SCTP_EVENTS) with the notification types
+// enabled by the test port parameters only.
+void SCTPasp__PT_PROVIDER::add_events_option(socket_options& options, const struct sctp_event_subscribe& subscribe)
+{
+  struct sctp_event_subscribe all = subscribe;
+#ifdef SCTP_SENDER_DRY_EVENT
+  all.sctp_sender_dry_event = sender_dry_event;
+#endif
+#ifdef SCTP_STREAM_RESET_EVENT
+  all.sctp_stream_reset_event = stream_reset_event;
+#endif
+#ifdef SCTP_ASSOC_RESET_EVENT
+  all.sctp_assoc_reset_event = assoc_reset_event;
+#endif
+  options.add(IPPROTO_SCTP, SCTP_EVENTS, "events", &all, sizeof (all));
+}
+
+
+// Tells if SCTP_EVENT can be used for the notification type, by setting it
+// alone on a socket of its own: the kernels older than the headers reject it.
+// The errors of the other options of the socket template say nothing about it.
+boolean SCTPasp__PT_PROVIDER::probe_sctp_event(uint16_t type)
+{
+#ifdef SCTP_EVENT
+  int probe_fd = transport->socket(AF_INET, false);
+  if (probe_fd == -1)
+  { // cannot tell, the socket errors are reported when the sockets are created
     errno = 0;
+    return TRUE;
+  }
+  struct sctp_event event;
+  (void) memset(&event, 0, sizeof (event));
+  event.se_type = type;
+  event.se_on = 1;
+  boolean supported = TRUE;
+  if (transport->setsockopt(probe_fd, IPPROTO_SCTP, SCTP_EVENT, &event, sizeof (event)) < 0)
+    supported = errno != ENOPROTOOPT && errno != EINVAL;
+  transport->close(probe_fd);
+  errno = 0;
+  return supported;
+#else
+  return FALSE;
+#endif
+}
+
+
+// Changes the subscription of the open sockets after Sctp_events.
+void SCTPasp__PT_PROVIDER::resubscribe_events(const struct sctp_event_subscribe& previous)
+{
+  socket_options changes;
+  if (sctp_event_supported) add_event_subscription(changes, events, &previous);
+  else if (memcmp(&previous, &events, sizeof (events)) != 0) add_events_option(changes, events);
+  if (changes.options.empty()) return;
+
+  int failed = 0;
+  for (int i = 0; i < fd_map.size(); i++)
+    if (!fd_map[i].erased && apply_socket_options(fd_map[i].fd, changes) != 0) failed++;
+  for (int i = 0; i < list_len_server; i++)
+    if (!fd_map_server[i].erased && apply_socket_options(fd_map_server[i].fd, changes) != 0) failed++;
+  if (simple_mode && server_mode && fd != -1 && apply_socket_options(fd, changes) != 0) failed++;
+  if (failed > 0)
+    TTCN_warning("SCTPasp Test Port (%s): The notification subscription of %d sockets cannot be changed!",
+      get_name(), failed);
+}
+
+
+// Sets every option on the socket, returns 0 or the errno of the first failing one.
+int SCTPasp__PT_PROVIDER::apply_socket_options(int fd, const socket_options& options)
+{
+  int err = 0;
+  for (size_t i = 0; i < options.options.size(); i++)
+  {
+    const socket_options::option_t& option = options.options[i];
+    log("Setting socket options (%s).", option.label);
+    if (transport->setsockopt(fd, option.level, option.name, &option.value[0], option.value.size()) < 0)
+    {
+      if (err == 0) err = errno;
+      errno = 0;
+    }
+  }
+  return err;
+}
+
+
+// The name of the profile of the associations accepted on listener_port, or
+// of the created sockets if listener_port is 0. NULL if no profile is bound.
+const char *SCTPasp__PT_PROVIDER::bound_profile(unsigned short listener_port)
+{
+  if (profiles == NULL) return NULL;
+  if (listener_port != 0)
+  {
+    std::map<unsigned short, std::string>::const_iterator it = profiles->listener_profiles.find(listener_port);
+    if (it != profiles->listener_profiles.end()) return it->second.c_str();
+  }
+  return profiles->port_profile.empty() ? NULL : profiles->port_profile.c_str();
+}
+
+
+void SCTPasp__PT_PROVIDER::apply_bound_profile(int fd, unsigned short listener_port)
+{
+  const char *name = bound_profile(listener_port);
+  if (name == NULL) return;
+  int err = apply_socket_options(fd, profiles->profiles[name]);
+  if (err != 0)
+    TTCN_warning("SCTPasp Test Port (%s): Cannot apply the socket option profile %s to the socket %d: %s",
+      get_name(), name, fd, strerror(err));
+}
+
+
+// Applies the profile to the live associations bound to it if apply_to_live
+// is set, and reports the result.
+void SCTPasp__PT_PROVIDER::profile_update(const char *name, boolean apply_to_live)
+{
+  int applied = 0;
+  int failed = 0;
+  int err = 0;
+  if (apply_to_live && name != NULL)
+  {
+    const socket_options& options = profiles->profiles[name];
+    for (int i = 0; i < fd_map.size(); i++)
+    {
+      if (fd_map[i].erased || fd_map[i].einprogress) continue;
+      const char *bound = bound_profile(fd_map[i].listener_port);
+      if (bound == NULL || strcmp(bound, name) != 0) continue;
+      int e = apply_socket_options(fd_map[i].fd, options);
+      applied++;
+      if (e != 0)
+      {
+        if (failed++ == 0) err = e;
+      }
+    }
+    log("The socket option profile %s is applied to %d associations.", name, applied);
   }
+  SCTPasp__Types::ASP__SCTP__RESULT asp_sctp_result;
+  asp_sctp_result.client__id() = OMIT_VALUE;
+  if (failed == 0)
+  {
+    asp_sctp_result.error__status() = FALSE;
+    asp_sctp_result.error__message() = OMIT_VALUE;
+    if (!lean_mode) incoming_message(asp_sctp_result);
+  }
+  else
+  {
+    char msg[128];
+    snprintf(msg, sizeof(msg), "%d of %d associations failed: %s", failed, applied, strerror(err));
+    asp_sctp_result.error__status() = TRUE;
+    asp_sctp_result.error__message() = msg;
+    incoming_message(asp_sctp_result);
+  }
+}
+
+
+int SCTPasp__PT_PROVIDER::create_socket(int addr_family, bool nonblocking)
+{
+  int local_fd;
+  log("Creating SCTP socket.");
+  if ((local_fd = transport->socket(addr_family, nonblocking)) == -1)
+    error("Socket error: cannot create socket! %d %s %d %d",errno, strerror(errno),addr_family,AF_INET);
+
+  int err = apply_socket_options(local_fd, *socket_template);
+  if (err != 0) TTCN_warning("Setsockopt error!");
+  if (!failure_detection->options.empty() && (err = apply_socket_options(local_fd, *failure_detection)) != 0)
+    TTCN_warning("SCTPasp Test Port (%s): Cannot set the failure detection parameters: %s", get_name(),
+      strerror(err));
+  apply_bound_profile(local_fd, 0);
   return local_fd;
 }
 
 
 void SCTPasp__PT_PROVIDER::setNonBlocking(int fd)
 {
-  int flags = fcntl(fd, F_GETFL);
-  flags |= O_NONBLOCK;
-  int result = fcntl(fd, F_SETFL, flags);
-  if (result==-1) error("SCTPasp__PT::setNonBlocking(): Fcntl() error!");
+  if (transport->set_nonblocking(fd)==-1) error("SCTPasp__PT::setNonBlocking(): Fcntl() error!");
 }
 
 
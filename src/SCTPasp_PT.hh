@@ -27,9 +27,11 @@
 
 #include <TTCN3.hh>
 #include "SCTPasp_Types.hh"
+#include "SCTPasp_Core.hh"
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <netinet/sctp.h>
+#include <vector>
 
 namespace SCTPasp__Types {
   class ASP__SCTP;
@@ -56,9 +58,33 @@ namespace SCTPasp__Types {
   class ASP__SCTP__Connected;
   class ASP__SCTP__SENDMSG__ERROR;
   class ASP__SCTP__RESULT;
+  class ASP__SCTP__RTT__Config;
+  class ASP__SCTP__RTT__Query;
+  class ASP__SCTP__RTT__Report;
+  class ASP__SCTP__FlightRecorder__Dump;
+  class ASP__SCTP__Replay__Start;
+  class ASP__SCTP__Replay__Stop;
+  class ASP__SCTP__Replay__Report;
+  class ASP__SCTP__Generator__Start;
+  class ASP__SCTP__Generator__Stop;
+  class ASP__SCTP__Generator__Report;
+  class ASP__SCTP__Reflector__Config;
+  class ASP__SCTP__Filter__Config;
+  class ASP__SCTP__Filter__Query;
+  class ASP__SCTP__Filter__Report;
+  class ASP__SCTP__Rate__Config;
+  class ASP__SCTP__Rate__Query;
+  class ASP__SCTP__Rate__Report;
+  class ASP__SCTP__Bundle;
+  class SCTP__CLIENT__ID__LIST;
 }
 
 namespace SCTPasp__PortType {
+class FlightRecorder;
+class CaptureWriter;
+class SocketEngine;
+class Transport;
+
 class SCTPasp__PT_PROVIDER : public PORT {
 public:
   SCTPasp__PT_PROVIDER(const char *par_port_name = NULL);
@@ -83,7 +109,22 @@ protected:
   void outgoing_send(const SCTPasp__Types::ASP__SCTP__Listen& send_par);
   void outgoing_send(const SCTPasp__Types::ASP__SCTP__SetSocketOptions& send_par);
   void outgoing_send(const SCTPasp__Types::ASP__SCTP__Close& send_par);
+  void outgoing_send(const SCTPasp__Types::ASP__SCTP__Close__List& send_par);
+  void outgoing_send(const SCTPasp__Types::ASP__SCTP__Profile__Config& send_par);
+  void outgoing_send(const SCTPasp__Types::ASP__SCTP__Profile__Bind& send_par);
   void outgoing_send(const SCTPasp__Types::ASP__SCTP& send_par);
+  void outgoing_send(const SCTPasp__Types::ASP__SCTP__RTT__Config& send_par);
+  void outgoing_send(const SCTPasp__Types::ASP__SCTP__RTT__Query& send_par);
+  void outgoing_send(const SCTPasp__Types::ASP__SCTP__FlightRecorder__Dump& send_par);
+  void outgoing_send(const SCTPasp__Types::ASP__SCTP__Replay__Start& send_par);
+  void outgoing_send(const SCTPasp__Types::ASP__SCTP__Replay__Stop& send_par);
+  void outgoing_send(const SCTPasp__Types::ASP__SCTP__Generator__Start& send_par);
+  void outgoing_send(const SCTPasp__Types::ASP__SCTP__Generator__Stop& send_par);
+  void outgoing_send(const SCTPasp__Types::ASP__SCTP__Reflector__Config& send_par);
+  void outgoing_send(const SCTPasp__Types::ASP__SCTP__Filter__Config& send_par);
+  void outgoing_send(const SCTPasp__Types::ASP__SCTP__Filter__Query& send_par);
+  void outgoing_send(const SCTPasp__Types::ASP__SCTP__Rate__Config& send_par);
+  void outgoing_send(const SCTPasp__Types::ASP__SCTP__Rate__Query& send_par);
 
   virtual void incoming_message(const SCTPasp__Types::ASP__SCTP& incoming_par) = 0;
   virtual void incoming_message(const SCTPasp__Types::ASP__SCTP__ASSOC__CHANGE& incoming_par) = 0;
@@ -93,14 +134,23 @@ protected:
   virtual void incoming_message(const SCTPasp__Types::ASP__SCTP__SHUTDOWN__EVENT& incoming_par) = 0;
   virtual void incoming_message(const SCTPasp__Types::ASP__SCTP__PARTIAL__DELIVERY__EVENT& incoming_par) = 0;
   virtual void incoming_message(const SCTPasp__Types::ASP__SCTP__ADAPTION__INDICATION& incoming_par) = 0;
+  virtual void incoming_message(const SCTPasp__Types::ASP__SCTP__SENDER__DRY& incoming_par) = 0;
   virtual void incoming_message(const SCTPasp__Types::ASP__SCTP__Connected& incoming_par) = 0;
+  virtual void incoming_message(const SCTPasp__Types::ASP__SCTP__OVERLOAD& incoming_par) = 0;
   virtual void incoming_message(const SCTPasp__Types::ASP__SCTP__SENDMSG__ERROR& incoming_par) = 0;
   virtual void incoming_message(const SCTPasp__Types::ASP__SCTP__RESULT& incoming_par) = 0;
+  virtual void incoming_message(const SCTPasp__Types::ASP__SCTP__RTT__Report& incoming_par) = 0;
+  virtual void incoming_message(const SCTPasp__Types::ASP__SCTP__Replay__Report& incoming_par) = 0;
+  virtual void incoming_message(const SCTPasp__Types::ASP__SCTP__Generator__Report& incoming_par) = 0;
+  virtual void incoming_message(const SCTPasp__Types::ASP__SCTP__Filter__Report& incoming_par) = 0;
+  virtual void incoming_message(const SCTPasp__Types::ASP__SCTP__Rate__Report& incoming_par) = 0;
+  virtual void incoming_message(const SCTPasp__Types::ASP__SCTP__Bundle& incoming_par) = 0;
 
 private:
-  enum return_value_t { WHOLE_MESSAGE_RECEIVED, PARTIAL_RECEIVE, EOF_OR_ERROR };
-  return_value_t getmsg(int fd, struct msghdr *msg);
-  void handle_event(void *buf);
+  // timers of the test port, served by a single timerfd
+  enum port_timer_t { TIMER_REPLAY, TIMER_GENERATOR, TIMER_BUNDLE, TIMER_COALESCE, TIMER_CONNECT, TIMER_ADMISSION, TIMER_RATE, TIMER_DUMP, TIMER_MAX };
+
+  void handle_event(const void *buf, size_t len);
   void log(const char *fmt, ...);
   void error(const char *fmt, ...);
   void handle_event_reconnect(void *buf);
@@ -110,21 +160,84 @@ private:
   int  map_get_item(int fd);
   void map_delete_item_fd(int fd); 
   void map_delete_item(int index);
+  void close_association(int index, boolean abort);
 
   void map_put_item_server(int fd, const CHARSTRING& local_IP_address, unsigned short local_port);
   int  map_get_item_server(int fd);
   void map_delete_item_fd_server(int fd); 
   void map_delete_item_server(int index);
   
-  int create_socket(int addr_family);
+  void build_socket_template();
+  boolean probe_sctp_event(uint16_t type);
+  struct socket_options;
+  void add_events_option(socket_options& options, const struct sctp_event_subscribe& subscribe);
+  void add_event_subscription(socket_options& options, const struct sctp_event_subscribe& subscribe,
+    const struct sctp_event_subscribe *previous);
+  void resubscribe_events(const struct sctp_event_subscribe& previous);
+  int apply_socket_options(int fd, const socket_options& options);
+  void add_failure_detection(socket_options& options, const struct sctp_paddrparams& paddr,
+    const struct sctp_assocparams& assoc, int pf_threshold);
+  void set_association_options(int client_id, const socket_options& options);
+  int detection_time(int index);
+  const char *bound_profile(unsigned short listener_port);
+  void apply_bound_profile(int fd, unsigned short listener_port);
+  void profile_update(const char *name, boolean apply_to_live);
+  int create_socket(int addr_family, bool nonblocking);
   int fill_addr_struct(const char* name, int port, struct sockaddr_storage* sa, socklen_t& saLen);
   void setNonBlocking(int fd);
+  void rtt_set_keys(const char *keys);
+  int flight_recorder_dump(const char *filename);
+  void flight_recorder_comm_lost();
+  void capture_message(int index, bool outgoing, bool notification, unsigned int stream,
+    uint32_t ppid, const void *data, size_t len);
+  int send_data(int target, int target_index, unsigned int stream, uint32_t ppid,
+    const unsigned char *buf, size_t len, boolean report_error = FALSE, uint32_t context = 0,
+    boolean has_context = FALSE);
+  void watch_socket(int fd);
+  void watch_connect(int fd);
+  void engine_receive();
+  void timer_arm(port_timer_t timer, unsigned long long deadline);
+  void timer_cancel(port_timer_t timer);
+  void timer_update();
+  void timer_expired();
+  void timer_close();
+  void get_targets(const SCTPasp__Types::SCTP__CLIENT__ID__LIST& client_ids, const char *asp_name,
+    std::vector<int>& targets);
+  void replay_run();
+  void replay_stop(boolean finished);
+  void generator_run();
+  void generator_stop(boolean finished);
+  boolean reflect(int index, unsigned int stream, uint32_t ppid);
+  void reflector_disable();
+  boolean filter_message(int client_id, unsigned int stream, uint32_t ppid, const unsigned char *data, size_t len);
+  void process_message(int i, boolean notification, unsigned int stream, uint32_t ppid);
+  void connection_lost(int i);
+  void bundle_flush();
+  void bundle_schedule();
+  void peer_addr_change(int client_id, SCTPasp__Types::SPC__STATE::enum_type state, int detection);
+  void coalesce_expired(int client_id);
+  void connect_arm(int index, int timeout);
+  void connect_expired();
+  void accept_association(int listener_fd, unsigned short listener_port, const CHARSTRING *local_IP_address);
+  int admission_check(unsigned short listener_port);
+  void admission_refused(int listener_fd, unsigned short listener_port, int reason, int client_fd,
+    int accept_errno);
+  void admission_released(unsigned short listener_port);
+  void admission_resume(unsigned short listener_port);
+  void admission_expired();
+  void send_asp(int target, int target_index, const SCTPasp__Types::ASP__SCTP& send_par);
+  void sendmsg_error(int target, const SCTPasp__Types::ASP__SCTP& send_par);
+  boolean rate_admit(int target, const SCTPasp__Types::ASP__SCTP& send_par);
+  void rate_expired();
+  void rate_release(int client_id);
     
   boolean simple_mode;
   boolean reconnect;
   int reconnect_max_attempts;
   boolean server_mode;
   boolean debug;
+  boolean rx_timestamp;
+  boolean lean_mode; // successful operations are not reported in ASP_SCTP_RESULT
   int server_backlog;
   CHARSTRING local_IP_address;
   CHARSTRING peer_IP_address;
@@ -132,7 +245,22 @@ private:
   unsigned short peer_port;
 
   struct sctp_event_subscribe events;
+  boolean sender_dry_event; // the newer notifications, not in sctp_event_subscribe of older headers
+  boolean stream_reset_event;
+  boolean assoc_reset_event;
+  boolean sctp_event_supported; // the notifications are subscribed one by one (SCTP_EVENT)
+  boolean send_failed_event_supported; // SCTP_SEND_FAILED_EVENT is subscribed instead of SCTP_SEND_FAILED
   struct sctp_initmsg  initmsg;
+
+  socket_options *socket_template; // set on every created socket
+  // the failure detection parameters, the zero fields are not changed by the kernel
+  struct sctp_paddrparams paddrparams;
+  struct sctp_assocparams assocparams;
+  int pf_threshold; // spt_pathpfthld, -1 if not set
+  socket_options *failure_detection; // set on every created socket after socket_template
+
+  struct profile_state;
+  profile_state *profiles; // NULL until the first ASP_SCTP_Profile_Config
   
   boolean local_port_is_present;
   boolean peer_IP_address_is_present;
@@ -142,14 +270,80 @@ private:
 
   int receiving_fd;
 
-  struct fd_map_item;
-  fd_map_item *fd_map;
-  int list_len;
+  AssociationTable fd_map;
 
   struct fd_map_server_item;
   fd_map_server_item *fd_map_server;
   int list_len_server;
 
+  struct rtt_correlator;
+  rtt_correlator *rtt; // NULL if the RTT correlator is not configured
+  int rtt_timeout; // in milliseconds
+
+  FlightRecorder *flight_recorder; // NULL if the flight recorder is disabled
+  CHARSTRING flight_recorder_file;
+  boolean flight_recorder_dump_on_comm_lost;
+  unsigned long long flight_recorder_dumped; // CLOCK_MONOTONIC of the last dump on SCTP_COMM_LOST, 0 if none
+
+  CaptureWriter *capture; // NULL if the capture is not active
+  CHARSTRING capture_file;
+  int capture_queue_size;
+
+  int timer_fd;
+  unsigned long long timer_deadline[TIMER_MAX]; // CLOCK_MONOTONIC in nanoseconds, 0 if not armed
+  boolean timer_dispatching;
+
+  struct replay_state;
+  replay_state *replay; // NULL if no replay is running
+
+  struct generator_state;
+  generator_state *generator; // NULL if the generator is not running
+
+  struct reflector_state;
+  reflector_state *reflector; // NULL if the reflector is disabled
+
+  struct filter_state;
+  filter_state *filters; // NULL if no receive filter is configured
+
+  int bundle_max_count; // 0: bundling is disabled
+  int bundle_max_delay; // in microseconds
+  SCTPasp__Types::ASP__SCTP__Bundle bundle; // messages waiting for delivery in bundle mode
+  unsigned long long bundle_first; // monotonic time of the first message in the bundle
+
+  int coalesce_window; // in milliseconds, 0: notifications are not coalesced
+  struct coalesce_state;
+  coalesce_state *coalesce; // NULL until the first coalesced notification
+
+  int connect_timeout; // in milliseconds, 0: the connects are not timed out
+  struct connect_timers;
+  connect_timers *connect_deadlines; // NULL until the first connect with a timeout
+
+  // admission control of the accepted associations, 0: no limit
+  int max_associations; // all associations of the port
+  int max_listener_associations; // associations accepted on one listening port
+  int accept_rate; // accepted associations per second
+  boolean overload_pause; // the listener is paused instead of aborting the associations over the limit
+  struct admission_state;
+  admission_state *admission; // NULL until the first accepted association
+
+  struct rate_state;
+  rate_state *rate_limits; // NULL until the first ASP_SCTP_Rate_Config
+
+  SocketEngine *engine; // the I/O thread, io_uring, usrsctp or the loopback, NULL if the sockets are served by the TITAN thread
+  boolean io_thread_enabled;
+  int io_thread_cpu; // -1: not pinned
+  int io_thread_queue_size;
+  boolean io_uring_enabled;
+  int io_uring_entries;
+  uint32_t io_seq; // last registration number of the sockets given to the socket engine
+
+  Transport *transport; // the SCTP stack, the kernel unless usrsctp or the loopback is used
+  boolean usrsctp_enabled;
+  int usrsctp_udp_port;
+  int usrsctp_remote_udp_port;
+  boolean loopback_enabled;
+  int loopback_ring_size; // in bytes, per direction
+
 
 };
 }
@@ -0,0 +1,367 @@
+/******************************************************************************
+* Copyright (c) 2000-2021 Ericsson Telecom AB
+* All rights reserved. This program and the accompanying materials
+* are made available under the terms of the Eclipse Public License v2.0
+* which accompanies this distribution, and is available at
+* https://www.eclipse.org/org/documents/epl-2.0/EPL-2.0.html
+*
+* Contributors:
+*  Peter Dimitrov- initial implementation and initial documentation
+*  Adam Delic
+*  Eduard Czimbalmos
+*  Endre Kulcsar
+*  Gabor Bettesch
+*  Gabor Szalai
+*  Tamas Buti
+*  Zoltan Medve
+******************************************************************************/
+//
+//  File:               SCTPasp_Replay.cc
+//  Description:        Capture file reader of the SCTPasp replay mode
+//  Prodnr:             CNL 113 469
+//
+
+
+#include "SCTPasp_Replay.hh"
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#define LINKTYPE_ETHERNET 1
+#define LINKTYPE_RAW 101
+#define LINKTYPE_LINUX_SLL 113
+#define LINKTYPE_IPV4 228
+#define LINKTYPE_IPV6 229
+#define LINKTYPE_LINUX_SLL2 276
+#define IPPROTO_SCTP_NUM 132
+// stream of the notifications in the captures of the test port
+#define NOTIFICATION_STREAM 0xFFFF
+// number of the last TSNs of a direction checked for retransmissions
+#define TSN_WINDOW 16384
+
+namespace SCTPasp__PortType {
+
+bool ReplayFile::assoc_key_t::operator<(const assoc_key_t& other) const
+{
+  return memcmp(this, &other, sizeof(assoc_key_t)) < 0;
+}
+
+struct ReplayFile::fragment_t
+{
+  uint8_t flags;
+  uint16_t stream;
+  uint32_t ppid;
+  uint64_t timestamp;
+  const unsigned char *data; // in the mapped file
+  uint32_t len;
+};
+
+// one direction of an association
+struct ReplayFile::direction_t
+{
+  uint32_t vtag;
+  std::set<uint32_t> seen;     // the last TSN_WINDOW TSNs
+  std::deque<uint32_t> order;  // the TSNs of seen, the oldest first
+  std::map<uint32_t, fragment_t> fragments; // of the incomplete messages, by TSN
+  direction_t() : vtag(0) {}
+};
+
+static inline uint16_t get16(const unsigned char *p) { return (p[0] << 8) | p[1]; }
+static inline uint32_t get32(const unsigned char *p) { return ((uint32_t)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3]; }
+static inline uint32_t get32le(const unsigned char *p) { return ((uint32_t)p[3] << 24) | (p[2] << 16) | (p[1] << 8) | p[0]; }
+
+
+ReplayFile::ReplayFile()
+  : map(NULL), map_len(0), filter_port(0)
+{
+}
+
+
+ReplayFile::~ReplayFile()
+{
+  close();
+}
+
+
+void ReplayFile::close()
+{
+  if (map != NULL) munmap(map, map_len);
+  map = NULL;
+  map_len = 0;
+  for (size_t i = 0; i < reassembled.size(); i++) free(reassembled[i]);
+  reassembled.clear();
+  messages.clear();
+  assoc_keys.clear();
+  directions.clear();
+}
+
+
+int ReplayFile::open(const char *filename, uint16_t src_port)
+{
+  close();
+  filter_port = src_port;
+  int fd = ::open(filename, O_RDONLY);
+  if (fd == -1) return errno;
+  struct stat st;
+  if (fstat(fd, &st) != 0)
+  {
+    int err = errno;
+    ::close(fd);
+    return err;
+  }
+  map_len = st.st_size;
+  if (map_len < 24)
+  {
+    ::close(fd);
+    return EINVAL;
+  }
+  void *p = mmap(NULL, map_len, PROT_READ, MAP_PRIVATE, fd, 0);
+  int err = errno;
+  ::close(fd);
+  if (p == MAP_FAILED)
+  {
+    map_len = 0;
+    return err;
+  }
+  map = (unsigned char *)p;
+  madvise(map, map_len, MADV_SEQUENTIAL);
+
+  bool swapped, nsec;
+  uint32_t magic = get32(map);
+  if (magic == 0xa1b2c3d4) { swapped = false; nsec = false; }
+  else if (magic == 0xa1b23c4d) { swapped = false; nsec = true; }
+  else if (magic == 0xd4c3b2a1) { swapped = true; nsec = false; }
+  else if (magic == 0x4d3cb2a1) { swapped = true; nsec = true; }
+  else
+  {
+    close();
+    return EINVAL;
+  }
+  uint32_t linktype = (swapped ? get32le(map + 20) : get32(map + 20)) & 0xffff;
+  if (linktype != LINKTYPE_ETHERNET && linktype != LINKTYPE_RAW && linktype != LINKTYPE_LINUX_SLL &&
+      linktype != LINKTYPE_LINUX_SLL2 && linktype != LINKTYPE_IPV4 && linktype != LINKTYPE_IPV6)
+  {
+    close();
+    return EINVAL;
+  }
+
+  size_t off = 24;
+  while (off + 16 <= map_len)
+  {
+    const unsigned char *rec = map + off;
+    uint32_t sec = swapped ? get32le(rec) : get32(rec);
+    uint32_t frac = swapped ? get32le(rec + 4) : get32(rec + 4);
+    uint32_t caplen = swapped ? get32le(rec + 8) : get32(rec + 8);
+    off += 16;
+    if (off + caplen > map_len) break; // truncated file
+    const unsigned char *pkt = map + off;
+    off += caplen;
+    uint64_t ts = (uint64_t)sec * 1000000000ULL + (nsec ? frac : (uint64_t)frac * 1000);
+
+    // link layer
+    uint16_t ethertype;
+    size_t l2;
+    switch (linktype)
+    {
+      case LINKTYPE_ETHERNET:
+        if (caplen < 14) continue;
+        ethertype = get16(pkt + 12);
+        l2 = 14;
+        while ((ethertype == 0x8100 || ethertype == 0x88a8) && caplen >= l2 + 4)
+        { // VLAN tags
+          ethertype = get16(pkt + l2 + 2);
+          l2 += 4;
+        }
+        break;
+      case LINKTYPE_LINUX_SLL:
+        if (caplen < 16) continue;
+        ethertype = get16(pkt + 14);
+        l2 = 16;
+        break;
+      case LINKTYPE_LINUX_SLL2:
+        if (caplen < 20) continue;
+        ethertype = get16(pkt);
+        l2 = 20;
+        break;
+      default: // raw IP
+        if (caplen < 1) continue;
+        ethertype = (pkt[0] >> 4) == 6 ? 0x86dd : 0x0800;
+        l2 = 0;
+        break;
+    }
+    const unsigned char *ip = pkt + l2;
+    size_t iplen = caplen - l2;
+    if (ethertype == 0x0800)
+    {
+      if (iplen < 20 || (ip[0] >> 4) != 4) continue;
+      size_t ihl = (ip[0] & 0x0f) * 4;
+      if (ihl < 20 || iplen < ihl || ip[9] != IPPROTO_SCTP_NUM) continue;
+      if (get16(ip + 6) & 0x3fff) continue; // IP fragments are not reassembled
+      size_t total = get16(ip + 2);
+      if (total < ihl || total > iplen) total = iplen;
+      parse_sctp(ts, ip + ihl, total - ihl, ip + 12, ip + 16, 4);
+    }
+    else if (ethertype == 0x86dd)
+    {
+      if (iplen < 40 || (ip[0] >> 4) != 6 || ip[6] != IPPROTO_SCTP_NUM) continue;
+      size_t total = 40 + get16(ip + 4);
+      if (total > iplen) total = iplen;
+      parse_sctp(ts, ip + 40, total - 40, ip + 8, ip + 24, 16);
+    }
+  }
+  directions.clear();
+  // the reassembled messages and the packets of several interfaces may be out of
+  // order, a message is not sent before the previous one
+  for (size_t i = 1; i < messages.size(); i++)
+    if (messages[i].timestamp < messages[i - 1].timestamp) messages[i].timestamp = messages[i - 1].timestamp;
+  return 0;
+}
+
+
+void ReplayFile::parse_sctp(uint64_t ts, const unsigned char *sctp, size_t len,
+  const unsigned char *src, const unsigned char *dst, size_t addr_len)
+{
+  if (len < 12) return;
+  uint16_t sport = get16(sctp);
+  uint16_t dport = get16(sctp + 2);
+  if (filter_port != 0 && sport != filter_port) return;
+
+  assoc_key_t key;
+  memset(&key, 0, sizeof(key));
+  int first = memcmp(src, dst, addr_len) < 0 || (memcmp(src, dst, addr_len) == 0 && sport < dport) ? 0 : 1;
+  memcpy(key.addr[first], src, addr_len);
+  memcpy(key.addr[1 - first], dst, addr_len);
+  key.port[first] = sport;
+  key.port[1 - first] = dport;
+  std::map<assoc_key_t, uint32_t>::const_iterator it = assoc_keys.find(key);
+  bool known = it != assoc_keys.end();
+  uint32_t assoc = known ? it->second : assoc_keys.size();
+
+  assoc_key_t dir_key; // the direction, the sender first
+  memset(&dir_key, 0, sizeof(dir_key));
+  memcpy(dir_key.addr[0], src, addr_len);
+  memcpy(dir_key.addr[1], dst, addr_len);
+  dir_key.port[0] = sport;
+  dir_key.port[1] = dport;
+  direction_t *d = NULL;
+  uint32_t vtag = get32(sctp + 4);
+
+  size_t off = 12;
+  while (off + 4 <= len)
+  {
+    const unsigned char *chunk = sctp + off;
+    uint16_t clen = get16(chunk + 2);
+    if (clen < 4 || off + clen > len) break;
+    off += (clen + 3) & ~3;
+    if (chunk[0] != 0 || clen < 16) continue; // DATA chunks only
+    uint8_t flags = chunk[1];
+    uint32_t tsn = get32(chunk + 4);
+    uint16_t stream = get16(chunk + 8);
+    uint32_t ppid = get32(chunk + 12);
+    if (d == NULL)
+    {
+      d = &directions[dir_key];
+      if (d->vtag != vtag)
+      { // a new association between the same endpoints, its TSNs start again
+        d->seen.clear();
+        d->order.clear();
+        d->fragments.clear();
+        d->vtag = vtag;
+      }
+    }
+    if (!new_tsn(*d, tsn)) continue; // retransmission
+    if (stream == NOTIFICATION_STREAM) continue;
+    if (!known)
+    { // only associations with user messages are numbered
+      assoc_keys.insert(std::make_pair(key, assoc));
+      known = true;
+    }
+    const unsigned char *data = chunk + 16;
+    uint32_t dlen = clen - 16;
+
+    if ((flags & 0x03) == 0x03)
+    { // unfragmented
+      message_t m = { ts, data, dlen, ppid, stream, sport, assoc };
+      messages.push_back(m);
+      continue;
+    }
+    // the fragments of a message have consecutive TSNs, they may arrive in any
+    // order: the message is complete when every TSN from its first fragment to
+    // its last one is there
+    std::map<uint32_t, fragment_t>& fragments = d->fragments;
+    fragment_t fr = { flags, stream, ppid, ts, data, dlen };
+    fragments[tsn] = fr;
+    std::map<uint32_t, fragment_t>::const_iterator f;
+    uint32_t first_tsn = tsn;
+    uint8_t first_flags = flags;
+    while (!(first_flags & 0x02))
+    {
+      f = fragments.find(first_tsn - 1);
+      if (f == fragments.end() || (f->second.flags & 0x01) || f->second.stream != stream) break;
+      first_tsn--;
+      first_flags = f->second.flags;
+    }
+    if (!(first_flags & 0x02)) continue;
+    uint32_t last_tsn = tsn;
+    uint8_t last_flags = flags;
+    while (!(last_flags & 0x01))
+    {
+      f = fragments.find(last_tsn + 1);
+      if (f == fragments.end() || (f->second.flags & 0x02) || f->second.stream != stream) break;
+      last_tsn++;
+      last_flags = f->second.flags;
+    }
+    if (!(last_flags & 0x01)) continue;
+
+    size_t total = 0;
+    for (uint32_t t = first_tsn; ; t++)
+    {
+      total += fragments[t].len;
+      if (t == last_tsn) break;
+    }
+    unsigned char *buf = (unsigned char *)malloc(total ? total : 1);
+    if (buf != NULL)
+    {
+      size_t pos = 0;
+      for (uint32_t t = first_tsn; ; t++)
+      {
+        memcpy(buf + pos, fragments[t].data, fragments[t].len);
+        pos += fragments[t].len;
+        if (t == last_tsn) break;
+      }
+      reassembled.push_back(buf);
+      const fragment_t& head = fragments[first_tsn];
+      message_t m = { head.timestamp, buf, (uint32_t)total, head.ppid, stream, sport, assoc };
+      messages.push_back(m);
+    }
+    for (uint32_t t = first_tsn; ; t++)
+    {
+      fragments.erase(t);
+      if (t == last_tsn) break;
+    }
+  }
+}
+
+
+// Tells if tsn is new in the direction, and remembers it. The TSNs older than
+// the window are forgotten with the fragments of their incomplete messages.
+bool ReplayFile::new_tsn(direction_t& d, uint32_t tsn)
+{
+  if (!d.seen.insert(tsn).second) return false;
+  d.order.push_back(tsn);
+  if (d.order.size() > TSN_WINDOW)
+  {
+    d.seen.erase(d.order.front());
+    d.fragments.erase(d.order.front());
+    d.order.pop_front();
+  }
+  return true;
+}
+
+}
@@ -0,0 +1,92 @@
+/******************************************************************************
+* Copyright (c) 2000-2021 Ericsson Telecom AB
+* All rights reserved. This program and the accompanying materials
+* are made available under the terms of the Eclipse Public License v2.0
+* which accompanies this distribution, and is available at
+* https://www.eclipse.org/org/documents/epl-2.0/EPL-2.0.html
+*
+* Contributors:
+*  Peter Dimitrov- initial implementation and initial documentation
+*  Adam Delic
+*  Eduard Czimbalmos
+*  Endre Kulcsar
+*  Gabor Bettesch
+*  Gabor Szalai
+*  Tamas Buti
+*  Zoltan Medve
+******************************************************************************/
+//
+//  File:               SCTPasp_Replay.hh
+//  Description:        Capture file reader of the SCTPasp replay mode
+//  Prodnr:             CNL 113 469
+//
+
+
+#ifndef SCTPasp__Replay_HH
+#define SCTPasp__Replay_HH
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+#include <map>
+#include <set>
+#include <deque>
+
+namespace SCTPasp__PortType {
+
+// Memory maps a pcap file and indexes the user messages of the SCTP DATA
+// chunks in it. Supported link types: raw IP, Ethernet, Linux cooked v1/v2.
+class ReplayFile
+{
+public:
+  struct message_t
+  {
+    uint64_t timestamp;       // capture time in nanoseconds
+    const unsigned char *data;
+    uint32_t len;
+    uint32_t ppid;            // host byte order
+    uint16_t stream;
+    uint16_t src_port;
+    uint32_t association;     // index of the association in order of appearance
+  };
+
+  ReplayFile();
+  ~ReplayFile();
+
+  // returns 0 or errno, EINVAL if the file is not a supported pcap file
+  // only the chunks sent from src_port are indexed if it is not 0
+  int open(const char *filename, uint16_t src_port = 0);
+  void close();
+
+  size_t size() const { return messages.size(); }
+  const message_t& operator[](size_t i) const { return messages[i]; }
+  uint32_t get_associations() const { return assoc_keys.size(); }
+
+private:
+  ReplayFile(const ReplayFile&);
+  ReplayFile& operator=(const ReplayFile&);
+
+  struct assoc_key_t
+  { // the endpoints are stored in a canonical order so both directions match
+    unsigned char addr[2][16];
+    uint16_t port[2];
+    bool operator<(const assoc_key_t& other) const;
+  };
+  struct fragment_t;
+  struct direction_t;
+  void parse_sctp(uint64_t ts, const unsigned char *sctp, size_t len,
+    const unsigned char *src, const unsigned char *dst, size_t addr_len);
+  bool new_tsn(direction_t& d, uint32_t tsn);
+
+  unsigned char *map;
+  size_t map_len;
+  uint16_t filter_port;
+  std::vector<message_t> messages;
+  std::vector<unsigned char *> reassembled; // buffers of the fragmented messages
+  std::map<assoc_key_t, uint32_t> assoc_keys;
+  // the TSNs and the fragments of the directions, keyed by source and destination
+  std::map<assoc_key_t, direction_t> directions;
+};
+
+}
+#endif
@@ -0,0 +1,94 @@
+/******************************************************************************
+* Copyright (c) 2000-2021 Ericsson Telecom AB
+* All rights reserved. This program and the accompanying materials
+* are made available under the terms of the Eclipse Public License v2.0
+* which accompanies this distribution, and is available at
+* https://www.eclipse.org/org/documents/epl-2.0/EPL-2.0.html
+*
+* Contributors:
+*  Peter Dimitrov- initial implementation and initial documentation
+*  Adam Delic
+*  Eduard Czimbalmos
+*  Endre Kulcsar
+*  Gabor Bettesch
+*  Gabor Szalai
+*  Tamas Buti
+*  Zoltan Medve
+******************************************************************************/
+//
+//  File:               SCTPasp_Transport.cc
+//  Description:        SCTP stack interface of the SCTPasp test port
+//  Prodnr:             CNL 113 469
+//
+
+
+#include "SCTPasp_Transport.hh"
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+
+namespace SCTPasp__PortType {
+
+int KernelTransport::socket(int family, bool nonblocking)
+{
+  return ::socket(family, SOCK_STREAM | (nonblocking ? SOCK_NONBLOCK : 0), IPPROTO_SCTP);
+}
+
+
+int KernelTransport::bind(int fd, const struct sockaddr *addr, socklen_t len)
+{
+  return ::bind(fd, addr, len);
+}
+
+
+int KernelTransport::listen(int fd, int backlog)
+{
+  return ::listen(fd, backlog);
+}
+
+
+int KernelTransport::accept(int fd, struct sockaddr *addr, socklen_t *len, bool nonblocking)
+{
+  return ::accept4(fd, addr, len, nonblocking ? SOCK_NONBLOCK : 0);
+}
+
+
+int KernelTransport::connect(int fd, const struct sockaddr *addr, socklen_t len)
+{
+  return ::connect(fd, addr, len);
+}
+
+
+int KernelTransport::set_nonblocking(int fd)
+{
+  int flags = fcntl(fd, F_GETFL);
+  if (flags == -1) return -1;
+  return fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+
+int KernelTransport::setsockopt(int fd, int level, int name, const void *value, socklen_t len)
+{
+  return ::setsockopt(fd, level, name, value, len);
+}
+
+
+int KernelTransport::getsockname(int fd, struct sockaddr *addr, socklen_t *len)
+{
+  return ::getsockname(fd, addr, len);
+}
+
+
+int KernelTransport::getpeername(int fd, struct sockaddr *addr, socklen_t *len)
+{
+  return ::getpeername(fd, addr, len);
+}
+
+
+int KernelTransport::close(int fd)
+{
+  return ::close(fd);
+}
+
+}
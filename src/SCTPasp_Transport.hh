@@ -0,0 +1,93 @@
+/******************************************************************************
+* Copyright (c) 2000-2021 Ericsson Telecom AB
+* All rights reserved. This program and the accompanying materials
+* are made available under the terms of the Eclipse Public License v2.0
+* which accompanies this distribution, and is available at
+* https://www.eclipse.org/org/documents/epl-2.0/EPL-2.0.html
+*
+* Contributors:
+*  Peter Dimitrov- initial implementation and initial documentation
+*  Adam Delic
+*  Eduard Czimbalmos
+*  Endre Kulcsar
+*  Gabor Bettesch
+*  Gabor Szalai
+*  Tamas Buti
+*  Zoltan Medve
+******************************************************************************/
+//
+//  File:               SCTPasp_Transport.hh
+//  Description:        SCTP stack interface of the SCTPasp test port
+//  Prodnr:             CNL 113 469
+//
+// The transport creates, configures, connects and closes the SCTP sockets of
+// the port. The calls follow the socket API of the Linux kernel stack: the
+// option levels, names and structures and the layout of the notifications are
+// those of <netinet/sctp.h>, a transport on another stack translates them.
+// The calls return -1 and set errno on failure, as the system calls.
+//
+// The sockets are identified by file descriptors. A transport without kernel
+// sockets hands out event file descriptors, they become readable when a
+// connection can be accepted or the connection attempt finished. Such a
+// transport serves the connected sockets by its own socket engine.
+
+
+#ifndef SCTPasp__Transport_HH
+#define SCTPasp__Transport_HH
+
+#include <stddef.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+
+namespace SCTPasp__PortType {
+
+class SocketEngine;
+
+class Transport
+{
+public:
+  virtual ~Transport() {}
+
+  virtual const char *get_transport_name() const = 0;
+  // false if the file descriptors are not kernel SCTP sockets, see above
+  virtual bool kernel_sockets() const = 0;
+  // the engine serving the connected sockets, NULL if the port may choose
+  virtual SocketEngine *get_engine() { return NULL; }
+
+  // creates a one-to-one style SCTP socket, the nonblocking ones are created
+  // so without set_nonblocking()
+  virtual int socket(int family, bool nonblocking) = 0;
+  virtual int bind(int fd, const struct sockaddr *addr, socklen_t len) = 0;
+  virtual int listen(int fd, int backlog) = 0;
+  virtual int accept(int fd, struct sockaddr *addr, socklen_t *len, bool nonblocking) = 0;
+  // a non-blocking socket returns EINPROGRESS, calling it again after the
+  // socket is signalled returns EISCONN on success
+  virtual int connect(int fd, const struct sockaddr *addr, socklen_t len) = 0;
+  virtual int set_nonblocking(int fd) = 0;
+  virtual int setsockopt(int fd, int level, int name, const void *value, socklen_t len) = 0;
+  virtual int getsockname(int fd, struct sockaddr *addr, socklen_t *len) = 0;
+  virtual int getpeername(int fd, struct sockaddr *addr, socklen_t *len) = 0;
+  virtual int close(int fd) = 0;
+};
+
+// the SCTP stack of the Linux kernel
+class KernelTransport : public Transport
+{
+public:
+  const char *get_transport_name() const { return "kernel"; }
+  bool kernel_sockets() const { return true; }
+
+  int socket(int family, bool nonblocking);
+  int bind(int fd, const struct sockaddr *addr, socklen_t len);
+  int listen(int fd, int backlog);
+  int accept(int fd, struct sockaddr *addr, socklen_t *len, bool nonblocking);
+  int connect(int fd, const struct sockaddr *addr, socklen_t len);
+  int set_nonblocking(int fd);
+  int setsockopt(int fd, int level, int name, const void *value, socklen_t len);
+  int getsockname(int fd, struct sockaddr *addr, socklen_t *len);
+  int getpeername(int fd, struct sockaddr *addr, socklen_t *len);
+  int close(int fd);
+};
+
+}
+#endif
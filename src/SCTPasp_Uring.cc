@@ -0,0 +1,873 @@
+/******************************************************************************
+* Copyright (c) 2000-2021 Ericsson Telecom AB
+* All rights reserved. This program and the accompanying materials
+* are made available under the terms of the Eclipse Public License v2.0
+* which accompanies this distribution, and is available at
+* https://www.eclipse.org/org/documents/epl-2.0/EPL-2.0.html
+*
+* Contributors:
+*  Peter Dimitrov- initial implementation and initial documentation
+*  Adam Delic
+*  Eduard Czimbalmos
+*  Endre Kulcsar
+*  Gabor Bettesch
+*  Gabor Szalai
+*  Tamas Buti
+*  Zoltan Medve
+******************************************************************************/
+//
+//  File:               SCTPasp_Uring.cc
+//  Description:        io_uring socket engine of the SCTPasp test port
+//  Prodnr:             CNL 113 469
+//
+
+
+#include "SCTPasp_Uring.hh"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/eventfd.h>
+#include <netinet/in.h>
+#include <netinet/sctp.h>
+#include <arpa/inet.h>
+#if defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#endif
+#endif
+#include <vector>
+#include <deque>
+#include <unordered_map>
+#include <new>
+
+namespace SCTPasp__PortType {
+
+#ifdef IORING_RECV_MULTISHOT
+
+// payload room of a receive buffer, longer messages are reassembled
+#define URING_BUFFER_SIZE 8192
+// room for the SNDRCV and the SO_TIMESTAMPNS ancillary data
+#define URING_CONTROL_SIZE (CMSG_SPACE(sizeof (struct sctp_sndrcvinfo)) + CMSG_SPACE(sizeof (struct timespec)))
+#define URING_BUFFER_LEN (sizeof (struct io_uring_recvmsg_out) + URING_CONTROL_SIZE + URING_BUFFER_SIZE)
+#define URING_BUFFER_GROUP 0
+#define URING_MAX_BUFFERS 32768
+// the send queue holds this many times the ring entries
+#define URING_SEND_QUEUE_FACTOR 16
+#define URING_MAX_FREE_SENDS 1024
+
+// the low bits of user_data identify the operation
+#define URING_TAG_RECV 1
+#define URING_TAG_SEND 2
+#define URING_TAG_OTHER 3
+#define URING_TAG_MASK 3
+#define URING_CANCEL ((uint64_t)URING_TAG_OTHER)
+#define URING_PROBE ((uint64_t)4 | URING_TAG_OTHER)
+
+struct UringEngine::connection_t
+{
+  int fd;
+  uint32_t seq;
+  bool closed; // closed by the port, waiting for its operations
+  bool eof; // the loss of the association is reported
+  bool recv_armed; // the multishot receive is active
+  bool dirty; // in the dirty list, see flush()
+  unsigned int in_flight; // sends submitted to the kernel
+  std::deque<send_t *> pending; // sends waiting for the completion of the previous ones
+  std::vector<unsigned char> partial; // fragments of a partially received message
+  bool ts_valid;
+  struct timespec ts;
+};
+
+
+struct UringEngine::send_t
+{
+  struct msghdr msg;
+  struct iovec iov;
+  char cbuf[CMSG_SPACE(sizeof (struct sctp_sndrcvinfo))];
+  int fd;
+  uint32_t seq;
+  uint16_t stream;
+  uint32_t ppid;
+  uint32_t context;
+  bool has_context;
+  bool report;
+  unsigned char *data;
+  size_t len;
+  size_t size; // allocated size of data
+};
+
+
+struct UringEngine::state_t
+{
+  std::unordered_map<uint32_t, connection_t *> connections; // by seq, until their operations complete
+  std::unordered_map<int, connection_t *> fds; // open sockets
+  std::vector<uint32_t> dirty; // connections with operations to submit
+  std::vector<uint32_t> work;
+  std::vector<uint32_t> cancels; // receives to be cancelled, the submission queue was full
+  std::vector<send_t *> free_sends;
+  unsigned int pending_sends;
+  std::vector<unsigned char> assembled; // the reassembled current message
+  struct msghdr recv_msg; // template of the multishot receives
+};
+
+
+static int uring_setup(unsigned int entries, struct io_uring_params *p)
+{
+  return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+
+static int uring_enter(int fd, unsigned int to_submit, unsigned int min_complete, unsigned int flags)
+{
+  return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+
+static int uring_register(int fd, unsigned int opcode, const void *arg, unsigned int nr_args)
+{
+  return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+
+UringEngine::UringEngine() :
+    ring_fd(-1), event_fd(-1), ring_ptr(NULL), ring_size(0), sqes(NULL), sqes_size(0),
+    sq_head(NULL), sq_tail(NULL), sq_flags(NULL), sq_array(NULL), sq_mask(0), sq_entries(0),
+    sq_local_tail(0), sq_submitted(0), cq_head(NULL), cq_tail(NULL), cq_mask(0), cqes(NULL),
+    buf_ring(NULL), buf_ring_size(0), buffers(NULL), buf_count(0), buf_tail(0),
+    state(NULL), current_bid(-1), current_send(NULL), sends_in_flight(0), recvs_armed(0), send_errors(0)
+{
+  current.data = current.inline_data;
+  current.len = 0;
+}
+
+
+UringEngine::~UringEngine()
+{
+  stop();
+}
+
+
+int UringEngine::start(unsigned int entries)
+{
+  if (ring_fd != -1) return EBUSY;
+  struct io_uring_params p;
+  memset(&p, 0, sizeof(p));
+  p.flags = IORING_SETUP_CLAMP;
+  ring_fd = uring_setup(entries, &p);
+  if (ring_fd < 0)
+  {
+    int err = errno;
+    errno = 0;
+    ring_fd = -1;
+    return err;
+  }
+  int err = 0;
+  if (!(p.features & IORING_FEAT_SINGLE_MMAP) || !(p.features & IORING_FEAT_NODROP)) err = EOPNOTSUPP;
+  if (err == 0)
+  {
+    ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+    size_t cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (cq_size > ring_size) ring_size = cq_size;
+    ring_ptr = mmap(NULL, ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQ_RING);
+    if (ring_ptr == MAP_FAILED)
+    {
+      ring_ptr = NULL;
+      err = errno;
+    }
+  }
+  if (err == 0)
+  {
+    sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+    void *ptr = mmap(NULL, sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQES);
+    if (ptr == MAP_FAILED) err = errno;
+    else sqes = (io_uring_sqe *)ptr;
+  }
+  if (err == 0)
+  {
+    char *r = (char *)ring_ptr;
+    sq_head = (unsigned int *)(r + p.sq_off.head);
+    sq_tail = (unsigned int *)(r + p.sq_off.tail);
+    sq_flags = (unsigned int *)(r + p.sq_off.flags);
+    sq_array = (unsigned int *)(r + p.sq_off.array);
+    sq_mask = *(unsigned int *)(r + p.sq_off.ring_mask);
+    sq_entries = p.sq_entries;
+    sq_local_tail = sq_submitted = *sq_tail;
+    cq_head = (unsigned int *)(r + p.cq_off.head);
+    cq_tail = (unsigned int *)(r + p.cq_off.tail);
+    cq_mask = *(unsigned int *)(r + p.cq_off.ring_mask);
+    cqes = (io_uring_cqe *)(r + p.cq_off.cqes);
+    event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (event_fd == -1) err = errno;
+    else if (uring_register(ring_fd, IORING_REGISTER_EVENTFD, &event_fd, 1) < 0) err = errno;
+  }
+  if (err == 0)
+  {
+    buf_count = 1;
+    while (buf_count < entries && buf_count < URING_MAX_BUFFERS) buf_count <<= 1;
+    buf_ring_size = buf_count * sizeof(struct io_uring_buf);
+    void *ptr = mmap(NULL, buf_ring_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (ptr == MAP_FAILED) err = errno;
+    else buf_ring = (io_uring_buf_ring *)ptr;
+  }
+  if (err == 0)
+  {
+    buffers = (unsigned char *)malloc(buf_count * URING_BUFFER_LEN);
+    if (!buffers) err = ENOMEM;
+  }
+  if (err == 0)
+  {
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (uint64_t)(uintptr_t)buf_ring;
+    reg.ring_entries = buf_count;
+    reg.bgid = URING_BUFFER_GROUP;
+    if (uring_register(ring_fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) err = errno;
+  }
+  if (err == 0)
+  {
+    buf_tail = 0;
+    for (unsigned int i = 0; i < buf_count; i++) recycle_buffer(i);
+    state = new (std::nothrow) state_t;
+    if (!state) err = ENOMEM;
+  }
+  if (err == 0)
+  {
+    state->pending_sends = 0;
+    memset(&state->recv_msg, 0, sizeof(state->recv_msg));
+    state->recv_msg.msg_controllen = URING_CONTROL_SIZE;
+    err = probe_multishot();
+  }
+  if (err != 0)
+  {
+    stop();
+    errno = 0;
+    return err;
+  }
+  return 0;
+}
+
+
+// Checks on a socket pair that the kernel supports the multishot receive.
+int UringEngine::probe_multishot()
+{
+  int sv[2];
+  if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0, sv) == -1)
+  {
+    int err = errno;
+    errno = 0;
+    return err;
+  }
+  int err = 0;
+  io_uring_sqe *sqe = get_sqe();
+  sqe->opcode = IORING_OP_RECVMSG;
+  sqe->fd = sv[0];
+  sqe->addr = (uint64_t)(uintptr_t)&state->recv_msg;
+  sqe->len = 1;
+  sqe->ioprio = IORING_RECV_MULTISHOT;
+  sqe->flags = IOSQE_BUFFER_SELECT;
+  sqe->buf_group = URING_BUFFER_GROUP;
+  sqe->user_data = URING_PROBE;
+  recvs_armed++;
+  if (write(sv[1], "", 1) != 1) err = errno;
+  else if ((err = -submit(1)) == 0)
+  {
+    uint64_t user_data;
+    int res;
+    unsigned int flags;
+    if (next_cqe(user_data, res, flags))
+    {
+      if (res == -EINVAL) err = EOPNOTSUPP; // older than Linux 6.0
+      else if (res < 0) err = -res;
+      complete(user_data, res, flags);
+    }
+  }
+  if (recvs_armed > 0)
+  {
+    sqe = get_sqe();
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->addr = URING_PROBE;
+    sqe->user_data = URING_CANCEL;
+  }
+  while (recvs_armed > 0 && submit(1) == 0)
+  {
+    uint64_t user_data;
+    int res;
+    unsigned int flags;
+    while (next_cqe(user_data, res, flags)) complete(user_data, res, flags);
+  }
+  close(sv[0]);
+  close(sv[1]);
+  clear_event();
+  errno = 0;
+  return err;
+}
+
+
+void UringEngine::stop()
+{
+  if (state)
+  {
+    for (std::unordered_map<int, connection_t *>::iterator it = state->fds.begin(); it != state->fds.end(); )
+      close_socket((it++)->first);
+    release();
+    if (sends_in_flight > 0 || recvs_armed > 0)
+    { // the operations in the kernel refer to the memory of the engine
+      io_uring_sqe *sqe = get_sqe();
+      if (sqe)
+      {
+        sqe->opcode = IORING_OP_ASYNC_CANCEL;
+        sqe->cancel_flags = IORING_ASYNC_CANCEL_ANY;
+        sqe->user_data = URING_CANCEL;
+      }
+      while ((sends_in_flight > 0 || recvs_armed > 0) && submit(1) == 0)
+      {
+        uint64_t user_data;
+        int res;
+        unsigned int flags;
+        while (next_cqe(user_data, res, flags))
+          if (complete(user_data, res, flags)) release();
+      }
+    }
+    for (std::unordered_map<uint32_t, connection_t *>::iterator it = state->connections.begin();
+         it != state->connections.end(); ++it)
+    {
+      connection_t *c = it->second;
+      for (size_t i = 0; i < c->pending.size(); i++) free_send(c->pending[i]);
+      delete c;
+    }
+    for (size_t i = 0; i < state->free_sends.size(); i++)
+    {
+      free(state->free_sends[i]->data);
+      delete state->free_sends[i];
+    }
+    delete state;
+    state = NULL;
+  }
+  if (ring_fd != -1) close(ring_fd); // unregisters the buffer ring and the eventfd
+  if (event_fd != -1) close(event_fd);
+  if (ring_ptr) munmap(ring_ptr, ring_size);
+  if (sqes) munmap(sqes, sqes_size);
+  if (buf_ring) munmap(buf_ring, buf_ring_size);
+  free(buffers);
+  ring_fd = event_fd = -1;
+  ring_ptr = NULL;
+  sqes = NULL;
+  buf_ring = NULL;
+  buffers = NULL;
+  sends_in_flight = recvs_armed = 0;
+}
+
+
+io_uring_sqe *UringEngine::get_sqe()
+{
+  if (sq_local_tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE) >= sq_entries)
+  {
+    submit(0);
+    if (sq_local_tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE) >= sq_entries) return NULL;
+  }
+  unsigned int index = sq_local_tail & sq_mask;
+  io_uring_sqe *sqe = &sqes[index];
+  memset(sqe, 0, sizeof(*sqe));
+  sq_array[index] = index;
+  sq_local_tail++;
+  return sqe;
+}
+
+
+// Submits the prepared SQEs and waits for wait completions.
+// Returns 0 or -errno.
+int UringEngine::submit(unsigned int wait)
+{
+  __atomic_store_n(sq_tail, sq_local_tail, __ATOMIC_RELEASE);
+  for (;;)
+  {
+    unsigned int n = sq_local_tail - sq_submitted;
+    if (n == 0 && wait == 0) return 0;
+    int r = uring_enter(ring_fd, n, wait, wait > 0 ? IORING_ENTER_GETEVENTS : 0);
+    if (r < 0)
+    {
+      int err = errno;
+      errno = 0;
+      if (err == EINTR) continue;
+      return -err; // EAGAIN, EBUSY: the completions should be reaped first
+    }
+    sq_submitted += r;
+    if (wait > 0 || sq_submitted == sq_local_tail) return 0;
+    if (r == 0) return -EAGAIN;
+  }
+}
+
+
+bool UringEngine::next_cqe(uint64_t& user_data, int& res, unsigned int& flags)
+{
+  unsigned int head = *cq_head;
+  if (head == __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE)) return false;
+  const io_uring_cqe *cqe = &cqes[head & cq_mask];
+  user_data = cqe->user_data;
+  res = cqe->res;
+  flags = cqe->flags;
+  __atomic_store_n(cq_head, head + 1, __ATOMIC_RELEASE);
+  return true;
+}
+
+
+void UringEngine::recycle_buffer(unsigned int bid)
+{
+  // not buf_ring->bufs, the flexible array of the header is misplaced in C++
+  struct io_uring_buf *b = (struct io_uring_buf *)buf_ring + (buf_tail & (buf_count - 1));
+  b->addr = (uint64_t)(uintptr_t)(buffers + bid * URING_BUFFER_LEN);
+  b->len = URING_BUFFER_LEN;
+  b->bid = bid;
+  buf_tail++;
+  __atomic_store_n(&buf_ring->tail, buf_tail, __ATOMIC_RELEASE);
+}
+
+
+void UringEngine::free_send(send_t *s)
+{
+  if (state->free_sends.size() < URING_MAX_FREE_SENDS) state->free_sends.push_back(s);
+  else
+  {
+    free(s->data);
+    delete s;
+  }
+}
+
+
+void UringEngine::mark_dirty(connection_t *c)
+{
+  if (!c->dirty)
+  {
+    c->dirty = true;
+    state->dirty.push_back(c->seq);
+  }
+}
+
+
+// Forgets a closed connection when the kernel does not use it any more.
+void UringEngine::release_connection(connection_t *c)
+{
+  if (c->recv_armed || c->in_flight > 0) return;
+  state->connections.erase(c->seq);
+  delete c;
+}
+
+
+bool UringEngine::arm_recv(connection_t *c)
+{
+  io_uring_sqe *sqe = get_sqe();
+  if (!sqe) return false;
+  sqe->opcode = IORING_OP_RECVMSG;
+  sqe->fd = c->fd;
+  sqe->addr = (uint64_t)(uintptr_t)&state->recv_msg;
+  sqe->len = 1;
+  sqe->ioprio = IORING_RECV_MULTISHOT;
+  sqe->flags = IOSQE_BUFFER_SELECT;
+  sqe->buf_group = URING_BUFFER_GROUP;
+  sqe->user_data = ((uint64_t)c->seq << 2) | URING_TAG_RECV;
+  c->recv_armed = true;
+  recvs_armed++;
+  return true;
+}
+
+
+void UringEngine::add_socket(int fd, uint32_t seq)
+{
+  connection_t *c = new connection_t;
+  c->fd = fd;
+  c->seq = seq;
+  c->closed = false;
+  c->eof = false;
+  c->recv_armed = false;
+  c->dirty = false;
+  c->in_flight = 0;
+  c->ts_valid = false;
+  state->connections[seq] = c;
+  state->fds[fd] = c;
+  mark_dirty(c);
+  flush();
+}
+
+
+void UringEngine::close_socket(int fd)
+{
+  std::unordered_map<int, connection_t *>::iterator it = state->fds.find(fd);
+  if (it != state->fds.end())
+  {
+    connection_t *c = it->second;
+    state->fds.erase(it);
+    c->closed = true;
+    for (size_t i = 0; i < c->pending.size(); i++) free_send(c->pending[i]);
+    state->pending_sends -= c->pending.size();
+    c->pending.clear();
+    if (c->recv_armed)
+    { // the multishot receive holds a reference to the socket
+      io_uring_sqe *sqe = get_sqe();
+      if (sqe)
+      {
+        sqe->opcode = IORING_OP_ASYNC_CANCEL;
+        sqe->addr = ((uint64_t)c->seq << 2) | URING_TAG_RECV;
+        sqe->user_data = URING_CANCEL;
+        submit(0);
+      }
+      else state->cancels.push_back(c->seq);
+    }
+    release_connection(c);
+  }
+  close(fd);
+}
+
+
+bool UringEngine::send(int fd, unsigned int stream, uint32_t ppid, uint32_t context, bool has_context, const void *data,
+  size_t len, bool report)
+{
+  std::unordered_map<int, connection_t *>::iterator it = state->fds.find(fd);
+  if (it == state->fds.end()) return false;
+  if (state->pending_sends + sends_in_flight >= sq_entries * URING_SEND_QUEUE_FACTOR) return false;
+  connection_t *c = it->second;
+  send_t *s;
+  if (state->free_sends.empty())
+  {
+    s = new (std::nothrow) send_t;
+    if (!s) return false;
+    s->data = NULL;
+    s->size = 0;
+  }
+  else
+  {
+    s = state->free_sends.back();
+    state->free_sends.pop_back();
+  }
+  if (s->size < len)
+  {
+    unsigned char *d = (unsigned char *)realloc(s->data, len);
+    if (!d)
+    {
+      free_send(s);
+      return false;
+    }
+    s->data = d;
+    s->size = len;
+  }
+  if (len > 0) memcpy(s->data, data, len);
+  s->len = len;
+  s->fd = fd;
+  s->seq = c->seq;
+  s->stream = stream;
+  s->ppid = ppid;
+  s->context = context;
+  s->has_context = has_context;
+  s->report = report;
+  s->iov.iov_base = s->data;
+  s->iov.iov_len = len;
+  memset(&s->msg, 0, sizeof(s->msg));
+  s->msg.msg_iov = &s->iov;
+  s->msg.msg_iovlen = 1;
+  s->msg.msg_control = s->cbuf;
+  s->msg.msg_controllen = sizeof(s->cbuf);
+  memset(s->cbuf, 0, sizeof(s->cbuf));
+  struct cmsghdr *cmsg = CMSG_FIRSTHDR(&s->msg);
+  cmsg->cmsg_len = CMSG_LEN(sizeof (struct sctp_sndrcvinfo));
+  cmsg->cmsg_level = IPPROTO_SCTP;
+  cmsg->cmsg_type = SCTP_SNDRCV;
+  struct sctp_sndrcvinfo *sri = (struct sctp_sndrcvinfo *)CMSG_DATA(cmsg);
+  sri->sinfo_stream = stream;
+  sri->sinfo_ppid = htonl(ppid);
+  sri->sinfo_context = context;
+  c->pending.push_back(s);
+  state->pending_sends++;
+  mark_dirty(c);
+  return true;
+}
+
+
+void UringEngine::flush()
+{
+  if (!state) return;
+  while (!state->cancels.empty())
+  {
+    io_uring_sqe *sqe = get_sqe();
+    if (!sqe) break;
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->addr = ((uint64_t)state->cancels.back() << 2) | URING_TAG_RECV;
+    sqe->user_data = URING_CANCEL;
+    state->cancels.pop_back();
+  }
+  state->work.swap(state->dirty);
+  for (size_t i = 0; i < state->work.size(); i++)
+  {
+    std::unordered_map<uint32_t, connection_t *>::iterator it = state->connections.find(state->work[i]);
+    if (it == state->connections.end()) continue;
+    connection_t *c = it->second;
+    c->dirty = false;
+    if (c->closed) continue;
+    if (!c->recv_armed && !c->eof && !arm_recv(c))
+    {
+      mark_dirty(c);
+      continue;
+    }
+    if (c->in_flight == 0 && !c->pending.empty())
+    {
+      // the sends of a socket are linked to keep their order, a chain must
+      // not be split between two submissions
+      unsigned int room = sq_entries - (sq_local_tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE));
+      if (room == 0)
+      {
+        submit(0);
+        room = sq_entries - (sq_local_tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE));
+      }
+      if (room == 0)
+      {
+        mark_dirty(c);
+        continue;
+      }
+      unsigned int n = c->pending.size() < room ? c->pending.size() : room;
+      for (unsigned int k = 0; k < n; k++)
+      {
+        send_t *s = c->pending.front();
+        c->pending.pop_front();
+        io_uring_sqe *sqe = get_sqe();
+        sqe->opcode = IORING_OP_SENDMSG;
+        sqe->fd = s->fd;
+        sqe->addr = (uint64_t)(uintptr_t)&s->msg;
+        sqe->len = 1;
+        sqe->msg_flags = MSG_NOSIGNAL;
+        if (k + 1 < n) sqe->flags = IOSQE_IO_LINK;
+        sqe->user_data = (uint64_t)(uintptr_t)s | URING_TAG_SEND;
+      }
+      c->in_flight = n;
+      sends_in_flight += n;
+      state->pending_sends -= n;
+    }
+  }
+  state->work.clear();
+  submit(0);
+}
+
+
+void UringEngine::clear_event()
+{
+  uint64_t value;
+  if (read(event_fd, &value, sizeof(value)) < 0) errno = 0;
+}
+
+
+void UringEngine::notify()
+{
+  uint64_t one = 1;
+  if (write(event_fd, &one, sizeof(one)) < 0) errno = 0;
+}
+
+
+const UringEngine::message_t *UringEngine::receive()
+{
+  if (!state) return NULL;
+  uint64_t user_data;
+  int res;
+  unsigned int flags;
+  for (;;)
+  {
+    if (!next_cqe(user_data, res, flags))
+    {
+      if (!(__atomic_load_n(sq_flags, __ATOMIC_RELAXED) & IORING_SQ_CQ_OVERFLOW)) return NULL;
+      // the completions which did not fit are kept by the kernel
+      if (uring_enter(ring_fd, 0, 0, IORING_ENTER_GETEVENTS) < 0) errno = 0;
+      if (!next_cqe(user_data, res, flags)) return NULL;
+    }
+    if (complete(user_data, res, flags)) return &current;
+  }
+}
+
+
+void UringEngine::release()
+{
+  if (current_bid != -1) recycle_buffer(current_bid);
+  current_bid = -1;
+  if (current_send) free_send(current_send);
+  current_send = NULL;
+  if (state) state->assembled.clear();
+  current.data = current.inline_data;
+  current.len = 0;
+}
+
+
+// Processes a completion, returns true if it produced the current message.
+bool UringEngine::complete(uint64_t user_data, int res, unsigned int flags)
+{
+  switch (user_data & URING_TAG_MASK)
+  {
+    case URING_TAG_RECV:
+    {
+      if (!(flags & IORING_CQE_F_MORE)) recvs_armed--;
+      std::unordered_map<uint32_t, connection_t *>::iterator it = state->connections.find((uint32_t)(user_data >> 2));
+      connection_t *c = it == state->connections.end() ? NULL : it->second;
+      if (c && !(flags & IORING_CQE_F_MORE)) c->recv_armed = false;
+      if (!c || c->closed || c->eof)
+      {
+        if (flags & IORING_CQE_F_BUFFER) recycle_buffer(flags >> IORING_CQE_BUFFER_SHIFT);
+        if (c && c->closed) release_connection(c);
+        return false;
+      }
+      return complete_recv(c, res, flags);
+    }
+    case URING_TAG_SEND:
+      return complete_send((send_t *)(uintptr_t)(user_data & ~(uint64_t)URING_TAG_MASK), res);
+    default:
+      if (user_data == URING_PROBE)
+      {
+        if (!(flags & IORING_CQE_F_MORE)) recvs_armed--;
+        if (flags & IORING_CQE_F_BUFFER) recycle_buffer(flags >> IORING_CQE_BUFFER_SHIFT);
+      }
+      return false;
+  }
+}
+
+
+bool UringEngine::complete_recv(connection_t *c, int res, unsigned int flags)
+{
+  int err = 0;
+  if (res < 0)
+  {
+    if (res == -ENOBUFS)
+    { // all buffers are in use, the receive is restarted by flush()
+      mark_dirty(c);
+      return false;
+    }
+    err = -res;
+  }
+  else if (flags & IORING_CQE_F_BUFFER)
+  {
+    unsigned int bid = flags >> IORING_CQE_BUFFER_SHIFT;
+    unsigned char *buf = buffers + bid * URING_BUFFER_LEN;
+    const struct io_uring_recvmsg_out *out = (const struct io_uring_recvmsg_out *)buf;
+    unsigned char *payload = buf + sizeof(*out) + state->recv_msg.msg_namelen + state->recv_msg.msg_controllen;
+    size_t len = out->payloadlen < URING_BUFFER_SIZE ? out->payloadlen : URING_BUFFER_SIZE;
+    if (!(flags & IORING_CQE_F_MORE)) mark_dirty(c); // restarting the receive
+    if (len > 0 || (out->flags & MSG_NOTIFICATION))
+    {
+      struct sctp_sndrcvinfo sri;
+      memset(&sri, 0, sizeof(sri));
+      struct msghdr msg;
+      memset(&msg, 0, sizeof(msg));
+      msg.msg_control = buf + sizeof(*out) + state->recv_msg.msg_namelen;
+      msg.msg_controllen = out->controllen;
+      for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg))
+      {
+        if (cmsg->cmsg_level == IPPROTO_SCTP && cmsg->cmsg_type == SCTP_SNDRCV)
+          memcpy(&sri, CMSG_DATA(cmsg), sizeof (sri));
+        else if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_TIMESTAMPNS && !c->ts_valid)
+        {
+          memcpy(&c->ts, CMSG_DATA(cmsg), sizeof (struct timespec));
+          c->ts_valid = true;
+        }
+      }
+      if (!(out->flags & MSG_EOR))
+      {
+        c->partial.insert(c->partial.end(), payload, payload + len);
+        recycle_buffer(bid);
+        return false;
+      }
+      current.type = out->flags & MSG_NOTIFICATION ? IO_NOTIFICATION : IO_DATA;
+      current.fd = c->fd;
+      current.seq = c->seq;
+      current.stream = sri.sinfo_stream;
+      current.ppid = ntohl(sri.sinfo_ppid);
+      current.err = 0;
+      current.ts_valid = c->ts_valid;
+      current.ts = c->ts;
+      if (c->partial.empty())
+      { // the message is passed in the receive buffer
+        current.data = payload;
+        current.len = len;
+        current_bid = bid;
+      }
+      else
+      {
+        c->partial.insert(c->partial.end(), payload, payload + len);
+        recycle_buffer(bid);
+        state->assembled.swap(c->partial);
+        c->partial.clear();
+        current.data = &state->assembled[0];
+        current.len = state->assembled.size();
+      }
+      c->ts_valid = false;
+      return true;
+    }
+    recycle_buffer(bid); // end of file
+  }
+  c->eof = true;
+  current.type = IO_EOF;
+  current.fd = c->fd;
+  current.seq = c->seq;
+  current.err = err;
+  current.ts_valid = false;
+  current.data = current.inline_data;
+  current.len = 0;
+  return true;
+}
+
+
+bool UringEngine::complete_send(send_t *s, int res)
+{
+  sends_in_flight--;
+  std::unordered_map<uint32_t, connection_t *>::iterator it = state->connections.find(s->seq);
+  connection_t *c = it == state->connections.end() ? NULL : it->second;
+  bool open = c && !c->closed;
+  if (c)
+  {
+    c->in_flight--;
+    if (c->closed) release_connection(c);
+    else if (c->in_flight == 0 && !c->pending.empty()) mark_dirty(c);
+  }
+  if (res < 0)
+  {
+    send_errors++;
+    if (s->report && open)
+    {
+      current.type = IO_SEND_ERROR;
+      current.fd = s->fd;
+      current.seq = s->seq;
+      current.stream = s->stream;
+      current.ppid = s->ppid;
+      current.context = s->context;
+      current.has_context = s->has_context;
+      current.err = -res;
+      current.ts_valid = false;
+      current.data = s->data;
+      current.len = s->len;
+      current_send = s;
+      return true;
+    }
+  }
+  free_send(s);
+  return false;
+}
+
+#else // the kernel headers do not support the multishot receive
+
+UringEngine::UringEngine() :
+    ring_fd(-1), event_fd(-1), state(NULL), current_bid(-1), current_send(NULL),
+    sends_in_flight(0), recvs_armed(0), send_errors(0)
+{
+}
+
+UringEngine::~UringEngine() {}
+int UringEngine::start(unsigned int) { return EOPNOTSUPP; }
+void UringEngine::stop() {}
+void UringEngine::add_socket(int, uint32_t) {}
+void UringEngine::close_socket(int fd) { close(fd); }
+bool UringEngine::send(int, unsigned int, uint32_t, uint32_t, bool, const void *, size_t, bool) { return false; }
+void UringEngine::flush() {}
+void UringEngine::clear_event() {}
+void UringEngine::notify() {}
+const UringEngine::message_t *UringEngine::receive() { return NULL; }
+void UringEngine::release() {}
+
+#endif
+
+}
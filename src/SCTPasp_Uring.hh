@@ -0,0 +1,125 @@
+/******************************************************************************
+* Copyright (c) 2000-2021 Ericsson Telecom AB
+* All rights reserved. This program and the accompanying materials
+* are made available under the terms of the Eclipse Public License v2.0
+* which accompanies this distribution, and is available at
+* https://www.eclipse.org/org/documents/epl-2.0/EPL-2.0.html
+*
+* Contributors:
+*  Peter Dimitrov- initial implementation and initial documentation
+*  Adam Delic
+*  Eduard Czimbalmos
+*  Endre Kulcsar
+*  Gabor Bettesch
+*  Gabor Szalai
+*  Tamas Buti
+*  Zoltan Medve
+******************************************************************************/
+//
+//  File:               SCTPasp_Uring.hh
+//  Description:        io_uring socket engine of the SCTPasp test port
+//  Prodnr:             CNL 113 469
+//
+// The engine receives with one multishot IORING_OP_RECVMSG per socket into a
+// provided buffer ring and sends with IORING_OP_SENDMSG. The sends of a socket
+// are linked, so they are executed in order. The completions are signalled by
+// an eventfd registered to the ring. Everything runs in the TITAN thread, the
+// system calls are issued directly, liburing is not needed.
+// Linux 6.0 or newer is required, start() fails on older kernels.
+
+
+#ifndef SCTPasp__Uring_HH
+#define SCTPasp__Uring_HH
+
+#include "SCTPasp_Engine.hh"
+
+struct io_uring_sqe;
+struct io_uring_cqe;
+struct io_uring_buf_ring;
+
+namespace SCTPasp__PortType {
+
+class UringEngine : public SocketEngine
+{
+public:
+  UringEngine();
+  ~UringEngine();
+
+  // sets up the ring with the given number of submission queue entries and
+  // receive buffers, returns 0 or errno
+  int start(unsigned int entries);
+  void stop();
+
+  int get_event_fd() const { return event_fd; }
+
+  void add_socket(int fd, uint32_t seq);
+  void close_socket(int fd);
+  bool send(int fd, unsigned int stream, uint32_t ppid, uint32_t context, bool has_context, const void *data,
+    size_t len, bool report);
+  void flush();
+
+  void clear_event();
+  void notify();
+  const message_t *receive();
+  void release();
+
+  uint64_t get_send_errors() const { return send_errors; }
+
+private:
+  UringEngine(const UringEngine&);
+  UringEngine& operator=(const UringEngine&);
+
+  struct connection_t;
+  struct send_t;
+  struct state_t;
+
+  int probe_multishot();
+  io_uring_sqe *get_sqe();
+  int submit(unsigned int wait);
+  bool next_cqe(uint64_t& user_data, int& res, unsigned int& flags);
+  bool complete(uint64_t user_data, int res, unsigned int flags);
+  bool complete_recv(connection_t *c, int res, unsigned int flags);
+  bool complete_send(send_t *s, int res);
+  bool arm_recv(connection_t *c);
+  void mark_dirty(connection_t *c);
+  void release_connection(connection_t *c);
+  void recycle_buffer(unsigned int bid);
+  void free_send(send_t *s);
+
+  int ring_fd;
+  int event_fd;
+
+  void *ring_ptr; // the SQ and CQ rings, mapped together
+  size_t ring_size;
+  io_uring_sqe *sqes;
+  size_t sqes_size;
+  unsigned int *sq_head;
+  unsigned int *sq_tail;
+  unsigned int *sq_flags;
+  unsigned int *sq_array;
+  unsigned int sq_mask;
+  unsigned int sq_entries;
+  unsigned int sq_local_tail; // SQEs prepared, but not yet published
+  unsigned int sq_submitted;
+  unsigned int *cq_head;
+  unsigned int *cq_tail;
+  unsigned int cq_mask;
+  io_uring_cqe *cqes;
+
+  io_uring_buf_ring *buf_ring;
+  size_t buf_ring_size;
+  unsigned char *buffers;
+  unsigned int buf_count;
+  unsigned short buf_tail;
+
+  state_t *state;
+  message_t current; // the message returned by receive()
+  int current_bid; // buffer of the current message, -1 if none
+  send_t *current_send; // failed send of the current IO_SEND_ERROR
+  unsigned int sends_in_flight;
+  unsigned int recvs_armed;
+  uint64_t send_errors;
+};
+
+}
+#endif
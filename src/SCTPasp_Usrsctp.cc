@@ -0,0 +1,980 @@
+/******************************************************************************
+* Copyright (c) 2000-2021 Ericsson Telecom AB
+* All rights reserved. This program and the accompanying materials
+* are made available under the terms of the Eclipse Public License v2.0
+* which accompanies this distribution, and is available at
+* https://www.eclipse.org/org/documents/epl-2.0/EPL-2.0.html
+*
+* Contributors:
+*  Peter Dimitrov- initial implementation and initial documentation
+*  Adam Delic
+*  Eduard Czimbalmos
+*  Endre Kulcsar
+*  Gabor Bettesch
+*  Gabor Szalai
+*  Tamas Buti
+*  Zoltan Medve
+******************************************************************************/
+//
+//  File:               SCTPasp_Usrsctp.cc
+//  Description:        usrsctp transport of the SCTPasp test port
+//  Prodnr:             CNL 113 469
+//
+
+
+#include "SCTPasp_Usrsctp.hh"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#ifdef USE_USRSCTP
+
+#include <usrsctp.h>
+#include <pthread.h>
+#include <time.h>
+#include <vector>
+#include <deque>
+#include <map>
+
+namespace SCTPasp__PortType {
+
+// usrsctp_finish() is retried while the closed associations shut down
+#define USRSCTP_FINISH_ATTEMPTS 100
+#define USRSCTP_FINISH_DELAY 10000 // us
+
+// The option names, the structures and the notification types of the kernel
+// API (<netinet/sctp.h>), they are translated to those of usrsctp.
+#define LK_SCTP_RTOINFO 0
+#define LK_SCTP_INITMSG 2
+#define LK_SCTP_NODELAY 3
+#define LK_SCTP_EVENTS 11
+#define LK_SCTP_EVENT 127
+
+enum {
+  LK_SN_TYPE_BASE = 1 << 15,
+  LK_ASSOC_CHANGE, LK_PEER_ADDR_CHANGE, LK_SEND_FAILED, LK_REMOTE_ERROR, LK_SHUTDOWN_EVENT,
+  LK_PARTIAL_DELIVERY_EVENT, LK_ADAPTATION_INDICATION, LK_AUTHENTICATION_EVENT,
+  LK_SENDER_DRY_EVENT, LK_STREAM_RESET_EVENT, LK_ASSOC_RESET_EVENT, LK_STREAM_CHANGE_EVENT,
+  LK_SEND_FAILED_EVENT
+};
+
+struct lk_initmsg
+{
+  uint16_t sinit_num_ostreams;
+  uint16_t sinit_max_instreams;
+  uint16_t sinit_max_attempts;
+  uint16_t sinit_max_init_timeo;
+};
+
+struct lk_rtoinfo
+{
+  int32_t srto_assoc_id;
+  uint32_t srto_initial;
+  uint32_t srto_max;
+  uint32_t srto_min;
+};
+
+struct lk_event
+{
+  int32_t se_assoc_id;
+  uint16_t se_type;
+  uint8_t se_on;
+};
+
+struct lk_notification_header
+{
+  uint16_t sn_type;
+  uint16_t sn_flags;
+  uint32_t sn_length;
+};
+
+struct lk_assoc_change
+{
+  uint16_t sac_type;
+  uint16_t sac_flags;
+  uint32_t sac_length;
+  uint16_t sac_state;
+  uint16_t sac_error;
+  uint16_t sac_outbound_streams;
+  uint16_t sac_inbound_streams;
+  int32_t sac_assoc_id;
+};
+
+struct lk_paddr_change
+{
+  uint16_t spc_type;
+  uint16_t spc_flags;
+  uint32_t spc_length;
+  struct sockaddr_storage spc_aaddr;
+  int spc_state;
+  int spc_error;
+  int32_t spc_assoc_id;
+} __attribute__((packed, aligned(4)));
+
+// the fields of struct sctp_event_subscribe, in the order of the kernel
+static const uint16_t event_types[] = {
+  0, // sctp_data_io_event: the receive callback always gets the stream and the ppid
+  SCTP_ASSOC_CHANGE, SCTP_PEER_ADDR_CHANGE, SCTP_SEND_FAILED, SCTP_REMOTE_ERROR,
+  SCTP_SHUTDOWN_EVENT, SCTP_PARTIAL_DELIVERY_EVENT, SCTP_ADAPTATION_INDICATION,
+  SCTP_AUTHENTICATION_EVENT, SCTP_SENDER_DRY_EVENT, SCTP_STREAM_RESET_EVENT,
+  SCTP_ASSOC_RESET_EVENT, SCTP_STREAM_CHANGE_EVENT, SCTP_SEND_FAILED_EVENT
+};
+
+// the stack is shared by the transports of the process
+static int stack_users = 0;
+static bool stack_running = false;
+static unsigned short stack_udp_port = 0;
+
+struct UsrsctpTransport::sock_t
+{
+  int fd; // event file descriptor, it identifies the socket towards the port
+  struct socket *so;
+  uint32_t seq; // see add_socket(), 0 if the socket is not served by the engine
+  int wanted; // the usrsctp events signalled on fd, read by the upcall
+  bool connecting;
+  bool timestamps; // SO_TIMESTAMPNS is set
+  std::vector<unsigned char> partial; // the fragments of an incomplete message
+};
+
+struct UsrsctpTransport::item_t
+{
+  struct socket *so;
+  message_type_t type;
+  bool eor; // last fragment of the message
+  uint16_t stream;
+  uint32_t ppid;
+  uint32_t context; // IO_SEND_ERROR only
+  bool has_context;
+  int err;
+  void *data; // allocated by malloc(), owned by the item
+  size_t len;
+  struct timespec ts;
+};
+
+struct UsrsctpTransport::state_t
+{
+  pthread_mutex_t lock; // protects shared
+  std::vector<item_t> shared; // filled by the receive callback
+  std::vector<item_t> local; // taken over from shared by receive()
+  size_t next; // the next item in local
+  std::deque<item_t> front; // served before local: send errors, items of the newly added sockets
+  std::map<int, sock_t *> by_fd;
+  std::map<struct socket *, sock_t *> by_sock;
+  std::map<struct socket *, std::vector<item_t> > parked; // items of the sockets not added yet
+  void *current_data; // freed by release()
+  std::vector<unsigned char> assembled;
+};
+
+
+static int receive_cb(struct socket *so, union sctp_sockstore, void *data, size_t len,
+  struct sctp_rcvinfo rcv, int flags, void *ulp_info)
+{
+  // accepted sockets inherit ulp_info from the listening socket
+  ((UsrsctpTransport *)ulp_info)->received(so, data, len, flags, rcv.rcv_sid, ntohl(rcv.rcv_ppid));
+  return 1;
+}
+
+
+UsrsctpTransport::UsrsctpTransport() :
+    event_fd(-1), remote_port(0), started(false), state(NULL), send_errors(0)
+{
+  current.data = NULL;
+}
+
+
+UsrsctpTransport::~UsrsctpTransport()
+{
+  stop();
+}
+
+
+int UsrsctpTransport::start(unsigned short udp_port, unsigned short remote_udp_port)
+{
+  if (!stack_running)
+  {
+    if (udp_port != 0)
+    { // usrsctp_init() does not report if the port is taken
+      int probe = ::socket(AF_INET, SOCK_DGRAM, 0);
+      if (probe == -1) return errno;
+      struct sockaddr_in sa;
+      memset(&sa, 0, sizeof(sa));
+      sa.sin_family = AF_INET;
+      sa.sin_port = htons(udp_port);
+      int err = ::bind(probe, (struct sockaddr *)&sa, sizeof(sa)) == -1 ? errno : 0;
+      ::close(probe);
+      if (err != 0) return err;
+    }
+    usrsctp_init(udp_port, NULL, NULL);
+    stack_running = true;
+    stack_udp_port = udp_port;
+  }
+  else if (udp_port != stack_udp_port) return EADDRINUSE;
+
+  if ((event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) == -1) return errno;
+  state = new state_t;
+  pthread_mutex_init(&state->lock, NULL);
+  state->next = 0;
+  state->current_data = NULL;
+  remote_port = remote_udp_port;
+  started = true;
+  stack_users++;
+  return 0;
+}
+
+
+void UsrsctpTransport::stop()
+{
+  if (!started) return;
+  while (!state->by_fd.empty()) close_sock(state->by_fd.begin()->second);
+  // the undelivered messages of the sockets never accepted
+  for (std::map<struct socket *, std::vector<item_t> >::iterator it = state->parked.begin();
+       it != state->parked.end(); ++it)
+    for (size_t i = 0; i < it->second.size(); i++) free(it->second[i].data);
+  for (size_t i = 0; i < state->front.size(); i++) free(state->front[i].data);
+  for (size_t i = state->next; i < state->local.size(); i++) free(state->local[i].data);
+  for (size_t i = 0; i < state->shared.size(); i++) free(state->shared[i].data);
+  release();
+  pthread_mutex_destroy(&state->lock);
+  delete state;
+  state = NULL;
+  ::close(event_fd);
+  event_fd = -1;
+  started = false;
+  if (--stack_users == 0)
+  { // the stack is left running if the associations do not finish the shutdown
+    for (int i = 0; i < USRSCTP_FINISH_ATTEMPTS; i++)
+    {
+      if (usrsctp_finish() == 0)
+      {
+        stack_running = false;
+        break;
+      }
+      usleep(USRSCTP_FINISH_DELAY);
+    }
+  }
+}
+
+
+UsrsctpTransport::sock_t *UsrsctpTransport::find(int fd) const
+{
+  if (!state) return NULL;
+  std::map<int, sock_t *>::const_iterator it = state->by_fd.find(fd);
+  return it == state->by_fd.end() ? NULL : it->second;
+}
+
+
+UsrsctpTransport::sock_t *UsrsctpTransport::add_sock(struct socket *so)
+{
+  int fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (fd == -1)
+  {
+    int err = errno;
+    usrsctp_close(so);
+    errno = err;
+    return NULL;
+  }
+  sock_t *s = new sock_t;
+  s->fd = fd;
+  s->so = so;
+  s->seq = 0;
+  s->wanted = 0;
+  s->connecting = false;
+  s->timestamps = false;
+  // also replaces the upcall an accepted socket may inherit
+  usrsctp_set_upcall(so, upcall, s);
+  state->by_fd[fd] = s;
+  state->by_sock[so] = s;
+  return s;
+}
+
+
+void UsrsctpTransport::upcall(struct socket *so, void *arg, int)
+{
+  sock_t *s = (sock_t *)arg;
+  int wanted = __atomic_load_n(&s->wanted, __ATOMIC_ACQUIRE);
+  if (wanted != 0 && (usrsctp_get_events(so) & wanted) != 0)
+  {
+    uint64_t one = 1;
+    if (write(s->fd, &one, sizeof(one)) < 0) errno = 0;
+  }
+}
+
+
+static void clear_fd(int fd)
+{
+  uint64_t value;
+  if (read(fd, &value, sizeof(value)) < 0) errno = 0;
+}
+
+
+int UsrsctpTransport::socket(int family, bool nonblocking)
+{
+  if (!started)
+  {
+    errno = ENOTCONN;
+    return -1;
+  }
+  struct socket *so = usrsctp_socket(family, SOCK_STREAM, IPPROTO_SCTP, receive_cb, NULL, 0, this);
+  if (so == NULL) return -1;
+  if (remote_port != 0)
+  {
+    struct sctp_udpencaps encaps;
+    memset(&encaps, 0, sizeof(encaps));
+    encaps.sue_address.ss_family = family;
+    encaps.sue_port = htons(remote_port);
+    if (usrsctp_setsockopt(so, IPPROTO_SCTP, SCTP_REMOTE_UDP_ENCAPS_PORT, &encaps, sizeof(encaps)) < 0)
+    {
+      int err = errno;
+      usrsctp_close(so);
+      errno = err;
+      return -1;
+    }
+  }
+  if (nonblocking) usrsctp_set_non_blocking(so, 1);
+  sock_t *s = add_sock(so);
+  return s ? s->fd : -1;
+}
+
+
+int UsrsctpTransport::bind(int fd, const struct sockaddr *addr, socklen_t len)
+{
+  sock_t *s = find(fd);
+  if (!s)
+  {
+    errno = EBADF;
+    return -1;
+  }
+  return usrsctp_bind(s->so, (struct sockaddr *)addr, len);
+}
+
+
+int UsrsctpTransport::listen(int fd, int backlog)
+{
+  sock_t *s = find(fd);
+  if (!s)
+  {
+    errno = EBADF;
+    return -1;
+  }
+  // the port accepts when fd is signalled, accept() must not block
+  if (usrsctp_set_non_blocking(s->so, 1) < 0 || usrsctp_listen(s->so, backlog) < 0) return -1;
+  __atomic_store_n(&s->wanted, SCTP_EVENT_READ, __ATOMIC_RELEASE);
+  if (usrsctp_get_events(s->so) & SCTP_EVENT_READ) upcall(s->so, s, 0);
+  return 0;
+}
+
+
+int UsrsctpTransport::accept(int fd, struct sockaddr *addr, socklen_t *len, bool nonblocking)
+{
+  sock_t *s = find(fd);
+  if (!s)
+  {
+    errno = EBADF;
+    return -1;
+  }
+  clear_fd(s->fd);
+  struct socket *so = usrsctp_accept(s->so, addr, len);
+  int err = errno;
+  // more connections are waiting
+  if (usrsctp_get_events(s->so) & SCTP_EVENT_READ) upcall(s->so, s, 0);
+  if (so == NULL)
+  {
+    errno = err;
+    return -1;
+  }
+  if (nonblocking) usrsctp_set_non_blocking(so, 1);
+  sock_t *n = add_sock(so);
+  if (!n) return -1;
+  n->timestamps = s->timestamps;
+  return n->fd;
+}
+
+
+int UsrsctpTransport::connect(int fd, const struct sockaddr *addr, socklen_t len)
+{
+  sock_t *s = find(fd);
+  if (!s)
+  {
+    errno = EBADF;
+    return -1;
+  }
+  if (s->connecting)
+  { // called again after fd was signalled
+    clear_fd(s->fd);
+    int events = usrsctp_get_events(s->so);
+    if (events & SCTP_EVENT_ERROR)
+    {
+      int err = 0;
+      socklen_t err_len = sizeof(err);
+      if (usrsctp_getsockopt(s->so, SOL_SOCKET, SO_ERROR, &err, &err_len) < 0 || err == 0) err = ECONNREFUSED;
+      errno = err;
+    }
+    else if (events & SCTP_EVENT_WRITE) errno = EISCONN;
+    else
+    {
+      errno = EALREADY;
+      return -1;
+    }
+    s->connecting = false;
+    __atomic_store_n(&s->wanted, 0, __ATOMIC_RELEASE);
+    return -1;
+  }
+  __atomic_store_n(&s->wanted, SCTP_EVENT_WRITE | SCTP_EVENT_ERROR, __ATOMIC_RELEASE);
+  if (usrsctp_connect(s->so, (struct sockaddr *)addr, len) == 0)
+  {
+    __atomic_store_n(&s->wanted, 0, __ATOMIC_RELEASE);
+    clear_fd(s->fd);
+    return 0;
+  }
+  int err = errno;
+  if (err == EINPROGRESS)
+  {
+    s->connecting = true;
+    // the attempt may have finished already
+    if (usrsctp_get_events(s->so) & (SCTP_EVENT_WRITE | SCTP_EVENT_ERROR)) upcall(s->so, s, 0);
+  }
+  else __atomic_store_n(&s->wanted, 0, __ATOMIC_RELEASE);
+  errno = err;
+  return -1;
+}
+
+
+int UsrsctpTransport::set_nonblocking(int fd)
+{
+  sock_t *s = find(fd);
+  if (!s)
+  {
+    errno = EBADF;
+    return -1;
+  }
+  return usrsctp_set_non_blocking(s->so, 1);
+}
+
+
+int UsrsctpTransport::setsockopt(int fd, int level, int name, const void *value, socklen_t len)
+{
+  sock_t *s = find(fd);
+  if (!s)
+  {
+    errno = EBADF;
+    return -1;
+  }
+  if (level == SOL_SOCKET)
+  {
+    switch (name)
+    {
+      case SO_LINGER:
+        return usrsctp_setsockopt(s->so, SOL_SOCKET, SO_LINGER, value, len);
+      case SO_TIMESTAMPNS:
+        // the messages are stamped by the receive callback
+        if (len < sizeof(int))
+        {
+          errno = EINVAL;
+          return -1;
+        }
+        s->timestamps = *(const int *)value != 0;
+        return 0;
+      default:
+        errno = ENOPROTOOPT;
+        return -1;
+    }
+  }
+  if (level != IPPROTO_SCTP)
+  {
+    errno = ENOPROTOOPT;
+    return -1;
+  }
+  switch (name)
+  {
+    case LK_SCTP_INITMSG:
+    {
+      if (len < sizeof(struct lk_initmsg))
+      {
+        errno = EINVAL;
+        return -1;
+      }
+      const struct lk_initmsg *lk = (const struct lk_initmsg *)value;
+      struct sctp_initmsg initmsg;
+      memset(&initmsg, 0, sizeof(initmsg));
+      initmsg.sinit_num_ostreams = lk->sinit_num_ostreams;
+      initmsg.sinit_max_instreams = lk->sinit_max_instreams;
+      initmsg.sinit_max_attempts = lk->sinit_max_attempts;
+      initmsg.sinit_max_init_timeo = lk->sinit_max_init_timeo;
+      return usrsctp_setsockopt(s->so, IPPROTO_SCTP, SCTP_INITMSG, &initmsg, sizeof(initmsg));
+    }
+    case LK_SCTP_RTOINFO:
+    {
+      if (len < sizeof(struct lk_rtoinfo))
+      {
+        errno = EINVAL;
+        return -1;
+      }
+      const struct lk_rtoinfo *lk = (const struct lk_rtoinfo *)value;
+      struct sctp_rtoinfo rtoinfo;
+      memset(&rtoinfo, 0, sizeof(rtoinfo));
+      rtoinfo.srto_assoc_id = lk->srto_assoc_id;
+      rtoinfo.srto_initial = lk->srto_initial;
+      rtoinfo.srto_max = lk->srto_max;
+      rtoinfo.srto_min = lk->srto_min;
+      return usrsctp_setsockopt(s->so, IPPROTO_SCTP, SCTP_RTOINFO, &rtoinfo, sizeof(rtoinfo));
+    }
+    case LK_SCTP_NODELAY:
+      return usrsctp_setsockopt(s->so, IPPROTO_SCTP, SCTP_NODELAY, value, len);
+    case LK_SCTP_EVENTS:
+    { // one byte per event, older kernels know fewer of them
+      const unsigned char *on = (const unsigned char *)value;
+      for (socklen_t i = 1; i < len && i < sizeof(event_types) / sizeof(event_types[0]); i++)
+      {
+        struct sctp_event event;
+        memset(&event, 0, sizeof(event));
+        event.se_assoc_id = SCTP_FUTURE_ASSOC;
+        event.se_type = event_types[i];
+        event.se_on = on[i] != 0;
+        if (usrsctp_setsockopt(s->so, IPPROTO_SCTP, SCTP_EVENT, &event, sizeof(event)) < 0) return -1;
+      }
+      return 0;
+    }
+    case LK_SCTP_EVENT:
+    {
+      if (len < sizeof(struct lk_event))
+      {
+        errno = EINVAL;
+        return -1;
+      }
+      const struct lk_event *lk = (const struct lk_event *)value;
+      unsigned int i = lk->se_type - LK_SN_TYPE_BASE;
+      if (lk->se_type < LK_SN_TYPE_BASE || i >= sizeof(event_types) / sizeof(event_types[0]))
+      {
+        errno = EINVAL;
+        return -1;
+      }
+      if (i == 0) return 0; // sctp_data_io_event
+      struct sctp_event event;
+      memset(&event, 0, sizeof(event));
+      event.se_assoc_id = SCTP_FUTURE_ASSOC;
+      event.se_type = event_types[i];
+      event.se_on = lk->se_on != 0;
+      return usrsctp_setsockopt(s->so, IPPROTO_SCTP, SCTP_EVENT, &event, sizeof(event));
+    }
+    default:
+      errno = ENOPROTOOPT;
+      return -1;
+  }
+}
+
+
+// copies the first address of the list returned by usrsctp_getladdrs() or usrsctp_getpaddrs()
+static int first_address(int n, const struct sockaddr *addrs, struct sockaddr *addr, socklen_t *len)
+{
+  if (n <= 0)
+  {
+    if (n == 0) errno = ENOTCONN;
+    return -1;
+  }
+  socklen_t size = addrs->sa_family == AF_INET6 ? sizeof(struct sockaddr_in6) : sizeof(struct sockaddr_in);
+  memcpy(addr, addrs, size < *len ? size : *len);
+  *len = size;
+  return 0;
+}
+
+
+int UsrsctpTransport::getsockname(int fd, struct sockaddr *addr, socklen_t *len)
+{
+  sock_t *s = find(fd);
+  if (!s)
+  {
+    errno = EBADF;
+    return -1;
+  }
+  struct sockaddr *addrs = NULL;
+  int n = usrsctp_getladdrs(s->so, 0, &addrs);
+  int result = first_address(n, addrs, addr, len);
+  if (n > 0) usrsctp_freeladdrs(addrs);
+  return result;
+}
+
+
+int UsrsctpTransport::getpeername(int fd, struct sockaddr *addr, socklen_t *len)
+{
+  sock_t *s = find(fd);
+  if (!s)
+  {
+    errno = EBADF;
+    return -1;
+  }
+  struct sockaddr *addrs = NULL;
+  int n = usrsctp_getpaddrs(s->so, 0, &addrs);
+  int result = first_address(n, addrs, addr, len);
+  if (n > 0) usrsctp_freepaddrs(addrs);
+  return result;
+}
+
+
+int UsrsctpTransport::close(int fd)
+{
+  sock_t *s = find(fd);
+  if (!s)
+  {
+    errno = EBADF;
+    return -1;
+  }
+  close_sock(s);
+  return 0;
+}
+
+
+void UsrsctpTransport::close_socket(int fd)
+{
+  sock_t *s = find(fd);
+  if (s) close_sock(s);
+}
+
+
+void UsrsctpTransport::close_sock(sock_t *s)
+{
+  __atomic_store_n(&s->wanted, 0, __ATOMIC_RELEASE);
+  usrsctp_set_upcall(s->so, NULL, NULL);
+  usrsctp_close(s->so);
+  purge(s->so);
+  state->by_fd.erase(s->fd);
+  state->by_sock.erase(s->so);
+  ::close(s->fd);
+  delete s;
+}
+
+
+// drops the queued items of a closed socket, its address may be reused by a new one
+void UsrsctpTransport::purge(struct socket *so)
+{
+  std::map<struct socket *, std::vector<item_t> >::iterator p = state->parked.find(so);
+  if (p != state->parked.end())
+  {
+    for (size_t i = 0; i < p->second.size(); i++) free(p->second[i].data);
+    state->parked.erase(p);
+  }
+  for (std::deque<item_t>::iterator it = state->front.begin(); it != state->front.end(); )
+  {
+    if (it->so == so)
+    {
+      free(it->data);
+      it = state->front.erase(it);
+    }
+    else ++it;
+  }
+  for (size_t i = state->next; i < state->local.size(); i++)
+    if (state->local[i].so == so)
+    {
+      free(state->local[i].data);
+      state->local[i].data = NULL;
+      state->local[i].so = NULL;
+    }
+  pthread_mutex_lock(&state->lock);
+  for (size_t i = 0; i < state->shared.size(); i++)
+    if (state->shared[i].so == so)
+    {
+      free(state->shared[i].data);
+      state->shared[i].data = NULL;
+      state->shared[i].so = NULL;
+    }
+  pthread_mutex_unlock(&state->lock);
+}
+
+
+void UsrsctpTransport::add_socket(int fd, uint32_t seq)
+{
+  sock_t *s = find(fd);
+  if (!s) return;
+  s->seq = seq;
+  std::map<struct socket *, std::vector<item_t> >::iterator p = state->parked.find(s->so);
+  if (p != state->parked.end())
+  { // received before the socket was accepted
+    state->front.insert(state->front.end(), p->second.begin(), p->second.end());
+    state->parked.erase(p);
+    notify();
+  }
+}
+
+
+bool UsrsctpTransport::send(int fd, unsigned int stream, uint32_t ppid, uint32_t context, bool has_context, const void *data,
+  size_t len, bool report)
+{
+  sock_t *s = find(fd);
+  if (!s) return true;
+  struct sctp_sndinfo info;
+  memset(&info, 0, sizeof(info));
+  info.snd_sid = stream;
+  info.snd_ppid = htonl(ppid);
+  info.snd_context = context;
+  if (usrsctp_sendv(s->so, data, len, NULL, 0, &info, sizeof(info), SCTP_SENDV_SNDINFO, 0) >= 0) return true;
+  int err = errno;
+  errno = 0;
+  if (err == EWOULDBLOCK) return false; // the send buffer is full
+  send_errors++;
+  if (report)
+  {
+    item_t item;
+    memset(&item, 0, sizeof(item));
+    item.so = s->so;
+    item.type = IO_SEND_ERROR;
+    item.stream = stream;
+    item.ppid = ppid;
+    item.context = context;
+    item.has_context = has_context;
+    item.err = err;
+    item.len = len;
+    item.data = malloc(len > 0 ? len : 1);
+    if (len > 0) memcpy(item.data, data, len);
+    state->front.push_back(item);
+    notify();
+  }
+  return true;
+}
+
+
+void UsrsctpTransport::received(struct socket *so, void *data, size_t len, int flags,
+  uint16_t stream, uint32_t ppid)
+{
+  item_t item;
+  item.so = so;
+  // no data: the association is gone
+  if (data == NULL) item.type = IO_EOF;
+  else if (flags & MSG_NOTIFICATION) item.type = IO_NOTIFICATION;
+  else item.type = IO_DATA;
+  item.eor = (flags & MSG_EOR) != 0;
+  item.stream = stream;
+  item.ppid = ppid;
+  item.context = 0;
+  item.has_context = false;
+  item.err = 0;
+  item.data = data;
+  item.len = len;
+  clock_gettime(CLOCK_REALTIME, &item.ts);
+  pthread_mutex_lock(&state->lock);
+  bool was_empty = state->shared.empty();
+  state->shared.push_back(item);
+  pthread_mutex_unlock(&state->lock);
+  if (was_empty) notify();
+}
+
+
+void UsrsctpTransport::clear_event()
+{
+  uint64_t value;
+  if (read(event_fd, &value, sizeof(value)) < 0) errno = 0;
+}
+
+
+void UsrsctpTransport::notify()
+{
+  uint64_t one = 1;
+  if (write(event_fd, &one, sizeof(one)) < 0) errno = 0;
+}
+
+
+// translates a notification of usrsctp to the layout of the kernel, returns its length
+static size_t translate_notification(const void *data, size_t len, unsigned char *out, size_t out_len)
+{
+  const union sctp_notification *n = (const union sctp_notification *)data;
+  memset(out, 0, sizeof(struct lk_paddr_change));
+  if (len < sizeof(struct lk_notification_header)) return 0;
+  switch (n->sn_header.sn_type)
+  {
+    case SCTP_ASSOC_CHANGE:
+    {
+      struct lk_assoc_change *lk = (struct lk_assoc_change *)out;
+      lk->sac_type = LK_ASSOC_CHANGE;
+      lk->sac_length = sizeof(*lk);
+      switch (n->sn_assoc_change.sac_state)
+      { // the kernel numbers the states from 0
+        case SCTP_COMM_UP: lk->sac_state = 0; break;
+        case SCTP_COMM_LOST: lk->sac_state = 1; break;
+        case SCTP_RESTART: lk->sac_state = 2; break;
+        case SCTP_SHUTDOWN_COMP: lk->sac_state = 3; break;
+        case SCTP_CANT_STR_ASSOC: lk->sac_state = 4; break;
+        default: lk->sac_state = 0xffff; break;
+      }
+      lk->sac_error = n->sn_assoc_change.sac_error;
+      lk->sac_outbound_streams = n->sn_assoc_change.sac_outbound_streams;
+      lk->sac_inbound_streams = n->sn_assoc_change.sac_inbound_streams;
+      lk->sac_assoc_id = n->sn_assoc_change.sac_assoc_id;
+      return sizeof(*lk);
+    }
+    case SCTP_PEER_ADDR_CHANGE:
+    {
+      struct lk_paddr_change *lk = (struct lk_paddr_change *)out;
+      lk->spc_type = LK_PEER_ADDR_CHANGE;
+      lk->spc_length = sizeof(*lk);
+      memcpy(&lk->spc_aaddr, &n->sn_paddr_change.spc_aaddr, sizeof(lk->spc_aaddr));
+      switch (n->sn_paddr_change.spc_state)
+      {
+        case SCTP_ADDR_AVAILABLE: lk->spc_state = 0; break;
+        case SCTP_ADDR_UNREACHABLE: lk->spc_state = 1; break;
+        case SCTP_ADDR_REMOVED: lk->spc_state = 2; break;
+        case SCTP_ADDR_ADDED: lk->spc_state = 3; break;
+        case SCTP_ADDR_MADE_PRIM: lk->spc_state = 4; break;
+        case SCTP_ADDR_CONFIRMED: lk->spc_state = 5; break;
+        default: lk->spc_state = -1; break;
+      }
+      lk->spc_error = n->sn_paddr_change.spc_error;
+      lk->spc_assoc_id = n->sn_paddr_change.spc_assoc_id;
+      return sizeof(*lk);
+    }
+    default:
+    { // only the type is used by the port, the rest is passed as it is
+      uint16_t type;
+      switch (n->sn_header.sn_type)
+      {
+        case SCTP_SEND_FAILED: type = LK_SEND_FAILED; break;
+        case SCTP_REMOTE_ERROR: type = LK_REMOTE_ERROR; break;
+        case SCTP_SHUTDOWN_EVENT: type = LK_SHUTDOWN_EVENT; break;
+        case SCTP_PARTIAL_DELIVERY_EVENT: type = LK_PARTIAL_DELIVERY_EVENT; break;
+        case SCTP_ADAPTATION_INDICATION: type = LK_ADAPTATION_INDICATION; break;
+        case SCTP_AUTHENTICATION_EVENT: type = LK_AUTHENTICATION_EVENT; break;
+        case SCTP_SENDER_DRY_EVENT: type = LK_SENDER_DRY_EVENT; break;
+        case SCTP_STREAM_RESET_EVENT: type = LK_STREAM_RESET_EVENT; break;
+        case SCTP_ASSOC_RESET_EVENT: type = LK_ASSOC_RESET_EVENT; break;
+        case SCTP_STREAM_CHANGE_EVENT: type = LK_STREAM_CHANGE_EVENT; break;
+        case SCTP_SEND_FAILED_EVENT: type = LK_SEND_FAILED_EVENT; break;
+        default: type = 0; break; // reported as unknown by the port
+      }
+      size_t n_len = len < out_len ? len : out_len;
+      memcpy(out, data, n_len);
+      ((struct lk_notification_header *)out)->sn_type = type;
+      return n_len;
+    }
+  }
+}
+
+
+// fills current from the item, returns false if the item is not delivered
+bool UsrsctpTransport::build(sock_t *s, item_t& item)
+{
+  current.type = item.type;
+  current.fd = s->fd;
+  current.seq = s->seq;
+  current.stream = item.stream;
+  current.ppid = item.ppid;
+  current.context = item.context;
+  current.has_context = item.has_context;
+  current.err = item.err;
+  current.report = false;
+  current.ts_valid = s->timestamps && item.type != IO_SEND_ERROR;
+  current.ts = item.ts;
+  current.len = 0;
+  current.data = current.inline_data;
+  switch (item.type)
+  {
+    case IO_EOF:
+      return true;
+    case IO_NOTIFICATION:
+      current.len = translate_notification(item.data, item.len, current.inline_data, IO_INLINE_SIZE);
+      free(item.data);
+      return current.len > 0;
+    case IO_DATA:
+      if (!item.eor || !s->partial.empty())
+      { // a fragment of a long message
+        s->partial.insert(s->partial.end(), (unsigned char *)item.data, (unsigned char *)item.data + item.len);
+        free(item.data);
+        if (!item.eor) return false;
+        state->assembled.swap(s->partial);
+        s->partial.clear();
+        current.data = &state->assembled[0];
+        current.len = state->assembled.size();
+        return true;
+      }
+      // falls through
+    default:
+      current.data = (unsigned char *)item.data;
+      current.len = item.len;
+      state->current_data = item.data;
+      return true;
+  }
+}
+
+
+const UsrsctpTransport::message_t *UsrsctpTransport::receive()
+{
+  if (!state) return NULL;
+  release();
+  for (;;)
+  {
+    item_t item;
+    if (!state->front.empty())
+    {
+      item = state->front.front();
+      state->front.pop_front();
+    }
+    else
+    {
+      if (state->next == state->local.size())
+      {
+        state->local.clear();
+        state->next = 0;
+        pthread_mutex_lock(&state->lock);
+        state->local.swap(state->shared);
+        pthread_mutex_unlock(&state->lock);
+        if (state->local.empty()) return NULL;
+      }
+      item = state->local[state->next++];
+    }
+    if (item.so == NULL) continue; // purged
+    std::map<struct socket *, sock_t *>::iterator it = state->by_sock.find(item.so);
+    if (it == state->by_sock.end() || it->second->seq == 0)
+    { // the socket is not accepted or not added yet
+      state->parked[item.so].push_back(item);
+      continue;
+    }
+    if (build(it->second, item)) return &current;
+  }
+}
+
+
+void UsrsctpTransport::release()
+{
+  if (!state) return;
+  free(state->current_data);
+  state->current_data = NULL;
+}
+
+}
+
+#else // built without usrsctp
+
+namespace SCTPasp__PortType {
+
+UsrsctpTransport::UsrsctpTransport() :
+    event_fd(-1), remote_port(0), started(false), state(NULL), send_errors(0)
+{
+}
+
+UsrsctpTransport::~UsrsctpTransport() {}
+int UsrsctpTransport::start(unsigned short, unsigned short) { return EOPNOTSUPP; }
+int UsrsctpTransport::socket(int, bool) { errno = EOPNOTSUPP; return -1; }
+int UsrsctpTransport::bind(int, const struct sockaddr *, socklen_t) { errno = EBADF; return -1; }
+int UsrsctpTransport::listen(int, int) { errno = EBADF; return -1; }
+int UsrsctpTransport::accept(int, struct sockaddr *, socklen_t *, bool) { errno = EBADF; return -1; }
+int UsrsctpTransport::connect(int, const struct sockaddr *, socklen_t) { errno = EBADF; return -1; }
+int UsrsctpTransport::set_nonblocking(int) { errno = EBADF; return -1; }
+int UsrsctpTransport::setsockopt(int, int, int, const void *, socklen_t) { errno = EBADF; return -1; }
+int UsrsctpTransport::getsockname(int, struct sockaddr *, socklen_t *) { errno = EBADF; return -1; }
+int UsrsctpTransport::getpeername(int, struct sockaddr *, socklen_t *) { errno = EBADF; return -1; }
+int UsrsctpTransport::close(int) { errno = EBADF; return -1; }
+void UsrsctpTransport::stop() {}
+void UsrsctpTransport::add_socket(int, uint32_t) {}
+void UsrsctpTransport::close_socket(int) {}
+bool UsrsctpTransport::send(int, unsigned int, uint32_t, uint32_t, bool, const void *, size_t, bool) { return false; }
+void UsrsctpTransport::clear_event() {}
+void UsrsctpTransport::notify() {}
+const UsrsctpTransport::message_t *UsrsctpTransport::receive() { return NULL; }
+void UsrsctpTransport::release() {}
+void UsrsctpTransport::received(struct socket *, void *, size_t, int, uint16_t, uint32_t) {}
+void UsrsctpTransport::upcall(struct socket *, void *, int) {}
+
+}
+
+#endif
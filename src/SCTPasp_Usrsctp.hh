@@ -0,0 +1,112 @@
+/******************************************************************************
+* Copyright (c) 2000-2021 Ericsson Telecom AB
+* All rights reserved. This program and the accompanying materials
+* are made available under the terms of the Eclipse Public License v2.0
+* which accompanies this distribution, and is available at
+* https://www.eclipse.org/org/documents/epl-2.0/EPL-2.0.html
+*
+* Contributors:
+*  Peter Dimitrov- initial implementation and initial documentation
+*  Adam Delic
+*  Eduard Czimbalmos
+*  Endre Kulcsar
+*  Gabor Bettesch
+*  Gabor Szalai
+*  Tamas Buti
+*  Zoltan Medve
+******************************************************************************/
+//
+//  File:               SCTPasp_Usrsctp.hh
+//  Description:        usrsctp transport of the SCTPasp test port
+//  Prodnr:             CNL 113 469
+//
+// SCTP in user space over UDP encapsulation (RFC 6951), the kernel SCTP module
+// is not needed. The stack is shared by the transports of the process, it is
+// started by the first one. usrsctp delivers the received messages and
+// notifications by a callback in its own threads, they are queued and fetched
+// by the TITAN thread as from the other socket engines. The options and the
+// notifications are translated from and to the kernel API, see
+// SCTPasp_Transport.hh.
+// Built only with -DUSE_USRSCTP, otherwise start() fails.
+
+
+#ifndef SCTPasp__Usrsctp_HH
+#define SCTPasp__Usrsctp_HH
+
+#include "SCTPasp_Transport.hh"
+#include "SCTPasp_Engine.hh"
+
+struct socket;
+
+namespace SCTPasp__PortType {
+
+class UsrsctpTransport : public Transport, public SocketEngine
+{
+public:
+  UsrsctpTransport();
+  ~UsrsctpTransport();
+
+  // udp_port is the local port of the UDP encapsulation, it is fixed by the
+  // first transport of the process; remote_udp_port is the port of the peers;
+  // returns 0 or errno
+  int start(unsigned short udp_port, unsigned short remote_udp_port);
+
+  const char *get_transport_name() const { return "usrsctp"; }
+  bool kernel_sockets() const { return false; }
+  SocketEngine *get_engine() { return this; }
+
+  int socket(int family, bool nonblocking);
+  int bind(int fd, const struct sockaddr *addr, socklen_t len);
+  int listen(int fd, int backlog);
+  int accept(int fd, struct sockaddr *addr, socklen_t *len, bool nonblocking);
+  int connect(int fd, const struct sockaddr *addr, socklen_t len);
+  int set_nonblocking(int fd);
+  int setsockopt(int fd, int level, int name, const void *value, socklen_t len);
+  int getsockname(int fd, struct sockaddr *addr, socklen_t *len);
+  int getpeername(int fd, struct sockaddr *addr, socklen_t *len);
+  int close(int fd);
+
+  void stop();
+
+  int get_event_fd() const { return event_fd; }
+
+  void add_socket(int fd, uint32_t seq);
+  void close_socket(int fd);
+  bool send(int fd, unsigned int stream, uint32_t ppid, uint32_t context, bool has_context, const void *data,
+    size_t len, bool report);
+
+  void clear_event();
+  void notify();
+  const message_t *receive();
+  void release();
+
+  uint64_t get_send_errors() const { return send_errors; }
+
+  // called by the threads of usrsctp
+  void received(struct socket *so, void *data, size_t len, int flags, uint16_t stream, uint32_t ppid);
+  static void upcall(struct socket *so, void *arg, int flags);
+
+private:
+  UsrsctpTransport(const UsrsctpTransport&);
+  UsrsctpTransport& operator=(const UsrsctpTransport&);
+
+  struct sock_t;
+  struct item_t;
+  struct state_t;
+
+  sock_t *find(int fd) const;
+  sock_t *add_sock(struct socket *so);
+  void close_sock(sock_t *s);
+  void purge(struct socket *so);
+  bool build(sock_t *s, item_t& item);
+
+  int event_fd;
+  unsigned short remote_port;
+  bool started;
+  state_t *state;
+  message_t current; // the message returned by receive()
+  uint64_t send_errors;
+};
+
+}
+#endif
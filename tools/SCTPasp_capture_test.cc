@@ -0,0 +1,238 @@
+/******************************************************************************
+* Copyright (c) 2000-2021 Ericsson Telecom AB
+* All rights reserved. This program and the accompanying materials
+* are made available under the terms of the Eclipse Public License v2.0
+* which accompanies this distribution, and is available at
+* https://www.eclipse.org/org/documents/epl-2.0/EPL-2.0.html
+*
+* Contributors:
+*  Peter Dimitrov- initial implementation and initial documentation
+*  Adam Delic
+*  Eduard Czimbalmos
+*  Endre Kulcsar
+*  Gabor Bettesch
+*  Gabor Szalai
+*  Tamas Buti
+*  Zoltan Medve
+******************************************************************************/
+//
+//  File:               SCTPasp_capture_test.cc
+//  Description:        Unit test of the pcap capture of the SCTPasp test port
+//  Prodnr:             CNL 113 469
+//
+// Captures made-up messages into a temporary file, reads the packets back and
+// checks them against a bitwise CRC32c: the checksums of the SCTP packets,
+// the IPv4 header checksums, the fragmentation of the long messages and that
+// every submitted message is either written or counted as dropped. Prints the
+// failed checks and exits with 1 if there is any.
+
+
+#include "SCTPasp_Capture.hh"
+#include "SCTPasp_check.hh"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <string>
+#include <vector>
+
+using namespace SCTPasp__PortType;
+
+static inline uint16_t get16(const unsigned char *p) { return (p[0] << 8) | p[1]; }
+static inline uint32_t get32(const unsigned char *p) { return ((uint32_t)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3]; }
+
+
+// the reference, bit by bit with the reflected Castagnoli polynomial
+static uint32_t crc32c_bitwise(const unsigned char *buf, size_t len)
+{
+  uint32_t crc = 0xffffffff;
+  while (len--)
+  {
+    crc ^= *buf++;
+    for (int k = 0; k < 8; k++) crc = crc & 1 ? (crc >> 1) ^ 0x82f63b78 : crc >> 1;
+  }
+  return ~crc;
+}
+
+
+struct packet_t
+{
+  bool v6;
+  std::vector<unsigned char> ip; // the whole packet
+};
+
+
+static std::string temp_file()
+{
+  char name[] = "/tmp/SCTPasp_capture_test.XXXXXX";
+  int fd = mkstemp(name);
+  if (fd == -1)
+  {
+    perror("mkstemp");
+    exit(1);
+  }
+  close(fd);
+  return name;
+}
+
+
+// reads the packets of the capture file, the file header is checked here
+static std::vector<packet_t> read_capture(const char *filename)
+{
+  std::vector<packet_t> packets;
+  FILE *f = fopen(filename, "rb");
+  CHECK(f != NULL);
+  if (f == NULL) return packets;
+  unsigned char hdr[24];
+  CHECK(fread(hdr, sizeof(hdr), 1, f) == 1);
+  CHECK(get32(hdr) == 0xa1b23c4d); // nanosecond timestamps, big endian
+  CHECK(get32(hdr + 20) == 101); // LINKTYPE_RAW
+  unsigned char rec[16];
+  while (fread(rec, sizeof(rec), 1, f) == 1)
+  {
+    packet_t p;
+    uint32_t len = get32(rec + 8);
+    CHECK(len == get32(rec + 12));
+    p.ip.resize(len);
+    if (len && fread(&p.ip[0], len, 1, f) != 1)
+    {
+      CHECK(!"truncated packet");
+      break;
+    }
+    p.v6 = len > 0 && (p.ip[0] >> 4) == 6;
+    packets.push_back(p);
+  }
+  fclose(f);
+  return packets;
+}
+
+
+static void test_reference()
+{ // the check value of CRC-32C
+  CHECK(crc32c_bitwise((const unsigned char *)"123456789", 9) == 0xe3069283);
+}
+
+
+static void test_packets()
+{
+  std::string filename = temp_file();
+  CaptureWriter capture;
+  CHECK(capture.open(filename.c_str(), 64) == 0);
+
+  struct sockaddr_storage local4, peer4, local6, peer6;
+  memset(&local4, 0, sizeof(local4));
+  memset(&peer4, 0, sizeof(peer4));
+  memset(&local6, 0, sizeof(local6));
+  memset(&peer6, 0, sizeof(peer6));
+  struct sockaddr_in *sin = (struct sockaddr_in *)&local4;
+  sin->sin_family = AF_INET;
+  sin->sin_port = htons(2905);
+  inet_pton(AF_INET, "10.0.0.1", &sin->sin_addr);
+  sin = (struct sockaddr_in *)&peer4;
+  sin->sin_family = AF_INET;
+  sin->sin_port = htons(3868);
+  inet_pton(AF_INET, "10.0.0.2", &sin->sin_addr);
+  struct sockaddr_in6 *sin6 = (struct sockaddr_in6 *)&local6;
+  sin6->sin6_family = AF_INET6;
+  sin6->sin6_port = htons(2905);
+  inet_pton(AF_INET6, "2001:db8::1", &sin6->sin6_addr);
+  sin6 = (struct sockaddr_in6 *)&peer6;
+  sin6->sin6_family = AF_INET6;
+  sin6->sin6_port = htons(3868);
+  inet_pton(AF_INET6, "2001:db8::2", &sin6->sin6_addr);
+
+  // every padding length, and a message split into two DATA chunks
+  static const size_t lengths[] = { 0, 1, 2, 3, 4, 5, 100, 70000 };
+  const size_t count = sizeof(lengths) / sizeof(lengths[0]);
+  std::vector<std::vector<unsigned char> > messages;
+  for (size_t i = 0; i < count; i++)
+  {
+    std::vector<unsigned char> m(lengths[i]);
+    for (size_t k = 0; k < m.size(); k++) m[k] = (unsigned char)(k * 7 + i);
+    messages.push_back(m);
+    bool v6 = i % 2;
+    capture.submit(i % 3 == 0, false, 5, i, 46, m.empty() ? NULL : &m[0], m.size(),
+      v6 ? &local6 : &local4, v6 ? &peer6 : &peer4, 1000000000ULL * (i + 1));
+  }
+  capture.close();
+  CHECK(capture.get_written() == count && capture.get_dropped() == 0);
+
+  std::vector<packet_t> packets = read_capture(filename.c_str());
+  unlink(filename.c_str());
+  CHECK(packets.size() == count + 1);
+  size_t message = 0;
+  std::vector<unsigned char> data;
+  for (size_t i = 0; i < packets.size() && message < count; i++)
+  {
+    std::vector<unsigned char>& ip = packets[i].ip;
+    size_t ip_len = packets[i].v6 ? 40 : 20;
+    CHECK(packets[i].v6 == (message % 2 == 1));
+    if (ip.size() < ip_len + 12 + 16)
+    {
+      CHECK(!"short packet");
+      break;
+    }
+    if (!packets[i].v6)
+    { // the checksum of a correct header sums to 0xffff
+      uint32_t sum = 0;
+      for (size_t k = 0; k < 20; k += 2) sum += get16(&ip[k]);
+      while (sum >> 16) sum = (sum & 0xffff) + (sum >> 16);
+      CHECK(sum == 0xffff);
+      CHECK(get16(&ip[2]) == ip.size());
+    }
+    else CHECK(get16(&ip[4]) == ip.size() - 40);
+    unsigned char *sctp = &ip[ip_len];
+    size_t sctp_len = ip.size() - ip_len;
+    CHECK(sctp_len % 4 == 0);
+    // the checksum is little endian, computed with the field zeroed
+    uint32_t stored = sctp[8] | (sctp[9] << 8) | (sctp[10] << 16) | ((uint32_t)sctp[11] << 24);
+    memset(sctp + 8, 0, 4);
+    CHECK(crc32c_bitwise(sctp, sctp_len) == stored);
+    CHECK(get32(sctp + 4) == 5);
+    unsigned char *chunk = sctp + 12;
+    CHECK(chunk[0] == 0);
+    CHECK(get16(chunk + 8) == message);
+    CHECK(get32(chunk + 12) == 46);
+    size_t frag = get16(chunk + 2) - 16;
+    CHECK(frag <= sctp_len - 28);
+    if (chunk[1] & 0x02) data.clear();
+    data.insert(data.end(), chunk + 16, chunk + 16 + frag);
+    if (chunk[1] & 0x01)
+    {
+      CHECK(data == messages[message]);
+      message++;
+    }
+  }
+  CHECK(message == count);
+}
+
+
+static void test_dropped()
+{ // a short queue overflows, nothing is lost without being counted
+  std::string filename = temp_file();
+  CaptureWriter capture;
+  CHECK(capture.open(filename.c_str(), 4) == 0);
+  unsigned char buf[64];
+  memset(buf, 0xaa, sizeof(buf));
+  const unsigned long submitted = 10000;
+  for (unsigned long i = 0; i < submitted; i++)
+    capture.submit(true, false, 1, 0, 0, buf, sizeof(buf), NULL, NULL);
+  capture.close();
+  CHECK(capture.get_written() + capture.get_dropped() == submitted);
+  std::vector<packet_t> packets = read_capture(filename.c_str());
+  unlink(filename.c_str());
+  CHECK(packets.size() == capture.get_written());
+}
+
+
+int main()
+{
+  test_reference();
+  test_packets();
+  test_dropped();
+  return check_result("SCTPasp_capture_test");
+}
@@ -0,0 +1,49 @@
+/******************************************************************************
+* Copyright (c) 2000-2021 Ericsson Telecom AB
+* All rights reserved. This program and the accompanying materials
+* are made available under the terms of the Eclipse Public License v2.0
+* which accompanies this distribution, and is available at
+* https://www.eclipse.org/org/documents/epl-2.0/EPL-2.0.html
+*
+* Contributors:
+*  Peter Dimitrov- initial implementation and initial documentation
+*  Adam Delic
+*  Eduard Czimbalmos
+*  Endre Kulcsar
+*  Gabor Bettesch
+*  Gabor Szalai
+*  Tamas Buti
+*  Zoltan Medve
+******************************************************************************/
+//
+//  File:               SCTPasp_check.hh
+//  Description:        checks of the unit tests of the SCTPasp test port
+//  Prodnr:             CNL 113 469
+//
+// CHECK() prints and counts the failed conditions and goes on with the test,
+// check_result() reports them at the end of main(): the exit code is 1 if
+// any check failed.
+
+
+#ifndef SCTPasp__Check_HH
+#define SCTPasp__Check_HH
+
+#include <stdio.h>
+
+static int check_failures = 0;
+
+#define CHECK(cond) \
+  do { if (!(cond)) { fprintf(stderr, "%s:%d: %s failed\n", __FILE__, __LINE__, #cond); check_failures++; } } while (0)
+
+static inline int check_result(const char *test)
+{
+  if (check_failures)
+  {
+    fprintf(stderr, "%s: %d checks failed\n", test, check_failures);
+    return 1;
+  }
+  printf("%s: passed\n", test);
+  return 0;
+}
+
+#endif
@@ -0,0 +1,319 @@
+/******************************************************************************
+* Copyright (c) 2000-2021 Ericsson Telecom AB
+* All rights reserved. This program and the accompanying materials
+* are made available under the terms of the Eclipse Public License v2.0
+* which accompanies this distribution, and is available at
+* https://www.eclipse.org/org/documents/epl-2.0/EPL-2.0.html
+*
+* Contributors:
+*  Peter Dimitrov- initial implementation and initial documentation
+*  Adam Delic
+*  Eduard Czimbalmos
+*  Endre Kulcsar
+*  Gabor Bettesch
+*  Gabor Szalai
+*  Tamas Buti
+*  Zoltan Medve
+******************************************************************************/
+//
+//  File:               SCTPasp_core_bench.cc
+//  Description:        Measures the socket core of the SCTPasp test port over loopback
+//  Prodnr:             CNL 113 469
+//
+// The associations are set up over 127.0.0.1. A helper thread echoes every
+// message on the server side, the main thread keeps a window of messages in
+// flight on each client association and measures the round trip time of each
+// message by the timestamp carried in its first 8 bytes. Both sides receive
+// and send by the socket core, as the test port does without a socket engine.
+// The throughput is the number of echoed messages and their payload in one
+// direction per second.
+
+
+#include "SCTPasp_Core.hh"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <netinet/in.h>
+#include <netinet/sctp.h>
+#include <arpa/inet.h>
+#include <vector>
+#include <algorithm>
+
+using namespace SCTPasp__PortType;
+
+static std::vector<int> clients; // the main thread uses these
+static std::vector<int> servers; // the echo thread uses these
+
+static unsigned long long monotonic_ns()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+
+static void fail(const char *what)
+{
+  fprintf(stderr, "%s: %s\n", what, strerror(errno));
+  exit(1);
+}
+
+
+// the stream and the ppid of the messages are received as the test port receives them
+static void subscribe(int fd)
+{
+  struct sctp_event_subscribe events;
+  memset(&events, 0, sizeof(events));
+  events.sctp_data_io_event = 1;
+  events.sctp_association_event = 1;
+  if (setsockopt(fd, IPPROTO_SCTP, SCTP_EVENTS, &events, sizeof(events)) == -1) fail("setsockopt");
+}
+
+
+static void setup(int associations)
+{
+  int lfd = socket(AF_INET, SOCK_STREAM, IPPROTO_SCTP);
+  if (lfd == -1) fail("socket");
+  struct sockaddr_in sa;
+  memset(&sa, 0, sizeof(sa));
+  sa.sin_family = AF_INET;
+  sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  socklen_t len = sizeof(sa);
+  if (bind(lfd, (struct sockaddr *)&sa, sizeof(sa)) == -1) fail("bind");
+  if (listen(lfd, associations) == -1) fail("listen");
+  if (getsockname(lfd, (struct sockaddr *)&sa, &len) == -1) fail("getsockname");
+  subscribe(lfd);
+  for (int i = 0; i < associations; i++)
+  {
+    int c = socket(AF_INET, SOCK_STREAM, IPPROTO_SCTP);
+    if (c == -1) fail("socket");
+    subscribe(c);
+    if (connect(c, (struct sockaddr *)&sa, sizeof(sa)) == -1) fail("connect");
+    int s = accept(lfd, NULL, NULL);
+    if (s == -1) fail("accept");
+    clients.push_back(c);
+    servers.push_back(s);
+  }
+  close(lfd);
+}
+
+
+// Echoes the messages until every association is closed by the client.
+static void *echo_server(void *)
+{
+  AssociationTable table;
+  int ep = epoll_create1(0);
+  if (ep == -1) fail("epoll_create1");
+  for (size_t i = 0; i < servers.size(); i++)
+  {
+    if (table.put(servers[i]) == -1) fail("put");
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.fd = servers[i];
+    epoll_ctl(ep, EPOLL_CTL_ADD, servers[i], &ev);
+  }
+  size_t open_associations = servers.size();
+  struct epoll_event events[64];
+  while (open_associations > 0)
+  {
+    int n = epoll_wait(ep, events, 64, 1000);
+    if (n < 0 && errno != EINTR) fail("epoll_wait");
+    for (int e = 0; e < n; e++)
+    {
+      int index = table.get(events[e].data.fd);
+      if (index == -1) continue;
+      receive_result_t value;
+      do
+      {
+        received_t received;
+        value = receive_message(table[index], MSG_DONTWAIT, received);
+        if (value == WHOLE_MESSAGE_RECEIVED)
+        {
+          if (received.notification)
+          { // decoded as the test port does, COMM_UP is the only expected one
+            notification_t notification;
+            decode_notification(table[index].buf, table[index].nr, notification);
+          }
+          else if (send_message(table[index].fd, received.stream, received.ppid, table[index].buf,
+                     table[index].nr) != 0) fail("send_message");
+          discard_message(table[index]);
+        }
+        else if (value == EOF_OR_ERROR)
+        {
+          close(table[index].fd);
+          table.erase(index);
+          open_associations--;
+        }
+      } while (value == WHOLE_MESSAGE_RECEIVED || value == PARTIAL_RECEIVE);
+    }
+  }
+  close(ep);
+  return NULL;
+}
+
+
+struct result_t
+{
+  double elapsed;
+  unsigned long long p50, p99, p999, max; // round trip times in ns
+};
+
+
+static result_t run(size_t msg_size, unsigned long messages, int window)
+{
+  pthread_t echo;
+  pthread_create(&echo, NULL, echo_server, NULL);
+
+  AssociationTable table;
+  int ep = epoll_create1(0);
+  if (ep == -1) fail("epoll_create1");
+  for (size_t i = 0; i < clients.size(); i++)
+  {
+    if (table.put(clients[i]) == -1) fail("put");
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.fd = clients[i];
+    epoll_ctl(ep, EPOLL_CTL_ADD, clients[i], &ev);
+  }
+  std::vector<unsigned long long> rtt;
+  rtt.reserve(messages);
+  std::vector<unsigned char> buf(msg_size, 0x55);
+  unsigned long sent = 0;
+
+  double start = monotonic_ns() / 1e9;
+  for (int w = 0; w < window; w++)
+    for (size_t i = 0; i < clients.size() && sent < messages; i++, sent++)
+    {
+      unsigned long long ts = monotonic_ns();
+      memcpy(&buf[0], &ts, sizeof(ts));
+      if (send_message(clients[i], 0, (uint32_t)sent, &buf[0], msg_size) != 0) fail("send_message");
+    }
+  struct epoll_event events[64];
+  while (rtt.size() < messages)
+  {
+    int n = epoll_wait(ep, events, 64, 1000);
+    if (n == 0)
+    {
+      fprintf(stderr, "no echo in 1s, %lu of %lu messages are answered\n", (unsigned long)rtt.size(), messages);
+      exit(1);
+    }
+    if (n < 0 && errno != EINTR) fail("epoll_wait");
+    for (int e = 0; e < n; e++)
+    {
+      int index = table.get(events[e].data.fd);
+      receive_result_t value;
+      do
+      {
+        received_t received;
+        value = receive_message(table[index], MSG_DONTWAIT, received);
+        if (value == EOF_OR_ERROR) fail("receive_message");
+        if (value == WHOLE_MESSAGE_RECEIVED && !received.notification)
+        {
+          unsigned long long ts;
+          memcpy(&ts, table[index].buf, sizeof(ts));
+          rtt.push_back(monotonic_ns() - ts);
+          if (sent < messages)
+          { // the answered message is replaced on the same association
+            ts = monotonic_ns();
+            memcpy(&buf[0], &ts, sizeof(ts));
+            if (send_message(table[index].fd, 0, (uint32_t)sent, &buf[0], msg_size) != 0) fail("send_message");
+            sent++;
+          }
+        }
+        if (value == WHOLE_MESSAGE_RECEIVED) discard_message(table[index]);
+      } while (value == WHOLE_MESSAGE_RECEIVED || value == PARTIAL_RECEIVE);
+    }
+  }
+  result_t result;
+  result.elapsed = monotonic_ns() / 1e9 - start;
+
+  for (int i = 0; i < table.size(); i++)
+  {
+    if (table[i].erased) continue;
+    close(table[i].fd);
+    table.erase(i);
+  }
+  close(ep);
+  pthread_join(echo, NULL);
+  clients.clear();
+  servers.clear();
+
+  std::sort(rtt.begin(), rtt.end());
+  result.p50 = rtt[rtt.size() / 2];
+  result.p99 = rtt[rtt.size() * 99 / 100];
+  result.p999 = rtt[rtt.size() * 999 / 1000];
+  result.max = rtt.back();
+  return result;
+}
+
+
+// parses a comma separated list of positive integers
+static std::vector<unsigned long> parse_list(const char *list)
+{
+  std::vector<unsigned long> values;
+  const char *p = list;
+  while (*p)
+  {
+    char *end;
+    unsigned long value = strtoul(p, &end, 10);
+    if (end == p || value == 0 || (*end != ',' && *end != '\0')) return std::vector<unsigned long>();
+    values.push_back(value);
+    p = *end == ',' ? end + 1 : end;
+  }
+  return values;
+}
+
+
+static void usage(const char *name)
+{
+  fprintf(stderr, "Usage: %s [-s message sizes] [-a association counts] [-n messages] [-w window]\n"
+    "The sizes and the association counts are comma separated lists, every combination is measured.\n"
+    "The window is the number of messages in flight on each association, the sizes are at least 8 bytes.\n",
+    name);
+  exit(1);
+}
+
+
+int main(int argc, char **argv)
+{
+  std::vector<unsigned long> sizes = parse_list("64,1024,16384");
+  std::vector<unsigned long> association_counts = parse_list("1,16,128");
+  unsigned long messages = 200000;
+  int window = 8;
+  int opt;
+  while ((opt = getopt(argc, argv, "s:a:n:w:")) != -1)
+  {
+    switch (opt)
+    {
+      case 's': sizes = parse_list(optarg); break;
+      case 'a': association_counts = parse_list(optarg); break;
+      case 'n': messages = strtoul(optarg, NULL, 10); break;
+      case 'w': window = atoi(optarg); break;
+      default: usage(argv[0]);
+    }
+  }
+  if (sizes.empty() || association_counts.empty() || messages == 0 || window <= 0) usage(argv[0]);
+  for (size_t i = 0; i < sizes.size(); i++)
+    if (sizes[i] < sizeof(unsigned long long)) usage(argv[0]);
+
+  printf("%8s %6s %6s %10s %12s %10s %10s %10s %10s %10s\n", "size", "assocs", "window", "messages", "msg/s",
+    "MB/s", "p50 us", "p99 us", "p99.9 us", "max us");
+  for (size_t s = 0; s < sizes.size(); s++)
+    for (size_t a = 0; a < association_counts.size(); a++)
+    {
+      setup((int)association_counts[a]);
+      result_t r = run(sizes[s], messages, window);
+      printf("%8lu %6lu %6d %10lu %12.0f %10.1f %10.1f %10.1f %10.1f %10.1f\n", sizes[s], association_counts[a],
+        window, messages, messages / r.elapsed, messages * sizes[s] / r.elapsed / 1e6, r.p50 / 1e3, r.p99 / 1e3,
+        r.p999 / 1e3, r.max / 1e3);
+      fflush(stdout);
+    }
+  return 0;
+}
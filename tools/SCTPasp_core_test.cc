@@ -0,0 +1,260 @@
+/******************************************************************************
+* Copyright (c) 2000-2021 Ericsson Telecom AB
+* All rights reserved. This program and the accompanying materials
+* are made available under the terms of the Eclipse Public License v2.0
+* which accompanies this distribution, and is available at
+* https://www.eclipse.org/org/documents/epl-2.0/EPL-2.0.html
+*
+* Contributors:
+*  Peter Dimitrov- initial implementation and initial documentation
+*  Adam Delic
+*  Eduard Czimbalmos
+*  Endre Kulcsar
+*  Gabor Bettesch
+*  Gabor Szalai
+*  Tamas Buti
+*  Zoltan Medve
+******************************************************************************/
+//
+//  File:               SCTPasp_core_test.cc
+//  Description:        Unit test of the association table and the notification decoding of the socket core
+//  Prodnr:             CNL 113 469
+//
+// Needs neither TITAN nor an SCTP capable kernel: the table is filled with
+// made-up descriptors and the notifications are built in memory. Prints the
+// failed checks and exits with 1 if there is any.
+
+
+#include "SCTPasp_Core.hh"
+#include "SCTPasp_check.hh"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stddef.h>
+#include <netinet/in.h>
+#include <netinet/sctp.h>
+#include <arpa/inet.h>
+
+using namespace SCTPasp__PortType;
+
+
+static void test_table_put_get()
+{
+  AssociationTable table;
+  CHECK(table.size() == 0 && table.count() == 0);
+  CHECK(table.get(5) == -1);
+  int a = table.put(5);
+  int b = table.put(7);
+  CHECK(a == 0 && b == 1);
+  CHECK(table.get(5) == a && table.get(7) == b);
+  CHECK(table[a].fd == 5 && !table[a].erased);
+  CHECK(table.count() == 2);
+  CHECK(table.get(6) == -1 && table.get(-1) == -1 && table.get(100000) == -1);
+}
+
+
+static void test_table_reuse()
+{
+  AssociationTable table;
+  for (int fd = 10; fd < 15; fd++) table.put(fd);
+  table.erase(table.get(11));
+  table.erase(table.get(13));
+  CHECK(table.count() == 3);
+  CHECK(table.get(11) == -1 && table.get(13) == -1);
+  CHECK(table[3].erased && table[3].fd == -1);
+  // the erased items are reused before the table grows
+  int size = table.size();
+  int first = table.put(20);
+  int second = table.put(21);
+  CHECK((first == 1 && second == 3) || (first == 3 && second == 1));
+  CHECK(table.size() == size);
+  CHECK(table.count() == 5);
+  CHECK(table.get(20) == first && table.get(21) == second);
+}
+
+
+static void test_table_erase_twice()
+{
+  AssociationTable table;
+  int i = table.put(3);
+  table[i].buf = malloc(16); // freed by erase
+  table.erase(i);
+  table.erase(i); // already free, neither counted nor listed again
+  CHECK(table.count() == 0);
+  CHECK(table[i].buf == NULL);
+  int a = table.put(4);
+  int b = table.put(5);
+  CHECK(a != b);
+  CHECK(table.count() == 2);
+}
+
+
+static void test_table_growth()
+{
+  AssociationTable table;
+  const int n = 10000;
+  int grows = 0;
+  for (int fd = 0; fd < n; fd++)
+  {
+    int size = table.size();
+    CHECK(table.put(fd) != -1);
+    if (table.size() != size) grows++;
+  }
+  CHECK(table.count() == n);
+  CHECK(grows < 32); // doubled, not grown by a constant
+  CHECK(table.size() >= n && table.size() < 2 * n);
+  for (int fd = 0; fd < n; fd++) CHECK(table.get(fd) != -1 && table[table.get(fd)].fd == fd);
+  for (int fd = 0; fd < n; fd += 2) table.erase(table.get(fd));
+  CHECK(table.count() == n / 2);
+  int size = table.size();
+  for (int fd = n; fd < n + n / 2; fd++) table.put(fd);
+  CHECK(table.size() == size);
+  CHECK(table.count() == n);
+}
+
+
+static void test_table_bad_fd()
+{
+  AssociationTable table;
+  errno = 0;
+  CHECK(table.put(-1) == -1 && errno == EBADF);
+  CHECK(table.count() == 0);
+}
+
+
+static void test_notification_short()
+{
+  notification_t n;
+  unsigned char buf[4] = { 0 };
+  CHECK(!decode_notification(buf, sizeof (buf), n));
+}
+
+
+static void test_notification_assoc_change()
+{
+  struct sctp_assoc_change sac;
+  memset(&sac, 0, sizeof (sac));
+  sac.sac_type = SCTP_ASSOC_CHANGE;
+  sac.sac_length = sizeof (sac);
+  sac.sac_state = SCTP_COMM_LOST;
+  notification_t n;
+  CHECK(decode_notification(&sac, sizeof (sac), n));
+  CHECK(n.type == NOTIFICATION_ASSOC_CHANGE);
+  CHECK(n.sn_type == SCTP_ASSOC_CHANGE && n.length == sizeof (sac));
+  CHECK(n.state == SCTP_COMM_LOST && n.assoc_state == ASSOC_COMM_LOST);
+  CHECK(n.addr_state == ADDR_UNKNOWN && !n.send_info);
+  // cut before the state: the type is known, the state is not
+  CHECK(decode_notification(&sac, offsetof(struct sctp_assoc_change, sac_state), n));
+  CHECK(n.type == NOTIFICATION_ASSOC_CHANGE && n.state == 0 && n.assoc_state == ASSOC_UNKNOWN);
+}
+
+
+static void test_notification_peer_addr_change()
+{
+  struct sctp_paddr_change spc;
+  memset(&spc, 0, sizeof (spc));
+  spc.spc_type = SCTP_PEER_ADDR_CHANGE;
+  spc.spc_length = sizeof (spc);
+  spc.spc_state = SCTP_ADDR_UNREACHABLE;
+  notification_t n;
+  CHECK(decode_notification(&spc, sizeof (spc), n));
+  CHECK(n.type == NOTIFICATION_PEER_ADDR_CHANGE);
+  CHECK(n.addr_state == ADDR_UNREACHABLE && n.assoc_state == ASSOC_UNKNOWN);
+#ifdef SCTP_ADDR_PF
+  spc.spc_state = SCTP_ADDR_PF;
+  CHECK(decode_notification(&spc, sizeof (spc), n));
+  CHECK(n.addr_state == ADDR_POTENTIALLY_FAILED);
+#endif
+  spc.spc_state = 1000;
+  CHECK(decode_notification(&spc, sizeof (spc), n));
+  CHECK(n.state == 1000 && n.addr_state == ADDR_UNKNOWN);
+}
+
+
+static void test_notification_send_failed()
+{
+  unsigned char buf[sizeof (struct sctp_send_failed) + 5];
+  memset(buf, 0, sizeof (buf));
+  struct sctp_send_failed *ssf = (struct sctp_send_failed *)buf;
+  ssf->ssf_type = SCTP_SEND_FAILED;
+  ssf->ssf_length = offsetof(struct sctp_send_failed, ssf_data) + 5;
+  ssf->ssf_error = 7;
+  ssf->ssf_info.sinfo_stream = 3;
+  ssf->ssf_info.sinfo_ppid = htonl(46);
+  ssf->ssf_info.sinfo_context = 0x12345678;
+  memcpy(buf + offsetof(struct sctp_send_failed, ssf_data), "hello", 5);
+  notification_t n;
+  CHECK(decode_notification(buf, ssf->ssf_length, n));
+  CHECK(n.type == NOTIFICATION_SEND_FAILED && n.send_info);
+  CHECK(n.error == 7 && n.stream == 3 && n.ppid == 46 && n.context == 0x12345678);
+  CHECK(n.data_len == 5 && memcmp(n.data, "hello", 5) == 0);
+  // without the whole header the message is not decoded
+  CHECK(decode_notification(buf, offsetof(struct sctp_send_failed, ssf_data) - 1, n));
+  CHECK(n.type == NOTIFICATION_SEND_FAILED && !n.send_info);
+}
+
+
+#ifdef SCTP_SEND_FAILED_EVENT
+static void test_notification_send_failed_event()
+{
+  unsigned char buf[sizeof (struct sctp_send_failed_event) + 3];
+  memset(buf, 0, sizeof (buf));
+  struct sctp_send_failed_event *ssfe = (struct sctp_send_failed_event *)buf;
+  ssfe->ssf_type = SCTP_SEND_FAILED_EVENT;
+  ssfe->ssf_length = offsetof(struct sctp_send_failed_event, ssf_data) + 3;
+  ssfe->ssf_error = 9;
+  ssfe->ssfe_info.snd_sid = 2;
+  ssfe->ssfe_info.snd_ppid = htonl(18);
+  ssfe->ssfe_info.snd_context = 5;
+  memcpy(buf + offsetof(struct sctp_send_failed_event, ssf_data), "abc", 3);
+  notification_t n;
+  CHECK(decode_notification(buf, ssfe->ssf_length, n));
+  CHECK(n.type == NOTIFICATION_SEND_FAILED && n.send_info);
+  CHECK(n.error == 9 && n.stream == 2 && n.ppid == 18 && n.context == 5);
+  CHECK(n.data_len == 3 && memcmp(n.data, "abc", 3) == 0);
+}
+#endif
+
+
+static void test_notification_other_types()
+{
+  struct sctp_shutdown_event sse;
+  memset(&sse, 0, sizeof (sse));
+  sse.sse_type = SCTP_SHUTDOWN_EVENT;
+  sse.sse_length = sizeof (sse);
+  notification_t n;
+  CHECK(decode_notification(&sse, sizeof (sse), n));
+  CHECK(n.type == NOTIFICATION_SHUTDOWN_EVENT && n.state == 0);
+#ifdef SCTP_EVENT
+  struct sctp_sender_dry_event sde;
+  memset(&sde, 0, sizeof (sde));
+  sde.sender_dry_type = SCTP_SENDER_DRY_EVENT;
+  sde.sender_dry_length = sizeof (sde);
+  CHECK(decode_notification(&sde, sizeof (sde), n));
+  CHECK(n.type == NOTIFICATION_SENDER_DRY);
+#endif
+  sse.sse_type = 0x7fff;
+  CHECK(decode_notification(&sse, sizeof (sse), n));
+  CHECK(n.type == NOTIFICATION_UNKNOWN && n.sn_type == 0x7fff);
+}
+
+
+int main()
+{
+  test_table_put_get();
+  test_table_reuse();
+  test_table_erase_twice();
+  test_table_growth();
+  test_table_bad_fd();
+  test_notification_short();
+  test_notification_assoc_change();
+  test_notification_peer_addr_change();
+  test_notification_send_failed();
+#ifdef SCTP_SEND_FAILED_EVENT
+  test_notification_send_failed_event();
+#endif
+  test_notification_other_types();
+  return check_result("SCTPasp_core_test");
+}
@@ -0,0 +1,546 @@
+/******************************************************************************
+* Copyright (c) 2000-2021 Ericsson Telecom AB
+* All rights reserved. This program and the accompanying materials
+* are made available under the terms of the Eclipse Public License v2.0
+* which accompanies this distribution, and is available at
+* https://www.eclipse.org/org/documents/epl-2.0/EPL-2.0.html
+*
+* Contributors:
+*  Peter Dimitrov- initial implementation and initial documentation
+*  Adam Delic
+*  Eduard Czimbalmos
+*  Endre Kulcsar
+*  Gabor Bettesch
+*  Gabor Szalai
+*  Tamas Buti
+*  Zoltan Medve
+******************************************************************************/
+//
+//  File:               SCTPasp_engine_bench.cc
+//  Description:        Compares the socket engines of the SCTPasp test port over loopback
+//  Prodnr:             CNL 113 469
+//
+// The associations are set up over 127.0.0.1. In the receive test a helper
+// thread sends on the client side and the engine receives on the server side,
+// in the send test the engine sends and the helper thread receives. The plain
+// socket engine works as the test port without io_thread and io_uring: epoll
+// and recvmsg/sendmsg in the calling thread. The usrsctp associations run over
+// UDP encapsulation, both sides use the usrsctp stack of the process; without
+// -DUSE_USRSCTP the usrsctp test is reported as not available. The loopback
+// associations are shared memory rings between two loopback transports.
+
+
+#include "SCTPasp_IOThread.hh"
+#include "SCTPasp_Uring.hh"
+#include "SCTPasp_Usrsctp.hh"
+#include "SCTPasp_Loopback.hh"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <netinet/in.h>
+#include <netinet/sctp.h>
+#include <arpa/inet.h>
+#include <vector>
+
+using namespace SCTPasp__PortType;
+
+static std::vector<int> clients; // the helper thread uses these
+static std::vector<int> servers; // the engine uses these
+static size_t msg_size = 64;
+static unsigned long messages = 1000000;
+static UsrsctpTransport *usrsctp_client = NULL; // kept for all the usrsctp tests
+static LoopbackTransport *loopback_client = NULL; // kept for all the loopback tests
+static SocketEngine *client_transport = NULL; // set during the usrsctp and loopback tests
+
+#define USRSCTP_UDP_PORT 9899
+#define LOOPBACK_RING_SIZE 262144 // grown for the messages longer than its quarter
+
+static double now()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+static void fail(const char *what)
+{
+  fprintf(stderr, "%s: %s\n", what, strerror(errno));
+  exit(1);
+}
+
+
+static void wait_event(int fd, const char *what)
+{
+  struct pollfd p;
+  p.fd = fd;
+  p.events = POLLIN;
+  int ret = poll(&p, 1, 1000);
+  if (ret == 0) errno = ETIMEDOUT; // nothing arrived, poll leaves errno alone
+  if (ret <= 0) fail(what);
+}
+
+
+// the loopback transport sends the messages up to the half of its rings
+static size_t loopback_ring_size()
+{
+  size_t size = LOOPBACK_RING_SIZE;
+  while (size / 4 < msg_size) size <<= 1;
+  return size;
+}
+
+
+static void setup(int associations)
+{
+  int lfd = socket(AF_INET, SOCK_STREAM, IPPROTO_SCTP);
+  if (lfd == -1) fail("socket");
+  struct sockaddr_in sa;
+  memset(&sa, 0, sizeof(sa));
+  sa.sin_family = AF_INET;
+  sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  socklen_t len = sizeof(sa);
+  if (bind(lfd, (struct sockaddr *)&sa, sizeof(sa)) == -1) fail("bind");
+  if (listen(lfd, associations) == -1) fail("listen");
+  if (getsockname(lfd, (struct sockaddr *)&sa, &len) == -1) fail("getsockname");
+  for (int i = 0; i < associations; i++)
+  {
+    int c = socket(AF_INET, SOCK_STREAM, IPPROTO_SCTP);
+    if (c == -1) fail("socket");
+    if (connect(c, (struct sockaddr *)&sa, sizeof(sa)) == -1) fail("connect");
+    int s = accept(lfd, NULL, NULL);
+    if (s == -1) fail("accept");
+    fcntl(s, F_SETFL, fcntl(s, F_GETFL) | O_NONBLOCK);
+    clients.push_back(c);
+    servers.push_back(s);
+  }
+  close(lfd);
+}
+
+
+static int setup_usrsctp(UsrsctpTransport *server, int associations)
+{
+  if (!usrsctp_client)
+  {
+    usrsctp_client = new UsrsctpTransport;
+    int err = usrsctp_client->start(USRSCTP_UDP_PORT, USRSCTP_UDP_PORT);
+    if (err != 0)
+    {
+      delete usrsctp_client;
+      usrsctp_client = NULL;
+      return err;
+    }
+  }
+  int err = server->start(USRSCTP_UDP_PORT, USRSCTP_UDP_PORT);
+  if (err != 0) return err;
+  int lfd = server->socket(AF_INET, false);
+  if (lfd == -1) fail("usrsctp socket");
+  struct sockaddr_in sa;
+  memset(&sa, 0, sizeof(sa));
+  sa.sin_family = AF_INET;
+  sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  socklen_t len = sizeof(sa);
+  if (server->bind(lfd, (struct sockaddr *)&sa, sizeof(sa)) == -1) fail("usrsctp bind");
+  if (server->listen(lfd, associations) == -1) fail("usrsctp listen");
+  if (server->getsockname(lfd, (struct sockaddr *)&sa, &len) == -1) fail("usrsctp getsockname");
+  for (int i = 0; i < associations; i++)
+  {
+    int c = usrsctp_client->socket(AF_INET, false);
+    if (c == -1) fail("usrsctp socket");
+    if (usrsctp_client->connect(c, (struct sockaddr *)&sa, sizeof(sa)) == -1) fail("usrsctp connect");
+    int s;
+    while ((s = server->accept(lfd, NULL, NULL, false)) == -1)
+    { // the listening socket is non-blocking
+      if (errno != EAGAIN) fail("usrsctp accept");
+      wait_event(lfd, "usrsctp accept");
+    }
+    usrsctp_client->set_nonblocking(c);
+    server->set_nonblocking(s);
+    usrsctp_client->add_socket(c, i + 1);
+    clients.push_back(c);
+    servers.push_back(s);
+  }
+  server->close(lfd);
+  client_transport = usrsctp_client;
+  return 0;
+}
+
+
+static int setup_loopback(LoopbackTransport *server, int associations)
+{
+  if (!loopback_client)
+  {
+    loopback_client = new LoopbackTransport;
+    int err = loopback_client->start(loopback_ring_size());
+    if (err != 0)
+    {
+      delete loopback_client;
+      loopback_client = NULL;
+      return err;
+    }
+  }
+  int err = server->start(loopback_ring_size());
+  if (err != 0) return err;
+  int lfd = server->socket(AF_INET, false);
+  if (lfd == -1) fail("loopback socket");
+  struct sockaddr_in sa;
+  memset(&sa, 0, sizeof(sa));
+  sa.sin_family = AF_INET;
+  sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  socklen_t len = sizeof(sa);
+  if (server->bind(lfd, (struct sockaddr *)&sa, sizeof(sa)) == -1) fail("loopback bind");
+  if (server->listen(lfd, associations) == -1) fail("loopback listen");
+  if (server->getsockname(lfd, (struct sockaddr *)&sa, &len) == -1) fail("loopback getsockname");
+  for (int i = 0; i < associations; i++)
+  {
+    int c = loopback_client->socket(AF_INET, false);
+    if (c == -1) fail("loopback socket");
+    if (loopback_client->connect(c, (struct sockaddr *)&sa, sizeof(sa)) == -1) fail("loopback connect");
+    int s = server->accept(lfd, NULL, NULL, false);
+    if (s == -1) fail("loopback accept");
+    loopback_client->add_socket(c, i + 1);
+    clients.push_back(c);
+    servers.push_back(s);
+  }
+  server->close(lfd);
+  client_transport = loopback_client;
+  return 0;
+}
+
+
+static void teardown()
+{
+  for (size_t i = 0; i < clients.size(); i++)
+  {
+    if (client_transport) client_transport->close_socket(clients[i]);
+    else close(clients[i]);
+  }
+  client_transport = NULL;
+  clients.clear();
+  servers.clear(); // closed by the engines
+}
+
+
+static void *client_sender(void *)
+{
+  std::vector<unsigned char> buf(msg_size, 0x55);
+  for (unsigned long n = 0; n < messages; n++)
+  {
+    if (client_transport)
+    { // waiting for room in the send buffer
+      while (!client_transport->send(clients[n % clients.size()], 0, 0, 0, false, &buf[0], msg_size, true)) usleep(10);
+      if (n % 64 == 63 || n + 1 == messages)
+      { // nothing else reads the client transport during the receive test
+        const SocketEngine::message_t *m;
+        while ((m = client_transport->receive()) != NULL)
+        {
+          if (m->type == SocketEngine::IO_SEND_ERROR)
+          {
+            errno = m->err;
+            fail("client send");
+          }
+          client_transport->release();
+        }
+      }
+    }
+    else if (send(clients[n % clients.size()], &buf[0], msg_size, 0) < 0) fail("send");
+  }
+  return NULL;
+}
+
+
+static void *client_receiver(void *)
+{
+  if (client_transport)
+  {
+    unsigned long received = 0;
+    while (received < messages)
+    {
+      wait_event(client_transport->get_event_fd(), "client receive");
+      client_transport->clear_event();
+      const SocketEngine::message_t *m;
+      while ((m = client_transport->receive()) != NULL)
+      {
+        if (m->type == SocketEngine::IO_DATA) received++;
+        client_transport->release();
+      }
+    }
+    return NULL;
+  }
+  std::vector<unsigned char> buf(msg_size + 1);
+  std::vector<struct pollfd> fds(clients.size());
+  for (size_t i = 0; i < clients.size(); i++)
+  {
+    fds[i].fd = clients[i];
+    fds[i].events = POLLIN;
+  }
+  unsigned long received = 0;
+  while (received < messages)
+  {
+    int ret = poll(&fds[0], fds.size(), 1000);
+    if (ret == 0) errno = ETIMEDOUT;
+    if (ret <= 0) fail("client receive");
+    for (size_t i = 0; i < fds.size(); i++)
+      if (fds[i].revents & POLLIN)
+        while (recv(fds[i].fd, &buf[0], buf.size(), MSG_DONTWAIT) > 0) received++;
+  }
+  return NULL;
+}
+
+
+static int socket_sendmsg(int fd, const unsigned char *data, size_t len)
+{
+  char cbuf[CMSG_SPACE(sizeof (struct sctp_sndrcvinfo))];
+  struct msghdr msg;
+  struct iovec iov;
+  iov.iov_base = (void *)data;
+  iov.iov_len = len;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = cbuf;
+  msg.msg_controllen = sizeof(cbuf);
+  memset(cbuf, 0, sizeof(cbuf));
+  struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+  cmsg->cmsg_len = CMSG_LEN(sizeof (struct sctp_sndrcvinfo));
+  cmsg->cmsg_level = IPPROTO_SCTP;
+  cmsg->cmsg_type = SCTP_SNDRCV;
+  return sendmsg(fd, &msg, 0) < 0 ? errno : 0;
+}
+
+
+// the receive and send paths of the test port without a socket engine
+static double run_socket(bool receive_test)
+{
+  pthread_t helper;
+  double start = now();
+  if (receive_test)
+  {
+    pthread_create(&helper, NULL, client_sender, NULL);
+    int ep = epoll_create1(0);
+    for (size_t i = 0; i < servers.size(); i++)
+    {
+      struct epoll_event ev;
+      memset(&ev, 0, sizeof(ev));
+      ev.events = EPOLLIN;
+      ev.data.fd = servers[i];
+      epoll_ctl(ep, EPOLL_CTL_ADD, servers[i], &ev);
+    }
+    std::vector<unsigned char> buf(65536);
+    char cbuf[CMSG_SPACE(sizeof (struct sctp_sndrcvinfo))];
+    unsigned long received = 0;
+    while (received < messages)
+    {
+      struct epoll_event events[64];
+      int n = epoll_wait(ep, events, 64, 1000);
+      if (n == 0) errno = ETIMEDOUT;
+      if (n <= 0) fail("epoll_wait");
+      for (int i = 0; i < n; i++)
+      {
+        struct msghdr msg;
+        struct iovec iov;
+        iov.iov_base = &buf[0];
+        iov.iov_len = buf.size();
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = cbuf;
+        msg.msg_controllen = sizeof(cbuf);
+        if (recvmsg(events[i].data.fd, &msg, 0) > 0) received++; // one message per event, as the port
+      }
+    }
+    close(ep);
+  }
+  else
+  {
+    pthread_create(&helper, NULL, client_receiver, NULL);
+    std::vector<unsigned char> buf(msg_size, 0xaa);
+    for (unsigned long n = 0; n < messages; n++)
+    {
+      int fd = servers[n % servers.size()];
+      int err;
+      while ((err = socket_sendmsg(fd, &buf[0], msg_size)) == EAGAIN)
+      {
+        struct pollfd p;
+        p.fd = fd;
+        p.events = POLLOUT;
+        poll(&p, 1, 1000);
+      }
+      if (err != 0)
+      {
+        errno = err;
+        fail("sendmsg");
+      }
+    }
+  }
+  pthread_join(helper, NULL);
+  double elapsed = now() - start;
+  for (size_t i = 0; i < servers.size(); i++) close(servers[i]);
+  return elapsed;
+}
+
+
+static void drain(SocketEngine *engine, unsigned long *received)
+{
+  engine->clear_event();
+  const SocketEngine::message_t *m;
+  while ((m = engine->receive()) != NULL)
+  {
+    if (m->type == SocketEngine::IO_DATA) (*received)++;
+    else if (m->type == SocketEngine::IO_SEND_ERROR)
+    {
+      errno = m->err;
+      fail("engine send");
+    }
+    engine->release();
+  }
+  engine->flush();
+}
+
+
+static double run_engine(SocketEngine *engine, bool receive_test)
+{
+  for (size_t i = 0; i < servers.size(); i++) engine->add_socket(servers[i], i + 1);
+  pthread_t helper;
+  double start = now();
+  unsigned long received = 0;
+  if (receive_test)
+  {
+    pthread_create(&helper, NULL, client_sender, NULL);
+    while (received < messages)
+    {
+      wait_event(engine->get_event_fd(), "engine receive");
+      drain(engine, &received);
+    }
+  }
+  else
+  {
+    pthread_create(&helper, NULL, client_receiver, NULL);
+    std::vector<unsigned char> buf(msg_size, 0xaa);
+    for (unsigned long n = 0; n < messages; n++)
+    {
+      while (!engine->send(servers[n % servers.size()], 0, 0, 0, false, &buf[0], msg_size, true))
+      { // the send queue is full
+        engine->flush();
+        struct pollfd p;
+        p.fd = engine->get_event_fd();
+        p.events = POLLIN;
+        poll(&p, 1, 1);
+        drain(engine, &received);
+      }
+      if (n % 64 == 63) drain(engine, &received); // flushes and reports the refused sends
+    }
+    drain(engine, &received);
+  }
+  pthread_join(helper, NULL);
+  double elapsed = now() - start;
+  for (size_t i = 0; i < servers.size(); i++) engine->close_socket(servers[i]);
+  engine->stop();
+  return elapsed;
+}
+
+
+static void usage(const char *name)
+{
+  fprintf(stderr, "Usage: %s [-e socket|io_thread|io_uring|usrsctp|loopback] [-s message size] [-n messages] [-a associations]\n"
+    "Without -e every engine is measured.\n", name);
+  exit(1);
+}
+
+
+int main(int argc, char **argv)
+{
+  const char *only = NULL;
+  int associations = 1;
+  int opt;
+  while ((opt = getopt(argc, argv, "e:s:n:a:")) != -1)
+  {
+    switch (opt)
+    {
+      case 'e': only = optarg; break;
+      case 's': msg_size = strtoul(optarg, NULL, 10); break;
+      case 'n': messages = strtoul(optarg, NULL, 10); break;
+      case 'a': associations = atoi(optarg); break;
+      default: usage(argv[0]);
+    }
+  }
+  if (msg_size == 0 || messages == 0 || associations <= 0) usage(argv[0]);
+
+  static const char *engines[] = { "socket", "io_thread", "io_uring", "usrsctp", "loopback" };
+  printf("%-10s %-8s %8s %6s %10s %12s %10s\n", "engine", "test", "size", "assocs", "messages", "msg/s", "MB/s");
+  for (int e = 0; e < 5; e++)
+  {
+    if (only && strcmp(only, engines[e]) != 0) continue;
+    for (int t = 0; t < 2; t++)
+    {
+      bool receive_test = t == 0;
+      double elapsed = 0;
+      SocketEngine *engine = NULL;
+      int err = 0;
+      if (e == 3)
+      { // the usrsctp transport is the engine of its own sockets
+        UsrsctpTransport *usrsctp = new UsrsctpTransport;
+        err = setup_usrsctp(usrsctp, associations);
+        engine = usrsctp;
+      }
+      else if (e == 4)
+      { // so is the loopback transport
+        LoopbackTransport *loopback = new LoopbackTransport;
+        err = setup_loopback(loopback, associations);
+        engine = loopback;
+      }
+      else
+      {
+        setup(associations);
+        if (e == 1)
+        {
+          IOThread *io_thread = new IOThread;
+          err = io_thread->start(1024, -1);
+          engine = io_thread;
+        }
+        else if (e == 2)
+        {
+          UringEngine *uring = new UringEngine;
+          err = uring->start(256);
+          engine = uring;
+        }
+      }
+      if (err != 0)
+      {
+        printf("%-10s not available: %s\n", engines[e], strerror(err));
+        delete engine;
+        for (size_t i = 0; i < servers.size(); i++) close(servers[i]);
+        teardown();
+        break;
+      }
+      if (engine)
+      {
+        elapsed = run_engine(engine, receive_test);
+        delete engine;
+      }
+      else elapsed = run_socket(receive_test);
+      teardown();
+      printf("%-10s %-8s %8lu %6d %10lu %12.0f %10.1f\n", engines[e], receive_test ? "receive" : "send",
+        (unsigned long)msg_size, associations, messages, messages / elapsed, messages * msg_size / elapsed / 1e6);
+    }
+  }
+  if (usrsctp_client)
+  {
+    usrsctp_client->stop();
+    delete usrsctp_client;
+  }
+  if (loopback_client)
+  {
+    loopback_client->stop();
+    delete loopback_client;
+  }
+  return 0;
+}
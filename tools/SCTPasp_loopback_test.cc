@@ -0,0 +1,235 @@
+/******************************************************************************
+* Copyright (c) 2000-2021 Ericsson Telecom AB
+* All rights reserved. This program and the accompanying materials
+* are made available under the terms of the Eclipse Public License v2.0
+* which accompanies this distribution, and is available at
+* https://www.eclipse.org/org/documents/epl-2.0/EPL-2.0.html
+*
+* Contributors:
+*  Peter Dimitrov- initial implementation and initial documentation
+*  Adam Delic
+*  Eduard Czimbalmos
+*  Endre Kulcsar
+*  Gabor Bettesch
+*  Gabor Szalai
+*  Tamas Buti
+*  Zoltan Medve
+******************************************************************************/
+//
+//  File:               SCTPasp_loopback_test.cc
+//  Description:        Unit test of the rings of the shared memory loopback transport
+//  Prodnr:             CNL 113 469
+//
+// Connects two loopback transports of the process with the smallest rings
+// and checks that the messages wrap around the ring intact and in order, that
+// a full ring refuses the send until the peer reads, and the errors reported
+// for the messages too long for the ring, the invalid streams and the closed
+// associations. Prints the failed checks and exits with 1 if there is any.
+
+
+#include "SCTPasp_Loopback.hh"
+#include "SCTPasp_check.hh"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <vector>
+
+using namespace SCTPasp__PortType;
+
+#define RING_SIZE 4096 // the smallest ring
+
+// an association between two transports, the client side sends
+struct association_t
+{
+  LoopbackTransport client;
+  LoopbackTransport server;
+  int c;
+  int s;
+
+  association_t() : c(-1), s(-1)
+  {
+    if (client.start(RING_SIZE) != 0 || server.start(RING_SIZE) != 0) fail("start");
+    int lfd = server.socket(AF_INET, false);
+    if (lfd == -1) fail("socket");
+    struct sockaddr_in sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sin_family = AF_INET;
+    sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t len = sizeof(sa);
+    if (server.bind(lfd, (struct sockaddr *)&sa, sizeof(sa)) == -1 || server.listen(lfd, 1) == -1 ||
+        server.getsockname(lfd, (struct sockaddr *)&sa, &len) == -1) fail("listen");
+    c = client.socket(AF_INET, false);
+    if (c == -1 || client.connect(c, (struct sockaddr *)&sa, sizeof(sa)) == -1) fail("connect");
+    s = server.accept(lfd, NULL, NULL, false);
+    if (s == -1) fail("accept");
+    server.close(lfd);
+    client.set_nonblocking(c);
+    server.set_nonblocking(s);
+    client.add_socket(c, 1);
+    server.add_socket(s, 2);
+  }
+  ~association_t()
+  {
+    client.stop();
+    server.stop();
+  }
+
+  static void fail(const char *what)
+  {
+    fprintf(stderr, "%s: %s\n", what, strerror(errno));
+    exit(1);
+  }
+};
+
+
+static void fill(std::vector<unsigned char>& buf, unsigned long n)
+{
+  for (size_t k = 0; k < buf.size(); k++) buf[k] = (unsigned char)(n + k);
+}
+
+
+static void test_wrap_around()
+{
+  association_t a;
+  const unsigned long messages = 5000;
+  unsigned long sent = 0, received = 0, refused = 0;
+  uint64_t bytes = 0;
+  std::vector<unsigned char> buf;
+  while (received < messages)
+  {
+    unsigned long before = sent + received;
+    // every record size, so the records end at every offset of the ring
+    while (sent < messages)
+    {
+      buf.resize((sent * 37) % 700 + 1);
+      fill(buf, sent);
+      if (!a.client.send(a.c, sent % 10, sent, 0, false, &buf[0], buf.size(), true))
+      {
+        refused++;
+        break;
+      }
+      bytes += buf.size();
+      sent++;
+    }
+    a.server.clear_event();
+    const SocketEngine::message_t *m;
+    while ((m = a.server.receive()) != NULL)
+    {
+      CHECK(m->type == SocketEngine::IO_DATA);
+      if (m->type != SocketEngine::IO_DATA) continue;
+      CHECK(m->fd == a.s && m->seq == 2);
+      CHECK(m->ppid == received && m->stream == received % 10);
+      buf.resize((received * 37) % 700 + 1);
+      fill(buf, received);
+      CHECK(m->len == buf.size() && memcmp(m->data, &buf[0], buf.size()) == 0);
+      received++;
+    }
+    if (sent + received == before) break; // stuck
+  }
+  CHECK(received == messages);
+  CHECK(refused > 0); // the ring was full
+  CHECK(bytes > 100 * RING_SIZE); // and wrapped around many times
+  CHECK(a.client.get_send_errors() == 0);
+}
+
+
+static void test_full_ring()
+{
+  association_t a;
+  std::vector<unsigned char> buf(1000, 0x55);
+  int accepted = 0;
+  while (a.client.send(a.c, 0, 0, 0, false, &buf[0], buf.size(), true)) accepted++;
+  CHECK(accepted > 0 && accepted * buf.size() <= RING_SIZE);
+  CHECK(!a.client.send(a.c, 0, 0, 0, false, &buf[0], buf.size(), true)); // still full
+  // reading one message frees its record
+  a.server.clear_event();
+  const SocketEngine::message_t *m = a.server.receive();
+  CHECK(m != NULL && m->type == SocketEngine::IO_DATA && m->len == buf.size());
+  a.server.release();
+  CHECK(a.client.send(a.c, 0, 0, 0, false, &buf[0], buf.size(), true));
+  int delivered = 1;
+  while ((m = a.server.receive()) != NULL) delivered++;
+  CHECK(delivered == accepted + 1);
+}
+
+
+// the single send error expected on the client side
+static void check_send_error(association_t& a, int err, uint32_t context, size_t len)
+{
+  a.client.clear_event();
+  const SocketEngine::message_t *m = a.client.receive();
+  CHECK(m != NULL);
+  if (m == NULL) return;
+  CHECK(m->type == SocketEngine::IO_SEND_ERROR && m->err == err);
+  CHECK(m->fd == a.c && m->seq == 1);
+  CHECK(m->has_context && m->context == context);
+  CHECK(m->len == len);
+  CHECK(a.client.receive() == NULL);
+}
+
+
+static void test_message_size()
+{
+  association_t a;
+  // the longest message takes half of the ring with its header
+  std::vector<unsigned char> buf(RING_SIZE / 2 - 16, 0xaa);
+  CHECK(a.client.send(a.c, 1, 2, 0, false, &buf[0], buf.size(), true));
+  a.server.clear_event();
+  const SocketEngine::message_t *m = a.server.receive();
+  CHECK(m != NULL && m->type == SocketEngine::IO_DATA && m->len == buf.size());
+  buf.resize(RING_SIZE / 2 - 15);
+  CHECK(a.client.send(a.c, 1, 2, 77, true, &buf[0], buf.size(), true));
+  check_send_error(a, EMSGSIZE, 77, buf.size());
+  CHECK(a.client.get_send_errors() == 1);
+  // not reported, only counted
+  CHECK(a.client.send(a.c, 1, 2, 0, false, &buf[0], buf.size(), false));
+  a.client.clear_event();
+  CHECK(a.client.receive() == NULL);
+  CHECK(a.client.get_send_errors() == 2);
+}
+
+
+static void test_invalid_stream()
+{
+  association_t a;
+  unsigned char data[4] = { 1, 2, 3, 4 };
+  CHECK(a.client.send(a.c, 10, 0, 5, true, data, sizeof(data), true)); // 10 outbound streams by default
+  check_send_error(a, EINVAL, 5, sizeof(data));
+}
+
+
+static void test_close()
+{
+  association_t a;
+  unsigned char data[4] = { 1, 2, 3, 4 };
+  CHECK(a.client.send(a.c, 0, 0, 0, false, data, sizeof(data), true));
+  a.client.close_socket(a.c);
+  // the message sent before the close is delivered before the end
+  a.server.clear_event();
+  const SocketEngine::message_t *m = a.server.receive();
+  CHECK(m != NULL && m->type == SocketEngine::IO_DATA);
+  m = a.server.receive();
+  CHECK(m != NULL && m->type == SocketEngine::IO_EOF && m->fd == a.s);
+  CHECK(a.server.receive() == NULL);
+  CHECK(a.server.send(a.s, 0, 0, 9, true, data, sizeof(data), true));
+  a.server.clear_event();
+  m = a.server.receive();
+  CHECK(m != NULL && m->type == SocketEngine::IO_SEND_ERROR && m->err == EPIPE && m->context == 9);
+}
+
+
+int main()
+{
+  alarm(60); // a corrupted ring may never end
+  test_wrap_around();
+  test_full_ring();
+  test_message_size();
+  test_invalid_stream();
+  test_close();
+  return check_result("SCTPasp_loopback_test");
+}
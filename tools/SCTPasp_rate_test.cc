@@ -0,0 +1,141 @@
+/******************************************************************************
+* Copyright (c) 2000-2021 Ericsson Telecom AB
+* All rights reserved. This program and the accompanying materials
+* are made available under the terms of the Eclipse Public License v2.0
+* which accompanies this distribution, and is available at
+* https://www.eclipse.org/org/documents/epl-2.0/EPL-2.0.html
+*
+* Contributors:
+*  Peter Dimitrov- initial implementation and initial documentation
+*  Adam Delic
+*  Eduard Czimbalmos
+*  Endre Kulcsar
+*  Gabor Bettesch
+*  Gabor Szalai
+*  Tamas Buti
+*  Zoltan Medve
+******************************************************************************/
+//
+//  File:               SCTPasp_rate_test.cc
+//  Description:        Unit test of the token bucket of the socket core
+//  Prodnr:             CNL 113 469
+//
+// Drives the bucket by made-up monotonic times: the burst, the refill up to
+// the burst, the fractional tokens and the time of the next token. Prints the
+// failed checks and exits with 1 if there is any.
+
+
+#include "SCTPasp_Core.hh"
+#include "SCTPasp_check.hh"
+
+#include <stdio.h>
+#include <math.h>
+
+using namespace SCTPasp__PortType;
+
+#define MS 1000000ULL
+#define START 1000000000000ULL // an arbitrary monotonic time
+
+
+static void test_burst()
+{ // a full bucket lets the burst through at once
+  TokenBucket b;
+  b.reset(5, START);
+  int taken = 0;
+  while (b.take()) taken++;
+  CHECK(taken == 5);
+  CHECK(!b.take());
+  b.refill(100, 5, START); // no time has passed
+  CHECK(!b.take());
+}
+
+
+static void test_refill()
+{ // 100 per second: a token every 10 ms
+  TokenBucket b;
+  b.reset(1, START);
+  CHECK(b.take());
+  b.refill(100, 1, START + 5 * MS);
+  CHECK(fabs(b.tokens - 0.5) < 1e-9);
+  CHECK(!b.take());
+  CHECK(fabs(b.tokens - 0.5) < 1e-9); // a refused take leaves the fraction
+  b.refill(100, 1, START + 10 * MS);
+  CHECK(b.take());
+  CHECK(b.refilled == START + 10 * MS);
+}
+
+
+static void test_refill_capped()
+{ // an idle bucket fills up to the burst only
+  TokenBucket b;
+  b.reset(3, START);
+  while (b.take()) {}
+  b.refill(1000, 3, START + 60000 * MS);
+  CHECK(b.tokens == 3);
+  int taken = 0;
+  while (b.take()) taken++;
+  CHECK(taken == 3);
+}
+
+
+static void test_rate_over_time()
+{ // taking as soon as possible follows the rate after the burst
+  TokenBucket b;
+  const double rate = 250;
+  b.reset(10, START);
+  unsigned long long now = START;
+  int taken = 0;
+  while (now < START + 1000 * MS)
+  {
+    b.refill(rate, 10, now);
+    while (b.take()) taken++;
+    now += MS;
+  }
+  CHECK(taken >= 10 + 249 && taken <= 10 + 250);
+}
+
+
+static void test_next_token()
+{
+  TokenBucket b;
+  b.reset(2, START);
+  CHECK(b.next_token(100) == START); // available now
+  b.take();
+  b.take();
+  CHECK(b.next_token(100) == START + 10 * MS);
+  b.refill(100, 2, START + 4 * MS);
+  CHECK(b.next_token(100) == START + 10 * MS); // the same moment seen later
+  b.refill(100, 2, b.next_token(100));
+  CHECK(b.take());
+  // the deadline is rounded up, the refill at the deadline gives the token
+  for (double rate = 1; rate < 1e6; rate *= 1.37)
+  {
+    b.reset(1, START);
+    b.take();
+    b.refill(rate, 1, START + 7);
+    b.refill(rate, 1, b.next_token(rate));
+    CHECK(b.take());
+  }
+}
+
+
+static void test_clock_not_advancing()
+{ // an earlier time adds nothing
+  TokenBucket b;
+  b.reset(1, START);
+  b.take();
+  b.refill(100, 1, START - 50 * MS);
+  CHECK(b.tokens == 0);
+}
+
+
+int main()
+{
+  test_burst();
+  test_refill();
+  test_refill_capped();
+  test_rate_over_time();
+  test_next_token();
+  test_clock_not_advancing();
+  return check_result("SCTPasp_rate_test");
+}
@@ -0,0 +1,304 @@
+/******************************************************************************
+* Copyright (c) 2000-2021 Ericsson Telecom AB
+* All rights reserved. This program and the accompanying materials
+* are made available under the terms of the Eclipse Public License v2.0
+* which accompanies this distribution, and is available at
+* https://www.eclipse.org/org/documents/epl-2.0/EPL-2.0.html
+*
+* Contributors:
+*  Peter Dimitrov- initial implementation and initial documentation
+*  Adam Delic
+*  Eduard Czimbalmos
+*  Endre Kulcsar
+*  Gabor Bettesch
+*  Gabor Szalai
+*  Tamas Buti
+*  Zoltan Medve
+******************************************************************************/
+//
+//  File:               SCTPasp_replay_test.cc
+//  Description:        Unit test of the capture file reader of the replay mode
+//  Prodnr:             CNL 113 469
+//
+// Writes made-up pcap files with retransmitted and reordered DATA chunks and
+// checks the messages read back: the retransmissions are skipped, the
+// fragments are reassembled in TSN order, a new association between the same
+// endpoints starts its TSNs again, and a capture of the test port is read
+// back intact. Prints the failed checks and exits with 1 if there is any.
+
+
+#include "SCTPasp_Replay.hh"
+#include "SCTPasp_Capture.hh"
+#include "SCTPasp_check.hh"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <string>
+#include <vector>
+
+using namespace SCTPasp__PortType;
+
+static void put16(std::vector<unsigned char>& b, uint16_t v)
+{
+  b.push_back(v >> 8);
+  b.push_back(v);
+}
+
+static void put32(std::vector<unsigned char>& b, uint32_t v)
+{
+  put16(b, v >> 16);
+  put16(b, v);
+}
+
+
+// a DATA chunk of a packet
+struct chunk_t
+{
+  uint32_t tsn;
+  uint8_t flags; // 0x02: first fragment, 0x01: last fragment
+  uint16_t stream;
+  std::string data;
+};
+
+
+// a pcap file with raw IPv4 packets of one DATA chunk each
+class pcap_file
+{
+public:
+  pcap_file() : packets(0)
+  {
+    put32(file, 0xa1b23c4d); // nanosecond timestamps, big endian
+    put16(file, 2);
+    put16(file, 4);
+    put32(file, 0);
+    put32(file, 0);
+    put32(file, 65535);
+    put32(file, 101); // LINKTYPE_RAW
+  }
+
+  void add(uint16_t sport, uint16_t dport, uint32_t vtag, const chunk_t& c)
+  {
+    std::vector<unsigned char> pkt;
+    size_t pad = (4 - (c.data.size() & 3)) & 3;
+    size_t total = 20 + 12 + 16 + c.data.size() + pad;
+    pkt.push_back(0x45);
+    pkt.push_back(0);
+    put16(pkt, total);
+    put32(pkt, 0x4000); // DF
+    pkt.push_back(64);
+    pkt.push_back(132); // SCTP
+    put16(pkt, 0);
+    put32(pkt, sport == 2905 ? 0x0a000001 : 0x0a000002);
+    put32(pkt, sport == 2905 ? 0x0a000002 : 0x0a000001);
+    put16(pkt, sport);
+    put16(pkt, dport);
+    put32(pkt, vtag);
+    put32(pkt, 0); // the checksum is not checked
+    pkt.push_back(0); // DATA
+    pkt.push_back(c.flags);
+    put16(pkt, 16 + c.data.size());
+    put32(pkt, c.tsn);
+    put16(pkt, c.stream);
+    put16(pkt, 0);
+    put32(pkt, 46);
+    pkt.insert(pkt.end(), c.data.begin(), c.data.end());
+    pkt.insert(pkt.end(), pad, 0);
+    put32(file, ++packets);
+    put32(file, 0);
+    put32(file, pkt.size());
+    put32(file, pkt.size());
+    file.insert(file.end(), pkt.begin(), pkt.end());
+  }
+
+  // writes the file and opens it in r
+  int open(ReplayFile& r)
+  {
+    char name[] = "/tmp/SCTPasp_replay_test.XXXXXX";
+    int fd = mkstemp(name);
+    if (fd == -1) return -1;
+    bool ok = write(fd, &file[0], file.size()) == (ssize_t)file.size();
+    close(fd);
+    int err = ok ? r.open(name) : -1;
+    unlink(name); // the mapping stays
+    return err;
+  }
+
+private:
+  std::vector<unsigned char> file;
+  uint32_t packets;
+};
+
+
+static std::string message(const ReplayFile& r, size_t i)
+{
+  return std::string((const char *)r[i].data, r[i].len);
+}
+
+
+static void test_retransmission()
+{ // the same TSN is replayed once, the next one is not taken for it
+  pcap_file pcap;
+  chunk_t a = { 100, 0x03, 1, "first" };
+  chunk_t b = { 101, 0x03, 1, "second" };
+  pcap.add(2905, 3868, 7, a);
+  pcap.add(2905, 3868, 7, a);
+  pcap.add(2905, 3868, 7, b);
+  pcap.add(2905, 3868, 7, a);
+  ReplayFile r;
+  CHECK(pcap.open(r) == 0);
+  CHECK(r.size() == 2);
+  if (r.size() != 2) return;
+  CHECK(message(r, 0) == "first" && message(r, 1) == "second");
+}
+
+
+static void test_directions()
+{ // the TSNs of the two directions are independent
+  pcap_file pcap;
+  chunk_t request = { 100, 0x03, 1, "request" };
+  chunk_t answer = { 100, 0x03, 1, "answer" };
+  pcap.add(2905, 3868, 7, request);
+  pcap.add(3868, 2905, 8, answer);
+  ReplayFile r;
+  CHECK(pcap.open(r) == 0);
+  CHECK(r.size() == 2);
+  CHECK(r.get_associations() == 1);
+}
+
+
+static void test_retransmitted_fragment()
+{ // a retransmitted middle fragment does not end up twice in the message
+  pcap_file pcap;
+  chunk_t first = { 10, 0x02, 3, "aaaa" };
+  chunk_t middle = { 11, 0x00, 3, "bbbb" };
+  chunk_t last = { 12, 0x01, 3, "cc" };
+  pcap.add(2905, 3868, 7, first);
+  pcap.add(2905, 3868, 7, middle);
+  pcap.add(2905, 3868, 7, middle);
+  pcap.add(2905, 3868, 7, last);
+  pcap.add(2905, 3868, 7, middle); // after the message is complete
+  ReplayFile r;
+  CHECK(pcap.open(r) == 0);
+  CHECK(r.size() == 1);
+  if (r.size() != 1) return;
+  CHECK(message(r, 0) == "aaaabbbbcc");
+  CHECK(r[0].stream == 3 && r[0].ppid == 46);
+}
+
+
+static void test_reordered_fragments()
+{ // the missing middle fragment is retransmitted after the last one
+  pcap_file pcap;
+  chunk_t first = { 20, 0x02, 0, "11" };
+  chunk_t middle = { 21, 0x00, 0, "22" };
+  chunk_t last = { 22, 0x01, 0, "33" };
+  chunk_t next = { 23, 0x03, 0, "44" };
+  pcap.add(2905, 3868, 7, last);
+  pcap.add(2905, 3868, 7, first);
+  pcap.add(2905, 3868, 7, next);
+  pcap.add(2905, 3868, 7, middle);
+  ReplayFile r;
+  CHECK(pcap.open(r) == 0);
+  CHECK(r.size() == 2);
+  if (r.size() != 2) return;
+  CHECK(message(r, 0) == "44");
+  CHECK(message(r, 1) == "112233");
+}
+
+
+static void test_incomplete_fragments()
+{ // the first fragment of an abandoned message does not start the next one
+  pcap_file pcap;
+  chunk_t abandoned = { 30, 0x02, 0, "x" };
+  chunk_t first = { 31, 0x02, 0, "y" };
+  chunk_t last = { 32, 0x01, 0, "z" };
+  chunk_t lost_last = { 41, 0x01, 0, "w" }; // the rest of its message is not captured
+  pcap.add(2905, 3868, 7, abandoned);
+  pcap.add(2905, 3868, 7, last);
+  pcap.add(2905, 3868, 7, first);
+  pcap.add(2905, 3868, 7, lost_last);
+  ReplayFile r;
+  CHECK(pcap.open(r) == 0);
+  CHECK(r.size() == 1);
+  if (r.size() != 1) return;
+  CHECK(message(r, 0) == "yz");
+}
+
+
+static void test_new_association()
+{ // a new verification tag starts the TSNs again
+  pcap_file pcap;
+  chunk_t a = { 1, 0x03, 0, "before" };
+  chunk_t b = { 1, 0x03, 0, "after" };
+  pcap.add(2905, 3868, 7, a);
+  pcap.add(2905, 3868, 9, b);
+  ReplayFile r;
+  CHECK(pcap.open(r) == 0);
+  CHECK(r.size() == 2);
+  if (r.size() != 2) return;
+  CHECK(message(r, 1) == "after");
+}
+
+
+static void test_capture_round_trip()
+{ // the captures of the test port are read back intact
+  char name[] = "/tmp/SCTPasp_replay_test.XXXXXX";
+  int fd = mkstemp(name);
+  CHECK(fd != -1);
+  if (fd == -1) return;
+  close(fd);
+  struct sockaddr_storage local, peer;
+  memset(&local, 0, sizeof(local));
+  memset(&peer, 0, sizeof(peer));
+  struct sockaddr_in *sin = (struct sockaddr_in *)&local;
+  sin->sin_family = AF_INET;
+  sin->sin_port = htons(2905);
+  inet_pton(AF_INET, "10.0.0.1", &sin->sin_addr);
+  sin = (struct sockaddr_in *)&peer;
+  sin->sin_family = AF_INET;
+  sin->sin_port = htons(3868);
+  inet_pton(AF_INET, "10.0.0.2", &sin->sin_addr);
+
+  CaptureWriter capture;
+  CHECK(capture.open(name, 64) == 0);
+  static const size_t lengths[] = { 1, 100, 70000, 3, 150000 };
+  const size_t count = sizeof(lengths) / sizeof(lengths[0]);
+  std::vector<std::string> messages;
+  for (size_t i = 0; i < count; i++)
+  {
+    std::string m(lengths[i], 'a' + i);
+    messages.push_back(m);
+    capture.submit(true, false, 5, i, 46, m.data(), m.size(),
+      &local, &peer, 1000000000ULL * (i + 1));
+    capture.submit(true, true, 5, CAPTURE_NOTIFICATION_STREAM, CAPTURE_NOTIFICATION_PPID, "n", 1,
+      &local, &peer, 1000000000ULL * (i + 1)); // a notification between the messages
+  }
+  capture.close();
+  CHECK(capture.get_dropped() == 0);
+  ReplayFile r;
+  CHECK(r.open(name) == 0);
+  unlink(name);
+  CHECK(r.size() == count);
+  for (size_t i = 0; i < r.size() && i < count; i++)
+  {
+    CHECK(message(r, i) == messages[i]);
+    CHECK(r[i].stream == i);
+  }
+}
+
+
+int main()
+{
+  test_retransmission();
+  test_directions();
+  test_retransmitted_fragment();
+  test_reordered_fragments();
+  test_incomplete_fragments();
+  test_new_association();
+  test_capture_round_trip();
+  return check_result("SCTPasp_replay_test");
+}
@@ -0,0 +1,58 @@
+/******************************************************************************
+* Copyright (c) 2000-2021 Ericsson Telecom AB
+* All rights reserved. This program and the accompanying materials
+* are made available under the terms of the Eclipse Public License v2.0
+* which accompanies this distribution, and is available at
+* https://www.eclipse.org/org/documents/epl-2.0/EPL-2.0.html
+*
+* Contributors:
+*  Peter Dimitrov- initial implementation and initial documentation
+*  Adam Delic
+*  Eduard Czimbalmos
+*  Endre Kulcsar
+*  Gabor Bettesch
+*  Gabor Szalai
+*  Tamas Buti
+*  Zoltan Medve
+******************************************************************************/
+//
+//  File:               SCTPasp_trace_decode.cc
+//  Description:        Renders the flight recorder dumps of the SCTPasp test port
+//  Prodnr:             CNL 113 469
+//
+
+
+#include "SCTPasp_FlightRecorder.hh"
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+int main(int argc, char **argv)
+{
+  if (argc < 2)
+  {
+    fprintf(stderr, "Usage: %s <dump file>...\n", argv[0]);
+    return 1;
+  }
+  int ret = 0;
+  for (int i = 1; i < argc; i++)
+  {
+    FILE *in = fopen(argv[i], "rb");
+    if (in == NULL)
+    {
+      fprintf(stderr, "%s: %s\n", argv[i], strerror(errno));
+      ret = 1;
+      continue;
+    }
+    if (argc > 2) printf("# %s\n", argv[i]);
+    int err = SCTPasp__PortType::FlightRecorder::render(in, stdout);
+    if (err != 0)
+    {
+      fprintf(stderr, "%s: %s\n", argv[i], err == EINVAL ? "not a flight recorder dump" : strerror(err));
+      ret = 1;
+    }
+    fclose(in);
+  }
+  return ret;
+}